@@ -243,6 +243,14 @@ macro(use_package_bullet)
 endmacro()
 
 macro(link_package_bullet)
+    # BulletMultiThreaded depends on the other Bullet libraries, so it has to come first.
+    if (TUNDRA_BULLET_MULTITHREADED)
+        if (WIN32)
+            target_link_libraries(${TARGET_NAME} debug BulletMultiThreaded.lib optimized BulletMultiThreaded.lib)
+        else()
+            target_link_libraries(${TARGET_NAME} optimized BulletMultiThreaded general pthread)
+        endif()
+    endif()
     if (WIN32) # Full-build deps 
         target_link_libraries(${TARGET_NAME} debug LinearMath.lib debug BulletDynamics.lib BulletCollision.lib)
         target_link_libraries(${TARGET_NAME} optimized LinearMath.lib optimized BulletDynamics.lib optimized BulletCollision.lib)
@@ -4,6 +4,7 @@
 #include "ZipHelpers.h"
 
 #include "CoreDefines.h"
+#include "Framework.h"
 #include "AssetCache.h"
 #include "LoggingFunctions.h"
 
@@ -11,11 +12,13 @@
 #include <QDir>
 #include <QDateTime>
 #include <QThreadPool>
+#include <QtConcurrentRun>
 
 ZipAssetBundle::ZipAssetBundle(AssetAPI *owner, const QString &type, const QString &name) :
     IAssetBundle(owner, type, name),
     archive_(0),
-    fileCount_(-1)
+    fileCount_(-1),
+    extract_(false)
 {
 }
 
@@ -27,6 +30,8 @@ ZipAssetBundle::~ZipAssetBundle()
 void ZipAssetBundle::DoUnload()
 {
     Close();
+    files_.clear();
+    fileIndex_.clear();
     fileCount_ = -1;
 }
 
@@ -38,7 +43,9 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
         return false;
     }
 
-    /* We want to detect if the extracted files are already up to date to save time.
+    extract_ = assetAPI_->GetAssetCache() && assetAPI_->GetFramework()->HasCommandLineParameter("--extractZipBundles");
+
+    /* If extracting, we want to detect if the extracted files are already up to date to save time.
        If the last modified date for the sub asset is the same as the parent zip file, 
        we don't extract it. If the zip is re-downloaded from source everything will get unpacked even
        if only one file would have changed inside it. We could do uncompressed size comparisons
@@ -50,8 +57,10 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
        the asset cache. For local scenes this should be fine as there is no real need to
        zip the scene up as you already have the disk sources right there in the storage.
        The last modified query will fail if the file is open with zziplib, do it first. */
-    QDateTime zipLastModified = assetAPI_->GetAssetCache()->LastModified(Name());
-        
+    QDateTime zipLastModified;
+    if (extract_)
+        zipLastModified = assetAPI_->GetAssetCache()->LastModified(Name());
+
     zzip_error_t error = ZZIP_NO_ERROR;
     archive_ = zzip_dir_open(QDir::toNativeSeparators(DiskSource()).toStdString().c_str(), &error);
     if (CheckAndLogZzipError(error) || CheckAndLogArchiveError(archive_) || !archive_)
@@ -61,38 +70,41 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
     }
     
     int uncompressing = 0;
-    
+    fileCount_ = 0;
+
+    // Read the central directory. The archive is kept open for reading the sub assets on demand.
     ZZIP_DIRENT archiveEntry;
     while(zzip_dir_read(archive_, &archiveEntry))
     {
         QString relativePath = QDir::fromNativeSeparators(archiveEntry.d_name);
         if (!relativePath.endsWith("/"))
         {
-            QString subAssetRef = GetFullAssetReference(relativePath);
-            
             ZipArchiveFile file;
             file.relativePath = relativePath;
-            file.cachePath = assetAPI_->GetAssetCache()->GetDiskSourceByRef(subAssetRef);
-            file.lastModified = assetAPI_->GetAssetCache()->LastModified(subAssetRef);
             file.compressedSize = archiveEntry.d_csize;
             file.uncompressedSize = archiveEntry.st_size;
-            
-            /* Mark this file for extraction. If both cache files have valid dates
-               and they differ extract. If they have the same date stamp skip extraction.
-               Note that file.lastModified will be non-valid for non cached files so we 
-               will cover also missing files. */
-            file.doExtract = (zipLastModified.isValid() && file.lastModified.isValid()) ? (zipLastModified != file.lastModified) : true;
-            if (file.doExtract)
-                uncompressing++;
 
+            if (extract_)
+            {
+                QString subAssetRef = GetFullAssetReference(relativePath);
+                file.cachePath = assetAPI_->GetAssetCache()->GetDiskSourceByRef(subAssetRef);
+                file.lastModified = assetAPI_->GetAssetCache()->LastModified(subAssetRef);
+
+                /* Mark this file for extraction. If both cache files have valid dates
+                   and they differ extract. If they have the same date stamp skip extraction.
+                   Note that file.lastModified will be non-valid for non cached files so we 
+                   will cover also missing files. */
+                file.doExtract = (zipLastModified.isValid() && file.lastModified.isValid()) ? (zipLastModified != file.lastModified) : true;
+                if (file.doExtract)
+                    uncompressing++;
+            }
+
+            fileIndex_[relativePath.toLower()] = files_.size();
             files_ << file;
             fileCount_++;
         }
     }
     
-    // Close the zzip directory ptr
-    Close();
-    
     // If the zip file was empty we don't want IsLoaded to fail on the files_ check.
     // The bundle loaded fine but there was no content, log a warning.
     if (files_.isEmpty())
@@ -103,7 +115,7 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
         return true;
     }
     
-    // Don't spin the worker if all sub assets are up to date in cache.
+    // Don't spin the worker if all sub assets are up to date in cache or we serve the sub assets from the archive.
     if (uncompressing > 0)
     {   
         // Now that the file info has been read, continue in a worker thread.
@@ -129,25 +141,101 @@ bool ZipAssetBundle::DeserializeFromData(const u8 * /*data*/, size_t /*numBytes*
 
 std::vector<u8> ZipAssetBundle::GetSubAssetData(const QString &subAssetName)
 {
-    /* Makes no sense to keep the whole zip file contents in memory as only
-       few files could be wanted from a 100mb bundle. Additionally all asset would take 2x the memory.
-       We could make this function also open the zip file and uncompress the data for every sub asset request. 
-       But that would be rather pointless, not to mention slower, as we already have the unpacked individual 
-       assets on disk. If the unpacking to disk changes we might need to rethink this. */
-
-    QString filePath = GetSubAssetDiskSource(subAssetName);
-    if (filePath.isEmpty())
-        return std::vector<u8>();
+    /* Only the requested sub asset is inflated from the archive, the rest of the archive
+       is never decompressed. If the data was prefetched, wait for the worker and hand out the result. */
+    const QString key = subAssetName.toLower();
+    QHash<QString, int>::iterator prefetchIter = prefetched_.find(key);
+    if (prefetchIter != prefetched_.end())
+    {
+        const int job = prefetchIter.value();
+        prefetched_.erase(prefetchIter);
+        prefetchJobs_[job].waitForFinished();
+        std::vector<u8> data;
+        QHash<QString, std::vector<u8> >::iterator dataIter = prefetchBatches_[job]->data.find(key);
+        if (dataIter != prefetchBatches_[job]->data.end())
+        {
+            data.swap(dataIter.value());
+            prefetchBatches_[job]->data.erase(dataIter);
+            return data;
+        }
+    }
 
-    std::vector<u8> data;
-    return LoadFileToVector(filePath, data) ? data : std::vector<u8>();
+    if (extract_)
+    {
+        QString filePath = GetSubAssetDiskSource(subAssetName);
+        std::vector<u8> data;
+        if (!filePath.isEmpty() && LoadFileToVector(filePath, data))
+            return data;
+    }
+
+    const int index = FindFile(subAssetName);
+    if (index < 0)
+        return std::vector<u8>();
+    return ReadZipFile(archive_, files_[index].relativePath, files_[index].uncompressedSize);
 }
 
 QString ZipAssetBundle::GetSubAssetDiskSource(const QString &subAssetName)
 {
+    if (!extract_)
+        return "";
     return assetAPI_->GetAssetCache()->FindInCache(GetFullAssetReference(subAssetName));
 }
 
+void ZipAssetBundle::PrefetchSubAssets(const QStringList &subAssetNames)
+{
+    // Extracted sub assets are loaded from their cache files.
+    if (extract_ || !archive_)
+        return;
+
+    ZipFileList files;
+    foreach(const QString &subAssetName, subAssetNames)
+    {
+        const int index = FindFile(subAssetName);
+        if (index >= 0 && !prefetched_.contains(subAssetName.toLower()))
+            files << files_[index];
+    }
+    if (files.isEmpty())
+        return;
+
+    // Split the files to a batch per thread. Each batch opens the archive once, which reads the central directory again.
+    const int numBatches = qMin(files.size(), qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+    const int firstJob = prefetchJobs_.size();
+    for(int i = 0; i < numBatches; ++i)
+    {
+        shared_ptr<PrefetchBatch> batch = MAKE_SHARED(PrefetchBatch);
+        batch->diskSource = DiskSource();
+        prefetchBatches_ << batch;
+    }
+    for(int i = 0; i < files.size(); ++i)
+    {
+        prefetchBatches_[firstJob + i % numBatches]->files << files[i];
+        prefetched_[files[i].relativePath.toLower()] = firstJob + i % numBatches;
+    }
+    for(int i = 0; i < numBatches; ++i)
+        prefetchJobs_ << QtConcurrent::run(&ZipAssetBundle::ReadPrefetchBatch, prefetchBatches_[firstJob + i].get());
+}
+
+void ZipAssetBundle::ReadPrefetchBatch(PrefetchBatch *batch)
+{
+    // Does not log, as it is called in a worker thread. GetSubAssetData falls back to reading the missing files.
+    zzip_error_t error = ZZIP_NO_ERROR;
+    ZZIP_DIR *archive = zzip_dir_open(QDir::toNativeSeparators(batch->diskSource).toStdString().c_str(), &error);
+    if (!archive)
+        return;
+    foreach(const ZipArchiveFile &file, batch->files)
+    {
+        std::vector<u8> data = ReadZipFile(archive, file.relativePath, file.uncompressedSize);
+        if (!data.empty() || file.uncompressedSize == 0)
+            batch->data[file.relativePath.toLower()].swap(data);
+    }
+    zzip_dir_close(archive);
+}
+
+int ZipAssetBundle::FindFile(const QString &subAssetName) const
+{
+    return fileIndex_.value(subAssetName.toLower(), -1);
+}
+
 QString ZipAssetBundle::GetFullAssetReference(const QString &subAssetName)
 {
     return Name() + "#" + subAssetName;
@@ -181,6 +269,13 @@ void ZipAssetBundle::OnAsynchLoadCompleted(bool successful)
 
 void ZipAssetBundle::Close()
 {
+    // The prefetch workers write to the batches, they must be done before releasing them.
+    for(int i = 0; i < prefetchJobs_.size(); ++i)
+        prefetchJobs_[i].waitForFinished();
+    prefetchJobs_.clear();
+    prefetchBatches_.clear();
+    prefetched_.clear();
+
     if (archive_)
     {
         zzip_dir_close(archive_);
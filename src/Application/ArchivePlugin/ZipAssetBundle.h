@@ -6,9 +6,18 @@
 #include "IAssetBundle.h"
 #include "ZipWorker.h"
 
+#include <QHash>
+#include <QFuture>
+
+#include <vector>
+
 struct zzip_dir;
 
 /// Provides zip packed asset bundle support.
+/** The archive is kept open and its central directory in memory while the bundle is loaded.
+    Sub assets are inflated on demand from the archive, so only the files that are actually
+    requested are ever decompressed. Extracting the whole archive to the asset cache can be enabled with
+    the --extractZipBundles command line parameter. */
 class ZipAssetBundle : public IAssetBundle
 {
     Q_OBJECT
@@ -25,10 +34,9 @@ public:
     virtual bool RequiresDiskSource() { return true; }
 
     /// IAssetBundle override.
-    /** Our current zziplib implementation requires disk source for processing.
-        So we fail DeserializeFromData and try our best here to.
-        This function unpacks the archive content to asset cache to normal cache files
-        and provides the sub asset data via GetSubAssetData and GetSubAssetDiskSource. */
+    /** Reads the central directory of the archive to memory. If --extractZipBundles is specified
+        the archive content is also unpacked to asset cache to normal cache files
+        and provided via GetSubAssetDiskSource. */
     virtual bool DeserializeFromDiskSource();
 
     /// IAssetBundle override.
@@ -42,11 +50,18 @@ public:
     virtual int SubAssetCount() const { return fileCount_; }
 
     /// IAssetBundle override.
+    /** Inflates the sub asset from the archive, or returns the result of an earlier PrefetchSubAssets call. */
     virtual std::vector<u8> GetSubAssetData(const QString &subAssetName);
 
     /// IAssetBundle override.
+    /** Returns the extracted cache file if extraction is enabled, otherwise empty string. */
     virtual QString GetSubAssetDiskSource(const QString &subAssetName);
-    
+
+    /// IAssetBundle override.
+    /** Starts inflating the sub assets on the global QThreadPool. Each worker opens the archive for itself,
+        as an open archive can not be read from several threads at a time. */
+    virtual void PrefetchSubAssets(const QStringList &subAssetNames);
+
 private slots:
     /// Returns full asset reference for a sub asset.
     QString GetFullAssetReference(const QString &subAssetName);
@@ -58,17 +73,46 @@ private:
     /// IAssetBundle override.
     virtual void DoUnload();
 
-    /// Closes zip file.
+    /// Waits for pending prefetches and closes the zip file.
     void Close();
-    
-    /// Zziplib ptr to the zip file.
+
+    /// Returns the index of a sub asset in files_, or -1 if not found.
+    int FindFile(const QString &subAssetName) const;
+
+    /// @cond PRIVATE
+    /// Sub assets inflated by one prefetch worker.
+    struct PrefetchBatch
+    {
+        QString diskSource;
+        ZipFileList files;
+        QHash<QString, std::vector<u8> > data; ///< Inflated data by lower case relative path. Written by the worker.
+    };
+    /// @endcond
+
+    /// Inflates the files of a prefetch batch. Called in a worker thread.
+    static void ReadPrefetchBatch(PrefetchBatch *batch);
+
+    /// Zziplib ptr to the zip file. Used from the main thread only.
     zzip_dir *archive_;
     
     /// Zip sub assets.
     ZipFileList files_;
 
+    /// Maps lower case relative paths to indexes in files_.
+    QHash<QString, int> fileIndex_;
+
+    /// Pending and completed prefetch workers, and the batches they fill.
+    QList<QFuture<void> > prefetchJobs_;
+    QList<shared_ptr<PrefetchBatch> > prefetchBatches_;
+
+    /// Maps the lower case relative paths of the prefetched sub assets to indexes in prefetchJobs_.
+    QHash<QString, int> prefetched_;
+
     /// Count of files inside this zip.
     int fileCount_;
+
+    /// Are the sub assets extracted to the asset cache.
+    bool extract_;
 };
 
 typedef shared_ptr<ZipAssetBundle> ArchiveAssetPtr;
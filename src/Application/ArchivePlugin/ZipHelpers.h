@@ -2,9 +2,14 @@
 
 #pragma once
 
+#include "CoreTypes.h"
 #include "LoggingFunctions.h"
 #include "zzip/zzip.h"
 
+#include <QString>
+
+#include <vector>
+
 static bool CheckAndLogZzipError(zzip_error_t error)
 {
     QString errorMsg;
@@ -42,4 +47,37 @@ static bool CheckAndLogArchiveError(zzip_dir *archive)
     if (archive)
         return CheckAndLogZzipError((zzip_error_t)zzip_error(archive));
     return true;
-}
\ No newline at end of file
+}
+
+/// Reads a single file from an open zip archive.
+/** The files opened from a ZZIP_DIR share its file handle, so an archive must be used from only one thread at a time.
+    @param uncompressedSize The uncompressed size of the file from the central directory, see ZZIP_DIRENT::st_size.
+    @return Uncompressed data of the file or empty vector on failure. */
+static std::vector<u8> ReadZipFile(ZZIP_DIR *archive, const QString &relativePath, uint uncompressedSize)
+{
+    std::vector<u8> data;
+    if (!archive)
+        return data;
+
+    ZZIP_FILE *file = zzip_file_open(archive, relativePath.toStdString().c_str(), ZZIP_ONLYZIP | ZZIP_CASELESS);
+    if (!file)
+        return data;
+
+    // The central directory tells the uncompressed size, inflate straight into the final buffer.
+    if (uncompressedSize > 0)
+    {
+        data.resize(uncompressedSize);
+        zzip_size_t total = 0;
+        while(total < uncompressedSize)
+        {
+            zzip_ssize_t read = zzip_file_read(file, &data[total], uncompressedSize - total);
+            if (read <= 0)
+                break;
+            total += (zzip_size_t)read;
+        }
+        if (total != uncompressedSize)
+            data.clear();
+    }
+    zzip_file_close(file);
+    return data;
+}
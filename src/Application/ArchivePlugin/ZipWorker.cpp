@@ -7,15 +7,9 @@
 
 #include "zzip/zzip.h"
 
-#include <QtAlgorithms>
 #include <QDir>
 #include <QFile>
 
-bool ArchiveFileSizeCompare(const ZipArchiveFile &f1, const ZipArchiveFile &f2)
-{
-    return f1.uncompressedSize < f2.uncompressedSize;
-}
-
 ZipWorker::ZipWorker(const QString &diskSource, ZipFileList files) :
     diskSource_(diskSource),
     files_(files),
@@ -40,55 +34,29 @@ void ZipWorker::run()
         emit AsynchLoadCompleted(false);
         return;
     }
-    
-    // Sort by size so we can resize the buffer less often.
-    qSort(files_.begin(), files_.end(), ArchiveFileSizeCompare);
 
-    // Read file contents
-    zzip_ssize_t chunkLen = 0;
-    zzip_ssize_t chunkRead = 0;
-    std::vector<u8> buffer;
-
-    foreach(ZipArchiveFile file, files_)
+    foreach(const ZipArchiveFile &file, files_)
     {
         if (!file.doExtract)
             continue;
-        
-        // Open file from zip
-        ZZIP_FILE *zzipFile = zzip_file_open(archive_, file.relativePath.toStdString().c_str(), ZZIP_ONLYZIP | ZZIP_CASELESS);
-        if (zzipFile && !CheckAndLogArchiveError(archive_))
-        {            
-            // Create cache file
-            QFile cacheFile(file.cachePath);
-            if (!cacheFile.open(QIODevice::WriteOnly))
-            {
-                LogError("ZipWorker: Failed to open cache file: " + cacheFile.fileName() + ". Cannot unzip " + file.relativePath);
-                continue;
-            }
 
-            // Detect file size and adjust buffer (quite naive atm but is a slight speed improvement)
-            if (file.uncompressedSize > 1000*1024)
-                chunkLen = 500*1024;
-            else if (file.uncompressedSize > 500*1024)
-                chunkLen = 250*1024;
-            else if (file.uncompressedSize > 100*1024)
-                chunkLen = 50*1024;
-            else if (file.uncompressedSize > 20*1024)
-                chunkLen = 10*1024;
-            else
-                chunkLen = 5*1024;
-
-            if (buffer.size() != (uint)chunkLen)
-                buffer.resize(chunkLen);
-
-            // Read zip file content to cache file
-            while (0 < (chunkRead = zzip_read(zzipFile, &buffer[0], chunkLen)))
-                cacheFile.write((char*)&buffer[0], chunkRead);
+        // Inflate the whole file in one go, the central directory knows the final size.
+        std::vector<u8> data = ReadZipFile(archive_, file.relativePath, file.uncompressedSize);
+        if (data.empty() && file.uncompressedSize > 0)
+        {
+            LogError("ZipWorker: Failed to uncompress " + file.relativePath + " from " + diskSource_);
+            continue;
+        }
 
-            // Close zip and cache file.
-            zzip_file_close(zzipFile);
-            cacheFile.close();
+        QFile cacheFile(file.cachePath);
+        if (!cacheFile.open(QIODevice::WriteOnly))
+        {
+            LogError("ZipWorker: Failed to open cache file: " + cacheFile.fileName() + ". Cannot unzip " + file.relativePath);
+            continue;
         }
+        if (!data.empty())
+            cacheFile.write((const char*)&data[0], data.size());
+        cacheFile.close();
     }
 
     // Close the zzip directory ptr
@@ -18,10 +18,13 @@ struct ZipArchiveFile
     uint uncompressedSize;
     QDateTime lastModified;
     bool doExtract;
+
+    ZipArchiveFile() : compressedSize(0), uncompressedSize(0), doExtract(false) {}
 };
 typedef QList<ZipArchiveFile> ZipFileList;
 
-/// Worker thread that unpacks zip file contents.
+/// Worker thread that unpacks zip file contents to the asset cache.
+/** Only used when zip bundle extraction is enabled with --extractZipBundles. */
 class ZipWorker : public QObject, public QRunnable
 {
 Q_OBJECT
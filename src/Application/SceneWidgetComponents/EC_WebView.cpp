@@ -49,7 +49,6 @@ static const u32 NoneControlID = 0;
 EC_WebView::EC_WebView(Scene *scene) :
     IComponent(scene),
     webview_(0),
-    renderTimer_(0),
     webviewLoading_(false),
     webviewHasContent_(false),
     componentPrepared_(false),
@@ -107,8 +106,6 @@ EC_WebView::EC_WebView(Scene *scene) :
     connect(this, SIGNAL(ParentEntitySet()), SLOT(PrepareComponent()), Qt::UniqueConnection);
     
     // Prepare render timer
-    renderTimer_ = new QTimer(this);
-    connect(renderTimer_, SIGNAL(timeout()), SLOT(Render()), Qt::UniqueConnection);
     resizeRenderTimer_ = new QTimer(this);
     resizeRenderTimer_->setSingleShot(true);
     connect(resizeRenderTimer_, SIGNAL(timeout()), SLOT(RenderDelayed()), Qt::UniqueConnection);
@@ -335,6 +332,14 @@ void EC_WebView::Render()
     if (sceneCanvas->GetWidget() != webview_)
         sceneCanvas->SetWidget(webview_);
 
+    // With a refresh rate the canvas keeps repainting the page when it changes, scheduled by the canvas manager.
+    if (renderRefreshRate.Get() > 0 && !sceneCanvas->IsRunning())
+    {
+        // Clamp FPS to 0-25, the EC editor UI does this for us with AttributeMetaData,
+        // but someone can inject crazy stuff here directly from code
+        sceneCanvas->SetRefreshRate(qMin(renderRefreshRate.Get(), 25));
+        sceneCanvas->Start();
+    }
     sceneCanvas->Update();
 }
 
@@ -390,17 +395,9 @@ void EC_WebView::RenderDelayed()
     if (!enabled.Get())
         return;
 
-    // If timer does not exist or is not active, 
-    // invoke a single shot to our Render() function.
-    // If the timer is active, it meas we dont want to double call Render()
-    // the timer will invoke it once the timeout() is emitted next time.
-    if (renderTimer_)
-    {
-        if (!renderTimer_->isActive())
-            QTimer::singleShot(10, this, SLOT(Render()));
-    }
-    else
-        QTimer::singleShot(10, this, SLOT(Render()));
+    // Invoke a single shot to our Render() function. Even if the canvas is running,
+    // Render() is needed to apply e.g. a changed submesh index.
+    QTimer::singleShot(10, this, SLOT(Render()));
 }
 
 void EC_WebView::RenderWindowResized()
@@ -745,30 +742,17 @@ void EC_WebView::ResetSubmeshIndex()
 
 void EC_WebView::RenderTimerStop()
 {
-    if (renderTimer_ && renderTimer_->isActive())
-        renderTimer_->stop();
+    EC_WidgetCanvas *sceneCanvas = GetSceneCanvasComponent();
+    if (sceneCanvas && sceneCanvas->IsRunning())
+        sceneCanvas->Stop();
 }
 
 void EC_WebView::RenderTimerStartOrSingleShot()
 {
-    if (renderTimer_)
-    {
-        if (renderRefreshRate.Get() > 0)
-        {
-            PrepareWebview();
-
-            // Clamp FPS to 0-25, the EC editor UI does this for us with AttributeMetaData,
-            // but someone can inject crazy stuff here directly from code
-            int rateNow = 1000 / renderRefreshRate.Get();
-            if (rateNow < 40)
-                rateNow = 40; // Max allowed FPS 25 == 40ms timer timeout
-            renderTimer_->start(rateNow);
-        }
-        else
-            QTimer::singleShot(10, this, SLOT(Render()));
-    }
-    else
-        QTimer::singleShot(10, this, SLOT(Render()));
+    // Render() starts the canvas if the refresh rate is set.
+    if (renderRefreshRate.Get() > 0)
+        PrepareWebview();
+    QTimer::singleShot(10, this, SLOT(Render()));
 
     // If we get here we can safely reset the widget
     // if no one has browser control
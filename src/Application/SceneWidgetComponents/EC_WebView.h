@@ -56,7 +56,7 @@ Registered by SceneWidgetComponents plugin.
 <li>int: renderSubmeshIndex
 <div>Sets the submesh index of the entitys EC_Mesh where the browser content will be rendered in the 3D scene object.</div>
 <li>int: renderRefreshRate
-<div>Sets how many times in a second the browser should be rendered (updated) in the 3D scene object. 0 is no automatic updates, then rendering will be done only when browser content is scrolled.</div>
+<div>Sets how many times in a second the browser should be rendered (updated) in the 3D scene object. 0 is no automatic updates, then rendering will be done only when browser content is scrolled. This is the maximum rate: the browser is rendered only when its content changes, and less often when the entity is out of view or far away.</div>
 <li>bool: interactive
 <div>Sets if this web browser is interactive. This means when you click it you will get a context menu to show 2D browser and to start/stop shared browsing.</div>
 <li>int: controllerId
@@ -176,7 +176,6 @@ private slots:
     void ServerCheckControllerValidity(u32 connectionID);
 
     /// For internals to do delayed rendering due to e.g. widget resize or submesh index change.
-    /// \note Depending if the 'renderRefreshRate' is a valid number (0-25) we use the timer, otherwise a QTimer::singleShot().
     void RenderDelayed();
 
     /// Handler for window resize signal.
@@ -213,10 +212,10 @@ private slots:
     /// If user select invalid submesh, this function is invoked with a delay and the value is reseted to 0.
     void ResetSubmeshIndex();
 
-    /// Stops the current update timer
+    /// Stops the continuous updates of the EC_WidgetCanvas.
     void RenderTimerStop();
 
-    /// Starts the update timer, or does a delayed rendering. Depending on the 'renderRefreshRate' value.
+    /// Does a delayed rendering, which starts the continuous updates of the EC_WidgetCanvas if 'renderRefreshRate' is set.
     void RenderTimerStartOrSingleShot();
 
     /// Handler when EC_Mesh emits that the mesh is ready.
@@ -273,9 +272,6 @@ private:
     /// Internal QWebView for rendering the web page.
     QPointer<QWebView> webview_;
 
-    /// Internal timer for updating inworld EC_WidgetCanvas.
-    QTimer *renderTimer_;
-
     /// Internal time for updating the rendering after a window resize event.
     QTimer *resizeRenderTimer_;
 
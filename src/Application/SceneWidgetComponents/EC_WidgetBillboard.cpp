@@ -40,6 +40,9 @@
 #include <QResizeEvent>
 #include <QFocusEvent>
 
+/// Maximum rate at which the widget is repainted when it changes.
+static const int cRefreshRate = 30;
+
 EC_WidgetBillboard::EC_WidgetBillboard(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(uiRef, "UI ref", AssetReference("", "QtUiFile")),
@@ -50,7 +53,6 @@ EC_WidgetBillboard::EC_WidgetBillboard(Scene* scene) :
     cloneMaterialRef_("Ogre Media:LitTextured.material"),
     refListener_(0),
     widgetContainer_(0),
-    rendering_(false),
     leftPressReleased_(true),
     trackingMouseMove_(false)
 {
@@ -89,10 +91,6 @@ EC_WidgetBillboard::EC_WidgetBillboard(Scene* scene) :
         connect(refListener_, SIGNAL(Loaded(AssetPtr)), SLOT(OnUiAssetLoaded(AssetPtr)));
         connect(refListener_, SIGNAL(TransferFailed(IAssetTransfer*, QString)), SLOT(OnUiAssetLoadFailed(IAssetTransfer*, QString)));
 
-        // RenderInternal timer
-        renderTimer_.setSingleShot(true);
-        connect(&renderTimer_, SIGNAL(timeout()), SLOT(RenderInternal()));
-
         // Init widget container and scene
         widgetContainer_ = new QGraphicsView();
         widgetContainer_->setAttribute(Qt::WA_DontShowOnScreen, true);
@@ -102,7 +100,7 @@ EC_WidgetBillboard::EC_WidgetBillboard(Scene* scene) :
         QGraphicsScene *scene = new QGraphicsScene(widgetContainer_);
         widgetContainer_->setScene(scene);
 
-        connect(scene, SIGNAL(changed(const QList<QRectF>&)), SLOT(Render()));
+        connect(scene, SIGNAL(changed(const QList<QRectF>&)), SLOT(OnSceneChanged(const QList<QRectF>&)));
         connect(framework->Ui()->GraphicsView(), SIGNAL(WindowResized(int, int)), SLOT(Render())); 
     }
     else
@@ -112,8 +110,9 @@ EC_WidgetBillboard::EC_WidgetBillboard(Scene* scene) :
 EC_WidgetBillboard::~EC_WidgetBillboard()
 {
     // Stop rendering
-    if (renderTimer_.isActive())
-        renderTimer_.stop();
+    WidgetCanvasManager *manager = CanvasManager();
+    if (manager)
+        manager->Unregister(this);
 
     // Release widget
     if (widget_)
@@ -142,53 +141,37 @@ EC_WidgetBillboard::~EC_WidgetBillboard()
 
 void EC_WidgetBillboard::Render()
 {
-    if (rendering_)
-        return;
     if (!getvisible())
         return;
 
-    if (!renderTimer_.isActive())
-        renderTimer_.start(10);
+    // The change is not known, the canvas manager repaints the whole widget and uploads the tiles that changed.
+    WidgetCanvasManager *manager = CanvasManager();
+    if (manager)
+        manager->AddDamage(this);
 }
 
-// Private slots
-
-void EC_WidgetBillboard::RenderInternal()
+void EC_WidgetBillboard::WidgetCanvasPainted(const QImage &image, const QRegion &changed)
 {
     if (!getvisible())
         return;
     if (!IsPrepared())
         return;
-    if (!widget_)
-        return;
-    if (renderTimer_.isActive())
-        return;
 
     OgreMaterialAsset *ogreMaterialAsset = dynamic_cast<OgreMaterialAsset*>(materialAsset_.get());
     TextureAsset *ogreTextureAsset = dynamic_cast<TextureAsset*>(textureAsset_.get());
     if (!ogreMaterialAsset || !ogreTextureAsset)
         return;
 
-    // Protection against malformed widgets.
-    if (widget_->width() <= 0 || widget_->height() <= 0)
-        return;
-
-    rendering_ = true;
-
-    // Prepare render buffer.
-    if (renderBuffer_.size() != widget_->size())
+    // Update ogre texture. Only the changed area is uploaded, unless the size changed.
+    Ogre::TexturePtr texture = ogreTextureAsset->ogreTexture;
+    if (texture.isNull() || (int)texture->getWidth() != image.width() || (int)texture->getHeight() != image.height())
     {
         HandlePPMChange();
-        renderBuffer_ = QImage(widget_->size(), QImage::Format_ARGB32_Premultiplied);
+        ogreTextureAsset->SetContents(image.width(), image.height(), image.constBits(), image.byteCount(), 
+                                      Ogre::PF_A8R8G8B8, false, true, false);
     }
-    renderBuffer_.fill(Qt::transparent);
-    
-    // Pull widget state to render buffer
-    widget_->render(&renderBuffer_, QPoint(), QRegion(), QWidget::DrawChildren);
-
-    // Update ogre texture
-    ogreTextureAsset->SetContents(renderBuffer_.width(), renderBuffer_.height(), renderBuffer_.bits(), renderBuffer_.byteCount(), 
-                                  Ogre::PF_A8R8G8B8, false, true, false);
+    else
+        WidgetCanvasManager::Blit(image, changed, texture);
 
     // Set texture to material if needed
     Ogre::TextureUnitState *texUnit = ogreMaterialAsset->GetTextureUnit(0, 0, 0);
@@ -201,8 +184,51 @@ void EC_WidgetBillboard::RenderInternal()
     EC_Billboard *bb = GetBillboardComponent();
     if (bb->getshow() != getvisible())
         bb->setshow(getvisible());
+}
+
+// Private slots
 
-    rendering_ = false;
+void EC_WidgetBillboard::RenderInternal()
+{
+    if (!getvisible())
+        return;
+    if (!IsPrepared())
+        return;
+    if (!widget_)
+        return;
+
+    // Protection against malformed widgets.
+    if (widget_->width() <= 0 || widget_->height() <= 0)
+        return;
+
+    // The widget container scene reports the changed areas, so the widget is never polled.
+    WidgetCanvasManager *manager = CanvasManager();
+    if (!manager)
+        return;
+    manager->Register(this, widget_, cRefreshRate, WidgetCanvasManager::TransparentBackground | WidgetCanvasManager::DamageReported);
+    manager->Paint(this, true);
+}
+
+void EC_WidgetBillboard::OnSceneChanged(const QList<QRectF> &region)
+{
+    if (!getvisible())
+        return;
+    WidgetCanvasManager *manager = CanvasManager();
+    if (!manager)
+        return;
+
+    // The widget proxy is at the scene origin, so scene coordinates are widget coordinates.
+    QRegion damage;
+    foreach(const QRectF &rect, region)
+        damage += rect.toAlignedRect();
+    if (!damage.isEmpty())
+        manager->AddDamage(this, damage);
+}
+
+WidgetCanvasManager *EC_WidgetBillboard::CanvasManager() const
+{
+    SceneWidgetComponents *module = framework->Module<SceneWidgetComponents>();
+    return module ? module->CanvasManager() : 0;
 }
 
 bool EC_WidgetBillboard::IsPrepared()
@@ -300,6 +326,8 @@ void EC_WidgetBillboard::AttributesChanged()
                 }
                 widget_->removeEventFilter(this);
                 SAFE_DELETE(widget_);
+                if (CanvasManager())
+                    CanvasManager()->Unregister(this);
             }
             if (myBillboard)
                 myBillboard->show.Set(false, AttributeChange::LocalOnly);
@@ -310,7 +338,11 @@ void EC_WidgetBillboard::AttributesChanged()
     if (myBillboard)
     {
         if (visible.ValueChanged() && widget_)
+        {
             myBillboard->show.Set(getvisible(), AttributeChange::LocalOnly);
+            // Changes are not tracked while hidden.
+            Render();
+        }
         if (position.ValueChanged())
             myBillboard->position.Set(getposition(), AttributeChange::LocalOnly);
     }
@@ -389,9 +421,9 @@ void EC_WidgetBillboard::OnUiAssetLoadFailed(IAssetTransfer * /*transfer*/, QStr
 
 bool EC_WidgetBillboard::eventFilter(QObject *obj, QEvent *e)
 {
-    if (e->type() == QEvent::UpdateRequest || e->type() == QEvent::Show || e->type() == QEvent::Hide || e->type() == QEvent::Move ||
-        dynamic_cast<QPaintEvent*>(e) || dynamic_cast<QChildEvent*>(e) || dynamic_cast<QMouseEvent*>(e) || 
-        dynamic_cast<QGraphicsSceneEvent*>(e) || dynamic_cast<QHoverEvent*>(e))
+    // Updates, paints and hovers of the widget are reported by the container scene in OnSceneChanged with the changed area.
+    if (e->type() == QEvent::Show || e->type() == QEvent::Hide || e->type() == QEvent::Move ||
+        dynamic_cast<QChildEvent*>(e) || dynamic_cast<QMouseEvent*>(e))
     {
         Render();
     }
@@ -432,7 +464,13 @@ void EC_WidgetBillboard::OnMouseEvent(MouseEvent *mEvent, RaycastResult *raycast
     QPoint widgetPos((int)widget_->width() * raycast->u, (int)widget_->height() * (1.f-raycast->v));
     
     // Don't register a hit for transparent widget parts. Make mouse event not handled so it will continue to propagate.
-    if (!renderBuffer_.isNull() && (renderBuffer_.pixel(widgetPos) & 0xFF000000) == 0x00000000)
+    bool transparentHit = false;
+    {
+        WidgetCanvasManager *manager = CanvasManager();
+        QImage image = manager ? manager->Image(this) : QImage();
+        transparentHit = image.valid(widgetPos) && (image.pixel(widgetPos) & 0xFF000000) == 0x00000000;
+    }
+    if (transparentHit)
     {
         CheckMouseState();
         mEvent->handled = false;
@@ -4,6 +4,7 @@
 
 #include "SceneWidgetComponentsApi.h"
 #include "SceneWidgetComponents.h"
+#include "WidgetCanvasManager.h"
 #include "IComponent.h"
 #include "Math/float3.h"
 #include "Math/float2.h"
@@ -16,7 +17,6 @@
 #include "AssetReference.h"
 
 #include <QWidget>
-#include <QTimer>
 #include <QImage>
 #include <QEvent>
 #include <QPointer>
@@ -26,7 +26,7 @@ class EC_Billboard;
 
 /// Attaches a billboard with UI widget to an entity.
 /** Depends on EC_Billboard*/
-class SCENEWIDGET_MODULE_API EC_WidgetBillboard : public IComponent
+class SCENEWIDGET_MODULE_API EC_WidgetBillboard : public IComponent, public IWidgetCanvasClient
 {
     Q_OBJECT
     COMPONENT_NAME("WidgetBillboard", 42)
@@ -60,14 +60,21 @@ public:
     Q_PROPERTY(int ppm READ getppm WRITE setppm);
     DEFINE_QPROPERTY_ATTRIBUTE(int, ppm);
 
+    /// IWidgetCanvasClient override.
+    void WidgetCanvasPainted(const QImage &image, const QRegion &changed);
+
 public slots:
     /// Update rendering.
+    /** The widget is repainted by the canvas manager on a following frame. */
     void Render();
 
 private slots:
-    // Internal render called by a delay timer from Render(), due the fact that qt does resize etc operations lazily.
+    /// Renders the whole widget immediately.
     void RenderInternal();
 
+    /// Adds the changed area of the widget container scene to the damage of the widget.
+    void OnSceneChanged(const QList<QRectF> &region);
+
     /// Returns if the component is prepared.
     bool IsPrepared();
 
@@ -144,12 +151,10 @@ private:
     QString billboardCompName_;
     QString cloneMaterialRef_;
 
-    // Rendering related variables.
-    QTimer renderTimer_;
-    QImage renderBuffer_;
+    /// Returns the canvas manager of the SceneWidgetComponents module, or null if not available.
+    WidgetCanvasManager *CanvasManager() const;
 
     // Tracking booleans.
-    bool rendering_;
     bool leftPressReleased_;
     bool trackingMouseMove_;
 
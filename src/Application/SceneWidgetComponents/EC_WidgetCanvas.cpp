@@ -13,28 +13,13 @@
 #include "OgreMaterialUtils.h"
 #include "EC_Mesh.h"
 #include "EC_OgreCustomObject.h"
+#include "SceneWidgetComponents.h"
 
 #include <OgreTextureManager.h>
 #include <OgreMaterialManager.h>
-#include <OgreHardwarePixelBuffer.h>
 #include <OgreTechnique.h>
 
-#include <QTimer>
 #include <QWidget>
-#include <QPainter>
-#include <QDebug>
-
-#if defined(DIRECTX_ENABLED) && defined(WIN32)
-#ifdef SAFE_DELETE
-#undef SAFE_DELETE
-#endif
-#ifdef SAFE_DELETE_ARRAY
-#undef SAFE_DELETE_ARRAY
-#endif
-#include <d3d9.h>
-#include <OgreD3D9RenderSystem.h>
-#include <OgreD3D9HardwarePixelBuffer.h>
-#endif
 
 #include "MemoryLeakCheck.h"
 
@@ -43,7 +28,7 @@ EC_WidgetCanvas::EC_WidgetCanvas(Scene *scene) :
     widget_(0),
     update_internals_(false),
     mesh_hooked_(false),
-    refresh_timer_(0),
+    running_(false),
     update_interval_msec_(0),
     material_name_(""),
     texture_name_("")
@@ -90,9 +75,9 @@ EC_WidgetCanvas::~EC_WidgetCanvas()
     submeshes_.clear();
     widget_ = 0;
 
-    if (refresh_timer_)
-        refresh_timer_->stop();
-    SAFE_DELETE(refresh_timer_);
+    WidgetCanvasManager *manager = CanvasManager();
+    if (manager)
+        manager->Unregister(this);
 
     if (!material_name_.empty())
     {
@@ -119,12 +104,9 @@ void EC_WidgetCanvas::Start()
         return;
 
     update_internals_ = true;
-    if (update_interval_msec_ != 0 && refresh_timer_)
-    {
-        if (refresh_timer_->isActive())
-            refresh_timer_->stop();
-        refresh_timer_->start(update_interval_msec_);
-    }
+    running_ = true;
+    if (update_interval_msec_ != 0)
+        SyncRegistration(); // The manager paints newly registered widgets right away.
     else
         Update();
 
@@ -165,9 +147,8 @@ void EC_WidgetCanvas::Stop()
     if (framework->IsHeadless())
         return;
 
-    if (refresh_timer_)
-        if (refresh_timer_->isActive())
-            refresh_timer_->stop();
+    running_ = false;
+    SyncRegistration();
 }
 
 void EC_WidgetCanvas::Setup(QWidget *widget, const QList<uint> &submeshes, int refresh_per_second)
@@ -190,6 +171,7 @@ void EC_WidgetCanvas::SetWidget(QWidget *widget)
         widget_ = widget;
         if (widget_)
             connect(widget_, SIGNAL(destroyed(QObject*)), SLOT(WidgetDestroyed(QObject *)), Qt::UniqueConnection);
+        SyncRegistration();
     }
 }
 
@@ -201,23 +183,8 @@ void EC_WidgetCanvas::SetRefreshRate(int refresh_per_second)
     if (refresh_per_second < 0)
         refresh_per_second = 0;
 
-    bool was_running = false;
-    if (refresh_timer_)
-        was_running = refresh_timer_->isActive();
-    SAFE_DELETE(refresh_timer_);
-
-    if (refresh_per_second != 0)
-    {
-        refresh_timer_ = new QTimer(this);
-        connect(refresh_timer_, SIGNAL(timeout()), SLOT(Update()), Qt::UniqueConnection);
-
-        int temp_msec = 1000 / refresh_per_second;
-        if (update_interval_msec_ != temp_msec && was_running)
-            refresh_timer_->start(temp_msec);
-        update_interval_msec_ = temp_msec;
-    }
-    else
-        update_interval_msec_ = 0;
+    update_interval_msec_ = (refresh_per_second != 0 ? 1000 / refresh_per_second : 0);
+    SyncRegistration();
 }
 
 void EC_WidgetCanvas::SetSubmesh(uint submesh)
@@ -250,7 +217,6 @@ void EC_WidgetCanvas::WidgetDestroyed(QObject *obj)
     widget_ = 0;
     Stop();
     RestoreOriginalMeshMaterials();
-    SAFE_DELETE(refresh_timer_);
 }
 
 void EC_WidgetCanvas::Update(QImage buffer)
@@ -273,31 +239,10 @@ void EC_WidgetCanvas::Update(QImage buffer)
 
     try
     {
-        Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().getByName(texture_name_);
-        if (texture.isNull())
-            return;
-
-        // Set texture to material if need be
-        if (update_internals_ && !material_name_.empty())
-        {
-            Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(material_name_);
-            if (material.isNull())
-                return;
-            // Just for good measure, this is done once in the ctor already if everything went well.
-            OgreRenderer::SetTextureUnitOnMaterial(material, texture_name_);
-            UpdateSubmeshes();
-            update_internals_ = false;
-        }
-
-        if ((int)texture->getWidth() != buffer.width() || (int)texture->getHeight() != buffer.height())
-        {
-            texture->freeInternalResources();
-            texture->setWidth(buffer.width());
-            texture->setHeight(buffer.height());
-            texture->createInternalResources();
-        }
-
-        Blit(buffer, texture);
+        bool resized = false;
+        Ogre::TexturePtr texture = PrepareTexture(buffer, resized);
+        if (!texture.isNull())
+            Blit(buffer, texture);
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -319,41 +264,25 @@ void EC_WidgetCanvas::Update()
     if (widget_->width() <= 0 || widget_->height() <= 0)
         return;
 
-    try
-    {
-        Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().getByName(texture_name_);
-        if (texture.isNull())
-            return;
-
-        if (buffer_.size() != widget_->size())
-            buffer_ = QImage(widget_->size(), QImage::Format_ARGB32_Premultiplied);
-        if (buffer_.width() <= 0 || buffer_.height() <= 0)
-            return;
-
-        QPainter painter(&buffer_);
-        widget_->render(&painter);
-
-        // Set texture to material
-        if (update_internals_ && !material_name_.empty())
-        {
-            Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(material_name_);
-            if (material.isNull())
-                return;
-            // Just for good measure, this is done once in the ctor already if everything went well.
-            OgreRenderer::SetTextureUnitOnMaterial(material, texture_name_);
-            UpdateSubmeshes();
-            update_internals_ = false;
-        }
+    // The widget is painted by the manager even when not running, WidgetCanvasPainted is called back.
+    WidgetCanvasManager *manager = CanvasManager();
+    if (!manager)
+        return;
+    SyncRegistration();
+    manager->Paint(this, true);
+}
 
-        if ((int)texture->getWidth() != buffer_.width() || (int)texture->getHeight() != buffer_.height())
-        {
-            texture->freeInternalResources();
-            texture->setWidth(buffer_.width());
-            texture->setHeight(buffer_.height());
-            texture->createInternalResources();
-        }
+void EC_WidgetCanvas::WidgetCanvasPainted(const QImage &image, const QRegion &changed)
+{
+    if (texture_name_.empty())
+        return;
 
-        Blit(buffer_, texture);
+    try
+    {
+        bool resized = false;
+        Ogre::TexturePtr texture = PrepareTexture(image, resized);
+        if (!texture.isNull())
+            WidgetCanvasManager::Blit(image, resized ? QRegion(image.rect()) : changed, texture);
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -365,46 +294,56 @@ void EC_WidgetCanvas::Update()
     }
 }
 
-bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
+Ogre::TexturePtr EC_WidgetCanvas::PrepareTexture(const QImage &image, bool &resized)
 {
-#if defined(DIRECTX_ENABLED) && defined(WIN32)
-    Ogre::HardwarePixelBufferSharedPtr pb = destination->getBuffer();
-    Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(pb.get());
-    if (!pixelBuffer)
-        return false;
-
-    LPDIRECT3DSURFACE9 surface = pixelBuffer->getSurface(Ogre::D3D9RenderSystem::getActiveD3D9Device());
-    if (surface)
+    resized = false;
+    Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().getByName(texture_name_);
+    if (texture.isNull())
+        return texture;
+
+    // Set texture to material if need be
+    if (update_internals_ && !material_name_.empty())
     {
-        D3DSURFACE_DESC desc;
-        HRESULT hr = surface->GetDesc(&desc);
-        if (SUCCEEDED(hr))
-        {
-            D3DLOCKED_RECT lock;
-            HRESULT hr = surface->LockRect(&lock, 0, 0);
-            if (SUCCEEDED(hr))
-            {
-                const int bytesPerPixel = 4; ///\todo Count from Ogre::PixelFormat!
-                const int sourceStride = bytesPerPixel * source.width();
-                if (lock.Pitch == sourceStride)
-                    memcpy(lock.pBits, source.bits(), sourceStride * source.height());
-                else
-                    for(int y = 0; y < source.height(); ++y)
-                        memcpy((u8*)lock.pBits + lock.Pitch * y, source.bits() + sourceStride * y, sourceStride);
-                surface->UnlockRect();
-            }
-        }
+        Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(material_name_);
+        if (material.isNull())
+            return Ogre::TexturePtr();
+        // Just for good measure, this is done once in the ctor already if everything went well.
+        OgreRenderer::SetTextureUnitOnMaterial(material, texture_name_);
+        UpdateSubmeshes();
+        update_internals_ = false;
     }
-#else
-    if (!destination->getBuffer().isNull())
+
+    if ((int)texture->getWidth() != image.width() || (int)texture->getHeight() != image.height())
     {
-        Ogre::Box update_box(0, 0, source.width(), source.height());
-        Ogre::PixelBox pixel_box(update_box, Ogre::PF_A8R8G8B8, (void*)source.bits());
-        destination->getBuffer()->blitFromMemory(pixel_box, update_box);
+        texture->freeInternalResources();
+        texture->setWidth(image.width());
+        texture->setHeight(image.height());
+        texture->createInternalResources();
+        resized = true;
     }
-#endif
+    return texture;
+}
+
+bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
+{
+    return WidgetCanvasManager::Blit(source, QRegion(source.rect()), destination);
+}
 
-    return true;
+WidgetCanvasManager *EC_WidgetCanvas::CanvasManager() const
+{
+    SceneWidgetComponents *module = framework->Module<SceneWidgetComponents>();
+    return module ? module->CanvasManager() : 0;
+}
+
+void EC_WidgetCanvas::SyncRegistration()
+{
+    WidgetCanvasManager *manager = CanvasManager();
+    if (!manager)
+        return;
+    if (widget_)
+        manager->Register(this, widget_, (running_ && update_interval_msec_ > 0) ? 1000 / update_interval_msec_ : 0);
+    else
+        manager->Unregister(this);
 }
 
 void EC_WidgetCanvas::UpdateSubmeshes()
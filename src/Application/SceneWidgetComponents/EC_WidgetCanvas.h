@@ -4,6 +4,7 @@
 
 #include "SceneWidgetComponentsApi.h"
 #include "IComponent.h"
+#include "WidgetCanvasManager.h"
 
 #include <QMap>
 #include <QImage>
@@ -13,8 +14,6 @@
 
 #include <OgreTexture.h>
 
-class QTimer;
-
 /// Paints UI widgets on to a 3D object surface
 /**
 <table class="header">
@@ -55,8 +54,12 @@ Registered by SceneWidgetComponents plugin.
 Does not emit any actions.
 
 <b>Depends on the component OgreCustomObject and EC_Mesh</b>.
-</table> */
-class SCENEWIDGET_MODULE_API EC_WidgetCanvas : public IComponent
+</table>
+
+The widget is painted by the WidgetCanvasManager of the SceneWidgetComponents module. When started with a non-zero refresh rate,
+the widget is repainted only when it has changed, at most at the refresh rate and less often when the entity is out of view or far away,
+and only the changed area of the texture is uploaded. */
+class SCENEWIDGET_MODULE_API EC_WidgetCanvas : public IComponent, public IWidgetCanvasClient
 {
     Q_OBJECT
     COMPONENT_NAME("WidgetCanvas", 35)
@@ -68,10 +71,17 @@ public:
     /// @endcond
     ~EC_WidgetCanvas();
 
+    /// IWidgetCanvasClient override.
+    void WidgetCanvasPainted(const QImage &image, const QRegion &changed);
+
 public slots:
+    /// Starts painting the widget at the refresh rate, or paints it once if the refresh rate is 0.
     void Start();
+    /// Stops painting the widget.
     void Stop();
+    /// Uploads the given image to the texture.
     void Update(QImage buffer);
+    /// Paints the whole widget immediately.
     void Update();
     void Setup(QWidget *widget, const QList<uint> &submeshes, int refresh_per_second);
     void RestoreOriginalMeshMaterials();
@@ -83,6 +93,7 @@ public slots:
     void SetSelfIllumination(bool illuminating);
 
     QWidget *GetWidget() const { return widget_; }
+    bool IsRunning() const { return running_; }
     int GetRefreshRate() const { return update_interval_msec_; }
     QList<uint> GetSubMeshes() const { return submeshes_; }
 
@@ -101,9 +112,15 @@ private slots:
     void ComponentRemoved(IComponent *component, AttributeChange::Type change);
 
 private:
+    WidgetCanvasManager *CanvasManager() const;
+    /// Registers the widget to the canvas manager with the current refresh rate, or unregisters if there is no widget.
+    void SyncRegistration();
+    /// Resizes the texture to the image size and applies the material to the submeshes if needed. Returns the texture, or null on failure.
+    Ogre::TexturePtr PrepareTexture(const QImage &image, bool &resized);
+
     QPointer<QWidget> widget_;
     QList<uint> submeshes_;
-    QTimer *refresh_timer_;
+    bool running_;
 
     QMap<uint, std::string> restore_materials_;
     std::string material_name_;
@@ -111,7 +128,5 @@ private:
 
     int update_interval_msec_;
     bool update_internals_;
-
-    QImage buffer_;
     bool mesh_hooked_;
 };
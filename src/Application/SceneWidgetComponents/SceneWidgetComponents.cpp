@@ -3,6 +3,7 @@
 #include "SceneWidgetComponents.h"
 #include "EC_WebView.h"
 #include "EC_WidgetBillboard.h"
+#include "WidgetCanvasManager.h"
 #include "EC_Billboard.h"
 
 #include "Framework.h"
@@ -30,7 +31,8 @@
 
 SceneWidgetComponents::SceneWidgetComponents() :
     IModule("SceneWidgetComponents"),
-    networkManager_(0)
+    networkManager_(0),
+    canvasManager_(0)
 {
     Reset();
 }
@@ -44,6 +46,8 @@ void SceneWidgetComponents::Initialize()
     if (framework_->IsHeadless())
         return;
 
+    canvasManager_ = new WidgetCanvasManager(framework_);
+
     processingDelay_.setSingleShot(true);
     connect(&processingDelay_, SIGNAL(timeout()), this, SLOT(ProcessNextRenderingRequestImpl()));
     connect(framework_->Input()->TopLevelInputContext(), SIGNAL(MouseEventReceived(MouseEvent*)), SLOT(OnMouseEvent(MouseEvent*)));
@@ -68,6 +72,13 @@ void SceneWidgetComponents::Uninitialize()
 #endif
 
     SAFE_DELETE(networkManager_)
+    SAFE_DELETE(canvasManager_);
+}
+
+void SceneWidgetComponents::Update(f64 /*frametime*/)
+{
+    if (canvasManager_)
+        canvasManager_->Update();
 }
 
 QImage SceneWidgetComponents::DrawMessageTexture(QString message, bool error)
@@ -22,6 +22,7 @@
 
 class QNetworkAccessManager;
 class QNetworkReply;
+class WidgetCanvasManager;
 
 struct WebRenderRequest
 {
@@ -54,6 +55,12 @@ public:
     /// IModule override.
     virtual void Uninitialize();
 
+    /// IModule override. Runs the widget repaints that are due.
+    virtual void Update(f64 frametime);
+
+    /// Returns the manager painting the widgets of the scene widget components, or null if running headless.
+    WidgetCanvasManager *CanvasManager() const { return canvasManager_; }
+
 public slots:
     void WebRenderingRequest(EC_WebView *client, QUrl url, QSize resolution);
     
@@ -83,4 +90,5 @@ private:
     UniqueIdGenerator idGenerator_;
     QImage buffer_;
     QTimer processingDelay_;
+    WidgetCanvasManager *canvasManager_;
 };
@@ -0,0 +1,485 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "Math/MathNamespace.h"
+
+#include "DebugOperatorNew.h"
+#include "WidgetCanvasManager.h"
+
+#include "Framework.h"
+#include "IRenderer.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "Math/float3.h"
+
+#include "OgreWorld.h"
+#include "EC_Placeable.h"
+
+#include <OgreHardwarePixelBuffer.h>
+
+#include <QPainter>
+#include <QEvent>
+#include <QWebView>
+#include <QWebPage>
+
+#include <algorithm>
+#include <functional>
+
+#if defined(DIRECTX_ENABLED) && defined(WIN32)
+#ifdef SAFE_DELETE
+#undef SAFE_DELETE
+#endif
+#ifdef SAFE_DELETE_ARRAY
+#undef SAFE_DELETE_ARRAY
+#endif
+#include <d3d9.h>
+#include <OgreD3D9RenderSystem.h>
+#include <OgreD3D9HardwarePixelBuffer.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+const float WidgetCanvasManager::cFullRateDistance = 10.f;
+
+/// @cond PRIVATE
+/// Size of the tiles polled widgets are compared in, in pixels.
+static const int cTileSize = 64;
+/// Longest repaint interval the distance of a widget can lead to.
+static const int cMaxIntervalMsec = 1000;
+/// Time after which no more due repaints are started on a frame. At least one repaint is always done.
+static const double cFrameBudgetMsec = 5.0;
+/// If the changed area has more rectangles than this, its bounding rectangle is uploaded instead.
+static const int cMaxUploadRects = 8;
+
+/// Returns a 64-bit FNV-1a style hash of the pixels of a tile of an image.
+static u64 HashTile(const QImage &image, const QRect &tile)
+{
+    u64 hash = 14695981039346656037ULL;
+    for(int y = tile.top(); y <= tile.bottom(); ++y)
+    {
+        const u32 *pixels = reinterpret_cast<const u32*>(image.constScanLine(y)) + tile.left();
+        for(int x = 0; x < tile.width(); ++x)
+            hash = (hash ^ pixels[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static double MsecsBetween(tick_t from, tick_t to)
+{
+    return (double)(to - from) * 1000.0 / (double)GetCurrentClockFreq();
+}
+/// @endcond
+
+WidgetCanvasManager::WidgetCanvasManager(Framework *framework) :
+    framework_(framework)
+{
+}
+
+WidgetCanvasManager::~WidgetCanvasManager()
+{
+    foreach(QObject *widget, widgetClients_.uniqueKeys())
+        widget->removeEventFilter(this);
+}
+
+bool WidgetCanvasManager::Register(IComponent *client, QWidget *widget, int refreshesPerSecond, int flags)
+{
+    IWidgetCanvasClient *canvasClient = dynamic_cast<IWidgetCanvasClient*>(client);
+    if (!canvasClient || !widget)
+    {
+        LogError("WidgetCanvasManager::Register: Null widget or a client that does not implement IWidgetCanvasClient passed!");
+        return false;
+    }
+
+    Canvas &canvas = canvases_[client];
+    if (canvas.widget != widget)
+    {
+        if (canvas.widget)
+        {
+            widgetClients_.remove(canvas.widget, client);
+            if (!widgetClients_.contains(canvas.widget))
+            {
+                canvas.widget->removeEventFilter(this);
+                QWebView *oldWebView = qobject_cast<QWebView*>(canvas.widget);
+                if (oldWebView && oldWebView->page())
+                    oldWebView->page()->disconnect(this);
+            }
+        }
+        QWebView *webView = qobject_cast<QWebView*>(widget);
+        if (!widgetClients_.contains(widget))
+        {
+            widget->installEventFilter(this);
+            connect(widget, SIGNAL(destroyed(QObject*)), SLOT(WidgetDestroyed(QObject*)), Qt::UniqueConnection);
+            if (webView && webView->page())
+            {
+                connect(webView->page(), SIGNAL(repaintRequested(const QRect&)), SLOT(WebPageRepaintRequested(const QRect&)), Qt::UniqueConnection);
+                connect(webView->page(), SIGNAL(scrollRequested(int, int, const QRect&)), SLOT(WebPageScrollRequested(int, int, const QRect&)), Qt::UniqueConnection);
+            }
+        }
+        widgetClients_.insert(widget, client);
+
+        canvas.widget = widget;
+        canvas.webPageDamage = webView && webView->page();
+        canvas.image = QImage();
+        canvas.tileHashes.clear();
+        canvas.damage = QRegion();
+        canvas.dirty = true;
+        canvas.lastPaint = 0;
+    }
+    canvas.client = canvasClient;
+    canvas.component = client;
+    canvas.flags = flags;
+    canvas.intervalMsec = refreshesPerSecond > 0 ? 1000 / refreshesPerSecond : 0;
+    return true;
+}
+
+void WidgetCanvasManager::Unregister(IComponent *client)
+{
+    QHash<IComponent*, Canvas>::iterator iter = canvases_.find(client);
+    if (iter == canvases_.end())
+        return;
+
+    QWidget *widget = iter->widget;
+    if (widget)
+    {
+        widgetClients_.remove(widget, client);
+        if (!widgetClients_.contains(widget))
+        {
+            widget->removeEventFilter(this);
+            QWebView *webView = qobject_cast<QWebView*>(widget);
+            if (webView && webView->page())
+                webView->page()->disconnect(this);
+        }
+    }
+    StopViewTracking(*iter);
+    canvases_.erase(iter);
+}
+
+void WidgetCanvasManager::StopViewTracking(Canvas &canvas)
+{
+    // OgreWorld reference counts the tracking, so this does not affect other users tracking the same entity.
+    EntityPtr entity = canvas.trackedEntity.lock();
+    Scene *scene = entity ? entity->ParentScene() : 0;
+    OgreWorldPtr world = scene ? scene->Subsystem<OgreWorld>() : OgreWorldPtr();
+    if (world)
+        world->StopViewTracking(entity.get());
+    canvas.trackedEntity.reset();
+}
+
+bool WidgetCanvasManager::IsRegistered(IComponent *client) const
+{
+    return canvases_.contains(client);
+}
+
+void WidgetCanvasManager::AddDamage(IComponent *client, const QRegion &region)
+{
+    QHash<IComponent*, Canvas>::iterator iter = canvases_.find(client);
+    if (iter == canvases_.end())
+        return;
+    if (region.isEmpty())
+        iter->dirty = true;
+    else
+        iter->damage += region;
+}
+
+void WidgetCanvasManager::Paint(IComponent *client, bool full)
+{
+    QHash<IComponent*, Canvas>::iterator iter = canvases_.find(client);
+    if (iter != canvases_.end())
+        PaintCanvas(*iter, full);
+}
+
+QImage WidgetCanvasManager::Image(IComponent *client) const
+{
+    QHash<IComponent*, Canvas>::const_iterator iter = canvases_.find(client);
+    return iter != canvases_.end() ? iter->image : QImage();
+}
+
+void WidgetCanvasManager::Update()
+{
+    if (canvases_.isEmpty())
+        return;
+
+    PROFILE(WidgetCanvasManager_Update);
+
+    float3 cameraPos;
+    const float3 *cameraPosPtr = 0;
+    Entity *cameraEntity = framework_->Renderer() ? framework_->Renderer()->MainCamera() : 0;
+    EC_Placeable *cameraPlaceable = cameraEntity ? cameraEntity->GetComponent<EC_Placeable>().get() : 0;
+    if (cameraPlaceable)
+    {
+        cameraPos = cameraPlaceable->WorldPosition();
+        cameraPosPtr = &cameraPos;
+    }
+
+    // Collect the canvases that have changed, or are polled, and whose interval has passed.
+    const tick_t now = GetCurrentClockTime();
+    std::vector<std::pair<double, IComponent*> > due;
+    for(QHash<IComponent*, Canvas>::iterator iter = canvases_.begin(); iter != canvases_.end(); ++iter)
+    {
+        Canvas &canvas = *iter;
+        if (!canvas.widget || !canvas.component || canvas.intervalMsec <= 0)
+            continue;
+        const bool polled = IsPolled(canvas);
+        if (!polled && !canvas.dirty && canvas.damage.isEmpty())
+            continue;
+
+        const int interval = AdaptedInterval(canvas, cameraPosPtr);
+        if (interval < 0)
+            continue;
+        const double elapsed = canvas.lastPaint != 0 ? MsecsBetween(canvas.lastPaint, now) : (double)cMaxIntervalMsec;
+        if (elapsed >= interval)
+            due.push_back(std::make_pair(elapsed / std::max(interval, 1), iter.key()));
+    }
+    if (due.empty())
+        return;
+
+    // Most overdue first, so that all the canvases get their turn when the budget does not allow painting all of them on one frame.
+    std::sort(due.begin(), due.end(), std::greater<std::pair<double, IComponent*> >());
+    for(size_t i = 0; i < due.size(); ++i)
+    {
+        if (i > 0 && MsecsBetween(now, GetCurrentClockTime()) > cFrameBudgetMsec)
+            break;
+        // The client may have unregistered others when called back, look the canvas up again.
+        QHash<IComponent*, Canvas>::iterator iter = canvases_.find(due[i].second);
+        if (iter != canvases_.end())
+            PaintCanvas(*iter, false);
+    }
+}
+
+int WidgetCanvasManager::AdaptedInterval(Canvas &canvas, const float3 *cameraPos)
+{
+    // Never painted canvases are painted right away, so that there is something to show when the entity comes to view.
+    if (canvas.lastPaint == 0)
+        return 0;
+
+    Entity *entity = canvas.component->ParentEntity();
+    EC_Placeable *placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+    if (!placeable)
+        return canvas.intervalMsec;
+
+    // Visibility is known only for entities tracked by OgreWorld, and only when the active camera is in the same scene.
+    Scene *scene = entity->ParentScene();
+    OgreWorldPtr world = scene ? scene->Subsystem<OgreWorld>() : OgreWorldPtr();
+    if (world)
+    {
+        if (canvas.trackedEntity.lock().get() != entity)
+        {
+            StopViewTracking(canvas);
+            world->StartViewTracking(entity);
+            canvas.trackedEntity = entity->shared_from_this();
+        }
+        else if (world->IsActive() && !world->IsEntityVisible(entity))
+            return -1;
+    }
+
+    if (!cameraPos)
+        return canvas.intervalMsec;
+    const float distance = placeable->WorldPosition().Distance(*cameraPos);
+    if (distance <= cFullRateDistance)
+        return canvas.intervalMsec;
+    return std::max(canvas.intervalMsec, std::min(cMaxIntervalMsec, (int)(canvas.intervalMsec * distance / cFullRateDistance)));
+}
+
+void WidgetCanvasManager::PaintCanvas(Canvas &canvas, bool full)
+{
+    QWidget *widget = canvas.widget;
+    if (!widget || !canvas.component || widget->width() <= 0 || widget->height() <= 0)
+        return;
+
+    PROFILE(WidgetCanvasManager_PaintCanvas);
+
+    const QRect bounds = widget->rect();
+    if (canvas.image.size() != widget->size())
+    {
+        canvas.image = QImage(widget->size(), QImage::Format_ARGB32_Premultiplied);
+        canvas.image.fill(0);
+        full = true;
+    }
+
+    // Without a known damaged area the whole widget is painted, and the changes are found by comparing the tiles to the previous paint.
+    const bool polled = IsPolled(canvas);
+    const bool compare = !full && (canvas.dirty || polled);
+    const QRegion painted = (full || compare) ? QRegion(bounds) : (canvas.damage & bounds);
+    canvas.damage = QRegion();
+    canvas.dirty = false;
+    canvas.lastPaint = GetCurrentClockTime();
+    if (painted.isEmpty())
+        return;
+
+    {
+        QPainter painter(&canvas.image);
+        if (canvas.flags & TransparentBackground)
+        {
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            foreach(const QRect &rect, painted.rects())
+                painter.fillRect(rect, Qt::transparent);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            widget->render(&painter, QPoint(), painted, QWidget::DrawChildren);
+        }
+        else
+            widget->render(&painter, QPoint(), painted);
+    }
+
+    QRegion changed = UpdateTileHashes(canvas, painted, compare);
+    if (changed.isEmpty())
+        return;
+    if (changed.rectCount() > cMaxUploadRects)
+        changed = changed.boundingRect();
+
+    // Note: the client may unregister from within the call, do not touch the canvas after it.
+    IWidgetCanvasClient *client = canvas.client;
+    client->WidgetCanvasPainted(canvas.image, changed);
+}
+
+QRegion WidgetCanvasManager::UpdateTileHashes(Canvas &canvas, const QRegion &painted, bool compare)
+{
+    const QImage &image = canvas.image;
+    const int tilesX = (image.width() + cTileSize - 1) / cTileSize;
+    const int tilesY = (image.height() + cTileSize - 1) / cTileSize;
+    if (canvas.tilesX != tilesX || canvas.tilesY != tilesY || canvas.tileHashes.size() != (size_t)(tilesX * tilesY))
+    {
+        // No previous hashes to compare to.
+        canvas.tilesX = tilesX;
+        canvas.tilesY = tilesY;
+        canvas.tileHashes.assign(tilesX * tilesY, 0);
+        compare = false;
+    }
+
+    QRegion changed;
+    const QRect paintedBounds = painted.boundingRect();
+    const int firstX = std::max(0, paintedBounds.left() / cTileSize), lastX = std::min(tilesX - 1, paintedBounds.right() / cTileSize);
+    const int firstY = std::max(0, paintedBounds.top() / cTileSize), lastY = std::min(tilesY - 1, paintedBounds.bottom() / cTileSize);
+    for(int ty = firstY; ty <= lastY; ++ty)
+        for(int tx = firstX; tx <= lastX; ++tx)
+        {
+            const QRect tile = QRect(tx * cTileSize, ty * cTileSize, cTileSize, cTileSize).intersected(image.rect());
+            if (!painted.intersects(tile))
+                continue;
+            u64 &hash = canvas.tileHashes[ty * tilesX + tx];
+            const u64 newHash = HashTile(image, tile);
+            if (compare && newHash != hash)
+                changed += tile;
+            hash = newHash;
+        }
+
+    // With a known damaged area the painted area is exactly what changed.
+    return compare ? changed : painted;
+}
+
+bool WidgetCanvasManager::IsPolled(const Canvas &canvas) const
+{
+    return !(canvas.flags & DamageReported) && !canvas.webPageDamage && canvas.widget && !canvas.widget->isVisible();
+}
+
+void WidgetCanvasManager::AddWidgetDamage(QObject *widget, const QRegion &region)
+{
+    QMultiHash<QObject*, IComponent*>::iterator iter = widgetClients_.find(widget);
+    while(iter != widgetClients_.end() && iter.key() == widget)
+    {
+        QHash<IComponent*, Canvas>::iterator canvas = canvases_.find(iter.value());
+        if (canvas != canvases_.end())
+        {
+            if (region.isEmpty())
+                canvas->dirty = true;
+            else
+                canvas->damage += region;
+        }
+        ++iter;
+    }
+}
+
+bool WidgetCanvasManager::eventFilter(QObject *obj, QEvent *e)
+{
+    switch(e->type())
+    {
+    case QEvent::UpdateRequest:
+    case QEvent::Show:
+    case QEvent::Resize:
+    {
+        // The area that changed is not known, the canvases will compare the next paint to the previous one.
+        AddWidgetDamage(obj, QRegion());
+        break;
+    }
+    default:
+        break;
+    }
+    return false;
+}
+
+void WidgetCanvasManager::WidgetDestroyed(QObject *obj)
+{
+    widgetClients_.remove(obj);
+}
+
+void WidgetCanvasManager::WebPageRepaintRequested(const QRect &rect)
+{
+    QWebPage *page = qobject_cast<QWebPage*>(sender());
+    if (page && page->view())
+        AddWidgetDamage(page->view(), QRegion(rect));
+}
+
+void WidgetCanvasManager::WebPageScrollRequested(int /*dx*/, int /*dy*/, const QRect &rectToScroll)
+{
+    // The whole scrolled area changes. An empty rectangle means the whole view was scrolled.
+    QWebPage *page = qobject_cast<QWebPage*>(sender());
+    if (page && page->view())
+        AddWidgetDamage(page->view(), rectToScroll.isEmpty() ? QRegion(page->view()->rect()) : QRegion(rectToScroll));
+}
+
+bool WidgetCanvasManager::Blit(const QImage &source, const QRegion &region, Ogre::TexturePtr destination)
+{
+    if (destination.isNull() || source.isNull())
+        return false;
+
+    PROFILE(WidgetCanvasManager_Blit);
+
+    const QRect textureRect(0, 0, std::min<int>(source.width(), destination->getWidth()), std::min<int>(source.height(), destination->getHeight()));
+    const QVector<QRect> rects = (region & textureRect).rects();
+    if (rects.isEmpty())
+        return false;
+
+#if defined(DIRECTX_ENABLED) && defined(WIN32)
+    // Copy the rows straight to the surface when the texture has the pixel size of the image, otherwise let Ogre convert them below.
+    const int bytesPerPixel = (int)Ogre::PixelUtil::getNumElemBytes(destination->getFormat());
+    if (bytesPerPixel == source.depth() / 8)
+    {
+        Ogre::HardwarePixelBufferSharedPtr pb = destination->getBuffer();
+        Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(pb.get());
+        if (!pixelBuffer)
+            return false;
+
+        LPDIRECT3DSURFACE9 surface = pixelBuffer->getSurface(Ogre::D3D9RenderSystem::getActiveD3D9Device());
+        if (!surface)
+            return false;
+
+        const int sourceStride = source.bytesPerLine();
+        foreach(const QRect &rect, rects)
+        {
+            RECT lockRect = { rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1 };
+            D3DLOCKED_RECT lock;
+            HRESULT hr = surface->LockRect(&lock, &lockRect, 0);
+            if (FAILED(hr))
+                return false;
+            const int rowBytes = bytesPerPixel * rect.width();
+            const u8 *src = source.constBits() + sourceStride * rect.top() + bytesPerPixel * rect.left();
+            for(int y = 0; y < rect.height(); ++y)
+                memcpy((u8*)lock.pBits + lock.Pitch * y, src + sourceStride * y, rowBytes);
+            surface->UnlockRect();
+        }
+        return true;
+    }
+#endif
+
+    if (destination->getBuffer().isNull())
+        return false;
+
+    Ogre::PixelBox sourceBox(Ogre::Box(0, 0, source.width(), source.height()), Ogre::PF_A8R8G8B8, (void*)source.constBits());
+    foreach(const QRect &rect, rects)
+    {
+        Ogre::Box dirtyBox(rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1);
+        destination->getBuffer()->blitFromMemory(sourceBox.getSubVolume(dirtyBox), dirtyBox);
+    }
+
+    return true;
+}
@@ -0,0 +1,160 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "SceneWidgetComponentsApi.h"
+#include "FrameworkFwd.h"
+#include "SceneFwd.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+#include "Math/MathFwd.h"
+#include "IComponent.h"
+
+#include <QObject>
+#include <QPointer>
+#include <QWidget>
+#include <QImage>
+#include <QRegion>
+#include <QHash>
+
+#include <OgreTexture.h>
+
+#include <vector>
+
+/// Interface of the components that show a widget painted by WidgetCanvasManager.
+class SCENEWIDGET_MODULE_API IWidgetCanvasClient
+{
+public:
+    virtual ~IWidgetCanvasClient() {}
+
+    /// Called when the widget of this client has been painted.
+    /** @param image The widget image in Format_ARGB32_Premultiplied, the same size as the widget.
+        @param changed The area of the image that changed since the last call. Only this area needs to be uploaded to the texture.
+        @note Do not keep a copy of the image, or the next paint will have to detach it. Use WidgetCanvasManager::Image instead. */
+    virtual void WidgetCanvasPainted(const QImage &image, const QRegion &changed) = 0;
+};
+
+/// Paints the widgets of EC_WidgetCanvas, EC_WebView and EC_WidgetBillboard, sharing the work between all of them.
+/** The manager tracks the damage of each registered widget and repaints only the damaged area. Frames without damage are skipped entirely.
+    Qt does not send update events for hidden widgets. The damage of a QWebView, e.g. the off-screen web view of EC_WebView, is taken
+    from the repaintRequested and scrollRequested signals of its page instead. Other hidden widgets are polled: the whole widget
+    is repainted on each scheduled turn and compared to the previous paint tile by tile, so that only the changed tiles are uploaded
+    and unchanged frames are not uploaded at all.
+
+    The repaint rate of each widget adapts to the entity of its component. Widgets of entities that are out of the view of the active camera,
+    as tracked by OgreWorld, are not repainted until they come to view, and widgets further away than cFullRateDistance are repainted
+    at a proportionally lower rate. The repaints that are due on a frame are done most overdue first, until the per-frame time budget runs out.
+
+    Owned by SceneWidgetComponents, see SceneWidgetComponents::CanvasManager. */
+class SCENEWIDGET_MODULE_API WidgetCanvasManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Registration flags.
+    enum CanvasFlags
+    {
+        NoFlags = 0,
+        /// The widget background is not painted, and the damaged area is cleared to transparent before painting.
+        TransparentBackground = 1,
+        /// The client reports the damage of the widget with AddDamage, the widget is never polled.
+        DamageReported = 2
+    };
+
+    explicit WidgetCanvasManager(Framework *framework);
+    ~WidgetCanvasManager();
+
+    /// Registers a client component, or updates its registration.
+    /** @param client The component showing the widget, must implement IWidgetCanvasClient.
+        @param widget The widget to paint.
+        @param refreshesPerSecond The maximum rate at which the widget is repainted when it changes.
+            If 0, the widget is painted only when requested with Paint.
+        @param flags Combination of CanvasFlags.
+        @return True if the client was registered. */
+    bool Register(IComponent *client, QWidget *widget, int refreshesPerSecond, int flags = NoFlags);
+
+    /// Unregisters a client component. The last painted image of the client is released.
+    void Unregister(IComponent *client);
+
+    /// Returns if the client component is registered.
+    bool IsRegistered(IComponent *client) const;
+
+    /// Adds to the damaged area of the client's widget.
+    /** @param region The damaged area in widget coordinates. An empty region marks the widget changed without a known area,
+        in which case the whole widget is repainted and compared to the previous paint. */
+    void AddDamage(IComponent *client, const QRegion &region = QRegion());
+
+    /// Paints the client's widget immediately, regardless of the schedule, and passes the result to the client.
+    /** @param full If true the whole widget is painted and reported changed, otherwise only the damage accumulated so far. */
+    void Paint(IComponent *client, bool full);
+
+    /// Returns the last painted image of the client's widget, or a null image if not painted yet.
+    QImage Image(IComponent *client) const;
+
+    /// Runs the repaints that are due on this frame. Called by SceneWidgetComponents::Update.
+    void Update();
+
+    /// Uploads an area of an image to a texture of the same size.
+    /** Parts of the area outside the texture are ignored. With the D3D9 render system the texture surface is written directly,
+        otherwise through Ogre::HardwarePixelBuffer::blitFromMemory.
+        @param source The image to upload, Format_ARGB32 or Format_ARGB32_Premultiplied.
+        @param region The area to upload.
+        @param destination The target texture, in PF_A8R8G8B8 format.
+        @return True if the area was uploaded. */
+    static bool Blit(const QImage &source, const QRegion &region, Ogre::TexturePtr destination);
+
+    /// Distance in world units up to which the widgets are repainted at their full rate.
+    static const float cFullRateDistance;
+
+private slots:
+    void WidgetDestroyed(QObject *obj);
+    void WebPageRepaintRequested(const QRect &rect);
+    void WebPageScrollRequested(int dx, int dy, const QRect &rectToScroll);
+
+private:
+    /// @cond PRIVATE
+    struct Canvas
+    {
+        Canvas() : client(0), flags(0), intervalMsec(0), dirty(true), webPageDamage(false), lastPaint(0), tilesX(0), tilesY(0) {}
+
+        IWidgetCanvasClient *client;
+        QPointer<IComponent> component;
+        QPointer<QWidget> widget;
+        int flags;
+        int intervalMsec; ///< Minimum interval between repaints, 0 if painted only on request.
+        QImage image; ///< Last painted image of the widget.
+        QRegion damage; ///< Known damaged area since the last paint, in widget coordinates.
+        bool dirty; ///< The widget changed since the last paint, but the damaged area is not known.
+        bool webPageDamage; ///< The widget is a QWebView whose page reports the damage, so it is not polled when hidden.
+        tick_t lastPaint; ///< Time of the last paint, 0 if not painted yet.
+        int tilesX;
+        int tilesY;
+        std::vector<u64> tileHashes; ///< Hash of each tile of the image, row by row.
+        EntityWeakPtr trackedEntity; ///< The entity view tracking was started for.
+    };
+    /// @endcond
+
+    bool eventFilter(QObject *obj, QEvent *e);
+
+    /// Returns if the canvas has to be polled for changes, i.e. the widget is hidden and nothing reports its damage.
+    bool IsPolled(const Canvas &canvas) const;
+
+    /// Adds to the damaged area of all the canvases of a widget.
+    void AddWidgetDamage(QObject *widget, const QRegion &region);
+
+    /// Paints the canvas and passes the changed area to its client.
+    void PaintCanvas(Canvas &canvas, bool full);
+
+    /// Returns the repaint interval of the canvas adapted to the visibility and distance of its entity, or -1 if the canvas should not be painted now.
+    int AdaptedInterval(Canvas &canvas, const float3 *cameraPos);
+
+    /// Stops the view tracking started for the canvas by AdaptedInterval.
+    void StopViewTracking(Canvas &canvas);
+
+    /// Rehashes the tiles of the image the painted region touches, and returns the area of the tiles that changed.
+    QRegion UpdateTileHashes(Canvas &canvas, const QRegion &painted, bool compare);
+
+    Framework *framework_;
+    QHash<IComponent*, Canvas> canvases_;
+    QMultiHash<QObject*, IComponent*> widgetClients_; ///< Clients of each widget, for looking up the canvases in eventFilter.
+};
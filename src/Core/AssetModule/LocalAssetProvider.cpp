@@ -28,6 +28,16 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+bool IsVersionControlPath(const QString &path)
+{
+    return path.contains(".git") || path.contains(".svn") || path.contains(".hg");
+}
+
+}
+
 LocalAssetProvider::LocalAssetProvider(Framework* framework_) :
     framework(framework_)
 {
@@ -248,6 +258,7 @@ LocalAssetStoragePtr LocalAssetProvider::AddStorageDirectory(QString directory,
     storage->name = storageName;
     storage->recursive = recursive;
     storage->provider = shared_from_this();
+    storage->StartScan(); // Build the filename index on the background. Note: it's important that recursive is set before calling this!
 // On Android, we get spurious file change notifications. Disable watcher for now.
 #ifndef ANDROID
     storage->SetupWatcher(); // Start listening on file change notifications. Note: it's important that recursive is set before calling this!
@@ -635,7 +646,6 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
                                 LogInfo("New file " + file + " added to storage " + storage->ToString());
                                 storage->changeWatcher->addPath(file);
                                 storage->EmitAssetChanged(file, IAssetStorage::AssetCreate);
-                                break;
                             }
                     }
                     //else if(if (currentFiles.size() > oldFiles.size())
@@ -730,6 +740,29 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
                         }
 */
                     }
+
+                    // Was new directory added? Its contents are not on the watch list, so add them and the files in them.
+                    if (storage->recursive)
+                    {
+                        const QStringList currentDirs = DirectorySearch(path, false, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+                        foreach(const QString &dir, currentDirs)
+                        {
+                            if (qFind(watchedDirs, dir) != watchedDirs.end() || IsVersionControlPath(dir))
+                                continue;
+                            LogInfo("New directory " + dir + " added to storage " + storage->ToString());
+                            storage->changeWatcher->addPath(dir);
+                            foreach(const QString &subdir, DirectorySearch(dir, true, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+                                if (!IsVersionControlPath(subdir))
+                                    storage->changeWatcher->addPath(subdir);
+                            foreach(const QString &file, DirectorySearch(dir, true, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+                            {
+                                if (IsVersionControlPath(file))
+                                    continue;
+                                storage->changeWatcher->addPath(file);
+                                storage->EmitAssetChanged(file, IAssetStorage::AssetCreate);
+                            }
+                        }
+                    }
                 }
 
                 //LogInfo("Refreshing storage \"" + storage->Name() + "\".");
@@ -13,77 +13,250 @@
 
 #include <QFileSystemWatcher>
 #include <QDir>
+#include <QDirIterator>
+#include <QSet>
+#include <QtConcurrentMap>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+const int cRescanIntervalMsecs = 5000; ///< How often a lookup missing the index may start a background rescan at most.
+
+bool IsVersionControlPath(const QString &path)
+{
+    return path.contains(".git") || path.contains(".svn") || path.contains(".hg");
+}
+
+QString LocalNameFromPath(const QString &path)
+{
+    int lastSlash = path.lastIndexOf('/');
+    return lastSlash != -1 ? path.right(path.length() - lastSlash - 1) : path;
+}
+
+/// Recursively collects all directories and files under dir. Run in a worker thread, one call per storage subdirectory.
+LocalAssetStorageScan ScanDirectoryTree(const QString &dir)
+{
+    LocalAssetStorageScan result;
+    if (IsVersionControlPath(dir))
+        return result;
+    result.dirs << dir;
+    QDirIterator it(dir, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while(it.hasNext())
+    {
+        QString path = it.next();
+        if (IsVersionControlPath(path))
+            continue;
+        if (it.fileInfo().isDir())
+            result.dirs << path;
+        else
+            result.files << path;
+    }
+    result.files.sort();
+    return result;
+}
+
+void MergeDirectoryScans(LocalAssetStorageScan &result, const LocalAssetStorageScan &partial)
+{
+    result.dirs += partial.dirs;
+    result.files += partial.files;
+}
+
+}
+
 LocalAssetStorage::LocalAssetStorage(bool writable_, bool liveUpdate_, bool autoDiscoverable_) :
     recursive(true),
-    changeWatcher(0)
+    changeWatcher(0),
+    scanStarted(false),
+    scanApplied(false),
+    indexBuilt(false),
+    watchListComplete(false),
+    lastScanTime(0)
 {
     // Override the parameters for the base class.
     writable = writable_;
     liveUpdate = liveUpdate_;
     autoDiscoverable = autoDiscoverable_;
+
+    connect(&scanWatcher, SIGNAL(finished()), SLOT(OnScanFinished()));
 }
 
 LocalAssetStorage::~LocalAssetStorage()
 {
+    scan.waitForFinished();
     RemoveWatcher();
 }
 
-void LocalAssetStorage::LoadAllAssetsOfType(AssetAPI *assetAPI, const QString &suffix, const QString &assetType)
+void LocalAssetStorage::StartScan()
 {
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if ((suffix == "" || str.endsWith(suffix)) && !(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
-        {
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            assetAPI->RequestAsset("local://" + str, assetType);
-        }
+    // Wait for a possible earlier scan so that it cannot overwrite the new result.
+    scan.waitForFinished();
+    scanStarted = true;
+    scanApplied = false;
+    lastScanTime = GetCurrentClockTime();
+    changesDuringScan.clear();
+
+    // List the storage root here and scan each subdirectory tree in parallel on the global thread pool.
+    rootFiles.clear();
+    QStringList subdirs;
+    QDirIterator it(directory, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    while(it.hasNext())
+    {
+        QString path = it.next();
+        if (IsVersionControlPath(path))
+            continue;
+        if (!it.fileInfo().isDir())
+            rootFiles << path;
+        else if (recursive)
+            subdirs << path;
+    }
+    // Merge the subdirectory scans in a fixed order, so that the same file of ambiguous ones always ends up in the index.
+    rootFiles.sort();
+    subdirs.sort();
+
+    scan = QtConcurrent::mappedReduced(subdirs, ScanDirectoryTree, MergeDirectoryScans, QtConcurrent::OrderedReduce | QtConcurrent::SequentialReduce);
+    scanWatcher.setFuture(scan);
 }
 
-void LocalAssetStorage::RefreshAssetRefs()
+void LocalAssetStorage::WaitForScan()
 {
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if (!(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
+    if (indexBuilt)
+        return;
+    if (!scanStarted)
+        StartScan();
+    PROFILE(LocalAssetStorage_WaitForScan);
+    scan.waitForFinished();
+    OnScanFinished();
+}
+
+void LocalAssetStorage::RequestRescan()
+{
+    // A scan in progress picks the file up, if it exists.
+    if (!scanApplied)
+        return;
+    if (GetCurrentClockTime() - lastScanTime < GetCurrentClockFreq() * cRescanIntervalMsecs / 1000)
+        return;
+    LogDebug("LocalAssetStorage: Rescanning " + ToString() + " on the background for files missing from the index.");
+    StartScan();
+}
+
+void LocalAssetStorage::OnScanFinished()
+{
+    // Already applied by a WaitForScan call, or the finished signal belongs to an earlier scan.
+    if (!scanStarted || scanApplied || !scan.isFinished())
+        return;
+    scanApplied = true;
+
+    LocalAssetStorageScan result;
+    if (scan.resultCount() > 0)
+        result = scan.result();
+    result.files += rootFiles;
+
+    std::map<QString, QString, QStringLessThanNoCase> previousFiles;
+    previousFiles.swap(cachedFiles);
+    foreach(const QString &file, result.files)
+        AddToIndex(file);
+    for(int i = 0; i < changesDuringScan.size(); ++i)
+        ApplyToIndex(changesDuringScan[i].first, changesDuringScan[i].second);
+    changesDuringScan.clear();
+    const bool rescan = indexBuilt;
+    indexBuilt = true;
+
+    if (changeWatcher)
+    {
+        // After the first scan only the paths the watcher has missed need to be added.
+        QStringList newDirs, newFiles;
+        if (watchListComplete)
         {
-            QString diskSource = str;
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            QString localName = str;
-            str.prepend("local://");
-            if (!assetRefs.contains(str))
+            const QSet<QString> watchedDirs = changeWatcher->directories().toSet();
+            foreach(const QString &dir, result.dirs)
+                if (!watchedDirs.contains(dir))
+                    newDirs << dir;
+            foreach(const QString &file, result.files)
             {
-                assetRefs.append(str);
-                emit AssetChanged(localName, diskSource, IAssetStorage::AssetCreate);
+                std::map<QString, QString, QStringLessThanNoCase>::const_iterator iter = previousFiles.find(LocalNameFromPath(file));
+                if (iter == previousFiles.end() || iter->second != file)
+                    newFiles << file;
             }
         }
+        const QStringList &dirs = watchListComplete ? newDirs : result.dirs;
+        const QStringList &files = watchListComplete ? newFiles : result.files;
+#ifndef Q_WS_MAC
+        if (!dirs.isEmpty())
+            changeWatcher->addPaths(dirs);
+        if (!files.isEmpty())
+            changeWatcher->addPaths(files);
+#endif
+        watchListComplete = true;
+        LogDebug("Total of " + QString::number(dirs.size() + files.size()) + " dirs and files added to watch list.");
+    }
+    else if (rescan)
+        LogDebug("LocalAssetStorage: Rescanned " + ToString() + ".");
 }
 
-void LocalAssetStorage::CacheStorageContents()
+void LocalAssetStorage::AddToIndex(const QString &diskSource)
 {
-    cachedFiles.clear();
-
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if (!(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
-        {
-            QString diskSource = str;
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            QString localName = str;
+    QString localName = LocalNameFromPath(diskSource);
 
 ///\todo This is an often-received error condition if the user is not aware, but also occurs naturally in built-in Ogre Media storages.
 /// Fix this check to occur somehow nicer (without additional constraints to asset load time) without a hardcoded check
 /// against the storage name.
-            if (Name() != "Ogre Media" && cachedFiles.find(localName) != cachedFiles.end())
-                LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + cachedFiles[localName] + "\" and \"" + diskSource + "\" in two different subdirectories!");
+    std::map<QString, QString, QStringLessThanNoCase>::iterator iter = cachedFiles.find(localName);
+    if (iter != cachedFiles.end())
+    {
+        if (Name() != "Ogre Media" && iter->second != diskSource)
+            LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + iter->second + "\" and \"" + diskSource + "\" in two different subdirectories!");
+        iter->second = diskSource;
+    }
+    else
+        cachedFiles[localName] = diskSource;
+}
 
-            cachedFiles[localName] = diskSource;
+void LocalAssetStorage::ApplyToIndex(const QString &diskSource, IAssetStorage::ChangeType change)
+{
+    if (change == IAssetStorage::AssetCreate)
+        AddToIndex(diskSource);
+    else if (change == IAssetStorage::AssetDelete)
+    {
+        std::map<QString, QString, QStringLessThanNoCase>::iterator iter = cachedFiles.find(LocalNameFromPath(diskSource));
+        if (iter != cachedFiles.end() && iter->second == diskSource)
+            cachedFiles.erase(iter);
+    }
+}
+
+void LocalAssetStorage::LoadAllAssetsOfType(AssetAPI *assetAPI, const QString &suffix, const QString &assetType)
+{
+    WaitForScan();
+    for(std::map<QString, QString, QStringLessThanNoCase>::const_iterator iter = cachedFiles.begin(); iter != cachedFiles.end(); ++iter)
+        if (suffix == "" || iter->first.endsWith(suffix))
+            assetAPI->RequestAsset("local://" + iter->first, assetType);
+}
+
+void LocalAssetStorage::RefreshAssetRefs()
+{
+    WaitForScan();
+
+    QSet<QString> knownRefs = assetRefs.toSet();
+    for(std::map<QString, QString, QStringLessThanNoCase>::const_iterator iter = cachedFiles.begin(); iter != cachedFiles.end(); ++iter)
+    {
+        QString ref = "local://" + iter->first;
+        if (!knownRefs.contains(ref))
+        {
+            knownRefs.insert(ref);
+            assetRefs.append(ref);
+            emit AssetChanged(iter->first, iter->second, IAssetStorage::AssetCreate);
         }
+    }
+}
+
+void LocalAssetStorage::CacheStorageContents()
+{
+    StartScan();
+    PROFILE(LocalAssetStorage_CacheStorageContents);
+    scan.waitForFinished();
+    OnScanFinished();
 }
 
 QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool recursiveLookup)
@@ -92,16 +265,8 @@ QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool re
     if (QFile::exists(dir.absolutePath()))
         return directory;
 
+    WaitForScan();
     std::map<QString, QString, QStringLessThanNoCase>::iterator iter = cachedFiles.find(assetname);
-    if (iter == cachedFiles.end())
-    {
-        if (!recursive || !recursiveLookup)
-            return "";
-        else
-            CacheStorageContents();
-    }
-
-    iter = cachedFiles.find(assetname);
     if (iter != cachedFiles.end())
     {
         QFileInfo file(iter->second);
@@ -109,6 +274,10 @@ QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool re
             return file.dir().path();
     }
 
+    // The change notifications are not available e.g. on Mac or in storages that are not auto-discoverable,
+    // so the file may still exist. Do not block the lookup, the requests made after the rescan find the file.
+    if (recursive && recursiveLookup)
+        RequestRescan();
     return "";
 }
 
@@ -138,14 +307,18 @@ QString LocalAssetStorage::SerializeToString(bool networkTransfer) const
 
 void LocalAssetStorage::EmitAssetChanged(QString absoluteFilename, IAssetStorage::ChangeType change)
 {
-    QString localName;
-    int lastSlash = absoluteFilename.lastIndexOf('/');
-    if (lastSlash != -1)
-        localName = absoluteFilename.right(absoluteFilename.length() - lastSlash - 1);
+    QString localName = LocalNameFromPath(absoluteFilename);
     QString assetRef = "local://" + localName;
     if (assetRefs.contains(assetRef) && change == IAssetStorage::AssetCreate)
         LogDebug("LocalAssetStorage::EmitAssetChanged: Emitting AssetCreate signal for already existing asset " + assetRef +
             ", file " + absoluteFilename + ". Asset was probably removed and then added back.");
+
+    // Keep the filename index current so that lookups of the changed files need not rescan the storage.
+    if (indexBuilt)
+        ApplyToIndex(absoluteFilename, change);
+    if (!scanApplied)
+        changesDuringScan.append(qMakePair(absoluteFilename, change));
+
     emit AssetChanged(localName, absoluteFilename, change);
 }
 
@@ -155,6 +328,7 @@ void LocalAssetStorage::SetupWatcher()
         RemoveWatcher();
 
     changeWatcher = new QFileSystemWatcher();
+    watchListComplete = false;
 
     // Add directory contents to watch list.
     if (recursive)
@@ -163,18 +337,19 @@ void LocalAssetStorage::SetupWatcher()
         QString installDir = QDir::toNativeSeparators(Application::InstallationDirectory());
         QString watchAbsPath = QDir::toNativeSeparators(QDir(directory).absolutePath());
         QString watchDirPath = (watchAbsPath.startsWith(installDir) ? QString(".%1%2").arg(QDir::separator()).arg(watchAbsPath.mid(installDir.length())) : watchAbsPath);
-        LogInfo("LocalAssetStorage: Recursively adding all files from " + watchDirPath + " to a watch list. This may take a while...");
+        LogInfo("LocalAssetStorage: Recursively adding all files from " + watchDirPath + " to a watch list.");
     }
     else
         LogDebug("LocalAssetStorage: Adding " + directory + " recursive=" + BoolToString(recursive));
 
-    QStringList paths = DirectorySearch(directory, recursive, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
 #ifndef Q_WS_MAC
     changeWatcher->addPath(QDir::fromNativeSeparators(directory));
-    changeWatcher->addPaths(paths);
 #endif
 
-    LogDebug("Total of " + QString::number(paths.count()) + " dirs and files added to watch list.");
+    // The rest of the storage contents are added once the background scan completes.
+    // If the scan is already done, the directories are not known anymore, so rescan.
+    if (scanApplied)
+        StartScan();
 }
 
 void LocalAssetStorage::RemoveWatcher()
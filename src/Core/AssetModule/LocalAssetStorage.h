@@ -5,12 +5,27 @@
 #include "AssetModuleApi.h"
 #include "IAssetStorage.h"
 #include "CoreStringUtils.h"
+#include "HighPerfClock.h"
 
 #include <QMap>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QStringList>
+#include <QList>
+#include <QPair>
 
 class QFileSystemWatcher;
 class AssetAPI;
 
+/// @cond PRIVATE
+/// Result of a background directory scan of a LocalAssetStorage.
+struct LocalAssetStorageScan
+{
+    QStringList dirs;
+    QStringList files;
+};
+/// @endcond
+
 /// Represents a single (possibly recursive) directory on the local file system.
 class ASSET_MODULE_API LocalAssetStorage : public IAssetStorage
 {
@@ -30,7 +45,16 @@ public:
     /// If true, all subdirectories of the storage directory are automatically looked in when loading an asset.
     bool recursive;
     
+    /// Starts scanning the storage directory on the background, in parallel over the subdirectories.
+    /** The resulting filename index is used for all lookups. Lookups done before the first scan completes wait for it,
+        later scans replace the index when they complete.
+        @note Set directory and recursive before calling this. */
+    void StartScan();
+
     /// Starts listening on the local directory this asset storage points to.
+    /** The contents of the storage are added to the watch list once the background scan completes.
+        From there on the filename index is kept current from the change notifications. The notifications are not available
+        on all platforms, so a lookup that misses the index starts a background rescan, at most once in cRescanIntervalMsecs. */
     void SetupWatcher();
 
     /// Stops and deallocates the directory change listener.
@@ -85,12 +109,57 @@ public slots:
     void EmitAssetChanged(QString absoluteFilename, IAssetStorage::ChangeType change);
 
     /// Walks through this storage on disk and creates a cached index of all the filenames inside this storage.
+    /** Rescans the whole storage and blocks until done. Lookups use the index kept current by the watcher instead. */
     void CacheStorageContents();
 
+private slots:
+    /// Applies the background scan result when it completes.
+    void OnScanFinished();
+
 private:
     friend class LocalAssetProvider;
 
+    /// Blocks until the filename index has been built by the first background scan.
+    void WaitForScan();
+
+    /// Starts a background rescan for a file missing from the index, unless one is in progress or was started recently.
+    void RequestRescan();
+
+    /// Adds an absolute filename to the filename index.
+    void AddToIndex(const QString &diskSource);
+
+    /// Updates the filename index for a change notification.
+    void ApplyToIndex(const QString &diskSource, IAssetStorage::ChangeType change);
+
+    /// Background scan of the storage directory.
+    QFuture<LocalAssetStorageScan> scan;
+
+    /// Notifies when the background scan completes.
+    QFutureWatcher<LocalAssetStorageScan> scanWatcher;
+
+    /// Files directly in the storage root directory, found while starting the scan.
+    QStringList rootFiles;
+
+    /// Has a scan been started.
+    bool scanStarted;
+
+    /// Has the result of the latest scan been applied to the index.
+    bool scanApplied;
+
+    /// Has the index been built, i.e. the result of any scan been applied.
+    bool indexBuilt;
+
+    /// Have the storage contents been added to the watch list of the current watcher. If so, a rescan adds only the new paths.
+    bool watchListComplete;
+
+    /// When the latest scan was started.
+    tick_t lastScanTime;
+
+    /// The changes notified while a rescan is in progress, reapplied on top of its result as the scan may have missed them.
+    QList<QPair<QString, IAssetStorage::ChangeType> > changesDuringScan;
+
     /// Maps a file basename 'asset.mesh' to its full path 'c:\project\assets\asset.mesh'.
     /// Used to quickly lookup known assets by basename instead of having to do an expensive recursive directory search.
+    /// Built by the background scan and kept up to date by EmitAssetChanged.
     std::map<QString, QString, QStringLessThanNoCase> cachedFiles;
 };
@@ -4,6 +4,7 @@
 #include "DebugOperatorNew.h"
 
 #include "EC_Terrain.h"
+#include "TerrainPatchGeometry.h"
 #include "CoreException.h"
 #include "BinaryAsset.h"
 #include "Renderer.h"
@@ -21,15 +22,32 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "FrameAPI.h"
+#include "HighPerfClock.h"
+#include "TerrainTileFile.h"
 
 #include <Ogre.h>
+#include <QFile>
 #include <utility>
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
 using namespace std;
 using namespace OgreRenderer;
 
+namespace
+{
+
+/// The time spent uploading generated patch geometry to the GPU per frame, in milliseconds.
+const int cPatchUploadMsecsPerFrame = 2;
+
+/// The GPU geometry of a streamed patch is kept until it is this many times the streaming distance away, so that moving back
+/// and forth over the edge of the range does not regenerate it over and over.
+const float cStreamingUnloadScale = 1.25f;
+
+} // ~unnamed namespace
+
 EC_Terrain::EC_Terrain(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE(nodeTransformation, "Transform"),
@@ -41,12 +59,25 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(vScale, "Tex. V scale", 0.13f),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    rootNode(0),
+    patchGeometry(0),
+    lastGeometryRevision(0),
+    streamingDistance(0.f),
+    streamingCenterX(0.f),
+    streamingCenterY(0.f),
+    streamingRadius(0.f),
+    streamingCenterValid(false),
+    streamedPatchesDirty(false),
+    changedMinX(1),
+    changedMinY(1),
+    changedMaxX(0),
+    changedMaxY(0)
 {
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 
     patches.resize(1);
-    MakePatchFlat(0, 0, 0.f);
+    heights = MAKE_SHARED(std::vector<float>, cPatchSize * cPatchSize, 0.f);
+    FillPatch(0, 0, 0.f);
 
     heightMapAsset = MAKE_SHARED(AssetRefListener);
     connect(heightMapAsset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(TerrainAssetLoaded(AssetPtr)));
@@ -55,6 +86,7 @@ EC_Terrain::EC_Terrain(Scene* scene) :
 EC_Terrain::~EC_Terrain()
 {
     Destroy();
+    SAFE_DELETE(patchGeometry);
 }
 
 void EC_Terrain::UpdateSignals()
@@ -68,21 +100,81 @@ void EC_Terrain::UpdateSignals()
 
         world_ = ParentScene()->Subsystem<OgreWorld>();
     }
+    if (framework && !framework->IsHeadless())
+        connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(UpdatePatchGeometry()), Qt::UniqueConnection);
 }
 
 void EC_Terrain::MakePatchFlat(uint x, uint y, float heightValue)
+{
+    emit HeightsAboutToChange();
+    FillPatch(x, y, heightValue);
+}
+
+void EC_Terrain::FillPatch(uint x, uint y, float heightValue)
 {
     Patch &patch = GetPatch(x, y);
-    patch.heightData.clear();
-    patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
+    for(uint i = 0; i < cPatchSize; ++i)
+    {
+        float *row = &Height(x * cPatchSize, y * cPatchSize + i);
+        std::fill(row, row + cPatchSize, heightValue);
+    }
     patch.patch_geometry_dirty = true;
+    MarkHeightsChanged(x, y, x, y);
+    patch.minHeight = patch.maxHeight = heightValue;
+    patch.heightRangeDirty = false;
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
 {
-    for(uint y = 0; y < this->yPatches.Get(); ++y)
-        for(uint x = 0; x < this->xPatches.Get(); ++x)
-            MakePatchFlat(x, y, heightValue);
+    emit HeightsAboutToChange();
+    for(uint y = 0; y < this->yPatches.Get() && y < patchHeight; ++y)
+        for(uint x = 0; x < this->xPatches.Get() && x < patchWidth; ++x)
+            FillPatch(x, y, heightValue);
+}
+
+void EC_Terrain::MarkHeightsChanged(uint firstPatchX, uint firstPatchY, uint lastPatchX, uint lastPatchY)
+{
+    for(uint y = firstPatchY; y <= lastPatchY; ++y)
+        for(uint x = firstPatchX; x <= lastPatchX; ++x)
+            GetPatch(x, y).heightRangeDirty = true;
+
+    if (changedMinX > changedMaxX)
+    {
+        changedMinX = firstPatchX;
+        changedMinY = firstPatchY;
+        changedMaxX = lastPatchX;
+        changedMaxY = lastPatchY;
+    }
+    else
+    {
+        changedMinX = min(changedMinX, firstPatchX);
+        changedMinY = min(changedMinY, firstPatchY);
+        changedMaxX = max(changedMaxX, lastPatchX);
+        changedMaxY = max(changedMaxY, lastPatchY);
+    }
+}
+
+void EC_Terrain::ReallocateHeights(uint newPatchWidth, uint newPatchHeight, uint oldPatchStartX, uint oldPatchStartY)
+{
+    const uint newVerticesWidth = newPatchWidth * cPatchSize;
+    shared_ptr<std::vector<float> > newHeights = MAKE_SHARED(std::vector<float>, newVerticesWidth * newPatchHeight * cPatchSize, 0.f);
+
+    // Copy the overlapping rows. The patches of the old array are left as they are, as whoever still refers to it may be reading them.
+    if (oldPatchStartX < patchWidth && oldPatchStartY < patchHeight)
+    {
+        const uint copyWidth = min(newPatchWidth, patchWidth - oldPatchStartX) * cPatchSize;
+        const uint copyHeight = min(newPatchHeight, patchHeight - oldPatchStartY) * cPatchSize;
+        for(uint y = 0; y < copyHeight; ++y)
+        {
+            const float *src = &Height(oldPatchStartX * cPatchSize, oldPatchStartY * cPatchSize + y);
+            std::copy(src, src + copyWidth, &(*newHeights)[y * newVerticesWidth]);
+        }
+    }
+
+    heights = newHeights;
+    // The pending changes refer to the old layout, and the new array is new to everyone anyway.
+    changedMinX = changedMinY = 1;
+    changedMaxX = changedMaxY = 0;
 }
 
 void EC_Terrain::ResizeTerrain(uint newPatchWidth, uint newPatchHeight)
@@ -120,7 +212,9 @@ void EC_Terrain::ResizeTerrain(uint newPatchWidth, uint newPatchHeight)
     for(uint y = 0; y < min(patchHeight, newPatchHeight); ++y)
         for(uint x = 0; x < min(patchWidth, newPatchWidth); ++x)
             newPatches[y * newPatchWidth + x] = GetPatch(x, y);
+    ReallocateHeights(newPatchWidth, newPatchHeight, 0, 0);
     patches = newPatches;
+    streamedPatchesDirty = true;
     uint oldPatchWidth = patchWidth;
     uint oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
@@ -132,10 +226,10 @@ void EC_Terrain::ResizeTerrain(uint newPatchWidth, uint newPatchHeight)
 
     for(uint y = oldPatchHeight; y < newPatchHeight; ++y)
         for(uint x = 0; x < patchWidth; ++x)
-            MakePatchFlat(x, y, initialPatchHeight);
+            FillPatch(x, y, initialPatchHeight);
     for(uint x = oldPatchWidth; x < newPatchWidth; ++x) // We have some overlap here with above, but it's ok since DestroyPatch is benign.
         for(uint y = 0; y < patchHeight; ++y)
-            MakePatchFlat(x, y, initialPatchHeight);
+            FillPatch(x, y, initialPatchHeight);
 
     // Tell each patch which coordinate in the grid they lie in.
     for(uint y = 0; y < patchHeight; ++y)
@@ -245,6 +339,7 @@ void EC_Terrain::DestroyPatch(uint x, uint y)
     Ogre::SceneManager *sceneMgr = world_.lock()->OgreSceneManager();
     
     EC_Terrain::Patch &patch = GetPatch(x, y);
+    patch.geometryRevision = 0; // Discard the geometry being generated for the patch.
 
     if (patch.node)
     {
@@ -273,6 +368,11 @@ void EC_Terrain::DestroyPatch(uint x, uint y)
 
 void EC_Terrain::Destroy()
 {
+    // The geometry being generated is for the patches that are destroyed.
+    if (patchGeometry)
+        patchGeometry->Clear();
+    streamedPatchesDirty = true;
+
     for(uint y = 0; y < patchHeight; ++y)
         for(uint x = 0; x < patchWidth; ++x)
             DestroyPatch(x, y);
@@ -294,7 +394,7 @@ float EC_Terrain::GetPoint(uint x, uint y) const
     if (y >= cPatchSize * patchHeight)
         y = cPatchSize * patchHeight - 1;
 
-    return GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
+    return (*heights)[y * VerticesWidth() + x];
 }
 
 void EC_Terrain::SetPointHeight(uint x, uint y, float height)
@@ -302,7 +402,17 @@ void EC_Terrain::SetPointHeight(uint x, uint y, float height)
     if (x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    emit HeightsAboutToChange();
+    WriteHeight(x, y, height);
+}
+
+void EC_Terrain::WriteHeight(uint x, uint y, float height)
+{
+    if (x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
+        return;
+
+    Height(x, y) = height;
+    MarkHeightsChanged(x / cPatchSize, y / cPatchSize, x / cPatchSize, y / cPatchSize);
 }
 
 float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
@@ -558,13 +668,11 @@ bool EC_Terrain::SaveToFile(QString filename)
 
     assert(sizeof(float) == 4);
 
-    for(u32 i = 0; i < xPatches*yPatches; ++i)
-    {
-        if (patches[i].heightData.size() < cPatchSize*cPatchSize)
-            patches[i].heightData.resize(cPatchSize*cPatchSize);
-
-        fwrite(&patches[i].heightData[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
-    }
+    // The file stores the height values patch by patch.
+    for(u32 y = 0; y < yPatches; ++y)
+        for(u32 x = 0; x < xPatches; ++x)
+            for(uint i = 0; i < cPatchSize; ++i)
+                fwrite(&Height(x * cPatchSize, y * cPatchSize + i), sizeof(float), cPatchSize, handle); ///< \todo Check read error.
     fflush(handle);
     if (ferror(handle))
     LogError("Write error in SaveToFile");
@@ -573,6 +681,21 @@ bool EC_Terrain::SaveToFile(QString filename)
     return true;
 }
 
+bool EC_Terrain::SaveToTiledFile(QString filename, uint tileSize, bool quantized, bool compressed)
+{
+    if (patchWidth * patchHeight != (int)patches.size())
+    {
+        LogError("The EC_Terrain is in inconsistent state. Cannot save.");
+        return false;
+    }
+    u32 flags = 0;
+    if (quantized)
+        flags |= TerrainTileFile::TileQuantized;
+    if (compressed)
+        flags |= TerrainTileFile::TileCompressed;
+    return TerrainTileFile::Save(filename, *heights, patchWidth, patchHeight, tileSize, flags);
+}
+
 u32 ReadU32(const char *dataPtr, size_t numBytes, int &offset)
 {
     if (offset + 4 > (int)numBytes)
@@ -586,12 +709,28 @@ bool EC_Terrain::LoadFromFile(QString filename)
 {
     filename = filename.trimmed();
 
-    std::vector<u8> file;
-    LoadFileToVector(filename, file);
+    // Map the file instead of reading it to memory first, so that it is decoded straight from the file cache of the OS.
+    QFile file(filename);
+    if (file.open(QIODevice::ReadOnly) && file.size() > 0)
+    {
+        uchar *data = file.map(0, file.size());
+        if (data)
+        {
+            bool success = LoadFromDataInMemory((const char *)data, (size_t)file.size());
+            file.unmap(data);
+            if (success)
+                currentHeightmapAssetSource = filename;
+            return success;
+        }
+    }
+    file.close();
+
+    std::vector<u8> fileData;
+    LoadFileToVector(filename, fileData);
 
-    if (file.size() > 0)
+    if (fileData.size() > 0)
     {
-        bool success = LoadFromDataInMemory((const char *)&file[0], file.size());
+        bool success = LoadFromDataInMemory((const char *)&fileData[0], fileData.size());
         if (success)
             currentHeightmapAssetSource = filename;
         return success;
@@ -601,42 +740,77 @@ bool EC_Terrain::LoadFromFile(QString filename)
 
 bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
 {
-    int offset = 0;
-    u32 xPatches = ReadU32(data, numBytes, offset);
-    u32 yPatches = ReadU32(data, numBytes, offset);
-
-    // Load all the data from the file to an intermediate buffer first, so that we can first see
+    // Load all the data from the file to a new height array first, so that we can first see
     // if the file is not broken, and reject it without losing the old terrain.
-    std::vector<Patch> newPatches(xPatches*yPatches);
-
-    // Initialize the new height data structure.
-    for(u32 y = 0; y < yPatches; ++y)
-        for(u32 x = 0; x < xPatches; ++x)
-        {
-            newPatches[y*xPatches+x].x = x;
-            newPatches[y*xPatches+x].y = y;
-        }
+    u32 xPatches = 0;
+    u32 yPatches = 0;
+    shared_ptr<std::vector<float> > newHeights;
 
     assert(sizeof(float) == 4);
 
-    // Load the new data.
-    for(size_t i = 0; i < newPatches.size(); ++i)
+    if (TerrainTileFile::IsTiledFormat(data, numBytes))
     {
-        newPatches[i].heightData.resize(cPatchSize*cPatchSize);
-        newPatches[i].patch_geometry_dirty = true;
-        if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
+        // The tiled format is decoded tile by tile to the rows of the whole terrain. Open limits the size to cMaxVertices.
+        TerrainTileFile tileFile;
+        if (!tileFile.Open(data, numBytes))
+            return false;
+        xPatches = tileFile.PatchWidth();
+        yPatches = tileFile.PatchHeight();
+        const size_t newVerticesWidth = xPatches * cPatchSize;
+        const size_t tileVertices = tileFile.TileSize() * cPatchSize;
+        newHeights = MAKE_SHARED(std::vector<float>, newVerticesWidth * yPatches * cPatchSize);
+        for(uint y = 0; y < tileFile.TilesHeight(); ++y)
+            for(uint x = 0; x < tileFile.TilesWidth(); ++x)
+                if (!tileFile.ReadTile(x, y, &(*newHeights)[y * tileVertices * newVerticesWidth + x * tileVertices], newVerticesWidth))
+                {
+                    LogError(QString("EC_Terrain::LoadFromDataInMemory: The data of tile (%1, %2) is corrupt.").arg(x).arg(y));
+                    return false;
+                }
+    }
+    else
+    {
+        int offset = 0;
+        xPatches = ReadU32(data, numBytes, offset);
+        yPatches = ReadU32(data, numBytes, offset);
+        // Check the size first, the byte count of an arbitrary size would overflow.
+        if ((u64)xPatches * yPatches > cMaxVertices / (cPatchSize * cPatchSize))
+        {
+            LogError(QString("EC_Terrain::LoadFromDataInMemory: The terrain size %1x%2 patches is too large.").arg(xPatches).arg(yPatches));
+            return false;
+        }
+        if ((u64)xPatches * yPatches * cPatchSize * cPatchSize * sizeof(float) > numBytes - offset)
             throw Exception("Not enough bytes to deserialize!");
 
-        memcpy(&newPatches[i].heightData[0], data + offset, cPatchSize*cPatchSize*sizeof(float));
-        offset += cPatchSize*cPatchSize*sizeof(float);
+        // The file stores the height values patch by patch, which are laid out to the rows of the whole terrain.
+        const size_t newVerticesWidth = xPatches * cPatchSize;
+        newHeights = MAKE_SHARED(std::vector<float>, newVerticesWidth * yPatches * cPatchSize);
+        for(u32 patchY = 0; patchY < yPatches; ++patchY)
+            for(u32 patchX = 0; patchX < xPatches; ++patchX)
+            {
+                float *dst = &(*newHeights)[patchY * cPatchSize * newVerticesWidth + patchX * cPatchSize];
+                for(uint y = 0; y < cPatchSize; ++y)
+                {
+                    memcpy(dst + y * newVerticesWidth, data + offset, cPatchSize*sizeof(float));
+                    offset += cPatchSize*sizeof(float);
+                }
+            }
     }
 
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
     Destroy();
 
-    patches = newPatches;
+    patches.assign(xPatches * yPatches, Patch());
+    for(u32 y = 0; y < yPatches; ++y)
+        for(u32 x = 0; x < xPatches; ++x)
+        {
+            patches[y*xPatches+x].x = x;
+            patches[y*xPatches+x].y = y;
+        }
+    heights = newHeights;
     patchWidth = xPatches;
     patchHeight = yPatches;
+    changedMinX = changedMinY = 1;
+    changedMaxX = changedMaxY = 0;
 
     // Re-do all the geometry on the GPU.
     RegenerateDirtyTerrainPatches();
@@ -723,12 +897,13 @@ bool EC_Terrain::LoadFromImageFile(QString filename, float offset, float scale)
     yPatches.Set((uint)image.getHeight() / cPatchSize, AttributeChange::Disconnected);
     ResizeTerrain(xPatches.Get(), yPatches.Get());
 
+    emit HeightsAboutToChange();
     for(uint y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(uint x = 0; x < xPatches.Get() * cPatchSize; ++x)
         {
             Ogre::ColourValue c = image.getColourAt(x, y, 0);
             float height = offset + scale * (c.r + c.g + c.b) / 3.f; // Treat the image as a grayscale heightmap field with the color in range [0,1].
-            SetPointHeight(x, y, height);
+            WriteHeight(x, y, height);
         }
 
     xPatches.Changed(AttributeChange::LocalOnly);
@@ -1022,7 +1197,7 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
             if (height < 1e8f)
             {
                 height = raycastHeight - height;
-                SetPointHeight(x, y, height);
+                WriteHeight(x, y, height);
                 minHeight = min(minHeight, height);
                 maxHeight = max(maxHeight, height);
             }
@@ -1031,7 +1206,7 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     for(int y = 0; y < yVertices; ++y)
         for(int x = 0; x < xVertices; ++x)
             if (GetPoint(x, y) >= 1e8f)
-                SetPointHeight(x, y, minHeight);
+                WriteHeight(x, y, minHeight);
 
     // Adjust offset so that we always have the lowest point of the terrain at height 0.
     RemapHeightValues(0.f, maxHeight - minHeight);
@@ -1048,22 +1223,16 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
 
 void EC_Terrain::AffineTransform(float scale, float offset)
 {
+    emit HeightsAboutToChange();
     for(uint y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(uint x = 0; x < xPatches.Get() * cPatchSize; ++x)
-            SetPointHeight(x, y, GetPoint(x, y) * scale + offset);
+            WriteHeight(x, y, GetPoint(x, y) * scale + offset);
 }
 
 void EC_Terrain::RemapHeightValues(float minHeight, float maxHeight)
 {
-    float minHeightCur = 1e9f;
-    float maxHeightCur = -1e9f;
-
-    for(uint y = 0; y < yPatches.Get() * cPatchSize; ++y)
-        for(uint x = 0; x < xPatches.Get() * cPatchSize; ++x)
-        {
-            minHeightCur = min(minHeightCur, GetPoint(x, y));
-            maxHeightCur = max(maxHeightCur, GetPoint(x, y));
-        }
+    float minHeightCur, maxHeightCur;
+    GetTerrainHeightRange(minHeightCur, maxHeightCur);
 
     // There is no height variance in the current terrain height values. Make the whole terrain show the minHeight value.
     if (fabs(maxHeightCur - minHeightCur) < 1e-4f)
@@ -1160,166 +1329,283 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
+void EC_Terrain::UpdatePatchGeometry()
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    if (!patchGeometry || world_.expired())
+        return;
 
-    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+    PROFILE(EC_Terrain_UpdatePatchGeometry);
 
-    if (!ViewEnabled())
-        return;
-    if (world_.expired())
-        return;
-    OgreWorldPtr world = world_.lock();
-    Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
+    UpdatePatchStreaming();
 
-    Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
-    if (!node)
+    // Upload the generated patches a limited time per frame, so that loading a large terrain does not freeze the frame.
+    if (patchGeometry->IsBusy())
     {
-        CreateOgreTerrainPatchNode(node, patch.x, patch.y);
-        patch.node = node;
+        const tick_t budget = GetCurrentClockFreq() * cPatchUploadMsecsPerFrame / 1000;
+        const tick_t startTime = GetCurrentClockTime();
+        bool uploaded = false;
+        TerrainPatchJob job;
+        while(GetCurrentClockTime() - startTime < budget && patchGeometry->TakeReady(job))
+        {
+            UploadTerrainGeometryForOnePatch(job);
+            uploaded = true;
+        }
+
+        // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
+        // we need to hide all newly created geometry.
+        if (uploaded)
+            AttachTerrainRootNode();
     }
-    assert(node);
 
-    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
-    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
-        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+    UpdatePatchLodLevels();
+}
 
-    Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
-    manual->setCastShadows(false);
+void EC_Terrain::GeneratePatchGeometry(uint firstX, uint firstY, uint lastX, uint lastY)
+{
+    // Created also when streaming before the camera position is known, as UpdatePatchGeometry drives the streaming.
+    if (!patchGeometry)
+        patchGeometry = new TerrainPatchGeometry();
 
-    manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+    const bool streaming = streamingDistance > 0.f;
+    if (streaming)
+    {
+        // Only the patches in the streaming range get geometry. The rest are left dirty, to be generated when the camera comes closer.
+        if (!streamingCenterValid)
+            return;
+        firstX = max(firstX, (uint)Clamp(floor(streamingCenterX - streamingRadius), 0.f, patchWidth - 1.f));
+        firstY = max(firstY, (uint)Clamp(floor(streamingCenterY - streamingRadius), 0.f, patchHeight - 1.f));
+        lastX = min(lastX, (uint)Clamp(floor(streamingCenterX + streamingRadius), 0.f, patchWidth - 1.f));
+        lastY = min(lastY, (uint)Clamp(floor(streamingCenterY + streamingRadius), 0.f, patchHeight - 1.f));
+    }
 
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, 0.f, patch.y * patchSpacingY);
-// Opensim:    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
+    // Generate the vertices of the dirty patches in the worker threads, from a copy of the height values around each patch.
+    // They are uploaded to the GPU by UpdatePatchGeometry.
+    std::vector<TerrainPatchJob> jobs;
+    for(uint y = firstY; y <= lastY; ++y)
+        for(uint x = firstX; x <= lastX; ++x)
+        {
+            EC_Terrain::Patch &scenePatch = GetPatch(x, y);
+            if (!scenePatch.patch_geometry_dirty || (streaming && !IsPatchInStreamingRange(x, y, 1.f)))
+                continue;
+            if (streaming && scenePatch.geometryRevision == 0) // Otherwise the patch is already in the list.
+                streamedPatches.push_back(y * patchWidth + x);
+
+            TerrainPatchJob job;
+            job.patchX = x;
+            job.patchY = y;
+            job.verticesWidth = VerticesWidth();
+            job.verticesHeight = VerticesHeight();
+            job.revision = scenePatch.geometryRevision = ++lastGeometryRevision;
+            job.uScale = uScale.Get();
+            job.vScale = vScale.Get();
+            TerrainPatchGeometry::CopyHeights(*heights, job);
+            jobs.push_back(job);
+            scenePatch.patch_geometry_dirty = false;
+        }
+    patchGeometry->Start(jobs);
+}
+
+void EC_Terrain::SetStreamingDistance(float distance)
+{
+    distance = max(0.f, distance);
+    if (distance == streamingDistance)
+        return;
 
-    int curIndex = 0;
+    const bool wasStreaming = streamingDistance > 0.f;
+    streamingDistance = distance;
+    streamingCenterValid = false;
+    streamedPatchesDirty = true;
+    // The patches outside the old streaming range were left without geometry.
+    if (wasStreaming && distance == 0.f && patchGeometry && !patches.empty())
+        GeneratePatchGeometry(0, 0, patchWidth - 1, patchHeight - 1);
+}
 
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
+bool EC_Terrain::IsPatchInStreamingRange(uint patchX, uint patchY, float rangeScale) const
+{
+    if (!streamingCenterValid)
+        return false;
+    // The distance to the closest point of the patch, on the plane of the terrain.
+    const float dx = streamingCenterX - Clamp(streamingCenterX, (float)patchX, patchX + 1.f);
+    const float dy = streamingCenterY - Clamp(streamingCenterY, (float)patchY, patchY + 1.f);
+    const float range = streamingRadius * rangeScale;
+    return dx * dx + dy * dy <= range * range;
+}
 
-    const float uScale = this->uScale.Get();
-    const float vScale = this->vScale.Get();
+Ogre::Camera *EC_Terrain::MainCamera() const
+{
+    OgreWorldPtr world = world_.lock();
+    Ogre::Camera *camera = world && world->Renderer() ? world->Renderer()->MainOgreCamera() : 0;
+    if (!camera || !rootNode || camera->getSceneManager() != world->OgreSceneManager())
+        return 0;
+    return camera;
+}
 
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
-        {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
-
-            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
-            // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-            pos.x = vertexSpacingX * x;
-            pos.z = vertexSpacingY * y;
-// Opensim:             pos.x = vertexSpacingX * x;
-// Opensim              pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
-            {
-                thisPatch = &patch;
+void EC_Terrain::UpdatePatchStreaming()
+{
+    if (streamingDistance <= 0.f)
+        return;
+    Ogre::Camera *camera = MainCamera();
+    if (!camera)
+        return;
 
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex);
-
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+1);
-                }
-            }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
-            }
-            else if (x == cPatchVertexWidth)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
-            }
-            else // (y == patchHeight)
-            {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
-            }
+    // The position of the camera on the terrain, in patches.
+    const Ogre::Vector3 localPos = rootNode->_getFullTransform().inverseAffine() * camera->getDerivedPosition();
+    const Ogre::Vector3 &scale = rootNode->_getDerivedScale();
+    const float patchSize = cPatchSize * max(fabs(scale.x), fabs(scale.z));
+    if (patchSize <= 0.f)
+        return;
+    const float centerX = localPos.x / cPatchSize;
+    const float centerY = localPos.z / cPatchSize;
+    const float radius = streamingDistance / patchSize;
 
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
+    // Revisit the patches only after the camera has moved a fair bit.
+    if (streamingCenterValid && !streamedPatchesDirty && radius == streamingRadius &&
+        fabs(centerX - streamingCenterX) < 0.5f && fabs(centerY - streamingCenterY) < 0.5f)
+        return;
 
-            manual->position(pos);
-            manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
+    PROFILE(EC_Terrain_UpdatePatchStreaming);
 
-            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-// Opensim:             manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
+    streamingCenterX = centerX;
+    streamingCenterY = centerY;
+    streamingRadius = radius;
+    streamingCenterValid = true;
 
-            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
+    if (streamedPatchesDirty)
+    {
+        // The patches have been replaced or moved, find the ones with geometry.
+        streamedPatches.clear();
+        for(size_t i = 0; i < patches.size(); ++i)
+            if (patches[i].geometryRevision != 0)
+                streamedPatches.push_back((uint)i);
+        streamedPatchesDirty = false;
+    }
 
-            ++curIndex;
+    // Destroy the geometry of the patches that have gone far enough.
+    size_t numKept = 0;
+    for(size_t i = 0; i < streamedPatches.size(); ++i)
+    {
+        Patch &patch = patches[streamedPatches[i]];
+        if (IsPatchInStreamingRange(patch.x, patch.y, cStreamingUnloadScale))
+            streamedPatches[numKept++] = streamedPatches[i];
+        else
+        {
+            DestroyPatch(patch.x, patch.y);
+            patch.patch_geometry_dirty = true;
         }
+    }
+    streamedPatches.resize(numKept);
 
-    manual->end();
+    // Generate the geometry of the patches that have come into the range.
+    if (!patches.empty())
+        GeneratePatchGeometry(0, 0, patchWidth - 1, patchHeight - 1);
+}
 
-    // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+void EC_Terrain::UploadTerrainGeometryForOnePatch(const TerrainPatchJob &job)
+{
+    PROFILE(EC_Terrain_UploadTerrainGeometryForOnePatch);
+
+    if (!PatchExists(job.patchX, job.patchY) || world_.expired())
+        return;
+    EC_Terrain::Patch &patch = GetPatch(job.patchX, job.patchY);
+    if (patch.geometryRevision != job.revision)
+        return; // The patch has been regenerated again, or replaced, since this geometry was started.
+
+    OgreWorldPtr world = world_.lock();
+    Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
+
+    Ogre::SceneNode *node = patch.node;
+    if (!node)
     {
-        try
+        CreateOgreTerrainPatchNode(node, patch.x, patch.y);
+        patch.node = node;
+    }
+    if (!node)
+        return;
+
+    // The mesh is created once per patch, after that the new vertices are just uploaded to it.
+    Ogre::MeshPtr terrainMesh;
+    if (patch.entity && patch.meshGeometryName.length() > 0)
+        terrainMesh = Ogre::MeshManager::getSingleton().getByName(patch.meshGeometryName);
+    if (terrainMesh.isNull())
+    {
+        Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+        if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+            terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+
+        // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
+        if (patch.meshGeometryName.length() > 0)
         {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            try
+            {
+                Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            }
+            catch(...) {}
         }
-        catch(...) {}
+
+        patch.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_patchmesh");
+        terrainMesh = patchGeometry->CreateMesh(patch.meshGeometryName, terrainMaterial->getName());
+        patchGeometry->Upload(terrainMesh.get(), job);
+        patch.lodLevel = 0;
+
+        patch.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
+        patch.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
+        patch.entity->setCastShadows(false);
+        // Set UserAny also on subentities
+        for(uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
+            patch.entity->getSubEntity(i)->setUserAny(patch.entity->getUserAny());
+
+        // Explicitly destroy all attached MovableObjects previously bound to this terrain node.
+        Ogre::SceneNode::ObjectIterator iter = node->getAttachedObjectIterator();
+        while(iter.hasMoreElements())
+        {
+            Ogre::MovableObject *obj = iter.getNext();
+            sceneMgr->destroyMovableObject(obj);
+        }
+        node->detachAllObjects();
+        // Now attach the new built terrain mesh.
+        node->attachObject(patch.entity);
     }
+    else
+    {
+        patchGeometry->Upload(terrainMesh.get(), job);
+        // The bounds of the entity follow the mesh, but the node caches them.
+        node->needUpdate();
+    }
+}
 
-    patch.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_patchmesh");
-    Ogre::MeshPtr terrainMesh = manual->convertToMesh(patch.meshGeometryName);
+void EC_Terrain::UpdatePatchLodLevels()
+{
+    Ogre::Camera *camera = MainCamera();
+    if (!camera)
+        return;
 
-    // Odd: destroyManualObject seems to leave behind a memory leak if we don't call manualObject->clear first.
-    manual->clear();
-    sceneMgr->destroyManualObject(manual);
+    PROFILE(EC_Terrain_UpdatePatchLodLevels);
 
-    patch.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
-    patch.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
-    patch.entity->setCastShadows(false);
-    // Set UserAny also on subentities
-    for(uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
-        patch.entity->getSubEntity(i)->setUserAny(patch.entity->getUserAny());
+    const Ogre::Vector3 cameraPos = camera->getDerivedPosition();
+    const Ogre::Vector3 &scale = rootNode->_getDerivedScale();
+    const float patchSize = cPatchSize * max(fabs(scale.x), fabs(scale.z));
 
-    // Explicitly destroy all attached MovableObjects previously bound to this terrain node.
-    Ogre::SceneNode::ObjectIterator iter = node->getAttachedObjectIterator();
-    while(iter.hasMoreElements())
+    // When streaming, only the patches in the list have geometry.
+    const bool streaming = streamingDistance > 0.f && !streamedPatchesDirty;
+    const size_t numPatches = streaming ? streamedPatches.size() : patches.size();
+    for(size_t i = 0; i < numPatches; ++i)
     {
-        Ogre::MovableObject *obj = iter.getNext();
-        sceneMgr->destroyMovableObject(obj);
+        Patch &patch = patches[streaming ? streamedPatches[i] : i];
+        if (!patch.entity)
+            continue;
+
+        // Distance from the camera to the closest point of the patch.
+        const Ogre::AxisAlignedBox &bounds = patch.entity->getWorldBoundingBox(true);
+        Ogre::Vector3 closest = cameraPos;
+        closest.makeCeil(bounds.getMinimum());
+        closest.makeFloor(bounds.getMaximum());
+        const uint level = TerrainPatchGeometry::LodLevel(closest.distance(cameraPos), patchSize);
+        if (level != patch.lodLevel)
+        {
+            patchGeometry->SetLodLevel(patch.entity->getMesh().get(), level);
+            patch.lodLevel = level;
+        }
     }
-    node->detachAllObjects();
-    // Now attach the new built terrain mesh.
-    node->attachObject(patch.entity);
-
-    patch.patch_geometry_dirty = false;
 }
 
 void EC_Terrain::CreateRootNode()
@@ -1375,34 +1661,34 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, uint patchX,
 
 float EC_Terrain::GetTerrainMinHeight() const
 {
-    float minHeight = std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            minHeight = min(minHeight, patches[i].heightData[j]);
-
+    float minHeight, maxHeight;
+    GetTerrainHeightRange(minHeight, maxHeight);
     return minHeight;
 }
 
 float EC_Terrain::GetTerrainMaxHeight() const
 {
-    float maxHeight = -std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            maxHeight = max(maxHeight, patches[i].heightData[j]);
-
+    float minHeight, maxHeight;
+    GetTerrainHeightRange(minHeight, maxHeight);
     return maxHeight;
 }
 
 void EC_Terrain::Resize(uint newWidth, uint newHeight, uint oldPatchStartX, uint oldPatchStartY)
 {
     std::vector<Patch> newPatches(newWidth * newHeight);
-    for(uint y = 0; y < newHeight && y + oldPatchStartY < yPatches.Get(); ++y)
-        for(uint x = 0; x < newWidth && x + oldPatchStartX < xPatches.Get(); ++x)
-            newPatches[y * newWidth + x] = patches[(y + oldPatchStartY) * xPatches.Get() + x + oldPatchStartX];
+    for(uint y = 0; y < newHeight && y + oldPatchStartY < patchHeight; ++y)
+        for(uint x = 0; x < newWidth && x + oldPatchStartX < patchWidth; ++x)
+            newPatches[y * newWidth + x] = GetPatch(x + oldPatchStartX, y + oldPatchStartY);
+    for(uint y = 0; y < newHeight; ++y)
+        for(uint x = 0; x < newWidth; ++x)
+        {
+            newPatches[y * newWidth + x].x = x;
+            newPatches[y * newWidth + x].y = y;
+        }
 
+    ReallocateHeights(newWidth, newHeight, oldPatchStartX, oldPatchStartY);
     patches = newPatches;
+    streamedPatchesDirty = true;
     xPatches.Set(newWidth, AttributeChange::Disconnected);
     yPatches.Set(newHeight, AttributeChange::Disconnected);
     patchWidth = newWidth;
@@ -1411,10 +1697,39 @@ void EC_Terrain::Resize(uint newWidth, uint newHeight, uint oldPatchStartX, uint
     RegenerateDirtyTerrainPatches();
 }
 
+void EC_Terrain::GetPatchHeightRange(uint patchX, uint patchY, float &minHeight, float &maxHeight) const
+{
+    const Patch &patch = GetPatch(patchX, patchY);
+    if (patch.heightRangeDirty)
+    {
+        const uint verticesWidth = VerticesWidth();
+        const float *row = &(*heights)[patchY * cPatchSize * verticesWidth + patchX * cPatchSize];
+        patch.minHeight = patch.maxHeight = row[0];
+        for(uint y = 0; y < cPatchSize; ++y, row += verticesWidth)
+            for(uint x = 0; x < cPatchSize; ++x)
+            {
+                patch.minHeight = min(patch.minHeight, row[x]);
+                patch.maxHeight = max(patch.maxHeight, row[x]);
+            }
+        patch.heightRangeDirty = false;
+    }
+    minHeight = patch.minHeight;
+    maxHeight = patch.maxHeight;
+}
+
 void EC_Terrain::GetTerrainHeightRange(float &minHeight, float &maxHeight) const
 {
-    minHeight = GetTerrainMinHeight();
-    maxHeight = GetTerrainMaxHeight();
+    minHeight = std::numeric_limits<float>::max();
+    maxHeight = -std::numeric_limits<float>::max();
+
+    for(uint y = 0; y < patchHeight; ++y)
+        for(uint x = 0; x < patchWidth; ++x)
+        {
+            float patchMin, patchMax;
+            GetPatchHeightRange(x, y, patchMin, patchMax);
+            minHeight = min(minHeight, patchMin);
+            maxHeight = max(maxHeight, patchMax);
+        }
 }
 
 void EC_Terrain::DirtyAllTerrainPatches()
@@ -1431,45 +1746,20 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
     if (!parentEntity)
         return;
     EC_Placeable *position = parentEntity->GetComponent<EC_Placeable>().get();
-    if (!GetFramework()->IsHeadless() && (!position || position->visible.Get())) // Only need to create GPU resources if the placeable itself is visible.
-    {
-        for(uint y = 0; y < patchHeight; ++y)
-            for(uint x = 0; x < patchWidth; ++x)
-            {
-                EC_Terrain::Patch &scenePatch = GetPatch(x, y);
-                if (!scenePatch.patch_geometry_dirty || scenePatch.heightData.size() == 0)
-                    continue;
-
-                bool neighborsLoaded = true;
-
-                const int neighbors[8][2] = 
-                { 
-                    { -1, -1 }, { -1, 0 }, { -1, 1 },
-                    {  0, -1 },            {  0, 1 },
-                    {  1, -1 }, {  1, 0 }, {  1, 1 }
-                };
-
-                for(uint i = 0; i < 8; ++i)
-                {
-                    uint nX = x + neighbors[i][0];
-                    uint nY = y + neighbors[i][1];
-                    if (nX >= 0 && nX < patchWidth &&
-                        nY >= 0 && nY < patchHeight &&
-                        GetPatch(nX, nY).heightData.size() == 0)
-                    {
-                        neighborsLoaded = false;
-                        break;
-                    }
-                }
-
-                if (neighborsLoaded)
-                    GenerateTerrainGeometryForOnePatch(x, y);
-            }
-    }
+    if (!GetFramework()->IsHeadless() && (!position || position->visible.Get()) && ViewEnabled() && !world_.expired() && !patches.empty()) // Only need to create GPU resources if the placeable itself is visible.
+        GeneratePatchGeometry(0, 0, patchWidth - 1, patchHeight - 1);
     
     // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
     // we need to hide all newly created geometry.
     AttachTerrainRootNode();
 
+    if (changedMinX <= changedMaxX)
+    {
+        const uint firstX = changedMinX, firstY = changedMinY, lastX = changedMaxX, lastY = changedMaxY;
+        changedMinX = changedMinY = 1;
+        changedMaxX = changedMaxY = 0;
+        emit HeightsChanged(firstX, firstY, lastX, lastY);
+    }
+
     emit TerrainRegenerated();
 }
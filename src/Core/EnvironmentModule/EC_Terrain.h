@@ -12,6 +12,8 @@
 #include "OgreModuleFwd.h"
 
 namespace Ogre { class Matrix4; }
+class TerrainPatchGeometry;
+struct TerrainPatchJob;
 
 /// Adds a heightmap-based terrain to the scene.
 /** <table class="header">
@@ -91,20 +93,35 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, heightMap);
 
     /// Returns the minimum and maximum extents of terrain heights.
+    /** Computed from the cached height ranges of the patches, so only the patches changed since the last call are iterated through. */
     void GetTerrainHeightRange(float &minHeight, float &maxHeight) const;
 
+    /// Returns the minimum and maximum height values of the given patch. The range is cached until the patch is changed.
+    void GetPatchHeightRange(uint patchX, uint patchY, float &minHeight, float &maxHeight) const;
+
+    /// Returns the height values of the whole terrain as a contiguous row-major array of VerticesWidth() * VerticesHeight() values.
+    /** The element of the terrain grid point (x, y) is at index y * VerticesWidth() + x. The array is edited in place, so it can be
+        referenced directly e.g. by a collision shape, instead of copying the height values. HeightsAboutToChange is emitted before
+        the values are edited, and HeightsChanged tells the changed patches.
+        When the terrain is resized or reloaded, a new array is allocated and the old one is left to whoever still refers to it. */
+    shared_ptr<const std::vector<float> > Heights() const { return heights; }
+
     /// Each patch is a square containing this many vertices per side.
     static const uint cPatchSize = 16;
 
+    /// The largest terrain loaded from a file, in vertices. Keeps the grid indices within 32 bits and the height array within 1 GB.
+    static const uint cMaxVertices = 1 << 28;
+
     /// Describes a single patch that is present in the scene.
-    /** A patch can be in one of the following three states:
-        - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
-        - heightmap data loaded. The heightData vector contains the heightmap data, but the visible GPU vertex data itself has not been generated yet, due to the neighbors
-          of this patch not being present yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
-        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
+    /** The height values of the patch are stored in the height array of the whole terrain, see Heights.
+        A patch can be in one of the following two states:
+        - heightmap data loaded. The visible GPU vertex data itself has not been generated yet. node == entity == 0, meshGeometryName == "".
+        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources.
+        The GPU vertex data is generated in the background, see RegenerateDirtyTerrainPatches, so a patch stays in its previous state
+        for a few frames after it has been regenerated. */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true), geometryRevision(0), lodLevel(0), minHeight(0.f), maxHeight(0.f), heightRangeDirty(true) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         uint x;
@@ -112,10 +129,6 @@ public:
         /// Y-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchHeight()].
         uint y;
 
-        /// Typically this will be a 16x16 array of height values in world coordinates.
-        /// If the length is zero, this patch hasn't been loaded in yet.
-        std::vector<float> heightData;
-
         /// Ogre -specific: Store a reference to the actual render hierarchy node.
         Ogre::SceneNode *node;
 
@@ -125,13 +138,21 @@ public:
         /// The name of the Ogre Mesh resource that contains the GPU geometry data for this patch.
         std::string meshGeometryName;
 
-        /// If true, the CPU-side heightmap data has changed, but we haven't yet updated
-        /// the GPU-side geometry resources since the neighboring patches haven't been loaded
-        /// in yet.
+        /// If true, the CPU-side heightmap data has changed, but we haven't yet started
+        /// to regenerate the GPU-side geometry resources.
         bool patch_geometry_dirty;
 
-        /// Call only when you've checked that this patch has been loaded in.
-        float GetHeightValue(uint x, uint y) const { return heightData[y*cPatchSize+x]; }
+        /// Identifies the latest regeneration of the GPU-side geometry started for this patch. The generated geometry
+        /// of an earlier regeneration is discarded.
+        uint geometryRevision;
+
+        /// The LOD level the GPU-side geometry is currently drawn at, 0 being the full detail.
+        uint lodLevel;
+
+        /// The cached range of the height values of the patch. Valid only if heightRangeDirty is false, see EC_Terrain::GetPatchHeightRange.
+        mutable float minHeight;
+        mutable float maxHeight;
+        mutable bool heightRangeDirty;
     };
     
     /// @return The patch at given (x,y) coordinates. Pass in values in range [0, PatchWidth()/PatchHeight[.
@@ -176,7 +197,7 @@ public slots:
     {
         for(uint y = 0; y < patchHeight; ++y)
             for(uint x = 0; x < patchWidth; ++x)
-                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || GetPatch(x,y).node == 0)
+                if (!PatchExists(x,y) || GetPatch(x,y).node == 0)
                     return false;
 
         return true;
@@ -187,8 +208,8 @@ public slots:
     /// @param y In the range [0, EC_Terrain::PatchHeight * EC_Terrain::cPatchSize [.
     float GetPoint(uint x, uint y) const;
 
-    /// Sets a new height value to the given terrain map vertex. Marks the patch that vertex is part of dirty,
-    /// but does not immediately recreate the GPU surfaces. Use the RegenerateDirtyTerrainPatches() function
+    /// Sets a new height value to the given terrain map vertex. Marks the height range of the patch that vertex is part of dirty,
+    /// but does not immediately recreate the GPU surfaces. Use the DirtyAllTerrainPatches() and RegenerateDirtyTerrainPatches() functions
     /// to regenerate the visible Ogre mesh geometry.
     void SetPointHeight(uint x, uint y, float height);
     
@@ -306,9 +327,27 @@ public slots:
         @return True if loading succeeded. */
     bool LoadFromFile(QString filename);
 
-    /// Loads the terrain height map data from the given in-memory .ntf file buffer.
+    /// Saves the height map data to a file in the tiled format, see TerrainTileFile.
+    /** As a convention, use the file suffix ".ntf" for these too. The tiled files are loaded by LoadFromFile and the heightMap
+        attribute the same way as the older format, and can be loaded without reading the whole file to memory first.
+        @param tileSize The size of the tiles, in patches per side.
+        @param quantized If true, the height values are stored as 16-bit integers over the height range of each tile.
+        @param compressed If true, the tiles are compressed.
+        @return True if the save succeeded. */
+    bool SaveToTiledFile(QString filename, uint tileSize = 8, bool quantized = false, bool compressed = false);
+
+    /// Loads the terrain height map data from the given in-memory .ntf file buffer, in either the tiled or the older format.
     bool LoadFromDataInMemory(const char *data, size_t numBytes);
 
+    /// Sets the distance from the main camera within which the patches have GPU geometry.
+    /** The geometry of the patches further away is destroyed, and generated again when the camera comes closer. Use this for
+        terrains too large to keep the geometry of all the patches on the GPU. This is a local setting, not replicated.
+        @param distance The distance in world units, or 0 to keep the geometry of all the patches, which is the default. */
+    void SetStreamingDistance(float distance);
+
+    /// Returns the distance within which the patches have GPU geometry, or 0 if all of them do. See SetStreamingDistance.
+    float StreamingDistance() const { return streamingDistance; }
+
     void NormalizeImage(QString filename) const;
 
     /// Loads the terrain from the given image file.
@@ -348,14 +387,14 @@ public slots:
     /// Marks all terrain patches dirty.
     void DirtyAllTerrainPatches();
 
+    /// Starts regenerating the GPU geometry of the dirty patches, and emits HeightsChanged for the height values changed since the last call, and TerrainRegenerated.
+    /** The vertices of the patches are generated in worker threads and uploaded to the GPU over the following frames. */
     void RegenerateDirtyTerrainPatches();
 
     /// Returns the minimum height value in the whole terrain.
-    /** This function blindly iterates through the whole terrain, so avoid calling it in performance-critical code. */
     float GetTerrainMinHeight() const;
 
     /// Returns the maximum height value in the whole terrain.
-    /** This function blindly iterates through the whole terrain, so avoid calling it in performance-critical code. */
     float GetTerrainMaxHeight() const;
 
     /// Resizes the terrain and recreates it.
@@ -367,6 +406,15 @@ signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted before the height values in the Heights() array are edited in place.
+    /** Whoever reads the array from another thread must stop doing so in a direct connection to this signal. */
+    void HeightsAboutToChange();
+
+    /// Emitted by RegenerateDirtyTerrainPatches before TerrainRegenerated, if height values have been edited since the last regeneration.
+    /** The patches in the range [firstPatchX, lastPatchX] x [firstPatchY, lastPatchY] contain all the changes. If the terrain has been
+        resized or reloaded in the meantime, the changes refer to the new Heights() array. */
+    void HeightsChanged(uint firstPatchX, uint firstPatchY, uint lastPatchX, uint lastPatchY);
+
 private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
@@ -378,6 +426,9 @@ private slots:
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
+    /// Uploads the patch geometry generated in the background, a limited time per frame, and updates the LOD levels of the patches.
+    void UpdatePatchGeometry();
+
 private:
     void AttributesChanged();
 
@@ -403,9 +454,44 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(uint index, const QString &textureName);
 
-    /// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
-    /// patch if the associated Ogre resources already exist.
-    void GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY);
+    /// Creates Ogre geometry data for the single given patch from its generated vertices, or updates the geometry
+    /// for an existing patch if the associated Ogre resources already exist.
+    /** @param job The generated vertices of the patch. Ignored if the patch has been regenerated again since. */
+    void UploadTerrainGeometryForOnePatch(const TerrainPatchJob &job);
+
+    /// Picks the LOD level of each patch from its distance to the main camera.
+    void UpdatePatchLodLevels();
+
+    /// Starts generating the GPU geometry of the dirty patches in the given range, or of those of them in the streaming range,
+    /// if streaming is enabled.
+    void GeneratePatchGeometry(uint firstX, uint firstY, uint lastX, uint lastY);
+
+    /// Destroys the GPU geometry of the patches that have gone out of the streaming range, and generates it for the ones that have come
+    /// into it, if the main camera has moved since the last call.
+    void UpdatePatchStreaming();
+
+    /// Returns true if the given patch is within the streaming range scaled by rangeScale from the main camera.
+    /** Returns false if the position of the camera is not known yet. */
+    bool IsPatchInStreamingRange(uint patchX, uint patchY, float rangeScale) const;
+
+    /// Returns the main camera if it is in the scene of the terrain, or null.
+    Ogre::Camera *MainCamera() const;
+
+    /// Returns the height value of the given terrain grid point, without bounds checking.
+    float &Height(uint x, uint y) { return (*heights)[y * VerticesWidth() + x]; }
+
+    /// Sets the height value of the given terrain grid point, like SetPointHeight but without emitting HeightsAboutToChange.
+    void WriteHeight(uint x, uint y, float height);
+
+    /// Sets all the height values of the given patch, like MakePatchFlat but without emitting HeightsAboutToChange.
+    void FillPatch(uint patchX, uint patchY, float heightValue);
+
+    /// Invalidates the cached height ranges of the given patches, and adds them to the changes HeightsChanged is emitted for.
+    void MarkHeightsChanged(uint firstPatchX, uint firstPatchY, uint lastPatchX, uint lastPatchY);
+
+    /// Replaces the height array with one of the given size in patches, copying the overlapping height values from the old array
+    /// at the given patch offset. The new area is left zero. Forgets the pending changes of the old array.
+    void ReallocateHeights(uint newPatchWidth, uint newPatchHeight, uint oldPatchStartX, uint oldPatchStartY);
 
     shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -424,6 +510,35 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    /// Generates the GPU geometry of the patches. Null until the first patch is generated.
+    TerrainPatchGeometry *patchGeometry;
+
+    /// The geometry revision given to the patch regenerated last, see Patch::geometryRevision.
+    uint lastGeometryRevision;
+
+    /// The height values of the whole terrain, see Heights.
+    shared_ptr<std::vector<float> > heights;
+
+    /// See SetStreamingDistance.
+    float streamingDistance;
+
+    /// The position of the main camera on the terrain at the last streaming update, in patches. Valid only if streamingCenterValid is true.
+    float streamingCenterX;
+    float streamingCenterY;
+    /// The streaming distance at the last streaming update, in patches.
+    float streamingRadius;
+    bool streamingCenterValid;
+
+    /// The indices of the patches whose GPU geometry exists or is being generated, when streaming. Rebuilt if streamedPatchesDirty is true.
+    std::vector<uint> streamedPatches;
+    bool streamedPatchesDirty;
+
+    /// The patches whose height values have changed since the last RegenerateDirtyTerrainPatches. Empty if changedMinX > changedMaxX.
+    uint changedMinX;
+    uint changedMinY;
+    uint changedMaxX;
+    uint changedMaxY;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
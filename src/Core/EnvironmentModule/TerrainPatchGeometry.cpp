@@ -0,0 +1,306 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#define MATH_OGRE_INTEROP
+#include "DebugOperatorNew.h"
+
+#include "TerrainPatchGeometry.h"
+#include "Math/float3.h"
+#include "Math/MathFunc.h"
+
+#include <Ogre.h>
+
+#include <QtConcurrentRun>
+
+#include <algorithm>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// The number of patches generated by one worker thread job.
+const size_t cBatchSize = 64;
+
+/// The distance up to which the patches are drawn at full detail, in patch sizes.
+const float cFullDetailDistance = 2.f;
+
+/// The minimum depth of the skirts.
+const float cMinSkirtDepth = 1.f;
+
+/// Returns the index of the i:th grid vertex along an edge of a patch. Edges 0 and 1 are the first and the last row, 2 and 3 the first and the last column.
+uint EdgeVertex(uint edge, uint i)
+{
+    const uint last = TerrainPatchGeometry::cGridSize - 1;
+    switch(edge)
+    {
+    case 0: return i;
+    case 1: return last * TerrainPatchGeometry::cGridSize + i;
+    case 2: return i * TerrainPatchGeometry::cGridSize;
+    default: return i * TerrainPatchGeometry::cGridSize + last;
+    }
+}
+
+} // ~unnamed namespace
+
+TerrainPatchGeometry::TerrainPatchGeometry()
+{
+    for(uint i = 0; i < cNumLodLevels; ++i)
+        lodStart_[i] = lodCount_[i] = 0;
+}
+
+TerrainPatchGeometry::~TerrainPatchGeometry()
+{
+    for(std::list<shared_ptr<Batch> >::iterator iter = running_.begin(); iter != running_.end(); ++iter)
+        (*iter)->future.waitForFinished();
+}
+
+void TerrainPatchGeometry::CopyHeights(const std::vector<float> &heights, TerrainPatchJob &job)
+{
+    const int width = (int)job.verticesWidth;
+    const int height = (int)job.verticesHeight;
+    const int firstX = (int)(job.patchX * EC_Terrain::cPatchSize) - 1;
+    const int firstY = (int)(job.patchY * EC_Terrain::cPatchSize) - 1;
+    // The vertices outside the terrain get the height of the nearest vertex on the edge.
+    job.heights.resize(cWindowSize * cWindowSize);
+    for(int y = 0; y < (int)cWindowSize; ++y)
+    {
+        const float *row = &heights[Clamp(firstY + y, 0, height - 1) * width];
+        for(int x = 0; x < (int)cWindowSize; ++x)
+            job.heights[y * cWindowSize + x] = row[Clamp(firstX + x, 0, width - 1)];
+    }
+}
+
+void TerrainPatchGeometry::Start(std::vector<TerrainPatchJob> &jobs)
+{
+    for(size_t i = 0; i < jobs.size(); i += cBatchSize)
+    {
+        shared_ptr<Batch> batch = MAKE_SHARED(Batch);
+        batch->jobs.assign(jobs.begin() + i, jobs.begin() + std::min(i + cBatchSize, jobs.size()));
+        batch->future = QtConcurrent::run(&TerrainPatchGeometry::GenerateBatch, batch);
+        running_.push_back(batch);
+    }
+    jobs.clear();
+}
+
+bool TerrainPatchGeometry::TakeReady(TerrainPatchJob &job)
+{
+    if (ready_.empty())
+    {
+        for(std::list<shared_ptr<Batch> >::iterator iter = running_.begin(); iter != running_.end();)
+        {
+            if ((*iter)->future.isFinished())
+            {
+                ready_.insert(ready_.end(), (*iter)->jobs.begin(), (*iter)->jobs.end());
+                iter = running_.erase(iter);
+            }
+            else
+                ++iter;
+        }
+        if (ready_.empty())
+            return false;
+    }
+
+    job = ready_.front();
+    ready_.pop_front();
+    return true;
+}
+
+void TerrainPatchGeometry::Clear()
+{
+    // The running batches are kept alive by their worker threads until they finish.
+    running_.clear();
+    ready_.clear();
+}
+
+void TerrainPatchGeometry::GenerateBatch(shared_ptr<Batch> batch)
+{
+    for(size_t i = 0; i < batch->jobs.size(); ++i)
+        Generate(batch->jobs[i]);
+}
+
+void TerrainPatchGeometry::Generate(TerrainPatchJob &job)
+{
+    const int patchSize = (int)EC_Terrain::cPatchSize;
+    const int width = (int)job.verticesWidth;
+    const int height = (int)job.verticesHeight;
+    const int firstX = (int)job.patchX * patchSize;
+    const int firstY = (int)job.patchY * patchSize;
+
+    job.vertices.resize(cNumVertices * cVertexFloats);
+    float *v = &job.vertices[0];
+    float minHeight = std::numeric_limits<float>::max();
+    float maxHeight = -std::numeric_limits<float>::max();
+
+    for(int y = 0; y < (int)cGridSize; ++y)
+        for(int x = 0; x < (int)cGridSize; ++x)
+        {
+            // The last row and column of the patches at the far edges of the terrain have nothing to join with.
+            // They are collapsed onto the previous ones, which leaves degenerate triangles but keeps the topology the same for all patches.
+            const int mapX = std::min(firstX + x, width - 1);
+            const int mapY = std::min(firstY + y, height - 1);
+            const int wx = mapX - firstX + 1;
+            const int wy = mapY - firstY + 1;
+            const float h = job.heights[wy * cWindowSize + wx];
+            minHeight = std::min(minHeight, h);
+            maxHeight = std::max(maxHeight, h);
+
+            // Same as EC_Terrain::CalculateNormal. The slope is one-sided at the edges of the terrain.
+            float xSlope = job.heights[wy * cWindowSize + wx - 1] - job.heights[wy * cWindowSize + wx + 1];
+            if (mapX == 0 || mapX == width - 1)
+                xSlope *= 2.f;
+            float ySlope = job.heights[(wy - 1) * cWindowSize + wx] - job.heights[(wy + 1) * cWindowSize + wx];
+            if (mapY == 0 || mapY == height - 1)
+                ySlope *= 2.f;
+            const float3 normal = float3(xSlope, 2.f, ySlope).Normalized();
+
+            // Note: heightmap X & Y correspond to X & Z axes, while height is Y.
+            *v++ = (float)(mapX - firstX);
+            *v++ = h;
+            *v++ = (float)(mapY - firstY);
+            *v++ = normal.x;
+            *v++ = normal.y;
+            *v++ = normal.z;
+            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
+            *v++ = mapX * job.uScale;
+            *v++ = mapY * job.vScale;
+            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+            *v++ = (float)mapX / (width - 1);
+            *v++ = (float)mapY / (height - 1);
+        }
+
+    // The cracks next to a patch of a coarser level are at most as deep as the height range of the shared edge.
+    const float skirtDepth = std::max(maxHeight - minHeight, cMinSkirtDepth);
+    for(uint edge = 0; edge < 4; ++edge)
+        for(uint i = 0; i < cGridSize; ++i)
+        {
+            const float *src = &job.vertices[EdgeVertex(edge, i) * cVertexFloats];
+            std::copy(src, src + cVertexFloats, v);
+            v[1] -= skirtDepth;
+            v += cVertexFloats;
+        }
+
+    job.minHeight = minHeight - skirtDepth;
+    job.maxHeight = maxHeight;
+}
+
+void TerrainPatchGeometry::CreateIndexBuffer()
+{
+    if (!indexBuffer_.isNull())
+        return;
+
+    std::vector<u16> indices;
+    const uint patchSize = EC_Terrain::cPatchSize;
+    for(uint level = 0; level < cNumLodLevels; ++level)
+    {
+        lodStart_[level] = (uint)indices.size();
+        const uint step = 1 << level;
+        const uint numQuads = patchSize / step;
+
+        for(uint y = 0; y < numQuads; ++y)
+            for(uint x = 0; x < numQuads; ++x)
+            {
+                const u16 i = (u16)(y * step * cGridSize + x * step);
+                const u16 right = (u16)(i + step);
+                const u16 below = (u16)(i + step * cGridSize);
+                // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+                indices.push_back(below); indices.push_back(right); indices.push_back(i);
+                indices.push_back(below); indices.push_back((u16)(below + step)); indices.push_back(right);
+            }
+
+        // Which side of a skirt is seen depends on which of the two patches has the coarser level, so both windings are drawn.
+        for(uint edge = 0; edge < 4; ++edge)
+        {
+            const uint skirt = cGridSize * cGridSize + edge * cGridSize;
+            for(uint k = 0; k < numQuads; ++k)
+            {
+                const u16 top0 = (u16)EdgeVertex(edge, k * step);
+                const u16 top1 = (u16)EdgeVertex(edge, (k + 1) * step);
+                const u16 bottom0 = (u16)(skirt + k * step);
+                const u16 bottom1 = (u16)(skirt + (k + 1) * step);
+                indices.push_back(top0); indices.push_back(top1); indices.push_back(bottom0);
+                indices.push_back(top1); indices.push_back(bottom1); indices.push_back(bottom0);
+                indices.push_back(top0); indices.push_back(bottom0); indices.push_back(top1);
+                indices.push_back(top1); indices.push_back(bottom0); indices.push_back(bottom1);
+            }
+        }
+        lodCount_[level] = (uint)indices.size() - lodStart_[level];
+    }
+
+    // The shadow buffer keeps raycasting against the terrain patches cheap.
+    indexBuffer_ = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+        indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    indexBuffer_->writeData(0, indices.size() * sizeof(u16), &indices[0], true);
+}
+
+Ogre::MeshPtr TerrainPatchGeometry::CreateMesh(const std::string &name, const std::string &materialName)
+{
+    CreateIndexBuffer();
+
+    Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+    Ogre::SubMesh *submesh = mesh->createSubMesh();
+    submesh->useSharedVertices = false;
+#include "DisableMemoryLeakCheck.h"
+    submesh->vertexData = new Ogre::VertexData();
+#include "EnableMemoryLeakCheck.h"
+    submesh->vertexData->vertexStart = 0;
+    submesh->vertexData->vertexCount = cNumVertices;
+
+    Ogre::VertexDeclaration *decl = submesh->vertexData->vertexDeclaration;
+    size_t offset = 0;
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+    assert(offset == cVertexFloats * sizeof(float));
+
+    Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        decl->getVertexSize(0), cNumVertices, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    submesh->vertexData->vertexBufferBinding->setBinding(0, vbuf);
+
+    submesh->indexData->indexBuffer = indexBuffer_;
+    submesh->indexData->indexStart = lodStart_[0];
+    submesh->indexData->indexCount = lodCount_[0];
+    submesh->setMaterialName(materialName);
+
+    const float patchSize = (float)EC_Terrain::cPatchSize;
+    mesh->_setBounds(Ogre::AxisAlignedBox(0.f, 0.f, 0.f, patchSize, 0.f, patchSize));
+    mesh->_setBoundingSphereRadius(patchSize);
+    mesh->load();
+    return mesh;
+}
+
+void TerrainPatchGeometry::Upload(Ogre::Mesh *mesh, const TerrainPatchJob &job)
+{
+    Ogre::SubMesh *submesh = mesh->getSubMesh(0);
+    Ogre::HardwareVertexBufferSharedPtr vbuf = submesh->vertexData->vertexBufferBinding->getBuffer(0);
+    vbuf->writeData(0, vbuf->getSizeInBytes(), &job.vertices[0], true);
+
+    const float patchSize = (float)EC_Terrain::cPatchSize;
+    Ogre::AxisAlignedBox bounds(0.f, job.minHeight, 0.f, patchSize, job.maxHeight, patchSize);
+    mesh->_setBounds(bounds, false);
+    mesh->_setBoundingSphereRadius(bounds.getHalfSize().length());
+}
+
+void TerrainPatchGeometry::SetLodLevel(Ogre::Mesh *mesh, uint level) const
+{
+    level = std::min(level, cNumLodLevels - 1);
+    Ogre::IndexData *indexData = mesh->getSubMesh(0)->indexData;
+    indexData->indexStart = lodStart_[level];
+    indexData->indexCount = lodCount_[level];
+}
+
+uint TerrainPatchGeometry::LodLevel(float distance, float patchSize)
+{
+    // Full detail up to cFullDetailDistance, and one level less for each doubling of the distance after that.
+    float ratio = distance / (cFullDetailDistance * patchSize);
+    if (!(ratio >= 1.f))
+        return 0;
+    uint level = 1;
+    while(ratio >= 2.f && level + 1 < cNumLodLevels)
+    {
+        ratio *= 0.5f;
+        ++level;
+    }
+    return level;
+}
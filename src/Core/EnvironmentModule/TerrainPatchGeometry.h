@@ -0,0 +1,116 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "EC_Terrain.h"
+
+#include <OgreHardwareIndexBuffer.h>
+#include <OgreMesh.h>
+
+#include <QFuture>
+
+#include <vector>
+#include <list>
+#include <deque>
+
+/// The generation of the vertices of one patch.
+struct TerrainPatchJob
+{
+    TerrainPatchJob() : patchX(0), patchY(0), verticesWidth(0), verticesHeight(0), revision(0), uScale(1.f), vScale(1.f), minHeight(0.f), maxHeight(0.f) {}
+
+    // Input
+    uint patchX;
+    uint patchY;
+    uint verticesWidth; ///< Size of the whole terrain in vertices.
+    uint verticesHeight;
+    uint revision; ///< The revision of the patch geometry, see EC_Terrain::Patch::geometryRevision.
+    float uScale;
+    float vScale;
+    std::vector<float> heights; ///< The height values around the patch, TerrainPatchGeometry::cWindowSize squared, starting from one vertex before its first vertex.
+
+    // Output
+    std::vector<float> vertices; ///< TerrainPatchGeometry::cNumVertices * TerrainPatchGeometry::cVertexFloats floats.
+    float minHeight; ///< The extents of the vertices, including the skirts.
+    float maxHeight;
+};
+
+/// Builds the GPU geometry of the terrain patches of EC_Terrain, with geometric LOD.
+/** Each patch is a grid of (cPatchSize+1)^2 vertices, the last row and column joining it with the next patches, and a skirt
+    hanging down from each of its edges to hide the cracks between patches of different LOD levels. All the patches have the same
+    topology, so one index buffer with all the LOD levels is shared by all of them, and a patch selects its level by the range of
+    the buffer it uses. The level is picked from the distance of the patch to the camera.
+
+    The vertices are generated in worker threads from a copy of the height values around each patch, and uploaded to the patch
+    meshes on the main thread as they become ready, a limited amount per frame. Used from the main thread only. */
+class TerrainPatchGeometry
+{
+public:
+    /// The number of vertices per side of a patch, without the skirt.
+    static const uint cGridSize = EC_Terrain::cPatchSize + 1;
+    /// The number of LOD levels. Level n uses every 2^n:th vertex per side.
+    static const uint cNumLodLevels = 5;
+    /// The number of vertices of a patch, the grid followed by the skirts of the four edges.
+    static const uint cNumVertices = cGridSize * cGridSize + 4 * cGridSize;
+    /// The number of floats per vertex: position, normal, diffuse UV and blend mask UV.
+    static const uint cVertexFloats = 10;
+    /// The size of the copy of the height values a patch is generated from, one vertex over the grid on each side for the normals.
+    static const uint cWindowSize = cGridSize + 2;
+
+    TerrainPatchGeometry();
+    /// Waits for the generation in progress.
+    ~TerrainPatchGeometry();
+
+    /// Copies the height values a patch is generated from.
+    /** @param heights The height values of the whole terrain, see EC_Terrain::Heights. */
+    static void CopyHeights(const std::vector<float> &heights, TerrainPatchJob &job);
+
+    /// Starts generating the vertices of patches in the worker threads. Takes the jobs, leaving the vector empty.
+    void Start(std::vector<TerrainPatchJob> &jobs);
+
+    /// Takes the next job whose vertices have been generated. @return False if none is ready.
+    bool TakeReady(TerrainPatchJob &job);
+
+    /// Returns true if jobs are being generated or waiting to be taken.
+    bool IsBusy() const { return !running_.empty() || !ready_.empty(); }
+
+    /// Forgets the jobs in progress and the ready ones.
+    void Clear();
+
+    /// Creates the mesh of a patch, with a vertex buffer of its own and the shared index buffer.
+    Ogre::MeshPtr CreateMesh(const std::string &name, const std::string &materialName);
+
+    /// Uploads the vertices of a generated patch to its mesh.
+    void Upload(Ogre::Mesh *mesh, const TerrainPatchJob &job);
+
+    /// Makes a patch mesh use the given LOD level.
+    void SetLodLevel(Ogre::Mesh *mesh, uint level) const;
+
+    /// Returns the LOD level of a patch at the given distance from the camera.
+    /** @param patchSize The size of a patch side, in the same units as distance. */
+    static uint LodLevel(float distance, float patchSize);
+
+private:
+    /// @cond PRIVATE
+    struct Batch
+    {
+        std::vector<TerrainPatchJob> jobs;
+        QFuture<void> future;
+    };
+    /// @endcond
+
+    /// Generates the vertices of a batch of jobs. Called in a worker thread.
+    static void GenerateBatch(shared_ptr<Batch> batch);
+
+    /// Generates the vertices of one job.
+    static void Generate(TerrainPatchJob &job);
+
+    /// Creates the shared index buffer, if not yet created.
+    void CreateIndexBuffer();
+
+    Ogre::HardwareIndexBufferSharedPtr indexBuffer_;
+    uint lodStart_[cNumLodLevels]; ///< The first index of each LOD level in indexBuffer_.
+    uint lodCount_[cNumLodLevels]; ///< The number of indices of each LOD level in indexBuffer_.
+    std::list<shared_ptr<Batch> > running_; ///< The batches being generated, in the order they were started.
+    std::deque<TerrainPatchJob> ready_; ///< The generated jobs not yet taken.
+};
@@ -0,0 +1,262 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "DebugOperatorNew.h"
+
+#include "TerrainTileFile.h"
+#include "EC_Terrain.h"
+#include "LoggingFunctions.h"
+
+#include <QFile>
+#include <QByteArray>
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const char cMagic[4] = { 'T', 'N', 'T', 'F' };
+
+/// @cond PRIVATE
+/// The header at the start of the file, followed by the tile index.
+struct FileHeader
+{
+    char magic[4];
+    u32 version;
+    u32 xPatches;
+    u32 yPatches;
+    u32 tileSize; ///< In patches per side.
+    u32 reserved;
+};
+/// @endcond
+
+/// Returns if a terrain of the given size in patches has at most EC_Terrain::cMaxVertices vertices.
+bool IsValidTerrainSize(u32 xPatches, u32 yPatches)
+{
+    return xPatches > 0 && yPatches > 0 && (u64)xPatches * yPatches <= EC_Terrain::cMaxVertices / (EC_Terrain::cPatchSize * EC_Terrain::cPatchSize);
+}
+
+/// The largest tile accepted, in patches per side. Keeps a tile well within the 32-bit sizes of the index and of qCompress.
+const u32 cMaxTileSize = 256;
+
+/// Returns the number of vertices per side of a tile, which is smaller at the far edges of the terrain.
+uint TileExtent(uint tile, uint tileSize, uint numPatches)
+{
+    return (std::min((tile + 1) * tileSize, numPatches) - tile * tileSize) * EC_Terrain::cPatchSize;
+}
+
+} // ~unnamed namespace
+
+TerrainTileFile::TerrainTileFile() :
+    data_(0),
+    numBytes_(0),
+    xPatches_(0),
+    yPatches_(0),
+    tileSize_(0),
+    xTiles_(0),
+    yTiles_(0)
+{
+}
+
+bool TerrainTileFile::IsTiledFormat(const char *data, size_t numBytes)
+{
+    return data && numBytes >= sizeof(cMagic) && memcmp(data, cMagic, sizeof(cMagic)) == 0;
+}
+
+bool TerrainTileFile::Open(const char *data, size_t numBytes)
+{
+    tiles_.clear();
+    data_ = 0;
+    numBytes_ = 0;
+
+    if (!IsTiledFormat(data, numBytes) || numBytes < sizeof(FileHeader))
+    {
+        LogError("TerrainTileFile::Open: Not a tiled terrain file.");
+        return false;
+    }
+    FileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version > cVersion)
+    {
+        LogError(QString("TerrainTileFile::Open: Unsupported version %1 of the tiled terrain format.").arg(header.version));
+        return false;
+    }
+    if (!IsValidTerrainSize(header.xPatches, header.yPatches) || header.tileSize == 0 || header.tileSize > cMaxTileSize)
+    {
+        LogError(QString("TerrainTileFile::Open: Invalid terrain size %1x%2 patches, tile size %3.").arg(header.xPatches).arg(header.yPatches).arg(header.tileSize));
+        return false;
+    }
+
+    const uint xTiles = (header.xPatches + header.tileSize - 1) / header.tileSize;
+    const uint yTiles = (header.yPatches + header.tileSize - 1) / header.tileSize;
+    const size_t indexSize = (size_t)xTiles * yTiles * sizeof(Tile);
+    if (numBytes - sizeof(FileHeader) < indexSize)
+    {
+        LogError("TerrainTileFile::Open: The tile index is truncated.");
+        return false;
+    }
+    tiles_.resize(xTiles * yTiles);
+    memcpy(&tiles_[0], data + sizeof(FileHeader), indexSize);
+    for(size_t i = 0; i < tiles_.size(); ++i)
+        if (tiles_[i].offset > numBytes || tiles_[i].size > numBytes - tiles_[i].offset)
+        {
+            LogError("TerrainTileFile::Open: The tile data is truncated.");
+            tiles_.clear();
+            return false;
+        }
+
+    data_ = data;
+    numBytes_ = numBytes;
+    xPatches_ = header.xPatches;
+    yPatches_ = header.yPatches;
+    tileSize_ = header.tileSize;
+    xTiles_ = xTiles;
+    yTiles_ = yTiles;
+    return true;
+}
+
+bool TerrainTileFile::ReadTile(uint tileX, uint tileY, float *dst, size_t dstStride) const
+{
+    if (tileX >= xTiles_ || tileY >= yTiles_)
+        return false;
+    const Tile &tile = GetTile(tileX, tileY);
+    const uint width = TileExtent(tileX, tileSize_, xPatches_);
+    const uint height = TileExtent(tileY, tileSize_, yPatches_);
+    const size_t numValues = (size_t)width * height;
+
+    const char *src = data_ + tile.offset;
+    size_t size = tile.size;
+    QByteArray uncompressed;
+    if (tile.flags & TileCompressed)
+    {
+        uncompressed = qUncompress(reinterpret_cast<const uchar*>(src), (int)size);
+        src = uncompressed.constData();
+        size = uncompressed.size();
+    }
+
+    if (tile.flags & TileQuantized)
+    {
+        if (size != numValues * sizeof(u16))
+            return false;
+        const float scale = (tile.maxHeight - tile.minHeight) / 65535.f;
+        for(uint y = 0; y < height; ++y)
+        {
+            const char *row = src + y * width * sizeof(u16);
+            float *dstRow = dst + y * dstStride;
+            for(uint x = 0; x < width; ++x)
+            {
+                u16 value;
+                memcpy(&value, row + x * sizeof(u16), sizeof(u16));
+                dstRow[x] = tile.minHeight + value * scale;
+            }
+        }
+    }
+    else
+    {
+        if (size != numValues * sizeof(float))
+            return false;
+        for(uint y = 0; y < height; ++y)
+            memcpy(dst + y * dstStride, src + y * width * sizeof(float), width * sizeof(float));
+    }
+    return true;
+}
+
+bool TerrainTileFile::Save(const QString &filename, const std::vector<float> &heights, uint xPatches, uint yPatches, uint tileSize, u32 flags)
+{
+    const size_t verticesWidth = (size_t)xPatches * EC_Terrain::cPatchSize;
+    if (!IsValidTerrainSize(xPatches, yPatches) || tileSize == 0 || tileSize > cMaxTileSize ||
+        heights.size() != verticesWidth * yPatches * EC_Terrain::cPatchSize)
+    {
+        LogError("TerrainTileFile::Save: Invalid terrain size.");
+        return false;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("TerrainTileFile::Save: Could not open file " + filename + ".");
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(header.magic, cMagic, sizeof(cMagic));
+    header.version = cVersion;
+    header.xPatches = xPatches;
+    header.yPatches = yPatches;
+    header.tileSize = tileSize;
+    header.reserved = 0;
+
+    const uint xTiles = (xPatches + tileSize - 1) / tileSize;
+    const uint yTiles = (yPatches + tileSize - 1) / tileSize;
+    std::vector<Tile> tiles(xTiles * yTiles);
+    u64 offset = sizeof(FileHeader) + tiles.size() * sizeof(Tile);
+    bool success = file.seek(offset);
+
+    // The tiles are written first, and the index after them when the positions are known.
+    std::vector<char> tileData;
+    for(uint tileY = 0; tileY < yTiles && success; ++tileY)
+        for(uint tileX = 0; tileX < xTiles && success; ++tileX)
+        {
+            const uint width = TileExtent(tileX, tileSize, xPatches);
+            const uint height = TileExtent(tileY, tileSize, yPatches);
+            const float *src = &heights[tileY * tileSize * EC_Terrain::cPatchSize * verticesWidth + tileX * tileSize * EC_Terrain::cPatchSize];
+            Tile &tile = tiles[tileY * xTiles + tileX];
+
+            tile.minHeight = std::numeric_limits<float>::max();
+            tile.maxHeight = -std::numeric_limits<float>::max();
+            for(uint y = 0; y < height; ++y)
+                for(uint x = 0; x < width; ++x)
+                {
+                    tile.minHeight = std::min(tile.minHeight, src[y * verticesWidth + x]);
+                    tile.maxHeight = std::max(tile.maxHeight, src[y * verticesWidth + x]);
+                }
+
+            tile.flags = flags & TileQuantized;
+            if (flags & TileQuantized)
+            {
+                tileData.resize(width * height * sizeof(u16));
+                const float range = tile.maxHeight - tile.minHeight;
+                const float scale = range > 0.f ? 65535.f / range : 0.f;
+                for(uint y = 0; y < height; ++y)
+                    for(uint x = 0; x < width; ++x)
+                    {
+                        const u16 value = (u16)std::min(65535.f, std::floor((src[y * verticesWidth + x] - tile.minHeight) * scale + 0.5f));
+                        memcpy(&tileData[(y * width + x) * sizeof(u16)], &value, sizeof(u16));
+                    }
+            }
+            else
+            {
+                tileData.resize(width * height * sizeof(float));
+                for(uint y = 0; y < height; ++y)
+                    memcpy(&tileData[y * width * sizeof(float)], src + y * verticesWidth, width * sizeof(float));
+            }
+
+            QByteArray compressed;
+            if (flags & TileCompressed)
+                compressed = qCompress(reinterpret_cast<const uchar*>(&tileData[0]), (int)tileData.size());
+            if (!compressed.isEmpty() && (size_t)compressed.size() < tileData.size())
+            {
+                tile.flags |= TileCompressed;
+                tile.size = compressed.size();
+                success = file.write(compressed) == compressed.size();
+            }
+            else
+            {
+                tile.size = (u32)tileData.size();
+                success = file.write(&tileData[0], tileData.size()) == (qint64)tileData.size();
+            }
+            tile.offset = offset;
+            offset += tile.size;
+        }
+
+    success = success && file.seek(0) &&
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == (qint64)sizeof(header) &&
+        file.write(reinterpret_cast<const char*>(&tiles[0]), tiles.size() * sizeof(Tile)) == (qint64)(tiles.size() * sizeof(Tile));
+    if (!success)
+        LogError("TerrainTileFile::Save: Write error in " + filename + ".");
+    return success;
+}
@@ -0,0 +1,83 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <QString>
+
+#include <vector>
+
+/// Reads and writes the tiled terrain height map format of EC_Terrain.
+/** The file starts with a header and an index of the tiles, followed by the data of the tiles. A tile is a square of
+    tileSize x tileSize patches, or less at the far edges of the terrain, and its height values are stored row by row,
+    either as floats, or quantized to 16 bits over the height range of the tile. The data of a tile may be compressed
+    with zlib. The index gives the position, size, encoding and height range of each tile, so a tile can be read without
+    touching the rest of the file, e.g. straight from a memory-mapped file. Note: Not endian safe.
+
+    The file uses the same ".ntf" suffix as the older format, which is just the patch counts followed by the height values
+    patch by patch. IsTiledFormat tells them apart by the magic at the start of the file. */
+class TerrainTileFile
+{
+public:
+    /// The version of the format written. Files of newer versions are rejected.
+    static const u32 cVersion = 1;
+
+    /// The encoding of a tile.
+    enum TileFlags
+    {
+        TileQuantized = 1, ///< The height values are 16-bit integers over the height range of the tile.
+        TileCompressed = 2 ///< The data is compressed with qCompress.
+    };
+
+    /// An entry of the tile index.
+    struct Tile
+    {
+        u64 offset; ///< Position of the tile data from the start of the file.
+        u32 size; ///< Size of the tile data in the file.
+        u32 flags; ///< TileFlags.
+        float minHeight;
+        float maxHeight;
+    };
+
+    TerrainTileFile();
+
+    /// Returns true if the data starts with the header of the tiled format.
+    static bool IsTiledFormat(const char *data, size_t numBytes);
+
+    /// Reads the header and the index of a file in memory, validating them. The data is not copied, and must stay valid while reading tiles.
+    /** @return False if the data is not a valid tiled terrain file. */
+    bool Open(const char *data, size_t numBytes);
+
+    uint PatchWidth() const { return xPatches_; }
+    uint PatchHeight() const { return yPatches_; }
+    uint TileSize() const { return tileSize_; }
+    uint TilesWidth() const { return xTiles_; }
+    uint TilesHeight() const { return yTiles_; }
+
+    /// Returns the index entry of the given tile.
+    const Tile &GetTile(uint tileX, uint tileY) const { return tiles_[tileY * xTiles_ + tileX]; }
+
+    /// Decodes the height values of a tile.
+    /** @param dst The first height value of the tile in a row-major array of the height values of the whole terrain.
+        @param dstStride The distance between the rows of dst, in values.
+        @return False if the tile data is corrupt. */
+    bool ReadTile(uint tileX, uint tileY, float *dst, size_t dstStride) const;
+
+    /// Writes a terrain to a file in the tiled format.
+    /** @param heights The height values of the whole terrain, row by row, see EC_Terrain::Heights.
+        @param tileSize The tile size, in patches per side.
+        @param flags The TileFlags to encode the tiles with. A tile is stored uncompressed if compression would not make it smaller.
+        @return True if the save succeeded. */
+    static bool Save(const QString &filename, const std::vector<float> &heights, uint xPatches, uint yPatches, uint tileSize, u32 flags);
+
+private:
+    const char *data_;
+    size_t numBytes_;
+    uint xPatches_;
+    uint yPatches_;
+    uint tileSize_;
+    uint xTiles_;
+    uint yTiles_;
+    std::vector<Tile> tiles_;
+};
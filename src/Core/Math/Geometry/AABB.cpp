@@ -39,6 +39,7 @@
 #include "Math/Quat.h"
 #include "Geometry/Triangle.h"
 #include "Geometry/Capsule.h"
+#include "Math/SIMDDispatch.h"
 
 #ifdef MATH_GRAPHICSENGINE_INTEROP
 #include "VertexBuffer.h"
@@ -458,6 +459,24 @@ void AABB::TransformAsAABB(const float3x4 &transform)
 	AABBTransformAsAABB(*this, transform);
 }
 
+void AABB::BatchTransformAsAABB(AABB *aabbArray, int numAABBs, const float3x4 &transform)
+{
+	assume(transform.IsColOrthogonal());
+	assume(transform.HasUniformScale());
+	assume(aabbArray || numAABBs <= 0);
+	if (numAABBs <= 0)
+		return;
+
+	// The kernels need the points packed, which they are unless MATH_SSE aligns them.
+	if (sizeof(AABB) != 6 * sizeof(float))
+	{
+		for(int i = 0; i < numAABBs; ++i)
+			AABBTransformAsAABB(aabbArray[i], transform);
+		return;
+	}
+	SIMD().transformAABBs(transform.ptr(), aabbArray->minPoint.ptr(), numAABBs);
+}
+
 void AABB::TransformAsAABB(const float4x4 &transform)
 {
 	assume(transform.IsColOrthogonal3());
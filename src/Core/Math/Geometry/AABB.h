@@ -343,6 +343,9 @@ public:
 	void TransformAsAABB(const float4x4 &transform);
 	void TransformAsAABB(const Quat &transform);
 
+	/// Applies TransformAsAABB(transform) to each AABB of the given array, using the SIMD kernels in use, see SIMDDispatch.h.
+	static void BatchTransformAsAABB(AABB *aabbArray, int numAABBs, const float3x4 &transform);
+
 	/// Applies a transformation to this AABB and returns the resulting OBB.
 	/** Transforming an AABB produces an oriented bounding box. This set of functions does not apply the transformation
 		to this object itself, but instead returns the OBB that results in the transformation.
@@ -40,4 +40,5 @@
 #include "Sphere.h"
 #include "Triangle.h"
 #include "TriangleMesh.h"
+#include "TriangleBVH.h"
 #include "GeomType.h"
@@ -0,0 +1,527 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   TriangleBVH.cpp
+    @brief  A flattened bounding volume hierarchy of static triangles, built with a binned SAH, for fast ray queries. */
+
+#include "TriangleBVH.h"
+#include "Triangle.h"
+#include "Ray.h"
+#include "Math/SIMDDispatch.h"
+#include "myassert.h"
+
+#include <algorithm>
+#include <math.h>
+
+MATH_BEGIN_NAMESPACE
+
+/// @cond PRIVATE
+namespace
+{
+/// Number of bins the SAH is evaluated over at each node.
+const int cNumBins = 16;
+/// Nodes of at most this many triangles become leaves if splitting them does not pay off.
+const u32 cMaxLeafTriangles = 16;
+/// Nodes of at most this many triangles always become leaves.
+const u32 cMinLeafTriangles = 4;
+/// After this depth the nodes are split at the median, so that the depth of the tree stays bounded.
+const int cMaxSAHDepth = 48;
+/// Size of the traversal stacks, enough for cMaxSAHDepth levels of SAH splits followed by median splits of any 32-bit triangle count.
+const int cStackSize = 128;
+/// Cost of visiting an inner node relative to intersecting a block of four triangles.
+const float cTraversalCost = 0.5f;
+/// Number of floats in a block of four triangles.
+const int cBlockFloats = 36;
+/// Same as Triangle::IntersectLineTri.
+const float cEpsilon = 1e-4f;
+
+const u32 cSerializationMagic = 0x48564254; // "TBVH"
+const u32 cSerializationVersion = 1;
+
+inline u32 NumBlocks(u32 numTris)
+{
+    return (numTris + 3) / 4;
+}
+
+struct Bin
+{
+    AABB aabb;
+    u32 count;
+};
+
+struct StackEntry
+{
+    u32 node;
+    float t; ///< Entry distance of the ray to the node.
+};
+
+struct CentroidLess
+{
+    explicit CentroidLess(int axis_) : axis(axis_) {}
+    int axis;
+    template<typename T>
+    bool operator()(const T &a, const T &b) const { return a.centroid[axis] < b.centroid[axis]; }
+};
+
+struct BinLessOrEqual
+{
+    BinLessOrEqual(int axis_, float minPos_, float scale_, int split_) : axis(axis_), minPos(minPos_), scale(scale_), split(split_) {}
+    int axis;
+    float minPos;
+    float scale;
+    int split;
+    template<typename T>
+    bool operator()(const T &t) const { return std::min(cNumBins - 1, (int)((t.centroid[axis] - minPos) * scale)) <= split; }
+};
+
+template<typename T>
+void AppendPod(std::vector<u8> &dst, const T *data, size_t count)
+{
+    if (!count)
+        return;
+    const u8 *bytes = reinterpret_cast<const u8*>(data);
+    dst.insert(dst.end(), bytes, bytes + sizeof(T) * count);
+}
+
+template<typename T>
+bool ReadPod(const u8 *&data, const u8 *end, T *dst, size_t count)
+{
+    if ((size_t)(end - data) < sizeof(T) * count)
+        return false;
+    // Copied as bytes, as the data need not be aligned for T.
+    std::copy(data, data + sizeof(T) * count, reinterpret_cast<u8*>(dst));
+    data += sizeof(T) * count;
+    return true;
+}
+}
+/// @endcond
+
+void TriangleBVH::Build(const Triangle *triangles, int numTriangles_)
+{
+    Clear();
+    if (!triangles || numTriangles_ <= 0)
+        return;
+
+    numTriangles = numTriangles_;
+    std::vector<BuildTriangle> buildTris;
+    buildTris.reserve(numTriangles);
+    for(int i = 0; i < numTriangles; ++i)
+    {
+        BuildTriangle t;
+        t.aabb = triangles[i].BoundingAABB();
+        t.centroid = t.aabb.CenterPoint();
+        t.index = (u32)i;
+        buildTris.push_back(t);
+    }
+
+    nodes.reserve(NumBlocks(numTriangles) * 2);
+    blocks.reserve(NumBlocks(numTriangles) * cBlockFloats);
+    triangleIndices.reserve(NumBlocks(numTriangles) * 4);
+    BuildNode(triangles, buildTris, 0, (u32)numTriangles, 0);
+}
+
+u32 TriangleBVH::BuildNode(const Triangle *triangles, std::vector<BuildTriangle> &buildTris, u32 first, u32 count, int depth)
+{
+    const u32 nodeIndex = (u32)nodes.size();
+    nodes.push_back(Node());
+
+    AABB bounds;
+    AABB centroidBounds;
+    bounds.SetNegativeInfinity();
+    centroidBounds.SetNegativeInfinity();
+    for(u32 i = first; i < first + count; ++i)
+    {
+        bounds.Enclose(buildTris[i].aabb);
+        centroidBounds.Enclose(buildTris[i].centroid);
+    }
+    nodes[nodeIndex].minPoint = bounds.minPoint;
+    nodes[nodeIndex].maxPoint = bounds.maxPoint;
+
+    if (count <= cMinLeafTriangles)
+    {
+        CreateLeaf(nodes[nodeIndex], triangles, buildTris, first, count);
+        return nodeIndex;
+    }
+
+    const float3 centroidSize = centroidBounds.maxPoint - centroidBounds.minPoint;
+    int axis = 0;
+    if (centroidSize.y > centroidSize[axis])
+        axis = 1;
+    if (centroidSize.z > centroidSize[axis])
+        axis = 2;
+
+    u32 mid = first + count / 2;
+    bool medianSplit = true;
+    if (centroidSize[axis] > 0.f && depth < cMaxSAHDepth)
+    {
+        // Sort the triangles to bins by their centroids, and evaluate the SAH at each boundary between the bins.
+        // The cost of a child is counted in blocks of four triangles, as that is the granularity the leaves are intersected at.
+        const float minPos = centroidBounds.minPoint[axis];
+        const float scale = cNumBins * (1.f - 1e-5f) / centroidSize[axis];
+        Bin bins[cNumBins];
+        for(int i = 0; i < cNumBins; ++i)
+        {
+            bins[i].aabb.SetNegativeInfinity();
+            bins[i].count = 0;
+        }
+        for(u32 i = first; i < first + count; ++i)
+        {
+            int b = std::min(cNumBins - 1, (int)((buildTris[i].centroid[axis] - minPos) * scale));
+            bins[b].aabb.Enclose(buildTris[i].aabb);
+            ++bins[b].count;
+        }
+
+        float rightCost[cNumBins];
+        AABB rightBounds;
+        rightBounds.SetNegativeInfinity();
+        u32 rightCount = 0;
+        for(int i = cNumBins - 1; i > 0; --i)
+        {
+            if (bins[i].count)
+            {
+                rightBounds.Enclose(bins[i].aabb);
+                rightCount += bins[i].count;
+            }
+            rightCost[i] = rightCount ? rightBounds.SurfaceArea() * NumBlocks(rightCount) : 0.f;
+        }
+
+        float bestCost = FLOAT_INF;
+        int bestSplit = -1;
+        AABB leftBounds;
+        leftBounds.SetNegativeInfinity();
+        u32 leftCount = 0;
+        for(int i = 0; i < cNumBins - 1; ++i)
+        {
+            if (bins[i].count)
+            {
+                leftBounds.Enclose(bins[i].aabb);
+                leftCount += bins[i].count;
+            }
+            if (!leftCount || leftCount == count)
+                continue;
+            float cost = leftBounds.SurfaceArea() * NumBlocks(leftCount) + rightCost[i + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        if (bestSplit >= 0)
+        {
+            const float area = bounds.SurfaceArea();
+            bestCost = cTraversalCost + (area > 0.f ? bestCost / area : 0.f);
+            if (count <= cMaxLeafTriangles && bestCost >= (float)NumBlocks(count))
+            {
+                CreateLeaf(nodes[nodeIndex], triangles, buildTris, first, count);
+                return nodeIndex;
+            }
+            mid = (u32)(std::partition(buildTris.begin() + first, buildTris.begin() + first + count,
+                BinLessOrEqual(axis, minPos, scale, bestSplit)) - buildTris.begin());
+            medianSplit = (mid == first || mid == first + count);
+        }
+    }
+
+    if (medianSplit)
+    {
+        // All the centroids are at the same point, the tree is too deep or the binning failed. Small nodes become leaves,
+        // and larger ones are halved so that the leaves stay small and the depth of the tree bounded.
+        if (count <= cMaxLeafTriangles)
+        {
+            CreateLeaf(nodes[nodeIndex], triangles, buildTris, first, count);
+            return nodeIndex;
+        }
+        mid = first + count / 2;
+        std::nth_element(buildTris.begin() + first, buildTris.begin() + mid, buildTris.begin() + first + count, CentroidLess(axis));
+    }
+
+    BuildNode(triangles, buildTris, first, mid - first, depth + 1);
+    const u32 rightChild = BuildNode(triangles, buildTris, mid, first + count - mid, depth + 1);
+    nodes[nodeIndex].offset = rightChild;
+    nodes[nodeIndex].count = 0;
+    nodes[nodeIndex].axis = (u16)axis;
+    return nodeIndex;
+}
+
+void TriangleBVH::CreateLeaf(Node &node, const Triangle *triangles, const std::vector<BuildTriangle> &buildTris, u32 first, u32 count)
+{
+    assert(count > 0 && count <= 0xFFFC);
+    const u32 paddedCount = NumBlocks(count) * 4;
+    node.offset = (u32)triangleIndices.size();
+    node.count = (u16)paddedCount;
+    node.axis = 0;
+
+    // The padding triangles have zero edges, so their determinant is zero and they are never hit.
+    const size_t firstFloat = blocks.size();
+    blocks.resize(firstFloat + NumBlocks(count) * cBlockFloats, 0.f);
+    for(u32 i = 0; i < paddedCount; ++i)
+    {
+        if (i >= count)
+        {
+            triangleIndices.push_back(0xFFFFFFFF);
+            continue;
+        }
+        const u32 index = buildTris[first + i].index;
+        const Triangle &tri = triangles[index];
+        const float3 e1 = tri.b - tri.a;
+        const float3 e2 = tri.c - tri.a;
+        float *block = &blocks[firstFloat + (i / 4) * cBlockFloats];
+        const u32 lane = i % 4;
+        block[lane] = tri.a.x;
+        block[4 + lane] = tri.a.y;
+        block[8 + lane] = tri.a.z;
+        block[12 + lane] = e1.x;
+        block[16 + lane] = e1.y;
+        block[20 + lane] = e1.z;
+        block[24 + lane] = e2.x;
+        block[28 + lane] = e2.y;
+        block[32 + lane] = e2.z;
+        triangleIndices.push_back(index);
+    }
+}
+
+void TriangleBVH::Clear()
+{
+    nodes.clear();
+    blocks.clear();
+    triangleIndices.clear();
+    numTriangles = 0;
+}
+
+AABB TriangleBVH::BoundingAABB() const
+{
+    AABB aabb;
+    if (nodes.empty())
+        aabb.SetNegativeInfinity();
+    else
+    {
+        aabb.minPoint = nodes[0].minPoint;
+        aabb.maxPoint = nodes[0].maxPoint;
+    }
+    return aabb;
+}
+
+size_t TriangleBVH::MemoryUsage() const
+{
+    return nodes.capacity() * sizeof(Node) + blocks.capacity() * sizeof(float) + triangleIndices.capacity() * sizeof(u32);
+}
+
+TriangleBVH::RayData TriangleBVH::PrepareRay(const Ray &ray)
+{
+    RayData data;
+    data.pos = ray.pos;
+    data.dir = ray.dir;
+    // Division by zero gives an infinity of the correct sign, which the slab test handles.
+    data.invDir = float3(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+    return data;
+}
+
+float TriangleBVH::IntersectNode(const Node &node, const RayData &ray, float maxDistance)
+{
+    const float tx1 = (node.minPoint.x - ray.pos.x) * ray.invDir.x;
+    const float tx2 = (node.maxPoint.x - ray.pos.x) * ray.invDir.x;
+    const float ty1 = (node.minPoint.y - ray.pos.y) * ray.invDir.y;
+    const float ty2 = (node.maxPoint.y - ray.pos.y) * ray.invDir.y;
+    const float tz1 = (node.minPoint.z - ray.pos.z) * ray.invDir.z;
+    const float tz2 = (node.maxPoint.z - ray.pos.z) * ray.invDir.z;
+    const float tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+    const float tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+    if (tFar < tNear || tFar < 0.f || tNear > maxDistance)
+        return FLOAT_INF;
+    return std::max(tNear, 0.f);
+}
+
+void TriangleBVH::IntersectLeaf(const Node &node, const RayData &ray, Hit &hit) const
+{
+    const u32 firstBlock = node.offset / 4;
+    const u32 endBlock = firstBlock + node.count / 4;
+
+    float t = hit.t, u, v;
+    const int index = SIMD().intersectRayBlocks4(&blocks[firstBlock * cBlockFloats], (int)(endBlock - firstBlock), &ray.pos.x, &ray.dir.x, cEpsilon, t, u, v);
+    if (index >= 0)
+    {
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        hit.triangleIndex = (int)triangleIndices[firstBlock * 4 + index];
+    }
+}
+
+TriangleBVH::Hit TriangleBVH::IntersectRay(const Ray &r, float maxDistance) const
+{
+    Hit hit;
+    if (nodes.empty())
+        return hit;
+
+    const RayData ray = PrepareRay(r);
+    hit.t = maxDistance;
+    if (IntersectNode(nodes[0], ray, hit.t) == FLOAT_INF)
+        return Hit();
+
+    StackEntry stack[cStackSize];
+    int stackSize = 0;
+    u32 nodeIndex = 0;
+    for(;;)
+    {
+        const Node &node = nodes[nodeIndex];
+        if (node.IsLeaf())
+            IntersectLeaf(node, ray, hit);
+        else
+        {
+            u32 nearChild = nodeIndex + 1;
+            u32 farChild = node.offset;
+            float tNear = IntersectNode(nodes[nearChild], ray, hit.t);
+            float tFar = IntersectNode(nodes[farChild], ray, hit.t);
+            if (tFar < tNear)
+            {
+                std::swap(nearChild, farChild);
+                std::swap(tNear, tFar);
+            }
+            if (tNear != FLOAT_INF)
+            {
+                if (tFar != FLOAT_INF)
+                {
+                    assert(stackSize < cStackSize);
+                    stack[stackSize].node = farChild;
+                    stack[stackSize].t = tFar;
+                    ++stackSize;
+                }
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        // Continue from the nearest pushed node that is still nearer than the best hit so far.
+        bool found = false;
+        while(stackSize > 0 && !found)
+        {
+            --stackSize;
+            if (stack[stackSize].t <= hit.t)
+            {
+                nodeIndex = stack[stackSize].node;
+                found = true;
+            }
+        }
+        if (!found)
+            break;
+    }
+
+    if (hit.triangleIndex < 0)
+        hit.t = FLOAT_INF;
+    return hit;
+}
+
+void TriangleBVH::IntersectRays(const Ray *rays, int numRays, Hit *outHits, float maxDistance) const
+{
+    for(int first = 0; first < numRays; first += cPacketSize)
+    {
+        const int packetSize = std::min(cPacketSize, numRays - first);
+        RayData packet[cPacketSize];
+        Hit *hits = outHits + first;
+        for(int i = 0; i < packetSize; ++i)
+        {
+            packet[i] = PrepareRay(rays[first + i]);
+            hits[i] = Hit();
+            hits[i].t = maxDistance;
+        }
+        if (nodes.empty())
+        {
+            for(int i = 0; i < packetSize; ++i)
+                hits[i] = Hit();
+            continue;
+        }
+
+        // The children are visited in the order the first ray of the packet prefers, which is a good guess for coherent rays.
+        const bool dirNegative[3] = { packet[0].dir.x < 0.f, packet[0].dir.y < 0.f, packet[0].dir.z < 0.f };
+        u32 stack[cStackSize];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while(stackSize > 0)
+        {
+            const u32 nodeIndex = stack[--stackSize];
+            const Node &node = nodes[nodeIndex];
+            u32 activeMask = 0;
+            for(int i = 0; i < packetSize; ++i)
+                if (IntersectNode(node, packet[i], hits[i].t) != FLOAT_INF)
+                    activeMask |= 1u << i;
+            if (!activeMask)
+                continue;
+
+            if (node.IsLeaf())
+            {
+                for(int i = 0; i < packetSize; ++i)
+                    if (activeMask & (1u << i))
+                        IntersectLeaf(node, packet[i], hits[i]);
+            }
+            else
+            {
+                assert(stackSize + 2 <= cStackSize);
+                const bool rightFirst = dirNegative[node.axis];
+                stack[stackSize++] = rightFirst ? nodeIndex + 1 : node.offset;
+                stack[stackSize++] = rightFirst ? node.offset : nodeIndex + 1;
+            }
+        }
+
+        for(int i = 0; i < packetSize; ++i)
+            if (hits[i].triangleIndex < 0)
+                hits[i].t = FLOAT_INF;
+    }
+}
+
+void TriangleBVH::Serialize(std::vector<u8> &dst) const
+{
+    const u32 header[6] = { cSerializationMagic, cSerializationVersion, (u32)sizeof(Node), (u32)numTriangles, (u32)nodes.size(), (u32)triangleIndices.size() };
+    AppendPod(dst, header, 6);
+    AppendPod(dst, nodes.empty() ? 0 : &nodes[0], nodes.size());
+    AppendPod(dst, blocks.empty() ? 0 : &blocks[0], blocks.size());
+    AppendPod(dst, triangleIndices.empty() ? 0 : &triangleIndices[0], triangleIndices.size());
+}
+
+bool TriangleBVH::Deserialize(const u8 *data, size_t numBytes)
+{
+    Clear();
+    if (!data)
+        return false;
+
+    const u8 *end = data + numBytes;
+    u32 header[6];
+    if (!ReadPod(data, end, header, 6) || header[0] != cSerializationMagic || header[1] != cSerializationVersion || header[2] != sizeof(Node) ||
+        header[5] % 4 != 0)
+        return false;
+
+    nodes.resize(header[4]);
+    blocks.resize((header[5] / 4) * cBlockFloats);
+    triangleIndices.resize(header[5]);
+    bool success = ReadPod(data, end, nodes.empty() ? 0 : &nodes[0], nodes.size()) &&
+        ReadPod(data, end, blocks.empty() ? 0 : &blocks[0], blocks.size()) &&
+        ReadPod(data, end, triangleIndices.empty() ? 0 : &triangleIndices[0], triangleIndices.size()) &&
+        data == end;
+
+    // Validate the links and the depth, so that a corrupted file can not make the queries read out of bounds or overflow the traversal stacks.
+    // The children always come after their parent, so the depth of each node is known when it is reached.
+    std::vector<int> depths(nodes.size(), 0);
+    for(size_t i = 0; i < nodes.size() && success; ++i)
+    {
+        const Node &node = nodes[i];
+        if (node.IsLeaf())
+            success = node.offset % 4 == 0 && node.count % 4 == 0 && (size_t)node.offset + node.count <= triangleIndices.size();
+        else
+        {
+            success = i + 1 < nodes.size() && node.offset > i + 1 && node.offset < nodes.size() && node.axis < 3 && depths[i] + 2 < cStackSize;
+            if (success)
+                depths[i + 1] = depths[node.offset] = depths[i] + 1;
+        }
+    }
+    for(size_t i = 0; i < triangleIndices.size() && success; ++i)
+        success = triangleIndices[i] < header[3] || triangleIndices[i] == 0xFFFFFFFF;
+
+    if (!success)
+    {
+        Clear();
+        return false;
+    }
+    numTriangles = (int)header[3];
+    return true;
+}
+
+MATH_END_NAMESPACE
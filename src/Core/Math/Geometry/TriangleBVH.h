@@ -0,0 +1,152 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   TriangleBVH.h
+    @brief  A flattened bounding volume hierarchy of static triangles, built with a binned SAH, for fast ray queries. */
+
+#pragma once
+
+#include "Math/MathNamespace.h"
+#include "Math/float3.h"
+#include "Math/MathConstants.h"
+#include "Types.h"
+#include "AABB.h"
+
+#include <vector>
+
+MATH_BEGIN_NAMESPACE
+
+class Ray;
+class Triangle;
+
+/// A bounding volume hierarchy of static triangles for ray queries.
+/** The hierarchy is built top-down with the surface area heuristic, evaluated over a fixed number of bins along the
+    longest axis of the centroid bounds of each node. The nodes are stored in a single array in depth-first order, so
+    that the left child of an inner node is the node right after it, which keeps the traversal cache-friendly.
+
+    The triangles of the leaves are stored in blocks of four in the same structure-of-arrays layout that
+    TriangleMesh::SetSoA4 produces (v0, v1-v0, v2-v0 of four triangles, 36 floats per block), and intersected four at
+    a time with the SIMD kernels in use, see SIMDKernels::intersectRayBlocks4. Leaves are padded to whole blocks with degenerate triangles that never hit.
+
+    The structure is immutable after Build() and can be queried from several threads at the same time.
+    Serialize() and Deserialize() allow storing a built hierarchy on disk to skip building it on the next run. */
+class TriangleBVH
+{
+public:
+    /// The result of a ray query.
+    struct Hit
+    {
+        Hit() : t(FLOAT_INF), triangleIndex(-1), u(0.f), v(0.f) {}
+
+        float t; ///< Distance along the ray to the hit point, or FLOAT_INF if nothing was hit.
+        int triangleIndex; ///< Index of the triangle that was hit, as given to Build(), or -1 if nothing was hit.
+        float u; ///< Barycentric u of the hit point, the weight of the second vertex of the triangle.
+        float v; ///< Barycentric v of the hit point, the weight of the third vertex of the triangle.
+    };
+
+    /// Maximum number of rays traversed together by IntersectRays.
+    static const int cPacketSize = 16;
+
+    /// Constructs an empty hierarchy.
+    TriangleBVH() : numTriangles(0) {}
+
+    /// Builds the hierarchy of the given triangles. Replaces any old contents.
+    void Build(const Triangle *triangles, int numTriangles);
+
+    /// Removes all the contents.
+    void Clear();
+
+    /// Returns true if the hierarchy has not been built or has no triangles.
+    bool IsEmpty() const { return nodes.empty(); }
+
+    /// Returns the number of triangles the hierarchy was built of.
+    int NumTriangles() const { return numTriangles; }
+
+    /// Returns the number of nodes (inner nodes and leaves).
+    int NumNodes() const { return (int)nodes.size(); }
+
+    /// Returns an AABB that encloses all the triangles, or a degenerate AABB if the hierarchy is empty.
+    AABB BoundingAABB() const;
+
+    /// Returns the number of bytes of memory used by the hierarchy.
+    size_t MemoryUsage() const;
+
+    /// Finds the nearest intersection of a ray with the triangles.
+    /** Both sides of the triangles are hit.
+        @param ray The ray to query. The direction must be normalized.
+        @param maxDistance Hits further away than this along the ray are ignored.
+        @return The nearest hit, or a Hit with t == FLOAT_INF if the ray does not hit any triangle. */
+    Hit IntersectRay(const Ray &ray, float maxDistance = FLOAT_INF) const;
+
+    /// Finds the nearest intersections of a number of rays with the triangles.
+    /** The rays are traversed in packets of cPacketSize, so that the rays of a packet share the fetches and tests of the
+        nodes they all visit. This is efficient for coherent rays, e.g. rays from the same origin to nearby directions.
+        @param rays The rays to query. The directions must be normalized.
+        @param numRays The number of rays.
+        @param outHits [out] Receives the nearest hit of each ray, numRays elements.
+        @param maxDistance Hits further away than this along the rays are ignored. */
+    void IntersectRays(const Ray *rays, int numRays, Hit *outHits, float maxDistance = FLOAT_INF) const;
+
+    /// Appends the hierarchy to a byte buffer. Note: Not endian safe.
+    void Serialize(std::vector<u8> &dst) const;
+
+    /// Replaces the contents with a hierarchy stored with Serialize.
+    /** @return True on success. On failure the hierarchy is left empty. */
+    bool Deserialize(const u8 *data, size_t numBytes);
+
+private:
+    /// @cond PRIVATE
+    /// A node of the hierarchy, 32 bytes.
+    struct Node
+    {
+        Node() : minPoint(0, 0, 0), offset(0), maxPoint(0, 0, 0), count(0), axis(0) {}
+
+        float3 minPoint;
+        /// For an inner node the index of the right child node, the left child is the next node.
+        /// For a leaf the index of the first triangle in the leaf order, always a multiple of 4.
+        u32 offset;
+        float3 maxPoint;
+        u16 count; ///< Number of triangles in a leaf including the padding, 0 for an inner node.
+        u16 axis; ///< Split axis of an inner node, used to visit the nearer child first.
+
+        bool IsLeaf() const { return count != 0; }
+    };
+
+    /// Precomputed data of a ray for the traversal.
+    struct RayData
+    {
+        float3 pos;
+        float3 dir;
+        float3 invDir;
+    };
+
+    /// A triangle being sorted to the leaves during the build.
+    struct BuildTriangle
+    {
+        AABB aabb;
+        float3 centroid;
+        u32 index;
+    };
+
+    static RayData PrepareRay(const Ray &ray);
+
+    /// Tests the ray against the AABB of the node, returning the entry distance or FLOAT_INF if the node is missed or further away than maxDistance.
+    static float IntersectNode(const Node &node, const RayData &ray, float maxDistance);
+
+    /// Tests the ray against the triangles of a leaf and updates the hit if a nearer one is found.
+    void IntersectLeaf(const Node &node, const RayData &ray, Hit &hit) const;
+
+    /// Builds the subtree of the triangles [first, first + count) of buildTris and returns the index of its root node.
+    u32 BuildNode(const Triangle *triangles, std::vector<BuildTriangle> &buildTris, u32 first, u32 count, int depth);
+
+    /// Appends a leaf of the triangles [first, first + count) of buildTris.
+    void CreateLeaf(Node &node, const Triangle *triangles, const std::vector<BuildTriangle> &buildTris, u32 first, u32 count);
+    /// @endcond
+
+    std::vector<Node> nodes; ///< Nodes in depth-first order, the root first.
+    std::vector<float> blocks; ///< Leaf triangles, 36 floats per block of four.
+    std::vector<u32> triangleIndices; ///< The original index of each triangle in the leaf order, 0xFFFFFFFF for padding.
+    int numTriangles;
+};
+
+MATH_END_NAMESPACE
@@ -19,13 +19,24 @@
 
 #include "Math/MathFwd.h"
 
+// If defined, we preprocess our TriangleMesh data structure to contain (v0, v1-v0, v2-v0)
+// instead of (v0, v1, v2) triplets for faster ray-triangle mesh intersection.
+#define SOA_HAS_EDGES
+
 MATH_BEGIN_NAMESPACE
 
+struct SIMDKernels;
+
 /// Represents an unindiced triangle mesh.
-/** This class stores a triangle mesh as flat array, optimized for ray intersections. */
+/** This class stores a triangle mesh as flat array, optimized for ray intersections. The layout of the array is chosen for
+	the SIMD kernels in use when the mesh is set, see SIMDDispatch.h: plain triangles (AoS), or blocks of 4 or 8 triangles with
+	each coordinate interleaved (SoA4, SoA8), padded with degenerate triangles to whole blocks. */
 class TriangleMesh
 {
 public:
+	TriangleMesh();
+	~TriangleMesh();
+
 	/// Specifies the vertex data of this triangle mesh. Replaces any old
 	/// specified geometry.
 	void Set(const float *triangleMesh, int numTriangles);
@@ -42,31 +53,15 @@ public:
 
 	float IntersectRay_TriangleIndex_UV_CPP(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
 
-#ifdef MATH_SSE2
-	float IntersectRay_SSE2(const Ray &ray) const;
-	float IntersectRay_TriangleIndex_SSE2(const Ray &ray, int &outTriangleIndex) const;
-	float IntersectRay_TriangleIndex_UV_SSE2(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
-#endif
-
-#ifdef MATH_SSE41
-	float IntersectRay_SSE41(const Ray &ray) const;
-	float IntersectRay_TriangleIndex_SSE41(const Ray &ray, int &outTriangleIndex) const;
-	float IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
-#endif
-
-#ifdef MATH_AVX
-	float IntersectRay_AVX(const Ray &ray) const;
-	float IntersectRay_TriangleIndex_AVX(const Ray &ray, int &outTriangleIndex) const;
-	float IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
-#endif
-
 private:
 	float *data;
-#ifdef _DEBUG
-	int vertexDataLayout; // 0 - AoS, 1 - SoA4, 2 - SoA8
-#endif
+	const SIMDKernels *kernels; ///< The kernels the data is laid out for.
 	int numTriangles;
-	void ReallocVertexBuffer(int numTriangles);
+	void ReallocVertexBuffer(int numTriangles, int blockSize);
+	void SetSoA(const float *vertexData, int numTriangles, int blockSize);
+
+	TriangleMesh(const TriangleMesh &); // Not copyable.
+	void operator =(const TriangleMesh &);
 };
 
 MATH_END_NAMESPACE
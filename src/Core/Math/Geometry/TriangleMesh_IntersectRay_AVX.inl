@@ -18,23 +18,21 @@
 MATH_BEGIN_NAMESPACE
 
 #if !defined(MATH_GEN_TRIANGLEINDEX)
-float TriangleMesh::IntersectRay_AVX(const Ray &ray) const
+float IntersectRay_AVX(const float *tris, int numTriangles, const float *rayPos, const float *rayDir)
 #elif defined(MATH_GEN_TRIANGLEINDEX) && !defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_AVX(const Ray &ray, int &outTriangleIndex) const
+float IntersectRay_TriangleIndex_AVX(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex)
 #elif defined(MATH_GEN_TRIANGLEINDEX) && defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const
+float IntersectRay_TriangleIndex_UV_AVX(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex, float &outU, float &outV)
 #endif
 {
 //	std::cout << numTris << " tris: ";
 //	TRACESTART(RayTriMeshIntersectAVX);
 
-	assert(sizeof(float3) == 3*sizeof(float));
-	assert(sizeof(Triangle) == 3*sizeof(float3));
-	assert(vertexDataLayout == 2); // Must be SoA8 structured!
+	// The triangles must be SoA8 structured, padded to a multiple of eight, and aligned to 32 bytes.
 
 //	hitTriangleIndex = -1;
 //	float3 pt;
-	const float inf = FLOAT_INF;
+	const float inf = (float)HUGE_VAL;
 	__m256 nearestD = _mm256_set1_ps(inf);
 #ifdef MATH_GEN_UV
 	__m256 nearestU = _mm256_set1_ps(inf);
@@ -44,13 +42,13 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTr
 	__m256i nearestIndex = _mm256_set1_epi32(-1);
 #endif
 
-	const __m256 lX = _mm256_broadcast_ss(&ray.pos.x);
-	const __m256 lY = _mm256_broadcast_ss(&ray.pos.y);
-	const __m256 lZ = _mm256_broadcast_ss(&ray.pos.z);
+	const __m256 lX = _mm256_broadcast_ss(rayPos);
+	const __m256 lY = _mm256_broadcast_ss(rayPos+1);
+	const __m256 lZ = _mm256_broadcast_ss(rayPos+2);
 
-	const __m256 dX = _mm256_broadcast_ss(&ray.dir.x);
-	const __m256 dY = _mm256_broadcast_ss(&ray.dir.y);
-	const __m256 dZ = _mm256_broadcast_ss(&ray.dir.z);
+	const __m256 dX = _mm256_broadcast_ss(rayDir);
+	const __m256 dY = _mm256_broadcast_ss(rayDir+1);
+	const __m256 dZ = _mm256_broadcast_ss(rayDir+2);
 
 	const __m256 epsilon = _mm256_set1_ps(1e-4f);
 	const __m256 zero = _mm256_setzero_ps();
@@ -58,11 +56,7 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTr
 
     const __m256 sign_mask = _mm256_set1_ps(-0.f); // -0.f = 1 << 31
 
-	assert(((uintptr_t)data & 0x1F) == 0);
-
-	const float *tris = reinterpret_cast<const float*>(data);
-
-	for(int i = 0; i+8 <= numTriangles; i += 8)
+	for(int i = 0; i < numTriangles; i += 8)
 	{
 		__m256 v0x = _mm256_load_ps(tris);
 		__m256 v0y = _mm256_load_ps(tris+8);
@@ -173,14 +167,14 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTr
 	}
 
 	float ds[32];
-	float *alignedDS = (float*)(((uintptr_t)ds + 0x1F) & ~0x1F);
+	float *alignedDS = (float*)(((size_t)ds + 0x1F) & ~0x1F);
 
 #ifdef MATH_GEN_UV
 	float su[32];
-	float *alignedU = (float*)(((uintptr_t)su + 0x1F) & ~0x1F);
+	float *alignedU = (float*)(((size_t)su + 0x1F) & ~0x1F);
 
 	float sv[32];
-	float *alignedV = (float*)(((uintptr_t)sv + 0x1F) & ~0x1F);
+	float *alignedV = (float*)(((size_t)sv + 0x1F) & ~0x1F);
 
 	_mm256_store_ps(alignedU, nearestU);
 	_mm256_store_ps(alignedV, nearestV);
@@ -188,14 +182,14 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTr
 
 #ifdef MATH_GEN_TRIANGLEINDEX
 	u32 ds2[32];
-	u32 *alignedDS2 = (u32*)(((uintptr_t)ds2 + 0x1F) & ~0x1F);
+	u32 *alignedDS2 = (u32*)(((size_t)ds2 + 0x1F) & ~0x1F);
 
 	_mm256_store_si256((__m256i*)alignedDS2, nearestIndex);
 #endif
 
 	_mm256_store_ps(alignedDS, nearestD);
 
-	float smallestT = FLOAT_INF;
+	float smallestT = inf;
 //	float u = FLOAT_NAN, v = FLOAT_NAN;
 	for(int i = 0; i < 8; ++i)
 		if (alignedDS[i] < smallestT)
@@ -18,29 +18,24 @@
 MATH_BEGIN_NAMESPACE
 
 #if defined(MATH_GEN_SSE2) && !defined(MATH_GEN_TRIANGLEINDEX)
-float TriangleMesh::IntersectRay_SSE2(const Ray &ray) const
+float IntersectRay_SSE2(const float *tris, int numTriangles, const float *rayPos, const float *rayDir)
 #elif defined(MATH_GEN_SSE2) && defined(MATH_GEN_TRIANGLEINDEX) && !defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_SSE2(const Ray &ray, int &outTriangleIndex) const
+float IntersectRay_TriangleIndex_SSE2(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex)
 #elif defined(MATH_GEN_SSE2) && defined(MATH_GEN_TRIANGLEINDEX) && defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE2(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const
+float IntersectRay_TriangleIndex_UV_SSE2(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex, float &outU, float &outV)
 #elif defined(MATH_GEN_SSE41) && !defined(MATH_GEN_TRIANGLEINDEX)
-float TriangleMesh::IntersectRay_SSE41(const Ray &ray) const
+float IntersectRay_SSE41(const float *tris, int numTriangles, const float *rayPos, const float *rayDir)
 #elif defined(MATH_GEN_SSE41) && defined(MATH_GEN_TRIANGLEINDEX) && !defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_SSE41(const Ray &ray, int &outTriangleIndex) const
+float IntersectRay_TriangleIndex_SSE41(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex)
 #elif defined(MATH_GEN_SSE41) && defined(MATH_GEN_TRIANGLEINDEX) && defined(MATH_GEN_UV)
-float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const
+float IntersectRay_TriangleIndex_UV_SSE41(const float *tris, int numTriangles, const float *rayPos, const float *rayDir, int &outTriangleIndex, float &outU, float &outV)
 #endif
 {
 //	std::cout << numTris << " tris: ";
 //	TRACESTART(RayTriMeshIntersectSSE);
 
-	assert(sizeof(float3) == 3*sizeof(float));
-	assert(sizeof(Triangle) == 3*sizeof(float3));
-#ifdef _DEBUG
-	assert(vertexDataLayout == 1); // Must be SoA4 structured!
-#endif
-	
-	const float inf = FLOAT_INF;
+	// The triangles must be SoA4 structured, padded to a multiple of four, and aligned to 16 bytes.
+	const float inf = (float)HUGE_VAL;
 	__m128 nearestD = _mm_set1_ps(inf);
 #ifdef MATH_GEN_UV
 	__m128 nearestU = _mm_set1_ps(inf);
@@ -50,13 +45,13 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &out
 	__m128i nearestIndex = _mm_set1_epi32(-1);
 #endif
 
-	const __m128 lX = _mm_load1_ps(&ray.pos.x);
-	const __m128 lY = _mm_load1_ps(&ray.pos.y);
-	const __m128 lZ = _mm_load1_ps(&ray.pos.z);
+	const __m128 lX = _mm_load1_ps(rayPos);
+	const __m128 lY = _mm_load1_ps(rayPos+1);
+	const __m128 lZ = _mm_load1_ps(rayPos+2);
 
-	const __m128 dX = _mm_load1_ps(&ray.dir.x);
-	const __m128 dY = _mm_load1_ps(&ray.dir.y);
-	const __m128 dZ = _mm_load1_ps(&ray.dir.z);
+	const __m128 dX = _mm_load1_ps(rayDir);
+	const __m128 dY = _mm_load1_ps(rayDir+1);
+	const __m128 dZ = _mm_load1_ps(rayDir+2);
 
 	const __m128 epsilon = _mm_set1_ps(1e-4f);
 	const __m128 zero = _mm_setzero_ps();
@@ -64,11 +59,7 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &out
 
     const __m128 sign_mask = _mm_set1_ps(-0.f); // -0.f = 1 << 31
 
-	assert(((uintptr_t)data & 0xF) == 0);
-
-	const float *tris = reinterpret_cast<const float*>(data);
-
-	for(int i = 0; i+4 <= numTriangles; i += 4)
+	for(int i = 0; i < numTriangles; i += 4)
 	{
 		__m128 v0x = _mm_load_ps(tris);
 		__m128 v0y = _mm_load_ps(tris+4);
@@ -208,14 +199,14 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &out
 	}
 
 	float ds[16];
-	float *alignedDS = (float*)(((uintptr_t)ds + 0xF) & ~0xF);
+	float *alignedDS = (float*)(((size_t)ds + 0xF) & ~0xF);
 
 #ifdef MATH_GEN_UV
 	float su[16];
-	float *alignedU = (float*)(((uintptr_t)su + 0xF) & ~0xF);
+	float *alignedU = (float*)(((size_t)su + 0xF) & ~0xF);
 
 	float sv[16];
-	float *alignedV = (float*)(((uintptr_t)sv + 0xF) & ~0xF);
+	float *alignedV = (float*)(((size_t)sv + 0xF) & ~0xF);
 
 	_mm_store_ps(alignedU, nearestU);
 	_mm_store_ps(alignedV, nearestV);
@@ -223,14 +214,14 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &out
 
 #ifdef MATH_GEN_TRIANGLEINDEX
 	u32 ds2[16];
-	u32 *alignedDS2 = (u32*)(((uintptr_t)ds2 + 0xF) & ~0xF);
+	u32 *alignedDS2 = (u32*)(((size_t)ds2 + 0xF) & ~0xF);
 
 	_mm_store_si128((__m128i*)alignedDS2, nearestIndex);
 #endif
 
 	_mm_store_ps(alignedDS, nearestD);
 
-	float smallestT = FLOAT_INF;
+	float smallestT = inf;
 //	float u = FLOAT_NAN, v = FLOAT_NAN;
 	for(int i = 0; i < 4; ++i)
 		if (alignedDS[i] < smallestT)
@@ -92,6 +92,7 @@ class TranslateOp;
 class Torus;
 class ScaleOp;
 class Triangle;
+class TriangleBVH;
 class LCG;
 
 MATH_END_NAMESPACE
@@ -25,6 +25,7 @@
 #include "Algorithm/Random/LCG.h"
 #include "assume.h"
 #include "Math/MathFunc.h"
+#include "Math/SIMDDispatch.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -657,6 +658,18 @@ Quat MUST_USE_RESULT Quat::Mul(const float3x3 &rhs) const { return *this * Quat(
 float3 MUST_USE_RESULT Quat::Mul(const float3 &vector) const { return this->Transform(vector); }
 float4 MUST_USE_RESULT Quat::Mul(const float4 &vector) const { return this->Transform(vector); }
 
+void Quat::BatchMul(Quat *out, const Quat *lhs, const Quat *rhs, int count)
+{
+	assume(out && lhs && rhs);
+	SIMD().quatMul(out->ptr(), lhs->ptr(), rhs->ptr(), count);
+}
+
+void Quat::BatchSlerp(Quat *out, const Quat *from, const Quat *to, const float *t, int count)
+{
+	assume(out && from && to && t);
+	SIMD().quatSlerp(out->ptr(), from->ptr(), to->ptr(), t, count);
+}
+
 const Quat Quat::identity = Quat(0.f, 0.f, 0.f, 1.f);
 const Quat Quat::nan = Quat(FLOAT_NAN, FLOAT_NAN, FLOAT_NAN, FLOAT_NAN);
 
@@ -381,6 +381,14 @@ public:
 	float3 MUST_USE_RESULT Mul(const float3 &vector) const;
 	float4 MUST_USE_RESULT Mul(const float4 &vector) const;
 
+	/// Computes out[i] = lhs[i] * rhs[i] for arrays of quaternions, using the SIMD kernels in use.
+	/** out may be the same array as lhs or rhs. Faster than a loop of operator * for more than a few quaternions. */
+	static void BatchMul(Quat *out, const Quat *lhs, const Quat *rhs, int count);
+
+	/// Computes out[i] = from[i].Slerp(to[i], t[i]) for arrays of normalized quaternions, using the SIMD kernels in use.
+	/** out may be the same array as from or to. The SIMD variants differ from Slerp only by rounding errors. */
+	static void BatchSlerp(Quat *out, const Quat *from, const Quat *to, const float *t, int count);
+
 private: // Hide the unsafe operations from the user, so that he doesn't accidentally invoke an unintended operation.
 
 	/// Multiplies a quaternion by a scalar.
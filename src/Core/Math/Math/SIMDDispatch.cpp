@@ -0,0 +1,309 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDDispatch.cpp
+    @brief  Runtime selection of the SIMD implementations of the hot Math kernels. */
+
+#include "Math/SIMDDispatch.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+#include "Geometry/Triangle.h"
+#include "Math/MathConstants.h"
+
+#ifdef MATH_SIMD_DISPATCH
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+#ifdef MATH_SIMD_DISPATCH
+/// Runs cpuid for the given leaf. @return False if the CPU does not have the leaf.
+bool CpuId(unsigned leaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if ((unsigned)info[0] < leaf)
+        return false;
+    __cpuid(info, (int)leaf);
+    for(int i = 0; i < 4; ++i)
+        regs[i] = (unsigned)info[i];
+    return true;
+#else
+    return __get_cpuid(leaf, &regs[0], &regs[1], &regs[2], &regs[3]) != 0;
+#endif
+}
+
+/// Returns the low bits of the extended control register XCR0, which tell the register states the operating system saves.
+unsigned ReadXCR0()
+{
+#ifdef _MSC_VER
+#if _MSC_FULL_VER >= 160040219 // Visual Studio 2010 SP1
+    return (unsigned)_xgetbv(0);
+#else
+    return 0;
+#endif
+#else
+    unsigned eax, edx;
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0)); // xgetbv, which older assemblers do not know.
+    return eax;
+#endif
+}
+#endif
+
+void Mat4x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    for(int i = 0; i < 16; i += 4)
+        for(int j = 0; j < 4; ++j)
+            out[i+j] = lhs[i] * rhs[j] + lhs[i+1] * rhs[4+j] + lhs[i+2] * rhs[8+j] + lhs[i+3] * rhs[12+j];
+}
+
+void Mat3x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    for(int i = 0; i < 12; i += 4)
+    {
+        for(int j = 0; j < 4; ++j)
+            out[i+j] = lhs[i] * rhs[j] + lhs[i+1] * rhs[4+j] + lhs[i+2] * rhs[8+j];
+        out[i+3] += lhs[i+3];
+    }
+}
+
+void TransformPos(const float *m, float *points, int numPoints, int strideBytes)
+{
+    u8 *data = reinterpret_cast<u8*>(points);
+    for(int i = 0; i < numPoints; ++i, data += strideBytes)
+    {
+        float *p = reinterpret_cast<float*>(data);
+        const float x = p[0], y = p[1], z = p[2];
+        p[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+        p[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+        p[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+void TransformDir(const float *m, float *vectors, int numVectors, int strideBytes)
+{
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    for(int i = 0; i < numVectors; ++i, data += strideBytes)
+    {
+        float *p = reinterpret_cast<float*>(data);
+        const float x = p[0], y = p[1], z = p[2];
+        p[0] = m[0] * x + m[1] * y + m[2] * z;
+        p[1] = m[4] * x + m[5] * y + m[6] * z;
+        p[2] = m[8] * x + m[9] * y + m[10] * z;
+    }
+}
+
+void QuatMul(float *out, const float *lhs, const float *rhs, int count)
+{
+    for(int i = 0; i < count * 4; i += 4)
+    {
+        const float x = lhs[i], y = lhs[i+1], z = lhs[i+2], w = lhs[i+3];
+        const float rx = rhs[i], ry = rhs[i+1], rz = rhs[i+2], rw = rhs[i+3];
+        out[i] = w*rx + x*rw + y*rz - z*ry;
+        out[i+1] = w*ry - x*rz + y*rw + z*rx;
+        out[i+2] = w*rz + x*ry - y*rx + z*rw;
+        out[i+3] = w*rw - x*rx - y*ry - z*rz;
+    }
+}
+
+void Mat3x4MulArray(float *out, const float *lhs, const float *rhs, int count)
+{
+    for(int i = 0; i < count * 12; i += 12)
+        Mat3x4Mul(out + i, lhs + i, rhs + i);
+}
+
+void QuatSlerp(float *out, const float *from, const float *to, const float *t, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        const Quat q = Quat(from + i * 4).Slerp(Quat(to + i * 4), t[i]);
+        out[i * 4] = q.x;
+        out[i * 4 + 1] = q.y;
+        out[i * 4 + 2] = q.z;
+        out[i * 4 + 3] = q.w;
+    }
+}
+
+void TransformAABBs(const float *m, float *aabbs, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        float *minPoint = aabbs + i * 6;
+        float *maxPoint = minPoint + 3;
+        const float3 center = (float3(minPoint) + float3(maxPoint)) * 0.5f;
+        const float3 halfSize = (float3(maxPoint) - float3(minPoint)) * 0.5f;
+        for(int row = 0; row < 3; ++row)
+        {
+            const float *r = m + row * 4;
+            const float c = r[0] * center.x + r[1] * center.y + r[2] * center.z + r[3];
+            const float h = fabs(r[0]) * halfSize.x + fabs(r[1]) * halfSize.y + fabs(r[2]) * halfSize.z;
+            minPoint[row] = c - h;
+            maxPoint[row] = c + h;
+        }
+    }
+}
+
+float IntersectRayTriangles(const float *vertexData, int numTriangles, const float *rayPos, const float *rayDir,
+    int &outTriangleIndex, float &outU, float &outV)
+{
+    const float3 pos(rayPos);
+    const float3 dir(rayDir);
+    const float3 *v = reinterpret_cast<const float3*>(vertexData);
+    float nearestD = FLOAT_INF;
+    for(int i = 0; i < numTriangles; ++i, v += 3)
+    {
+        float u, v2;
+        const float d = Triangle::IntersectLineTri(pos, dir, v[0], v[1], v[2], u, v2);
+        if (d >= 0.f && d < nearestD)
+        {
+            nearestD = d;
+            outU = u;
+            outV = v2;
+            outTriangleIndex = i;
+        }
+    }
+    return nearestD;
+}
+
+int IntersectRayBlocks4(const float *blocks, int numBlocks, const float *rayPos, const float *rayDir, float epsilon,
+    float &t, float &u, float &v)
+{
+    const float3 pos(rayPos);
+    const float3 dir(rayDir);
+    int hitIndex = -1;
+    for(int b = 0; b < numBlocks; ++b)
+    {
+        const float *tris = blocks + b * 36;
+        for(int lane = 0; lane < 4; ++lane)
+        {
+            const float3 v0(tris[lane], tris[4 + lane], tris[8 + lane]);
+            const float3 e1(tris[12 + lane], tris[16 + lane], tris[20 + lane]);
+            const float3 e2(tris[24 + lane], tris[28 + lane], tris[32 + lane]);
+
+            const float3 p = dir.Cross(e2);
+            const float det = e1.Dot(p);
+            if (fabs(det) <= epsilon)
+                continue;
+            const float recipDet = 1.f / det;
+            const float3 tv = pos - v0;
+            const float hitU = tv.Dot(p) * recipDet;
+            if (hitU < -epsilon || hitU > 1.f + epsilon)
+                continue;
+            const float3 q = tv.Cross(e1);
+            const float hitV = dir.Dot(q) * recipDet;
+            if (hitV < -epsilon || hitU + hitV > 1.f + epsilon)
+                continue;
+            const float hitT = e2.Dot(q) * recipDet;
+            if (hitT < 0.f || hitT >= t)
+                continue;
+            t = hitT;
+            u = hitU;
+            v = hitV;
+            hitIndex = b * 4 + lane;
+        }
+    }
+    return hitIndex;
+}
+
+const SIMDKernels scalarKernels =
+{
+    SIMDScalar,
+    Mat4x4Mul,
+    Mat3x4Mul,
+    TransformPos,
+    TransformDir,
+    QuatMul,
+    Mat3x4MulArray,
+    QuatSlerp,
+    TransformAABBs,
+    1,
+    IntersectRayTriangles,
+    IntersectRayBlocks4
+};
+
+/// Chooses the kernels of the fastest level the CPU supports.
+bool SelectFastestSIMDKernels()
+{
+    for(int level = DetectSIMDLevel(); level > SIMDScalar; --level)
+        if (SetSIMDLevel((SIMDLevel)level))
+            return true;
+    return false;
+}
+
+} // ~unnamed namespace
+
+/// Starts with the scalar kernels, which are statically initialized and thus usable by the static initializers of other
+/// translation units, and switches to the fastest supported ones during the dynamic initialization of this file.
+const SIMDKernels *activeSIMDKernels = &scalarKernels;
+static const bool simdKernelsSelected = SelectFastestSIMDKernels();
+
+const SIMDKernels *ScalarSIMDKernels()
+{
+    return &scalarKernels;
+}
+
+SIMDLevel DetectSIMDLevel()
+{
+    SIMDLevel level = SIMDScalar;
+#ifdef MATH_SIMD_DISPATCH
+    unsigned regs[4];
+    if (!CpuId(1, regs))
+        return level;
+    const unsigned ecx = regs[2];
+    const unsigned edx = regs[3];
+    if (edx & (1u << 26))
+        level = SIMDSSE2;
+    if (level == SIMDSSE2 && (ecx & (1u << 19)))
+        level = SIMDSSE41;
+    // AVX also needs the operating system to save the upper halves of the registers on context switches:
+    // OSXSAVE tells that XCR0 can be read, and its bits 1 and 2 that the SSE and AVX states are saved.
+    const bool hasAVX = (ecx & (1u << 28)) != 0;
+    const bool hasOSXSAVE = (ecx & (1u << 27)) != 0;
+    if (level == SIMDSSE41 && hasAVX && hasOSXSAVE && (ReadXCR0() & 6) == 6)
+        level = SIMDAVX;
+#endif
+    return level;
+}
+
+const char *SIMDLevelName(SIMDLevel level)
+{
+    switch(level)
+    {
+    case SIMDScalar: return "Scalar";
+    case SIMDSSE2: return "SSE2";
+    case SIMDSSE41: return "SSE4.1";
+    case SIMDAVX: return "AVX";
+    default: return "Unknown";
+    }
+}
+
+const SIMDKernels *SIMDKernelsForLevel(SIMDLevel level)
+{
+    switch(level)
+    {
+    case SIMDScalar: return ScalarSIMDKernels();
+    case SIMDSSE2: return SSE2SIMDKernels();
+    case SIMDSSE41: return SSE41SIMDKernels();
+    case SIMDAVX: return AVXSIMDKernels();
+    default: return 0;
+    }
+}
+
+bool SetSIMDLevel(SIMDLevel level)
+{
+    const SIMDKernels *kernels = SIMDKernelsForLevel(level);
+    if (!kernels || level > DetectSIMDLevel())
+        return false;
+    activeSIMDKernels = kernels;
+    return true;
+}
+
+MATH_END_NAMESPACE
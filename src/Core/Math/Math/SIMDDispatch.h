@@ -0,0 +1,116 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDDispatch.h
+    @brief  Runtime selection of the SIMD implementations of the hot Math kernels. */
+
+#pragma once
+
+#include "Math/MathNamespace.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+/// Defined when the SIMD variants of the kernels are compiled in, and chosen at runtime.
+#define MATH_SIMD_DISPATCH
+#endif
+
+MATH_BEGIN_NAMESPACE
+
+/// The instruction set levels the kernels are compiled for, in increasing order.
+enum SIMDLevel
+{
+    SIMDScalar = 0, ///< Plain C++.
+    SIMDSSE2,
+    SIMDSSE41,
+    SIMDAVX,
+    NumSIMDLevels
+};
+
+/// The implementations of the hot Math kernels for one instruction set level.
+/** The kernels work on raw float arrays, so that the translation units of the SIMD variants, which are compiled with their
+    instruction set enabled, do not need the Math classes. Matrices are row-major like float3x4 and float4x4, and quaternions
+    are stored as x, y, z, w like Quat. The functions of float3x4, float4x4, Quat and TriangleMesh that have a dispatched
+    implementation forward to the kernels in use, so calling the classes is enough to use the fastest variant. */
+struct SIMDKernels
+{
+    /// The instruction set level these kernels are compiled for.
+    SIMDLevel level;
+
+    /// out = lhs * rhs for 4x4 matrices. out may not alias lhs or rhs.
+    void (*mat4x4Mul)(float *out, const float *lhs, const float *rhs);
+
+    /// out = lhs * rhs for 3x4 matrices, whose implicit last row is (0, 0, 0, 1). out may not alias lhs or rhs.
+    void (*mat3x4Mul)(float *out, const float *lhs, const float *rhs);
+
+    /// Transforms points in place by the first three rows of a 3x4 or 4x4 matrix, i.e. as (x, y, z, 1).
+    /** @param strideBytes The distance between the starts of consecutive points, at least the size of three floats. */
+    void (*transformPos)(const float *matrix, float *points, int numPoints, int strideBytes);
+
+    /// Transforms direction vectors in place by the first three rows of a 3x4 or 4x4 matrix, i.e. as (x, y, z, 0).
+    void (*transformDir)(const float *matrix, float *vectors, int numVectors, int strideBytes);
+
+    /// out[i] = lhs[i] * rhs[i] for arrays of quaternions. out may be the same array as lhs or rhs.
+    void (*quatMul)(float *out, const float *lhs, const float *rhs, int count);
+
+    /// out[i] = lhs[i] * rhs[i] for arrays of 3x4 matrices, e.g. to compose local transforms with the world transforms of
+    /// their parents. out may not alias lhs or rhs.
+    void (*mat3x4MulArray)(float *out, const float *lhs, const float *rhs, int count);
+
+    /// out[i] = from[i].Slerp(to[i], t[i]) for arrays of normalized quaternions, see Quat::Slerp. out may be the same array as from or to.
+    /** The SIMD variants evaluate acos and sin with polynomials, so their results differ from Quat::Slerp by rounding errors. */
+    void (*quatSlerp)(float *out, const float *from, const float *to, const float *t, int count);
+
+    /// Transforms axis-aligned bounding boxes, stored as the min and max points, in place by the first three rows of a 3x4
+    /// or 4x4 matrix, like AABB::TransformAsAABB.
+    void (*transformAABBs)(const float *matrix, float *aabbs, int count);
+
+    /// The number of triangles interleaved in a block of the vertex data of intersectRayTriangles: 1, 4 or 8, see TriangleMesh.
+    int triangleBlockSize;
+
+    /// Returns the distance along the ray to the nearest triangle hit, or infinity if none is hit.
+    /** @param vertexData The vertices of the triangles, laid out by TriangleMesh for triangleBlockSize, and aligned to 32 bytes.
+        @param outTriangleIndex, outU, outV Receive the index and the barycentric coordinates of the hit, if any. */
+    float (*intersectRayTriangles)(const float *vertexData, int numTriangles, const float *rayPos, const float *rayDir,
+        int &outTriangleIndex, float &outU, float &outV);
+
+    /// Finds the nearest triangle hit by a ray in blocks of four triangles laid out like the SoA4 layout of TriangleMesh.
+    /** Unlike intersectRayTriangles, uses the exact reciprocal of the determinant and counts the edges of the triangles as
+        inside by epsilon, like Triangle::IntersectLineTri. Used for the leaves of TriangleBVH. The blocks need not be aligned.
+        @param t The distance of the nearest hit so far; only closer hits are reported. Updated with u and v on a hit.
+        @return The index of the triangle hit from the start of blocks, or -1 if none is closer than t. */
+    int (*intersectRayBlocks4)(const float *blocks, int numBlocks, const float *rayPos, const float *rayDir, float epsilon,
+        float &t, float &u, float &v);
+};
+
+/// Returns the highest instruction set level both the CPU and the operating system support.
+SIMDLevel DetectSIMDLevel();
+
+/// Returns the name of an instruction set level, e.g. "SSE4.1".
+const char *SIMDLevelName(SIMDLevel level);
+
+/// Returns the kernels compiled for the given level, or null if the level is not compiled in, e.g. on other CPU architectures.
+/** Does not check that the CPU supports the level, see DetectSIMDLevel. */
+const SIMDKernels *SIMDKernelsForLevel(SIMDLevel level);
+
+/// The kernels in use, see SIMD(). Set to the fastest supported level when the program starts; change with SetSIMDLevel.
+extern const SIMDKernels *activeSIMDKernels;
+
+/// Returns the kernels in use.
+inline const SIMDKernels &SIMD() { return *activeSIMDKernels; }
+
+/// Returns the instruction set level in use.
+inline SIMDLevel ActiveSIMDLevel() { return activeSIMDKernels->level; }
+
+/// Changes the instruction set level in use, e.g. to compare the variants.
+/** Not thread-safe: call before other threads use the Math library. Data already prepared for a level, like the vertex data of
+    a TriangleMesh, keeps using the kernels it was prepared for.
+    @return False, leaving the level unchanged, if the level is not compiled in or the CPU does not support it. */
+bool SetSIMDLevel(SIMDLevel level);
+
+/// The kernels of each level. The scalar ones are in SIMDDispatch.cpp, the others in SIMDKernels_<level>.cpp.
+/** The SIMD ones return null if their translation unit was not compiled with the instruction set enabled. */
+const SIMDKernels *ScalarSIMDKernels();
+const SIMDKernels *SSE2SIMDKernels();
+const SIMDKernels *SSE41SIMDKernels();
+const SIMDKernels *AVXSIMDKernels();
+
+MATH_END_NAMESPACE
@@ -0,0 +1,435 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_AVX.cpp
+    @brief  The AVX variant of the dispatched Math kernels. Compiled with AVX enabled, see CMakeLists.txt.
+
+    Like SIMDKernels_SSE.inl, must not call inline functions of other headers, see there. The kernels process two matrix rows,
+    or eight vectors, at a time, using the 128-bit lanes of the AVX registers like two SSE registers. The ray tests of the
+    TriangleBVH leaves, whose few blocks of four triangles do not fill the AVX registers, use the SSE kernel compiled for AVX. */
+
+#include "Math/SIMDDispatch.h"
+
+#if defined(MATH_SIMD_DISPATCH) && (defined(__AVX__) || (defined(_MSC_VER) && _MSC_VER >= 1600))
+
+#include "Geometry/TriangleMesh.h"
+
+#include <immintrin.h>
+#include <math.h>
+
+#include "Math/SIMDKernels_SSE.inl"
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+/// Loads four floats to both lanes.
+#define AVX_LOAD_DUP(p) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p), 1)
+
+/// Loads four floats to each lane.
+#define AVX_LOAD_2X4(lo, hi) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1)
+
+/// Stores the lanes to two addresses.
+#define AVX_STORE_2X4(lo, hi, v) { _mm_storeu_ps(lo, _mm256_castps256_ps128(v)); _mm_storeu_ps(hi, _mm256_extractf128_ps(v, 1)); }
+
+/// Broadcasts element i of each lane within the lane.
+#define AVX_SPLAT(v, i) _mm256_permute_ps((v), _MM_SHUFFLE(i, i, i, i))
+
+void AVX_Mat4x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    const __m256 r0 = AVX_LOAD_DUP(rhs);
+    const __m256 r1 = AVX_LOAD_DUP(rhs + 4);
+    const __m256 r2 = AVX_LOAD_DUP(rhs + 8);
+    const __m256 r3 = AVX_LOAD_DUP(rhs + 12);
+    for(int i = 0; i < 16; i += 8)
+    {
+        const __m256 l = _mm256_loadu_ps(lhs + i); // Two rows.
+        const __m256 xy = _mm256_add_ps(_mm256_mul_ps(AVX_SPLAT(l, 0), r0), _mm256_mul_ps(AVX_SPLAT(l, 1), r1));
+        const __m256 zw = _mm256_add_ps(_mm256_mul_ps(AVX_SPLAT(l, 2), r2), _mm256_mul_ps(AVX_SPLAT(l, 3), r3));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(xy, zw));
+    }
+}
+
+void AVX_Mat3x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    const __m256 r0 = AVX_LOAD_DUP(rhs);
+    const __m256 r1 = AVX_LOAD_DUP(rhs + 4);
+    const __m256 r2 = AVX_LOAD_DUP(rhs + 8);
+    const __m256 r3 = _mm256_set_ps(1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f); // The implicit last row (0, 0, 0, 1).
+
+    const __m256 l = _mm256_loadu_ps(lhs); // The first two rows.
+    const __m256 xy = _mm256_add_ps(_mm256_mul_ps(AVX_SPLAT(l, 0), r0), _mm256_mul_ps(AVX_SPLAT(l, 1), r1));
+    const __m256 zw = _mm256_add_ps(_mm256_mul_ps(AVX_SPLAT(l, 2), r2), _mm256_mul_ps(AVX_SPLAT(l, 3), r3));
+    _mm256_storeu_ps(out, _mm256_add_ps(xy, zw));
+
+    // The last row in the low lane only.
+    const __m128 l2 = _mm_loadu_ps(lhs + 8);
+    const __m128 xy2 = _mm_add_ps(_mm_mul_ps(_mm_permute_ps(l2, 0x00), _mm256_castps256_ps128(r0)), _mm_mul_ps(_mm_permute_ps(l2, 0x55), _mm256_castps256_ps128(r1)));
+    const __m128 zw2 = _mm_add_ps(_mm_mul_ps(_mm_permute_ps(l2, 0xAA), _mm256_castps256_ps128(r2)), _mm_mul_ps(_mm_permute_ps(l2, 0xFF), _mm256_castps256_ps128(r3)));
+    _mm_storeu_ps(out + 8, _mm_add_ps(xy2, zw2));
+}
+
+/// Transforms eight vectors in SoA form by the first three rows of a matrix, with the translation if Pos is true.
+template<bool Pos>
+struct AVX_Transform
+{
+    __m256 m[12];
+
+    explicit AVX_Transform(const float *matrix)
+    {
+        for(int i = 0; i < 12; ++i)
+            m[i] = _mm256_broadcast_ss(matrix + i);
+    }
+
+    void operator()(__m256 &x, __m256 &y, __m256 &z) const
+    {
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], x), _mm256_mul_ps(m[1], y)), _mm256_mul_ps(m[2], z));
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[4], x), _mm256_mul_ps(m[5], y)), _mm256_mul_ps(m[6], z));
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[8], x), _mm256_mul_ps(m[9], y)), _mm256_mul_ps(m[10], z));
+        if (Pos)
+        {
+            rx = _mm256_add_ps(rx, m[3]);
+            ry = _mm256_add_ps(ry, m[7]);
+            rz = _mm256_add_ps(rz, m[11]);
+        }
+        x = rx;
+        y = ry;
+        z = rz;
+    }
+};
+
+/// Converts two groups of four packed float3s, one in each lane, to SoA form, see SSE_DEINTERLEAVE3 in SIMDKernels_SSE.inl.
+#define AVX_DEINTERLEAVE3(a, b, c, x, y, z) \
+    { \
+        const __m256 xy23 = _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2)); \
+        const __m256 yz01 = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1)); \
+        x = _mm256_shuffle_ps(a, xy23, _MM_SHUFFLE(2, 0, 3, 0)); \
+        y = _mm256_shuffle_ps(yz01, xy23, _MM_SHUFFLE(3, 1, 2, 0)); \
+        z = _mm256_shuffle_ps(yz01, c, _MM_SHUFFLE(3, 0, 3, 1)); \
+    }
+
+/// The inverse of AVX_DEINTERLEAVE3.
+#define AVX_INTERLEAVE3(x, y, z, a, b, c) \
+    { \
+        const __m256 xy01 = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(1, 0, 1, 0)); \
+        const __m256 xy23 = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(3, 2, 3, 2)); \
+        a = _mm256_shuffle_ps(xy01, _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)); \
+        b = _mm256_shuffle_ps(_mm256_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23, _MM_SHUFFLE(2, 0, 2, 0)); \
+        c = _mm256_shuffle_ps(_mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm256_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)); \
+    }
+
+template<bool Pos>
+void AVX_TransformArray(const float *matrix, float *vectors, int numVectors, int strideBytes)
+{
+    const AVX_Transform<Pos> transform(matrix);
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    int i = 0;
+    if (strideBytes == 3 * sizeof(float))
+    {
+        for(; i + 8 <= numVectors; i += 8)
+        {
+            float *p = vectors + i * 3;
+            __m256 a = AVX_LOAD_2X4(p, p + 12);
+            __m256 b = AVX_LOAD_2X4(p + 4, p + 16);
+            __m256 c = AVX_LOAD_2X4(p + 8, p + 20);
+            __m256 x, y, z;
+            AVX_DEINTERLEAVE3(a, b, c, x, y, z);
+            transform(x, y, z);
+            AVX_INTERLEAVE3(x, y, z, a, b, c);
+            AVX_STORE_2X4(p, p + 12, a);
+            AVX_STORE_2X4(p + 4, p + 16, b);
+            AVX_STORE_2X4(p + 8, p + 20, c);
+        }
+    }
+    else
+    {
+        for(; i + 8 <= numVectors; i += 8)
+        {
+            float *p[8];
+            for(int j = 0; j < 8; ++j)
+                p[j] = reinterpret_cast<float*>(data + (i + j) * strideBytes);
+            __m256 x = _mm256_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0], p[4][0], p[5][0], p[6][0], p[7][0]);
+            __m256 y = _mm256_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1], p[4][1], p[5][1], p[6][1], p[7][1]);
+            __m256 z = _mm256_setr_ps(p[0][2], p[1][2], p[2][2], p[3][2], p[4][2], p[5][2], p[6][2], p[7][2]);
+            transform(x, y, z);
+            float rx[8], ry[8], rz[8];
+            _mm256_storeu_ps(rx, x);
+            _mm256_storeu_ps(ry, y);
+            _mm256_storeu_ps(rz, z);
+            for(int j = 0; j < 8; ++j)
+            {
+                p[j][0] = rx[j];
+                p[j][1] = ry[j];
+                p[j][2] = rz[j];
+            }
+        }
+    }
+    if (i < numVectors)
+    {
+        const SIMDKernels *scalar = ScalarSIMDKernels();
+        (Pos ? scalar->transformPos : scalar->transformDir)(matrix, reinterpret_cast<float*>(data + i * strideBytes), numVectors - i, strideBytes);
+    }
+}
+
+void AVX_TransformPos(const float *matrix, float *points, int numPoints, int strideBytes)
+{
+    AVX_TransformArray<true>(matrix, points, numPoints, strideBytes);
+}
+
+void AVX_TransformDir(const float *matrix, float *vectors, int numVectors, int strideBytes)
+{
+    AVX_TransformArray<false>(matrix, vectors, numVectors, strideBytes);
+}
+
+/// Transposes the 4x4 matrix in each lane of the four registers, like _MM_TRANSPOSE4_PS.
+#define AVX_TRANSPOSE4_LANES(r0, r1, r2, r3) \
+    { \
+        const __m256 t0 = _mm256_unpacklo_ps(r0, r1); \
+        const __m256 t1 = _mm256_unpacklo_ps(r2, r3); \
+        const __m256 t2 = _mm256_unpackhi_ps(r0, r1); \
+        const __m256 t3 = _mm256_unpackhi_ps(r2, r3); \
+        r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0)); \
+        r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2)); \
+        r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0)); \
+        r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2)); \
+    }
+
+void AVX_QuatMul(float *out, const float *lhs, const float *rhs, int count)
+{
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        // Loading two quaternions per register and transposing the lanes gives the SoA form, with the quaternions in the order
+        // 0 2 4 6 1 3 5 7. The order does not matter, as the same transpose puts them back.
+        const float *l = lhs + i * 4;
+        const float *r = rhs + i * 4;
+        __m256 x = _mm256_loadu_ps(l), y = _mm256_loadu_ps(l + 8), z = _mm256_loadu_ps(l + 16), w = _mm256_loadu_ps(l + 24);
+        __m256 rx = _mm256_loadu_ps(r), ry = _mm256_loadu_ps(r + 8), rz = _mm256_loadu_ps(r + 16), rw = _mm256_loadu_ps(r + 24);
+        AVX_TRANSPOSE4_LANES(x, y, z, w);
+        AVX_TRANSPOSE4_LANES(rx, ry, rz, rw);
+
+        __m256 ox = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w, rx), _mm256_mul_ps(x, rw)), _mm256_mul_ps(y, rz)), _mm256_mul_ps(z, ry));
+        __m256 oy = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(w, ry), _mm256_mul_ps(x, rz)), _mm256_mul_ps(y, rw)), _mm256_mul_ps(z, rx));
+        __m256 oz = _mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(w, rz), _mm256_mul_ps(x, ry)), _mm256_mul_ps(y, rx)), _mm256_mul_ps(z, rw));
+        __m256 ow = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(w, rw), _mm256_mul_ps(x, rx)), _mm256_mul_ps(y, ry)), _mm256_mul_ps(z, rz));
+
+        AVX_TRANSPOSE4_LANES(ox, oy, oz, ow);
+        _mm256_storeu_ps(out + i * 4, ox);
+        _mm256_storeu_ps(out + i * 4 + 8, oy);
+        _mm256_storeu_ps(out + i * 4 + 16, oz);
+        _mm256_storeu_ps(out + i * 4 + 24, ow);
+    }
+    if (i < count)
+        ScalarSIMDKernels()->quatMul(out + i * 4, lhs + i * 4, rhs + i * 4, count - i);
+}
+
+void AVX_Mat3x4MulArray(float *out, const float *lhs, const float *rhs, int count)
+{
+    for(int i = 0; i < count * 12; i += 12)
+        AVX_Mat3x4Mul(out + i, lhs + i, rhs + i);
+}
+
+/// Returns a * x + b, to evaluate polynomials with Horner's rule.
+#define AVX_MADD(a, x, b) _mm256_add_ps(_mm256_mul_ps(a, x), _mm256_set1_ps(b))
+
+/// Returns acos(x) for 0 <= x <= 1, see SSE_ACos01.
+__m256 AVX_ACos01(__m256 x)
+{
+    __m256 p = _mm256_set1_ps(-0.0012624911f);
+    p = AVX_MADD(p, x, 0.0066700901f);
+    p = AVX_MADD(p, x, -0.0170881256f);
+    p = AVX_MADD(p, x, 0.0308918810f);
+    p = AVX_MADD(p, x, -0.0501743046f);
+    p = AVX_MADD(p, x, 0.0889789874f);
+    p = AVX_MADD(p, x, -0.2145988016f);
+    p = AVX_MADD(p, x, 1.5707963050f);
+    return _mm256_mul_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), x)), p);
+}
+
+/// Returns sin(x) for 0 <= x <= pi/2, see SSE_Sin0ToHalfPi.
+__m256 AVX_Sin0ToHalfPi(__m256 x)
+{
+    const __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(-1.f / 39916800.f);
+    p = AVX_MADD(p, x2, 1.f / 362880.f);
+    p = AVX_MADD(p, x2, -1.f / 5040.f);
+    p = AVX_MADD(p, x2, 1.f / 120.f);
+    p = AVX_MADD(p, x2, -1.f / 6.f);
+    p = AVX_MADD(p, x2, 1.f);
+    return _mm256_mul_ps(p, x);
+}
+
+void AVX_QuatSlerp(float *out, const float *from, const float *to, const float *t, int count)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        // The quaternions are in the order 0 2 4 6 1 3 5 7 after the transpose, see AVX_QuatMul, so the weights are shuffled to match.
+        const float *f = from + i * 4;
+        const float *d = to + i * 4;
+        __m256 x = _mm256_loadu_ps(f), y = _mm256_loadu_ps(f + 8), z = _mm256_loadu_ps(f + 16), w = _mm256_loadu_ps(f + 24);
+        __m256 tx = _mm256_loadu_ps(d), ty = _mm256_loadu_ps(d + 8), tz = _mm256_loadu_ps(d + 16), tw = _mm256_loadu_ps(d + 24);
+        AVX_TRANSPOSE4_LANES(x, y, z, w);
+        AVX_TRANSPOSE4_LANES(tx, ty, tz, tw);
+        const __m128 t03 = _mm_loadu_ps(t + i);
+        const __m128 t47 = _mm_loadu_ps(t + i + 4);
+        const __m256 weight = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_shuffle_ps(t03, t47, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_shuffle_ps(t03, t47, _MM_SHUFFLE(3, 1, 3, 1)), 1);
+
+        // The steps of Quat::Slerp, like in SSE_Slerp.
+        __m256 cosAngle = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, tx), _mm256_mul_ps(y, ty)), _mm256_add_ps(_mm256_mul_ps(z, tz), _mm256_mul_ps(w, tw)));
+        const __m256 sign = _mm256_and_ps(cosAngle, signMask);
+        cosAngle = _mm256_xor_ps(cosAngle, sign);
+        const __m256 angle = AVX_ACos01(cosAngle);
+        const __m256 c = _mm256_div_ps(one, AVX_Sin0ToHalfPi(angle));
+        const __m256 oneMinusT = _mm256_sub_ps(one, weight);
+        __m256 a = _mm256_mul_ps(AVX_Sin0ToHalfPi(_mm256_mul_ps(oneMinusT, angle)), c);
+        __m256 b = _mm256_mul_ps(AVX_Sin0ToHalfPi(_mm256_mul_ps(angle, weight)), c);
+        const __m256 linear = _mm256_cmp_ps(cosAngle, _mm256_set1_ps(0.97f), _CMP_GT_OQ);
+        a = _mm256_xor_ps(_mm256_blendv_ps(a, oneMinusT, linear), sign);
+        b = _mm256_blendv_ps(b, weight, linear);
+
+        x = _mm256_add_ps(_mm256_mul_ps(x, a), _mm256_mul_ps(tx, b));
+        y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_mul_ps(ty, b));
+        z = _mm256_add_ps(_mm256_mul_ps(z, a), _mm256_mul_ps(tz, b));
+        w = _mm256_add_ps(_mm256_mul_ps(w, a), _mm256_mul_ps(tw, b));
+        const __m256 lengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_add_ps(_mm256_mul_ps(z, z), _mm256_mul_ps(w, w)));
+        const __m256 rcpLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSq));
+        x = _mm256_mul_ps(x, rcpLength);
+        y = _mm256_mul_ps(y, rcpLength);
+        z = _mm256_mul_ps(z, rcpLength);
+        w = _mm256_mul_ps(w, rcpLength);
+
+        AVX_TRANSPOSE4_LANES(x, y, z, w);
+        _mm256_storeu_ps(out + i * 4, x);
+        _mm256_storeu_ps(out + i * 4 + 8, y);
+        _mm256_storeu_ps(out + i * 4 + 16, z);
+        _mm256_storeu_ps(out + i * 4 + 24, w);
+    }
+    if (i < count)
+        SSE_QuatSlerp(out + i * 4, from + i * 4, to + i * 4, t + i, count - i);
+}
+
+void AVX_TransformAABBs(const float *matrix, float *aabbs, int count)
+{
+    const AVX_Transform<true> transform(matrix);
+    __m256 absM[9];
+    for(int row = 0; row < 3; ++row)
+        for(int col = 0; col < 3; ++col)
+            absM[row * 3 + col] = _mm256_set1_ps(fabsf(matrix[row * 4 + col]));
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        // The low lanes hold the AABBs 0, 1, 4 and 5, the high lanes 2, 3, 6 and 7, see SSE_TransformAABBs.
+        float *p = aabbs + i * 6;
+        __m256 a = AVX_LOAD_2X4(p, p + 12), b = AVX_LOAD_2X4(p + 4, p + 16), c = AVX_LOAD_2X4(p + 8, p + 20);
+        __m256 x01, y01, z01, x23, y23, z23;
+        AVX_DEINTERLEAVE3(a, b, c, x01, y01, z01);
+        a = AVX_LOAD_2X4(p + 24, p + 36);
+        b = AVX_LOAD_2X4(p + 28, p + 40);
+        c = AVX_LOAD_2X4(p + 32, p + 44);
+        AVX_DEINTERLEAVE3(a, b, c, x23, y23, z23);
+        const __m256 minX = _mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 minY = _mm256_shuffle_ps(y01, y23, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 minZ = _mm256_shuffle_ps(z01, z23, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 maxX = _mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m256 maxY = _mm256_shuffle_ps(y01, y23, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m256 maxZ = _mm256_shuffle_ps(z01, z23, _MM_SHUFFLE(3, 1, 3, 1));
+
+        __m256 cx = _mm256_mul_ps(_mm256_add_ps(minX, maxX), half);
+        __m256 cy = _mm256_mul_ps(_mm256_add_ps(minY, maxY), half);
+        __m256 cz = _mm256_mul_ps(_mm256_add_ps(minZ, maxZ), half);
+        const __m256 hx = _mm256_mul_ps(_mm256_sub_ps(maxX, minX), half);
+        const __m256 hy = _mm256_mul_ps(_mm256_sub_ps(maxY, minY), half);
+        const __m256 hz = _mm256_mul_ps(_mm256_sub_ps(maxZ, minZ), half);
+        transform(cx, cy, cz);
+        const __m256 ex = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absM[0], hx), _mm256_mul_ps(absM[1], hy)), _mm256_mul_ps(absM[2], hz));
+        const __m256 ey = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absM[3], hx), _mm256_mul_ps(absM[4], hy)), _mm256_mul_ps(absM[5], hz));
+        const __m256 ez = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absM[6], hx), _mm256_mul_ps(absM[7], hy)), _mm256_mul_ps(absM[8], hz));
+        const __m256 newMinX = _mm256_sub_ps(cx, ex), newMinY = _mm256_sub_ps(cy, ey), newMinZ = _mm256_sub_ps(cz, ez);
+        const __m256 newMaxX = _mm256_add_ps(cx, ex), newMaxY = _mm256_add_ps(cy, ey), newMaxZ = _mm256_add_ps(cz, ez);
+
+        x01 = _mm256_unpacklo_ps(newMinX, newMaxX);
+        y01 = _mm256_unpacklo_ps(newMinY, newMaxY);
+        z01 = _mm256_unpacklo_ps(newMinZ, newMaxZ);
+        AVX_INTERLEAVE3(x01, y01, z01, a, b, c);
+        AVX_STORE_2X4(p, p + 12, a);
+        AVX_STORE_2X4(p + 4, p + 16, b);
+        AVX_STORE_2X4(p + 8, p + 20, c);
+        x23 = _mm256_unpackhi_ps(newMinX, newMaxX);
+        y23 = _mm256_unpackhi_ps(newMinY, newMaxY);
+        z23 = _mm256_unpackhi_ps(newMinZ, newMaxZ);
+        AVX_INTERLEAVE3(x23, y23, z23, a, b, c);
+        AVX_STORE_2X4(p + 24, p + 36, a);
+        AVX_STORE_2X4(p + 28, p + 40, b);
+        AVX_STORE_2X4(p + 32, p + 44, c);
+    }
+    if (i < count)
+        SSE_TransformAABBs(matrix, aabbs + i * 6, count - i);
+}
+
+#undef AVX_LOAD_DUP
+#undef AVX_LOAD_2X4
+#undef AVX_STORE_2X4
+#undef AVX_SPLAT
+#undef AVX_DEINTERLEAVE3
+#undef AVX_INTERLEAVE3
+#undef AVX_TRANSPOSE4_LANES
+#undef AVX_MADD
+
+} // ~unnamed namespace
+
+MATH_END_NAMESPACE
+
+#define MATH_GEN_AVX
+#define MATH_GEN_TRIANGLEINDEX
+#define MATH_GEN_UV
+#include "Geometry/TriangleMesh_IntersectRay_AVX.inl"
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+const SIMDKernels avxKernels =
+{
+    SIMDAVX,
+    AVX_Mat4x4Mul,
+    AVX_Mat3x4Mul,
+    AVX_TransformPos,
+    AVX_TransformDir,
+    AVX_QuatMul,
+    AVX_Mat3x4MulArray,
+    AVX_QuatSlerp,
+    AVX_TransformAABBs,
+    8,
+    IntersectRay_TriangleIndex_UV_AVX,
+    SSE_IntersectRayBlocks4
+};
+
+} // ~unnamed namespace
+
+const SIMDKernels *AVXSIMDKernels()
+{
+    return &avxKernels;
+}
+
+MATH_END_NAMESPACE
+
+#else
+
+MATH_BEGIN_NAMESPACE
+
+const SIMDKernels *AVXSIMDKernels()
+{
+    return 0;
+}
+
+MATH_END_NAMESPACE
+
+#endif
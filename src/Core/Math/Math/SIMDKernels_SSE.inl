@@ -0,0 +1,444 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_SSE.inl
+    @brief  The SSE implementations of the dispatched Math kernels.
+
+    Included by SIMDKernels_SSE2.cpp, SIMDKernels_SSE41.cpp and SIMDKernels_AVX.cpp, which compile it with their instruction
+    set enabled. Like the files including it, uses no inline functions of other headers: the compiler could emit their out-of-line copies with the
+    instruction set enabled, and the linker pick those for the rest of the program. */
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+#define SSE_SPLAT(v, i) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(i, i, i, i))
+
+void SSE_Mat4x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    const __m128 r0 = _mm_loadu_ps(rhs);
+    const __m128 r1 = _mm_loadu_ps(rhs + 4);
+    const __m128 r2 = _mm_loadu_ps(rhs + 8);
+    const __m128 r3 = _mm_loadu_ps(rhs + 12);
+    for(int i = 0; i < 16; i += 4)
+    {
+        const __m128 l = _mm_loadu_ps(lhs + i);
+        const __m128 xy = _mm_add_ps(_mm_mul_ps(SSE_SPLAT(l, 0), r0), _mm_mul_ps(SSE_SPLAT(l, 1), r1));
+        const __m128 zw = _mm_add_ps(_mm_mul_ps(SSE_SPLAT(l, 2), r2), _mm_mul_ps(SSE_SPLAT(l, 3), r3));
+        _mm_storeu_ps(out + i, _mm_add_ps(xy, zw));
+    }
+}
+
+void SSE_Mat3x4Mul(float *out, const float *lhs, const float *rhs)
+{
+    const __m128 r0 = _mm_loadu_ps(rhs);
+    const __m128 r1 = _mm_loadu_ps(rhs + 4);
+    const __m128 r2 = _mm_loadu_ps(rhs + 8);
+    const __m128 r3 = _mm_set_ps(1.f, 0.f, 0.f, 0.f); // The implicit last row (0, 0, 0, 1).
+    for(int i = 0; i < 12; i += 4)
+    {
+        const __m128 l = _mm_loadu_ps(lhs + i);
+        const __m128 xy = _mm_add_ps(_mm_mul_ps(SSE_SPLAT(l, 0), r0), _mm_mul_ps(SSE_SPLAT(l, 1), r1));
+        const __m128 zw = _mm_add_ps(_mm_mul_ps(SSE_SPLAT(l, 2), r2), _mm_mul_ps(SSE_SPLAT(l, 3), r3));
+        _mm_storeu_ps(out + i, _mm_add_ps(xy, zw));
+    }
+}
+
+/// Transforms four vectors in SoA form by the first three rows of a matrix, with the translation if Pos is true.
+template<bool Pos>
+struct SSE_Transform
+{
+    __m128 m[12];
+
+    explicit SSE_Transform(const float *matrix)
+    {
+        for(int i = 0; i < 12; ++i)
+            m[i] = _mm_set1_ps(matrix[i]);
+    }
+
+    void operator()(__m128 &x, __m128 &y, __m128 &z) const
+    {
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[1], y)), _mm_mul_ps(m[2], z));
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[4], x), _mm_mul_ps(m[5], y)), _mm_mul_ps(m[6], z));
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[8], x), _mm_mul_ps(m[9], y)), _mm_mul_ps(m[10], z));
+        if (Pos)
+        {
+            rx = _mm_add_ps(rx, m[3]);
+            ry = _mm_add_ps(ry, m[7]);
+            rz = _mm_add_ps(rz, m[11]);
+        }
+        x = rx;
+        y = ry;
+        z = rz;
+    }
+};
+
+/// Converts four packed float3s (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3) to SoA form (x0 x1 x2 x3) (y0 ...) (z0 ...).
+#define SSE_DEINTERLEAVE3(a, b, c, x, y, z) \
+    { \
+        const __m128 xy23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2)); \
+        const __m128 yz01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1)); \
+        x = _mm_shuffle_ps(a, xy23, _MM_SHUFFLE(2, 0, 3, 0)); \
+        y = _mm_shuffle_ps(yz01, xy23, _MM_SHUFFLE(3, 1, 2, 0)); \
+        z = _mm_shuffle_ps(yz01, c, _MM_SHUFFLE(3, 0, 3, 1)); \
+    }
+
+/// The inverse of SSE_DEINTERLEAVE3.
+#define SSE_INTERLEAVE3(x, y, z, a, b, c) \
+    { \
+        const __m128 xy01 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 0, 1, 0)); \
+        const __m128 xy23 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 2, 3, 2)); \
+        a = _mm_shuffle_ps(xy01, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)); \
+        b = _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23, _MM_SHUFFLE(2, 0, 2, 0)); \
+        c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)); \
+    }
+
+template<bool Pos>
+void SSE_TransformArray(const float *matrix, float *vectors, int numVectors, int strideBytes)
+{
+    const SSE_Transform<Pos> transform(matrix);
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    int i = 0;
+    if (strideBytes == 3 * sizeof(float))
+    {
+        for(; i + 4 <= numVectors; i += 4)
+        {
+            float *p = vectors + i * 3;
+            __m128 a = _mm_loadu_ps(p);
+            __m128 b = _mm_loadu_ps(p + 4);
+            __m128 c = _mm_loadu_ps(p + 8);
+            __m128 x, y, z;
+            SSE_DEINTERLEAVE3(a, b, c, x, y, z);
+            transform(x, y, z);
+            SSE_INTERLEAVE3(x, y, z, a, b, c);
+            _mm_storeu_ps(p, a);
+            _mm_storeu_ps(p + 4, b);
+            _mm_storeu_ps(p + 8, c);
+        }
+    }
+    else if (strideBytes >= 4 * (int)sizeof(float))
+    {
+        // Each point but the last of a group of four is followed by at least one float of the next point, so it can be loaded
+        // with a single instruction. The results are stored three floats at a time, leaving the rest of the elements intact.
+        for(; i + 4 <= numVectors; i += 4)
+        {
+            float *p0 = reinterpret_cast<float*>(data + i * strideBytes);
+            float *p1 = reinterpret_cast<float*>(data + (i + 1) * strideBytes);
+            float *p2 = reinterpret_cast<float*>(data + (i + 2) * strideBytes);
+            float *p3 = reinterpret_cast<float*>(data + (i + 3) * strideBytes);
+            __m128 x = _mm_loadu_ps(p0);
+            __m128 y = _mm_loadu_ps(p1);
+            __m128 z = _mm_loadu_ps(p2);
+            __m128 w = _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p3)), _mm_load_ss(p3 + 2));
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            transform(x, y, z);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storel_pi(reinterpret_cast<__m64*>(p0), x);
+            _mm_store_ss(p0 + 2, _mm_movehl_ps(x, x));
+            _mm_storel_pi(reinterpret_cast<__m64*>(p1), y);
+            _mm_store_ss(p1 + 2, _mm_movehl_ps(y, y));
+            _mm_storel_pi(reinterpret_cast<__m64*>(p2), z);
+            _mm_store_ss(p2 + 2, _mm_movehl_ps(z, z));
+            _mm_storel_pi(reinterpret_cast<__m64*>(p3), w);
+            _mm_store_ss(p3 + 2, _mm_movehl_ps(w, w));
+        }
+    }
+    if (i < numVectors)
+    {
+        const SIMDKernels *scalar = ScalarSIMDKernels();
+        (Pos ? scalar->transformPos : scalar->transformDir)(matrix, reinterpret_cast<float*>(data + i * strideBytes), numVectors - i, strideBytes);
+    }
+}
+
+void SSE_TransformPos(const float *matrix, float *points, int numPoints, int strideBytes)
+{
+    SSE_TransformArray<true>(matrix, points, numPoints, strideBytes);
+}
+
+void SSE_TransformDir(const float *matrix, float *vectors, int numVectors, int strideBytes)
+{
+    SSE_TransformArray<false>(matrix, vectors, numVectors, strideBytes);
+}
+
+void SSE_QuatMul(float *out, const float *lhs, const float *rhs, int count)
+{
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        const float *l = lhs + i * 4;
+        const float *r = rhs + i * 4;
+        __m128 x = _mm_loadu_ps(l), y = _mm_loadu_ps(l + 4), z = _mm_loadu_ps(l + 8), w = _mm_loadu_ps(l + 12);
+        __m128 rx = _mm_loadu_ps(r), ry = _mm_loadu_ps(r + 4), rz = _mm_loadu_ps(r + 8), rw = _mm_loadu_ps(r + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+
+        __m128 ox = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w, rx), _mm_mul_ps(x, rw)), _mm_mul_ps(y, rz)), _mm_mul_ps(z, ry));
+        __m128 oy = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(w, ry), _mm_mul_ps(x, rz)), _mm_mul_ps(y, rw)), _mm_mul_ps(z, rx));
+        __m128 oz = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(w, rz), _mm_mul_ps(x, ry)), _mm_mul_ps(y, rx)), _mm_mul_ps(z, rw));
+        __m128 ow = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(w, rw), _mm_mul_ps(x, rx)), _mm_mul_ps(y, ry)), _mm_mul_ps(z, rz));
+
+        _MM_TRANSPOSE4_PS(ox, oy, oz, ow);
+        _mm_storeu_ps(out + i * 4, ox);
+        _mm_storeu_ps(out + i * 4 + 4, oy);
+        _mm_storeu_ps(out + i * 4 + 8, oz);
+        _mm_storeu_ps(out + i * 4 + 12, ow);
+    }
+    if (i < count)
+        ScalarSIMDKernels()->quatMul(out + i * 4, lhs + i * 4, rhs + i * 4, count - i);
+}
+
+void SSE_Mat3x4MulArray(float *out, const float *lhs, const float *rhs, int count)
+{
+    for(int i = 0; i < count * 12; i += 12)
+        SSE_Mat3x4Mul(out + i, lhs + i, rhs + i);
+}
+
+/// Returns a * x + b, to evaluate polynomials with Horner's rule.
+#define SSE_MADD(a, x, b) _mm_add_ps(_mm_mul_ps(a, x), _mm_set1_ps(b))
+
+/// Returns acos(x) for 0 <= x <= 1, with an absolute error below 1e-7 (Abramowitz and Stegun 4.4.46).
+__m128 SSE_ACos01(__m128 x)
+{
+    __m128 p = _mm_set1_ps(-0.0012624911f);
+    p = SSE_MADD(p, x, 0.0066700901f);
+    p = SSE_MADD(p, x, -0.0170881256f);
+    p = SSE_MADD(p, x, 0.0308918810f);
+    p = SSE_MADD(p, x, -0.0501743046f);
+    p = SSE_MADD(p, x, 0.0889789874f);
+    p = SSE_MADD(p, x, -0.2145988016f);
+    p = SSE_MADD(p, x, 1.5707963050f);
+    return _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.f), x)), p);
+}
+
+/// Returns sin(x) for 0 <= x <= pi/2 from its Taylor series, with an absolute error below 1e-7.
+__m128 SSE_Sin0ToHalfPi(__m128 x)
+{
+    const __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_set1_ps(-1.f / 39916800.f);
+    p = SSE_MADD(p, x2, 1.f / 362880.f);
+    p = SSE_MADD(p, x2, -1.f / 5040.f);
+    p = SSE_MADD(p, x2, 1.f / 120.f);
+    p = SSE_MADD(p, x2, -1.f / 6.f);
+    p = SSE_MADD(p, x2, 1.f);
+    return _mm_mul_ps(p, x);
+}
+
+/// Slerps four quaternions in SoA form, see Quat::Slerp, which this follows step by step.
+void SSE_Slerp(__m128 &x, __m128 &y, __m128 &z, __m128 &w, __m128 tx, __m128 ty, __m128 tz, __m128 tw, __m128 t)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 signMask = _mm_set1_ps(-0.f);
+
+    // Rotate along the shorter arc: negate the weight of the source if the dot product is negative.
+    __m128 cosAngle = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, tx), _mm_mul_ps(y, ty)), _mm_add_ps(_mm_mul_ps(z, tz), _mm_mul_ps(w, tw)));
+    const __m128 sign = _mm_and_ps(cosAngle, signMask);
+    cosAngle = _mm_xor_ps(cosAngle, sign);
+
+    const __m128 angle = SSE_ACos01(cosAngle);
+    const __m128 c = _mm_div_ps(one, SSE_Sin0ToHalfPi(angle));
+    const __m128 oneMinusT = _mm_sub_ps(one, t);
+    __m128 a = _mm_mul_ps(SSE_Sin0ToHalfPi(_mm_mul_ps(oneMinusT, angle)), c);
+    __m128 b = _mm_mul_ps(SSE_Sin0ToHalfPi(_mm_mul_ps(angle, t)), c);
+
+    // Close to the same orientation, where 1 / sin(angle) blows up, interpolate linearly. The bitwise selection also drops
+    // the infinities and NaNs computed for those quaternions above.
+    const __m128 linear = _mm_cmpgt_ps(cosAngle, _mm_set1_ps(0.97f));
+    a = _mm_or_ps(_mm_and_ps(linear, oneMinusT), _mm_andnot_ps(linear, a));
+    b = _mm_or_ps(_mm_and_ps(linear, t), _mm_andnot_ps(linear, b));
+    a = _mm_xor_ps(a, sign);
+
+    x = _mm_add_ps(_mm_mul_ps(x, a), _mm_mul_ps(tx, b));
+    y = _mm_add_ps(_mm_mul_ps(y, a), _mm_mul_ps(ty, b));
+    z = _mm_add_ps(_mm_mul_ps(z, a), _mm_mul_ps(tz, b));
+    w = _mm_add_ps(_mm_mul_ps(w, a), _mm_mul_ps(tw, b));
+    const __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+    const __m128 rcpLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+    x = _mm_mul_ps(x, rcpLength);
+    y = _mm_mul_ps(y, rcpLength);
+    z = _mm_mul_ps(z, rcpLength);
+    w = _mm_mul_ps(w, rcpLength);
+}
+
+void SSE_QuatSlerp(float *out, const float *from, const float *to, const float *t, int count)
+{
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        const float *f = from + i * 4;
+        const float *d = to + i * 4;
+        __m128 x = _mm_loadu_ps(f), y = _mm_loadu_ps(f + 4), z = _mm_loadu_ps(f + 8), w = _mm_loadu_ps(f + 12);
+        __m128 tx = _mm_loadu_ps(d), ty = _mm_loadu_ps(d + 4), tz = _mm_loadu_ps(d + 8), tw = _mm_loadu_ps(d + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+        SSE_Slerp(x, y, z, w, tx, ty, tz, tw, _mm_loadu_ps(t + i));
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(out + i * 4, x);
+        _mm_storeu_ps(out + i * 4 + 4, y);
+        _mm_storeu_ps(out + i * 4 + 8, z);
+        _mm_storeu_ps(out + i * 4 + 12, w);
+    }
+    if (i < count)
+        ScalarSIMDKernels()->quatSlerp(out + i * 4, from + i * 4, to + i * 4, t + i, count - i);
+}
+
+/// Transforms four AABBs in SoA form like AABB::TransformAsAABB: the center as a point, and the half size by the absolute
+/// values of the matrix.
+struct SSE_AABBTransform
+{
+    SSE_Transform<true> transform;
+    __m128 absM[9];
+
+    explicit SSE_AABBTransform(const float *matrix) :
+        transform(matrix)
+    {
+        for(int row = 0; row < 3; ++row)
+            for(int col = 0; col < 3; ++col)
+                absM[row * 3 + col] = _mm_set1_ps(fabsf(matrix[row * 4 + col]));
+    }
+
+    void operator()(__m128 &minX, __m128 &minY, __m128 &minZ, __m128 &maxX, __m128 &maxY, __m128 &maxZ) const
+    {
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 cx = _mm_mul_ps(_mm_add_ps(minX, maxX), half);
+        __m128 cy = _mm_mul_ps(_mm_add_ps(minY, maxY), half);
+        __m128 cz = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half);
+        const __m128 hx = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+        const __m128 hy = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+        const __m128 hz = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+        transform(cx, cy, cz);
+        const __m128 ex = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absM[0], hx), _mm_mul_ps(absM[1], hy)), _mm_mul_ps(absM[2], hz));
+        const __m128 ey = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absM[3], hx), _mm_mul_ps(absM[4], hy)), _mm_mul_ps(absM[5], hz));
+        const __m128 ez = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absM[6], hx), _mm_mul_ps(absM[7], hy)), _mm_mul_ps(absM[8], hz));
+        minX = _mm_sub_ps(cx, ex);
+        minY = _mm_sub_ps(cy, ey);
+        minZ = _mm_sub_ps(cz, ez);
+        maxX = _mm_add_ps(cx, ex);
+        maxY = _mm_add_ps(cy, ey);
+        maxZ = _mm_add_ps(cz, ez);
+    }
+};
+
+void SSE_TransformAABBs(const float *matrix, float *aabbs, int count)
+{
+    const SSE_AABBTransform transform(matrix);
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        // The four AABBs are eight packed float3s, min0 max0 min1 max1 and min2 max2 min3 max3.
+        float *p = aabbs + i * 6;
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        __m128 x01, y01, z01, x23, y23, z23;
+        SSE_DEINTERLEAVE3(a, b, c, x01, y01, z01);
+        a = _mm_loadu_ps(p + 12);
+        b = _mm_loadu_ps(p + 16);
+        c = _mm_loadu_ps(p + 20);
+        SSE_DEINTERLEAVE3(a, b, c, x23, y23, z23);
+        __m128 minX = _mm_shuffle_ps(x01, x23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 minY = _mm_shuffle_ps(y01, y23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 minZ = _mm_shuffle_ps(z01, z23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 maxX = _mm_shuffle_ps(x01, x23, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 maxY = _mm_shuffle_ps(y01, y23, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 maxZ = _mm_shuffle_ps(z01, z23, _MM_SHUFFLE(3, 1, 3, 1));
+        transform(minX, minY, minZ, maxX, maxY, maxZ);
+        x01 = _mm_unpacklo_ps(minX, maxX);
+        y01 = _mm_unpacklo_ps(minY, maxY);
+        z01 = _mm_unpacklo_ps(minZ, maxZ);
+        SSE_INTERLEAVE3(x01, y01, z01, a, b, c);
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+        x23 = _mm_unpackhi_ps(minX, maxX);
+        y23 = _mm_unpackhi_ps(minY, maxY);
+        z23 = _mm_unpackhi_ps(minZ, maxZ);
+        SSE_INTERLEAVE3(x23, y23, z23, a, b, c);
+        _mm_storeu_ps(p + 12, a);
+        _mm_storeu_ps(p + 16, b);
+        _mm_storeu_ps(p + 20, c);
+    }
+    if (i < count)
+        ScalarSIMDKernels()->transformAABBs(matrix, aabbs + i * 6, count - i);
+}
+
+int SSE_IntersectRayBlocks4(const float *blocks, int numBlocks, const float *rayPos, const float *rayDir, float epsilon,
+    float &t, float &u, float &v)
+{
+    const __m128 lX = _mm_set1_ps(rayPos[0]);
+    const __m128 lY = _mm_set1_ps(rayPos[1]);
+    const __m128 lZ = _mm_set1_ps(rayPos[2]);
+    const __m128 dX = _mm_set1_ps(rayDir[0]);
+    const __m128 dY = _mm_set1_ps(rayDir[1]);
+    const __m128 dZ = _mm_set1_ps(rayDir[2]);
+    const __m128 eps = _mm_set1_ps(epsilon);
+    const __m128 minusEps = _mm_set1_ps(-epsilon);
+    const __m128 onePlusEps = _mm_set1_ps(1.f + epsilon);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 signMask = _mm_set1_ps(-0.f);
+
+    int hitIndex = -1;
+    for(int b = 0; b < numBlocks; ++b)
+    {
+        const float *tris = blocks + b * 36;
+        const __m128 v0x = _mm_loadu_ps(tris);
+        const __m128 v0y = _mm_loadu_ps(tris + 4);
+        const __m128 v0z = _mm_loadu_ps(tris + 8);
+        const __m128 e1x = _mm_loadu_ps(tris + 12);
+        const __m128 e1y = _mm_loadu_ps(tris + 16);
+        const __m128 e1z = _mm_loadu_ps(tris + 20);
+        const __m128 e2x = _mm_loadu_ps(tris + 24);
+        const __m128 e2y = _mm_loadu_ps(tris + 28);
+        const __m128 e2z = _mm_loadu_ps(tris + 32);
+
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(dY, e2z), _mm_mul_ps(dZ, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(dZ, e2x), _mm_mul_ps(dX, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(dX, e2y), _mm_mul_ps(dY, e2x));
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 out = _mm_cmple_ps(_mm_andnot_ps(signMask, det), eps);
+        if (_mm_movemask_ps(out) == 0xF)
+            continue;
+        const __m128 recipDet = _mm_div_ps(one, det);
+
+        const __m128 tx = _mm_sub_ps(lX, v0x);
+        const __m128 ty = _mm_sub_ps(lY, v0y);
+        const __m128 tz = _mm_sub_ps(lZ, v0z);
+        const __m128 hitU = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), recipDet);
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(hitU, minusEps), _mm_cmpgt_ps(hitU, onePlusEps)));
+
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        const __m128 hitV = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dX, qx), _mm_mul_ps(dY, qy)), _mm_mul_ps(dZ, qz)), recipDet);
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(hitV, minusEps), _mm_cmpgt_ps(_mm_add_ps(hitU, hitV), onePlusEps)));
+
+        const __m128 hitT = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), recipDet);
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(hitT, zero), _mm_cmpge_ps(hitT, _mm_set1_ps(t))));
+
+        const int outMask = _mm_movemask_ps(out);
+        if (outMask == 0xF)
+            continue;
+
+        float ts[4], us[4], vs[4];
+        _mm_storeu_ps(ts, hitT);
+        _mm_storeu_ps(us, hitU);
+        _mm_storeu_ps(vs, hitV);
+        for(int lane = 0; lane < 4; ++lane)
+            if (!(outMask & (1 << lane)) && ts[lane] < t)
+            {
+                t = ts[lane];
+                u = us[lane];
+                v = vs[lane];
+                hitIndex = b * 4 + lane;
+            }
+    }
+    return hitIndex;
+}
+
+#undef SSE_SPLAT
+#undef SSE_MADD
+#undef SSE_DEINTERLEAVE3
+#undef SSE_INTERLEAVE3
+
+} // ~unnamed namespace
+
+MATH_END_NAMESPACE
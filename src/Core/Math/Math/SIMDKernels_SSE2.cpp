@@ -0,0 +1,66 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_SSE2.cpp
+    @brief  The SSE2 variant of the dispatched Math kernels. Compiled with SSE2 enabled, see CMakeLists.txt.
+
+    Like SIMDKernels_SSE.inl, must not call inline functions of other headers, see there. */
+
+#include "Math/SIMDDispatch.h"
+
+#if defined(MATH_SIMD_DISPATCH) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#include "Geometry/TriangleMesh.h"
+
+#include <emmintrin.h>
+#include <math.h>
+
+#include "Math/SIMDKernels_SSE.inl"
+
+#define MATH_GEN_SSE2
+#define MATH_GEN_TRIANGLEINDEX
+#define MATH_GEN_UV
+#include "Geometry/TriangleMesh_IntersectRay_SSE.inl"
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+const SIMDKernels sse2Kernels =
+{
+    SIMDSSE2,
+    SSE_Mat4x4Mul,
+    SSE_Mat3x4Mul,
+    SSE_TransformPos,
+    SSE_TransformDir,
+    SSE_QuatMul,
+    SSE_Mat3x4MulArray,
+    SSE_QuatSlerp,
+    SSE_TransformAABBs,
+    4,
+    IntersectRay_TriangleIndex_UV_SSE2,
+    SSE_IntersectRayBlocks4
+};
+
+} // ~unnamed namespace
+
+const SIMDKernels *SSE2SIMDKernels()
+{
+    return &sse2Kernels;
+}
+
+MATH_END_NAMESPACE
+
+#else
+
+MATH_BEGIN_NAMESPACE
+
+const SIMDKernels *SSE2SIMDKernels()
+{
+    return 0;
+}
+
+MATH_END_NAMESPACE
+
+#endif
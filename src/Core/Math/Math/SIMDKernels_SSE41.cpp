@@ -0,0 +1,68 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_SSE41.cpp
+    @brief  The SSE4.1 variant of the dispatched Math kernels. Compiled with SSE4.1 enabled, see CMakeLists.txt.
+
+    The math kernels are the SSE ones, which gain little from SSE4.1; the ray tests use its blend instructions.
+
+    Like SIMDKernels_SSE.inl, must not call inline functions of other headers, see there. */
+
+#include "Math/SIMDDispatch.h"
+
+#if defined(MATH_SIMD_DISPATCH) && (defined(__SSE4_1__) || defined(_MSC_VER))
+
+#include "Geometry/TriangleMesh.h"
+
+#include <smmintrin.h>
+#include <math.h>
+
+#include "Math/SIMDKernels_SSE.inl"
+
+#define MATH_GEN_SSE41
+#define MATH_GEN_TRIANGLEINDEX
+#define MATH_GEN_UV
+#include "Geometry/TriangleMesh_IntersectRay_SSE.inl"
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+const SIMDKernels sse41Kernels =
+{
+    SIMDSSE41,
+    SSE_Mat4x4Mul,
+    SSE_Mat3x4Mul,
+    SSE_TransformPos,
+    SSE_TransformDir,
+    SSE_QuatMul,
+    SSE_Mat3x4MulArray,
+    SSE_QuatSlerp,
+    SSE_TransformAABBs,
+    4,
+    IntersectRay_TriangleIndex_UV_SSE41,
+    SSE_IntersectRayBlocks4
+};
+
+} // ~unnamed namespace
+
+const SIMDKernels *SSE41SIMDKernels()
+{
+    return &sse41Kernels;
+}
+
+MATH_END_NAMESPACE
+
+#else
+
+MATH_BEGIN_NAMESPACE
+
+const SIMDKernels *SSE41SIMDKernels()
+{
+    return 0;
+}
+
+MATH_END_NAMESPACE
+
+#endif
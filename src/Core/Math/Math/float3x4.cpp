@@ -29,6 +29,7 @@
 #include "Geometry/Plane.h"
 #include "TransformOps.h"
 #include "SSEMath.h"
+#include "Math/SIMDDispatch.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -1125,8 +1126,7 @@ void float3x4::BatchTransformPos(float3 *pointArray, int numPoints) const
 	if (!pointArray)
 		return;
 #endif
-	for(int i = 0; i < numPoints; ++i)
-		pointArray[i] = MulPos(pointArray[i]);
+	SIMD().transformPos(ptr(), reinterpret_cast<float*>(pointArray), numPoints, sizeof(float3));
 }
 
 void float3x4::BatchTransformPos(float3 *pointArray, int numPoints, int stride) const
@@ -1137,12 +1137,7 @@ void float3x4::BatchTransformPos(float3 *pointArray, int numPoints, int stride)
 		return;
 #endif
 	assume(stride >= (int)sizeof(float3));
-	u8 *data = reinterpret_cast<u8*>(pointArray);
-	for(int i = 0; i < numPoints; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data + stride*i);
-		*v = MulPos(*v);
-	}
+	SIMD().transformPos(ptr(), reinterpret_cast<float*>(pointArray), numPoints, stride);
 }
 
 void float3x4::BatchTransformDir(float3 *dirArray, int numVectors) const
@@ -1152,8 +1147,7 @@ void float3x4::BatchTransformDir(float3 *dirArray, int numVectors) const
 	if (!dirArray)
 		return;
 #endif
-	for(int i = 0; i < numVectors; ++i)
-		dirArray[i] = MulPos(dirArray[i]);
+	SIMD().transformDir(ptr(), reinterpret_cast<float*>(dirArray), numVectors, sizeof(float3));
 }
 
 void float3x4::BatchTransformDir(float3 *dirArray, int numVectors, int stride) const
@@ -1164,12 +1158,15 @@ void float3x4::BatchTransformDir(float3 *dirArray, int numVectors, int stride) c
 		return;
 #endif
 	assume(stride >= (int)sizeof(float3));
-	u8 *data = reinterpret_cast<u8*>(dirArray);
-	for(int i = 0; i < numVectors; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data + stride*i);
-		*v = MulDir(*v);
-	}
+	SIMD().transformDir(ptr(), reinterpret_cast<float*>(dirArray), numVectors, stride);
+}
+
+void float3x4::BatchMul(float3x4 *out, const float3x4 *lhs, const float3x4 *rhs, int count)
+{
+	assume(out != lhs && out != rhs);
+	if (count <= 0)
+		return;
+	SIMD().mat3x4MulArray(out->ptr(), lhs->ptr(), rhs->ptr(), count);
 }
 
 void float3x4::BatchTransform(float4 *vectorArray, int numVectors) const
@@ -1230,24 +1227,7 @@ float3x4 float3x4::operator *(const float3x4 &rhs) const
 #ifdef MATH_SSE
 	_mm_mat3x4_mul_ps(r.row, row, rhs.row);
 #else
-	const float *c0 = rhs.ptr();
-	const float *c1 = rhs.ptr() + 1;
-	const float *c2 = rhs.ptr() + 2;
-	const float *c3 = rhs.ptr() + 3;
-	r[0][0] = DOT3STRIDED(v[0], c0, 4);
-	r[0][1] = DOT3STRIDED(v[0], c1, 4);
-	r[0][2] = DOT3STRIDED(v[0], c2, 4);
-	r[0][3] = DOT3STRIDED(v[0], c3, 4) + v[0][3];
-
-	r[1][0] = DOT3STRIDED(v[1], c0, 4);
-	r[1][1] = DOT3STRIDED(v[1], c1, 4);
-	r[1][2] = DOT3STRIDED(v[1], c2, 4);
-	r[1][3] = DOT3STRIDED(v[1], c3, 4) + v[1][3];
-
-	r[2][0] = DOT3STRIDED(v[2], c0, 4);
-	r[2][1] = DOT3STRIDED(v[2], c1, 4);
-	r[2][2] = DOT3STRIDED(v[2], c2, 4);
-	r[2][3] = DOT3STRIDED(v[2], c3, 4) + v[2][3];
+	SIMD().mat3x4Mul(r.ptr(), ptr(), rhs.ptr());
 #endif
 
 	return r;
@@ -624,6 +624,10 @@ public:
 	/// Performs a batch transform of the given array.
 	void BatchTransform(float4 *vectorArray, int numVectors, int stride) const;
 
+	/// Computes out[i] = lhs[i] * rhs[i] for arrays of matrices, e.g. composes local transforms with the world transforms of their parents.
+	/** Uses the SIMD kernels in use, see SIMDDispatch.h. out may not be the same array as lhs or rhs. */
+	static void BatchMul(float3x4 *out, const float3x4 *lhs, const float3x4 *rhs, int count);
+
 	/// Treats the float3x3 as a 4-by-4 matrix with the last row and column as identity, and multiplies the two matrices.
 	float3x4 operator *(const float3x3 &rhs) const;
 
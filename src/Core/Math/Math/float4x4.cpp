@@ -29,6 +29,7 @@
 #include "Geometry/Plane.h"
 #include "Algorithm/Random/LCG.h"
 #include "SSEMath.h"
+#include "Math/SIMDDispatch.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -1485,8 +1486,8 @@ void float4x4::TransformPos(float3 *pointArray, int numPoints) const
 	if (!pointArray)
 		return;
 #endif
-	for(int i = 0; i < numPoints; ++i)
-		pointArray[i] = this->TransformPos(pointArray[i]);
+	assume(!this->ContainsProjection()); // The kernels do not divide by w.
+	SIMD().transformPos(ptr(), reinterpret_cast<float*>(pointArray), numPoints, sizeof(float3));
 }
 
 void float4x4::TransformPos(float3 *pointArray, int numPoints, int strideBytes) const
@@ -1496,13 +1497,8 @@ void float4x4::TransformPos(float3 *pointArray, int numPoints, int strideBytes)
 	if (!pointArray)
 		return;
 #endif
-	u8 *data = reinterpret_cast<u8*>(pointArray);
-	for(int i = 0; i < numPoints; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data);
-		*v = this->TransformPos(*v);
-		data += strideBytes;
-	}
+	assume(!this->ContainsProjection()); // The kernels do not divide by w.
+	SIMD().transformPos(ptr(), reinterpret_cast<float*>(pointArray), numPoints, strideBytes);
 }
 
 void float4x4::TransformDir(float3 *dirArray, int numVectors) const
@@ -1512,8 +1508,8 @@ void float4x4::TransformDir(float3 *dirArray, int numVectors) const
 	if (!dirArray)
 		return;
 #endif
-	for(int i = 0; i < numVectors; ++i)
-		dirArray[i] = this->TransformDir(dirArray[i]);
+	assume(!this->ContainsProjection()); // The kernels do not divide by w.
+	SIMD().transformDir(ptr(), reinterpret_cast<float*>(dirArray), numVectors, sizeof(float3));
 }
 
 void float4x4::TransformDir(float3 *dirArray, int numVectors, int strideBytes) const
@@ -1523,13 +1519,8 @@ void float4x4::TransformDir(float3 *dirArray, int numVectors, int strideBytes) c
 	if (!dirArray)
 		return;
 #endif
-	u8 *data = reinterpret_cast<u8*>(dirArray);
-	for(int i = 0; i < numVectors; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data);
-		*v = this->TransformDir(*v);
-		data += strideBytes;
-	}
+	assume(!this->ContainsProjection()); // The kernels do not divide by w.
+	SIMD().transformDir(ptr(), reinterpret_cast<float*>(dirArray), numVectors, strideBytes);
 }
 
 void float4x4::Transform(float4 *vectorArray, int numVectors) const
@@ -1626,29 +1617,7 @@ float4x4 float4x4::operator *(const float4x4 &rhs) const
 #ifdef MATH_AUTOMATIC_SSE
 	_mm_mat4x4_mul_ps(r.row, this->row, rhs.row);
 #else
-	const float *c0 = rhs.ptr();
-	const float *c1 = rhs.ptr() + 1;
-	const float *c2 = rhs.ptr() + 2;
-	const float *c3 = rhs.ptr() + 3;
-	r[0][0] = DOT4STRIDED(v[0], c0, 4);
-	r[0][1] = DOT4STRIDED(v[0], c1, 4);
-	r[0][2] = DOT4STRIDED(v[0], c2, 4);
-	r[0][3] = DOT4STRIDED(v[0], c3, 4);
-
-	r[1][0] = DOT4STRIDED(v[1], c0, 4);
-	r[1][1] = DOT4STRIDED(v[1], c1, 4);
-	r[1][2] = DOT4STRIDED(v[1], c2, 4);
-	r[1][3] = DOT4STRIDED(v[1], c3, 4);
-
-	r[2][0] = DOT4STRIDED(v[2], c0, 4);
-	r[2][1] = DOT4STRIDED(v[2], c1, 4);
-	r[2][2] = DOT4STRIDED(v[2], c2, 4);
-	r[2][3] = DOT4STRIDED(v[2], c3, 4);
-
-	r[3][0] = DOT4STRIDED(v[3], c0, 4);
-	r[3][1] = DOT4STRIDED(v[3], c1, 4);
-	r[3][2] = DOT4STRIDED(v[3], c2, 4);
-	r[3][3] = DOT4STRIDED(v[3], c3, 4);
+	SIMD().mat4x4Mul(r.ptr(), ptr(), rhs.ptr());
 #endif
 
 	return r;
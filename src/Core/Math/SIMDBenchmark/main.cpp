@@ -0,0 +1,417 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+/** Standalone benchmark for the dispatched Math kernels, see SIMDDispatch.h.
+    Runs every kernel with each instruction set level the host CPU supports, checks the results against the scalar kernels,
+    and prints the time per element. Then compares the batch functions of the Math classes against loops of their per-element
+    counterparts with the fastest level.
+    Usage: SIMDBenchmark [--iterations <count>] */
+
+#include "Math/SIMDDispatch.h"
+#include "Math/float3.h"
+#include "Math/float3x4.h"
+#include "Math/float4x4.h"
+#include "Math/Quat.h"
+#include "Math/MathConstants.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Ray.h"
+#include "Geometry/TriangleMesh.h"
+#include "Algorithm/Random/LCG.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+
+const int cNumMatrices = 4096;
+const int cNumPoints = 65536;
+const int cNumQuats = 65536;
+const int cNumTriangles = 4096;
+const int cNumRays = 256;
+const int cNumAABBs = 65536;
+
+/// The distance between the points of the strided transform tests, like a vertex with a position and a normal.
+const int cVertexStride = 6 * sizeof(float);
+
+/// The input data shared by all levels.
+struct BenchmarkData
+{
+    std::vector<float> lhs;       ///< cNumMatrices 4x4 matrices.
+    std::vector<float> rhs;       ///< cNumMatrices 4x4 matrices.
+    std::vector<float> points;    ///< cNumPoints vertices of cVertexStride bytes.
+    std::vector<float> quats;     ///< cNumQuats quaternions.
+    std::vector<float> weights;   ///< cNumQuats slerp weights.
+    std::vector<float3x4> parents; ///< cNumMatrices world transforms.
+    std::vector<float3x4> locals;  ///< cNumMatrices local transforms.
+    std::vector<AABB> aabbs;      ///< cNumAABBs boxes.
+    std::vector<float> triangles; ///< cNumTriangles triangles of three vertices.
+    std::vector<float> blocks;    ///< The triangles in blocks of four, like TriangleBVH stores them.
+    std::vector<Ray> rays;
+    float4x4 transform;
+};
+
+/// The outputs of a level, compared against those of the scalar kernels.
+struct BenchmarkResults
+{
+    std::vector<float> mat4x4;
+    std::vector<float> mat3x4;
+    std::vector<float> pos;
+    std::vector<float> strided;
+    std::vector<float> dir;
+    std::vector<float> quats;
+    std::vector<float> composed;
+    std::vector<float> slerped;
+    std::vector<float> aabbs;
+    std::vector<int> meshHits;
+    std::vector<int> blockHits;
+};
+
+void CreateData(BenchmarkData &data)
+{
+    LCG rng(1234);
+    data.lhs.resize(cNumMatrices * 16);
+    data.rhs.resize(cNumMatrices * 16);
+    for(size_t i = 0; i < data.lhs.size(); ++i)
+    {
+        data.lhs[i] = rng.Float(-1.f, 1.f);
+        data.rhs[i] = rng.Float(-1.f, 1.f);
+    }
+    data.points.resize(cNumPoints * cVertexStride / sizeof(float));
+    for(size_t i = 0; i < data.points.size(); ++i)
+        data.points[i] = rng.Float(-100.f, 100.f);
+    data.quats.resize(cNumQuats * 4);
+    for(int i = 0; i < cNumQuats; ++i)
+    {
+        Quat q = Quat::RotateAxisAngle(float3(rng.Float(-1.f, 1.f), rng.Float(-1.f, 1.f), 1.f).Normalized(), rng.Float(-3.f, 3.f));
+        memcpy(&data.quats[i * 4], q.ptr(), 4 * sizeof(float));
+        data.weights.push_back(rng.Float());
+    }
+    for(int i = 0; i < cNumMatrices; ++i)
+    {
+        const Quat rot = Quat::RotateAxisAngle(float3(rng.Float(-1.f, 1.f), 1.f, rng.Float(-1.f, 1.f)).Normalized(), rng.Float(-3.f, 3.f));
+        data.parents.push_back(float3x4::FromTRS(float3(rng.Float(-100.f, 100.f), rng.Float(-100.f, 100.f), 0.f), rot, float3(2.f, 2.f, 2.f)));
+        data.locals.push_back(float3x4::FromTRS(float3(rng.Float(-1.f, 1.f), 0.f, rng.Float(-1.f, 1.f)), rot.Inverted(), float3::one));
+    }
+    for(int i = 0; i < cNumAABBs; ++i)
+    {
+        const float3 center(rng.Float(-100.f, 100.f), rng.Float(-100.f, 100.f), rng.Float(-100.f, 100.f));
+        const float3 halfSize(rng.Float(0.f, 5.f), rng.Float(0.f, 5.f), rng.Float(0.f, 5.f));
+        data.aabbs.push_back(AABB(center - halfSize, center + halfSize));
+    }
+    data.transform = float4x4::FromTRS(float3(1.f, 2.f, 3.f), Quat::RotateAxisAngle(float3(0.f, 1.f, 0.f), 0.5f), float3(2.f, 2.f, 2.f));
+
+    // Small triangles scattered in a cube, so that the rays hit some of them.
+    data.triangles.resize(cNumTriangles * 9);
+    for(int i = 0; i < cNumTriangles; ++i)
+    {
+        const float3 center(rng.Float(-10.f, 10.f), rng.Float(-10.f, 10.f), rng.Float(-10.f, 10.f));
+        for(int j = 0; j < 3; ++j)
+        {
+            const float3 v = center + float3(rng.Float(-1.f, 1.f), rng.Float(-1.f, 1.f), rng.Float(-1.f, 1.f));
+            memcpy(&data.triangles[i * 9 + j * 3], v.ptr(), 3 * sizeof(float));
+        }
+    }
+    data.blocks.resize(cNumTriangles / 4 * 36);
+    for(int i = 0; i < cNumTriangles; ++i)
+    {
+        const float *t = &data.triangles[i * 9];
+        float *block = &data.blocks[(i / 4) * 36 + i % 4];
+        for(int c = 0; c < 3; ++c)
+        {
+            block[c * 4] = t[c];
+            block[12 + c * 4] = t[3 + c] - t[c];
+            block[24 + c * 4] = t[6 + c] - t[c];
+        }
+    }
+    for(int i = 0; i < cNumRays; ++i)
+        data.rays.push_back(Ray(float3(rng.Float(-12.f, 12.f), rng.Float(-12.f, 12.f), -20.f),
+            float3(rng.Float(-0.3f, 0.3f), rng.Float(-0.3f, 0.3f), 1.f).Normalized()));
+}
+
+/// Runs the kernels of the current level and stores the outputs of the last iteration.
+void RunLevel(const BenchmarkData &data, int iterations, BenchmarkResults &results)
+{
+    const SIMDKernels &kernels = SIMD();
+    QElapsedTimer timer;
+    qint64 elapsed;
+
+    results.mat4x4.resize(cNumMatrices * 16);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumMatrices; ++i)
+            kernels.mat4x4Mul(&results.mat4x4[i * 16], &data.lhs[i * 16], &data.rhs[i * 16]);
+    printf("  mat4x4Mul        %8.2f ns/matrix\n", (double)timer.nsecsElapsed() / ((double)iterations * cNumMatrices));
+
+    results.mat3x4.resize(cNumMatrices * 12);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumMatrices; ++i)
+            kernels.mat3x4Mul(&results.mat3x4[i * 12], &data.lhs[i * 16], &data.rhs[i * 16]);
+    printf("  mat3x4Mul        %8.2f ns/matrix\n", (double)timer.nsecsElapsed() / ((double)iterations * cNumMatrices));
+
+    // The transforms work in place, so the input is restored before each iteration, outside the timing.
+    results.pos.resize(cNumPoints * 3);
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        for(int i = 0; i < cNumPoints; ++i)
+            memcpy(&results.pos[i * 3], &data.points[i * 6], 3 * sizeof(float));
+        timer.start();
+        kernels.transformPos(data.transform.ptr(), &results.pos[0], cNumPoints, sizeof(float3));
+        elapsed += timer.nsecsElapsed();
+    }
+    printf("  transformPos     %8.2f ns/point\n", (double)elapsed / ((double)iterations * cNumPoints));
+
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        results.strided = data.points;
+        timer.start();
+        kernels.transformPos(data.transform.ptr(), &results.strided[0], cNumPoints, cVertexStride);
+        elapsed += timer.nsecsElapsed();
+    }
+    printf("  transformPos %2d  %8.2f ns/point\n", cVertexStride, (double)elapsed / ((double)iterations * cNumPoints));
+
+    results.dir.resize(cNumPoints * 3);
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        for(int i = 0; i < cNumPoints; ++i)
+            memcpy(&results.dir[i * 3], &data.points[i * 6 + 3], 3 * sizeof(float));
+        timer.start();
+        kernels.transformDir(data.transform.ptr(), &results.dir[0], cNumPoints, sizeof(float3));
+        elapsed += timer.nsecsElapsed();
+    }
+    printf("  transformDir     %8.2f ns/vector\n", (double)elapsed / ((double)iterations * cNumPoints));
+
+    results.quats.resize(cNumQuats * 4);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        kernels.quatMul(&results.quats[0], &data.quats[0], &data.quats[0] + 4, cNumQuats - 1);
+    printf("  quatMul          %8.2f ns/quat\n", (double)timer.nsecsElapsed() / ((double)iterations * (cNumQuats - 1)));
+
+    results.composed.resize(cNumMatrices * 12);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        kernels.mat3x4MulArray(&results.composed[0], data.parents[0].ptr(), data.locals[0].ptr(), cNumMatrices);
+    printf("  mat3x4MulArray   %8.2f ns/matrix\n", (double)timer.nsecsElapsed() / ((double)iterations * cNumMatrices));
+
+    results.slerped.resize(cNumQuats * 4);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        kernels.quatSlerp(&results.slerped[0], &data.quats[0], &data.quats[0] + 4, &data.weights[0], cNumQuats - 1);
+    printf("  quatSlerp        %8.2f ns/quat\n", (double)timer.nsecsElapsed() / ((double)iterations * (cNumQuats - 1)));
+
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        results.aabbs.assign(data.aabbs[0].minPoint.ptr(), data.aabbs[0].minPoint.ptr() + cNumAABBs * 6);
+        timer.start();
+        kernels.transformAABBs(data.transform.ptr(), &results.aabbs[0], cNumAABBs);
+        elapsed += timer.nsecsElapsed();
+    }
+    printf("  transformAABBs   %8.2f ns/AABB\n", (double)elapsed / ((double)iterations * cNumAABBs));
+
+    // The mesh lays out its vertices for the kernels in use when Set is called.
+    TriangleMesh mesh;
+    mesh.Set(&data.triangles[0], cNumTriangles);
+    results.meshHits.resize(cNumRays);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumRays; ++i)
+        {
+            float u, v;
+            int index = -1;
+            mesh.IntersectRay_TriangleIndex_UV(data.rays[i], index, u, v);
+            results.meshHits[i] = index;
+        }
+    printf("  TriangleMesh     %8.2f ns/triangle\n", (double)timer.nsecsElapsed() / ((double)iterations * cNumRays * cNumTriangles));
+
+    results.blockHits.resize(cNumRays);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumRays; ++i)
+        {
+            float t = FLOAT_INF, u, v;
+            results.blockHits[i] = kernels.intersectRayBlocks4(&data.blocks[0], cNumTriangles / 4, data.rays[i].pos.ptr(),
+                data.rays[i].dir.ptr(), 1e-6f, t, u, v);
+        }
+    printf("  TriangleBVH leaf %8.2f ns/triangle\n", (double)timer.nsecsElapsed() / ((double)iterations * cNumRays * cNumTriangles));
+}
+
+/// Returns the largest difference between the values relative to their magnitude.
+float MaxRelativeError(const std::vector<float> &a, const std::vector<float> &b)
+{
+    float maxError = 0.f;
+    for(size_t i = 0; i < a.size() && i < b.size(); ++i)
+        maxError = std::max(maxError, std::fabs(a[i] - b[i]) / std::max(1.f, std::fabs(b[i])));
+    return maxError;
+}
+
+int CountMismatches(const std::vector<int> &a, const std::vector<int> &b)
+{
+    int mismatches = 0;
+    for(size_t i = 0; i < a.size() && i < b.size(); ++i)
+        if (a[i] != b[i])
+            ++mismatches;
+    return mismatches;
+}
+
+/// Prints how much the results differ from the scalar ones. @return False if the differences exceed rounding errors.
+bool CheckResults(const BenchmarkResults &results, const BenchmarkResults &reference)
+{
+    const float cTolerance = 1e-4f;
+    const float errors[] =
+    {
+        MaxRelativeError(results.mat4x4, reference.mat4x4),
+        MaxRelativeError(results.mat3x4, reference.mat3x4),
+        MaxRelativeError(results.pos, reference.pos),
+        MaxRelativeError(results.strided, reference.strided),
+        MaxRelativeError(results.dir, reference.dir),
+        MaxRelativeError(results.quats, reference.quats),
+        MaxRelativeError(results.composed, reference.composed),
+        MaxRelativeError(results.slerped, reference.slerped),
+        MaxRelativeError(results.aabbs, reference.aabbs)
+    };
+    float maxError = 0.f;
+    for(size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); ++i)
+        maxError = std::max(maxError, errors[i]);
+    // The ray tests of the SIMD variants may decide the hits exactly at the edges of the triangles differently.
+    const int meshMismatches = CountMismatches(results.meshHits, reference.meshHits);
+    const int blockMismatches = CountMismatches(results.blockHits, reference.blockHits);
+    printf("  Largest relative error %g, differing ray hits %d/%d and %d/%d.\n", maxError, meshMismatches, cNumRays,
+        blockMismatches, cNumRays);
+    return maxError <= cTolerance && meshMismatches <= cNumRays / 64 && blockMismatches <= cNumRays / 64;
+}
+
+/// Prints a result line in the format of Google Benchmark.
+void PrintBenchmark(const char *name, qint64 nsecs, int iterations, int count)
+{
+    printf("%-36s %10.2f ns %10d\n", name, (double)nsecs / ((double)iterations * count), iterations * count);
+}
+
+/// Compares the batch functions of the Math classes against loops of the per-element functions.
+void RunBatchComparisons(const BenchmarkData &data, int iterations)
+{
+    QElapsedTimer timer;
+    qint64 elapsed;
+    printf("%-36s %13s %10s\n", "Benchmark", "Time", "Items");
+
+    std::vector<float3x4> worlds(cNumMatrices);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumMatrices; ++i)
+            worlds[i] = data.parents[i] * data.locals[i];
+    PrintBenchmark("BM_float3x4_Mul_Loop", timer.nsecsElapsed(), iterations, cNumMatrices);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        float3x4::BatchMul(&worlds[0], &data.parents[0], &data.locals[0], cNumMatrices);
+    PrintBenchmark("BM_float3x4_BatchMul", timer.nsecsElapsed(), iterations, cNumMatrices);
+
+    const Quat *quats = reinterpret_cast<const Quat*>(&data.quats[0]);
+    std::vector<Quat> slerped(cNumQuats - 1);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        for(int i = 0; i < cNumQuats - 1; ++i)
+            slerped[i] = quats[i].Slerp(quats[i + 1], data.weights[i]);
+    PrintBenchmark("BM_Quat_Slerp_Loop", timer.nsecsElapsed(), iterations, cNumQuats - 1);
+    timer.start();
+    for(int it = 0; it < iterations; ++it)
+        Quat::BatchSlerp(&slerped[0], quats, quats + 1, &data.weights[0], cNumQuats - 1);
+    PrintBenchmark("BM_Quat_BatchSlerp", timer.nsecsElapsed(), iterations, cNumQuats - 1);
+
+    const float3x4 transform = data.transform.Float3x4Part();
+    std::vector<AABB> aabbs;
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        aabbs = data.aabbs;
+        timer.start();
+        for(int i = 0; i < cNumAABBs; ++i)
+            aabbs[i].TransformAsAABB(transform);
+        elapsed += timer.nsecsElapsed();
+    }
+    PrintBenchmark("BM_AABB_TransformAsAABB_Loop", elapsed, iterations, cNumAABBs);
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        aabbs = data.aabbs;
+        timer.start();
+        AABB::BatchTransformAsAABB(&aabbs[0], cNumAABBs, transform);
+        elapsed += timer.nsecsElapsed();
+    }
+    PrintBenchmark("BM_AABB_BatchTransformAsAABB", elapsed, iterations, cNumAABBs);
+
+    std::vector<float3> points(cNumPoints);
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        memcpy(&points[0], &data.points[0], cNumPoints * sizeof(float3));
+        timer.start();
+        for(int i = 0; i < cNumPoints; ++i)
+            points[i] = transform.TransformPos(points[i]);
+        elapsed += timer.nsecsElapsed();
+    }
+    PrintBenchmark("BM_float3x4_TransformPos_Loop", elapsed, iterations, cNumPoints);
+    elapsed = 0;
+    for(int it = 0; it < iterations; ++it)
+    {
+        memcpy(&points[0], &data.points[0], cNumPoints * sizeof(float3));
+        timer.start();
+        transform.BatchTransformPos(&points[0], cNumPoints);
+        elapsed += timer.nsecsElapsed();
+    }
+    PrintBenchmark("BM_float3x4_BatchTransformPos", elapsed, iterations, cNumPoints);
+}
+
+} // ~unnamed namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int iterations = 20;
+    for(int i = 1; i < args.size(); ++i)
+        if (args[i] == "--iterations" && i + 1 < args.size())
+            iterations = qMax(1, args[++i].toInt());
+
+    const SIMDLevel detected = DetectSIMDLevel();
+    const SIMDLevel initial = ActiveSIMDLevel();
+    printf("Detected %s, using %s by default.\n", SIMDLevelName(detected), SIMDLevelName(initial));
+
+    BenchmarkData data;
+    CreateData(data);
+
+    bool success = true;
+    BenchmarkResults reference;
+    for(int level = SIMDScalar; level < NumSIMDLevels; ++level)
+    {
+        if (!SetSIMDLevel((SIMDLevel)level))
+        {
+            printf("%s: not available.\n", SIMDLevelName((SIMDLevel)level));
+            continue;
+        }
+        printf("%s:\n", SIMDLevelName((SIMDLevel)level));
+        BenchmarkResults results;
+        RunLevel(data, iterations, results);
+        if (level == SIMDScalar)
+            reference = results;
+        else if (!CheckResults(results, reference))
+        {
+            printf("  The results differ from the scalar kernels!\n");
+            success = false;
+        }
+    }
+    SetSIMDLevel(initial);
+
+    printf("\nBatch functions against per-element loops, %s:\n", SIMDLevelName(initial));
+    RunBatchComparisons(data, iterations);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AnimationScheduler.h"
+#include "EC_AnimationController.h"
+#include "OgreWorld.h"
+#include "Renderer.h"
+
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "ConfigAPI.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+/// @cond PRIVATE
+namespace
+{
+
+/// Below this many due controllers the animations are advanced on the main thread, the worker threads would cost more than they save.
+const size_t cMinThreadedJobs = 16;
+
+/// Number of distinct offsets the controllers are staggered by.
+const unsigned cNumSlots = 64;
+
+} // ~unnamed namespace
+/// @endcond
+
+AnimationScheduler::AnimationScheduler(OgreWorld *world, Framework *framework) :
+    world_(world),
+    rateScaling_(true),
+    threaded_(true),
+    fullRateScreenSize_(0.2f),
+    minRate_(10.f),
+    offscreenRate_(2.f),
+    averageFrameTime_(1.f / 60.f),
+    frame_(0),
+    nextSlot_(0)
+{
+    ConfigAPI *config = framework->Config();
+    rateScaling_ = config->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "animation rate scaling", true).toBool();
+    threaded_ = config->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "animation worker threads", true).toBool();
+
+    connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
+}
+
+AnimationScheduler::~AnimationScheduler()
+{
+    for(size_t i = 0; i < entries_.size(); ++i)
+        entries_[i].controller->schedulerIndex_ = -1;
+}
+
+void AnimationScheduler::Register(EC_AnimationController *controller)
+{
+    if (!controller || controller->schedulerIndex_ >= 0)
+        return;
+
+    Entry entry;
+    entry.controller = controller;
+    entry.pendingTime = 0.f;
+    entry.slot = nextSlot_++ % cNumSlots;
+    controller->schedulerIndex_ = (int)entries_.size();
+    entries_.push_back(entry);
+}
+
+void AnimationScheduler::Unregister(EC_AnimationController *controller)
+{
+    if (!controller || controller->schedulerIndex_ < 0 || controller->schedulerIndex_ >= (int)entries_.size() ||
+        entries_[controller->schedulerIndex_].controller != controller)
+        return;
+
+    size_t index = (size_t)controller->schedulerIndex_;
+    controller->schedulerIndex_ = -1;
+    if (index + 1 < entries_.size())
+    {
+        entries_[index] = entries_.back();
+        entries_[index].controller->schedulerIndex_ = (int)index;
+    }
+    entries_.pop_back();
+}
+
+void AnimationScheduler::SetRateScaling(bool enabled)
+{
+    rateScaling_ = enabled;
+}
+
+void AnimationScheduler::SetThreaded(bool enabled)
+{
+    threaded_ = enabled;
+}
+
+void AnimationScheduler::SetFullRateScreenSize(float size)
+{
+    if (size > 0.f)
+        fullRateScreenSize_ = size;
+}
+
+void AnimationScheduler::SetMinRate(float rate)
+{
+    if (rate > 0.f)
+        minRate_ = rate;
+}
+
+void AnimationScheduler::SetOffscreenRate(float rate)
+{
+    if (rate > 0.f)
+        offscreenRate_ = rate;
+}
+
+Ogre::Camera *AnimationScheduler::ActiveCamera() const
+{
+    OgreRenderer::Renderer *renderer = world_->Renderer();
+    Ogre::Camera *camera = renderer ? renderer->MainOgreCamera() : 0;
+    return (camera && camera->getSceneManager() == world_->OgreSceneManager()) ? camera : 0;
+}
+
+int AnimationScheduler::FrameInterval(EC_AnimationController *controller, Ogre::Entity *entity, Ogre::Camera *camera) const
+{
+    // The debug skeleton is drawn on the frames the controller is updated, so it is updated every frame to not flicker.
+    if (!rateScaling_ || !camera || controller->getdrawDebug())
+        return 1;
+
+    const Ogre::Sphere &bounds = entity->getWorldBoundingSphere(true);
+    if (!entity->isVisible() || !camera->isVisible(bounds))
+        return std::max(1, (int)(1.f / (offscreenRate_ * averageFrameTime_) + 0.5f));
+
+    // The diameter of the bounding sphere as a fraction of the screen height.
+    float screenSize;
+    if (camera->getProjectionType() == Ogre::PT_ORTHOGRAPHIC)
+        screenSize = 2.f * bounds.getRadius() / camera->getOrthoWindowHeight();
+    else
+    {
+        float distance = camera->getDerivedPosition().distance(bounds.getCenter());
+        if (distance <= bounds.getRadius())
+            return 1;
+        screenSize = bounds.getRadius() / (distance * tanf(camera->getFOVy().valueRadians() * 0.5f));
+    }
+    if (screenSize >= fullRateScreenSize_)
+        return 1;
+
+    int maxInterval = std::max(1, (int)(1.f / (minRate_ * averageFrameTime_)));
+    if (screenSize * maxInterval <= fullRateScreenSize_)
+        return maxInterval;
+    return std::max(1, (int)(fullRateScreenSize_ / screenSize));
+}
+
+void AnimationScheduler::AdvanceJob(Job &job)
+{
+    static_cast<EC_AnimationController*>(job.controller.get())->AdvanceAnimations(job.entity, job.time);
+}
+
+void AnimationScheduler::OnUpdated(float frameTime)
+{
+    PROFILE(AnimationScheduler_Update);
+
+    ++frame_;
+    averageFrameTime_ = averageFrameTime_ * 0.9f + std::max(frameTime, 1e-4f) * 0.1f;
+    stats_.controllers = (int)entries_.size();
+    stats_.updated = 0;
+    stats_.threaded = 0;
+
+    // Find out the controllers due for an update. GetEntity may reset the controller state, so it is called on the main thread.
+    Ogre::Camera *camera = ActiveCamera();
+    jobs_.clear();
+    for(size_t i = 0; i < entries_.size(); ++i)
+    {
+        Entry &entry = entries_[i];
+        entry.pendingTime += frameTime;
+        Ogre::Entity *entity = entry.controller->GetEntity();
+        if (!entity)
+        {
+            entry.pendingTime = 0.f;
+            continue;
+        }
+
+        int interval = FrameInterval(entry.controller, entity, camera);
+        // If the interval grew since the last update, the controller could wait for longer than the new interval for its frame.
+        if (interval > 1 && (frame_ + entry.slot) % (unsigned)interval != 0 && entry.pendingTime < 2.f * interval * averageFrameTime_)
+            continue;
+
+        Job job;
+        job.controller = entry.controller->shared_from_this();
+        job.entity = entity;
+        job.time = entry.pendingTime;
+        jobs_.push_back(job);
+        entry.pendingTime = 0.f;
+    }
+    stats_.updated = (int)jobs_.size();
+    if (jobs_.empty())
+        return;
+
+    // Advance the animations. Entities that share a skeleton instance share the animation states too, so they are not threaded.
+    {
+        PROFILE(AnimationScheduler_AdvanceAnimations);
+        threadedJobs_.clear();
+        if (threaded_ && jobs_.size() >= cMinThreadedJobs)
+        {
+            for(size_t i = 0; i < jobs_.size(); ++i)
+                if (!jobs_[i].entity->sharesSkeletonInstance())
+                    threadedJobs_.push_back(jobs_[i]);
+        }
+        if (threadedJobs_.size() >= cMinThreadedJobs)
+        {
+            QtConcurrent::blockingMap(threadedJobs_, &AnimationScheduler::AdvanceJob);
+            for(size_t i = 0; i < jobs_.size(); ++i)
+                if (jobs_[i].entity->sharesSkeletonInstance())
+                    AdvanceJob(jobs_[i]);
+            stats_.threaded = (int)threadedJobs_.size();
+        }
+        else
+        {
+            for(size_t i = 0; i < jobs_.size(); ++i)
+                AdvanceJob(jobs_[i]);
+        }
+        threadedJobs_.clear();
+    }
+
+    // Emit the signals. The handlers may remove controllers, which the jobs keep alive until they have all been finished.
+    std::vector<Job> jobs;
+    jobs.swap(jobs_);
+    for(size_t i = 0; i < jobs.size(); ++i)
+        static_cast<EC_AnimationController*>(jobs[i].controller.get())->FinishUpdate(jobs[i].time);
+    jobs.clear();
+    if (jobs_.empty())
+        jobs_.swap(jobs);
+}
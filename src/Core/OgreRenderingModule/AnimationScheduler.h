@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "SceneFwd.h"
+
+#include <QObject>
+
+#include <vector>
+
+class EC_AnimationController;
+
+namespace Ogre { class Camera; }
+
+/// Updates the animation controllers of a scene, at a rate that depends on how visible their meshes are.
+/** Instead of every controller advancing its animations every frame, the scheduler advances each controller every Nth frame
+    with the time accumulated since its last update. N is 1 for meshes that cover at least fullRateScreenSize of the screen
+    height, grows as the mesh gets smaller on the screen, and is limited so that visible meshes are still updated at least
+    minRate times per second. Meshes that are hidden or outside the view frustum of the active camera are updated offscreenRate
+    times per second, which keeps the animation times, the fades and the AnimationFinished and AnimationCycled signals going.
+    Ogre skins an entity only when it is rendered and its animation state has changed, so skipping a controller also skips the
+    skinning of its mesh. The controllers are staggered, so that the ones updated at the same rate are spread over the frames.
+
+    The animations of the controllers due for an update are advanced on worker threads when there are enough of them, since they
+    only touch the Ogre entity of their own mesh. The signals are emitted, and the skeletons debug drawn, afterwards on the main
+    thread. Entities sharing a skeleton instance are always advanced on the main thread.
+
+    The rate scaling can be disabled with the "animation rate scaling" rendering config value, and the worker threads with
+    "animation worker threads". Without an active camera, e.g. on a headless server, every controller is updated every frame.
+
+    Owned by OgreWorld, see OgreWorld::Animations. */
+class OGRE_MODULE_API AnimationScheduler : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool rateScaling READ RateScaling WRITE SetRateScaling)
+    Q_PROPERTY(bool threaded READ IsThreaded WRITE SetThreaded)
+    Q_PROPERTY(float fullRateScreenSize READ FullRateScreenSize WRITE SetFullRateScreenSize)
+    Q_PROPERTY(float minRate READ MinRate WRITE SetMinRate)
+    Q_PROPERTY(float offscreenRate READ OffscreenRate WRITE SetOffscreenRate)
+
+public:
+    AnimationScheduler(OgreWorld *world, Framework *framework);
+    ~AnimationScheduler();
+
+    /// The work done on the last frame.
+    struct Statistics
+    {
+        Statistics() : controllers(0), updated(0), threaded(0) {}
+
+        int controllers; ///< Number of controllers scheduled.
+        int updated; ///< Number of controllers updated on the last frame.
+        int threaded; ///< Number of controllers updated on the worker threads on the last frame.
+    };
+
+    /// Returns the statistics of the last frame.
+    const Statistics &Stats() const { return stats_; }
+
+    /// Starts updating a controller. Called by EC_AnimationController.
+    void Register(EC_AnimationController *controller);
+
+    /// Stops updating a controller. Called by EC_AnimationController.
+    void Unregister(EC_AnimationController *controller);
+
+    bool RateScaling() const { return rateScaling_; }
+    bool IsThreaded() const { return threaded_; }
+    float FullRateScreenSize() const { return fullRateScreenSize_; }
+    float MinRate() const { return minRate_; }
+    float OffscreenRate() const { return offscreenRate_; }
+
+public slots:
+    /// Enables or disables reducing the update rate of small and off-screen meshes. When disabled, every controller is updated every frame.
+    void SetRateScaling(bool enabled);
+
+    /// Enables or disables advancing the animations on worker threads.
+    void SetThreaded(bool enabled);
+
+    /// Sets the fraction of the screen height a mesh needs to cover to be updated every frame. The default is 0.2.
+    void SetFullRateScreenSize(float size);
+
+    /// Sets the minimum number of updates per second for visible meshes. The default is 10.
+    void SetMinRate(float rate);
+
+    /// Sets the number of updates per second for hidden and off-screen meshes. The default is 2.
+    void SetOffscreenRate(float rate);
+
+private slots:
+    void OnUpdated(float frameTime);
+
+private:
+    /// @cond PRIVATE
+    struct Entry
+    {
+        EC_AnimationController *controller;
+        float pendingTime; ///< Time accumulated since the last update of the controller.
+        unsigned slot; ///< Offsets the frames the controller is updated on from the other controllers.
+    };
+
+    struct Job
+    {
+        ComponentPtr controller; ///< Keeps the controller alive if the signals of another controller remove it.
+        Ogre::Entity *entity;
+        float time;
+    };
+    /// @endcond
+
+    /// Returns every how many frames a controller whose mesh has the Ogre entity should be updated.
+    int FrameInterval(EC_AnimationController *controller, Ogre::Entity *entity, Ogre::Camera *camera) const;
+
+    /// Returns the active camera if it is in the scene of the world, otherwise null.
+    Ogre::Camera *ActiveCamera() const;
+
+    /// Advances the animations of a job. Runs on a worker thread.
+    static void AdvanceJob(Job &job);
+
+    OgreWorld *world_;
+    bool rateScaling_;
+    bool threaded_;
+    float fullRateScreenSize_;
+    float minRate_;
+    float offscreenRate_;
+    float averageFrameTime_; ///< Smoothed frame time, to convert the rates to frame intervals.
+    unsigned frame_;
+    unsigned nextSlot_;
+
+    std::vector<Entry> entries_;
+    std::vector<Job> jobs_; ///< Controllers due for an update on the current frame, reused.
+    std::vector<Job> threadedJobs_; ///< The jobs run on the worker threads, reused.
+    Statistics stats_;
+};
@@ -12,6 +12,7 @@
 #include "Profiler.h"
 #include "Scene/Scene.h"
 #include "OgreWorld.h"
+#include "AnimationScheduler.h"
 
 #include <Ogre.h>
 
@@ -26,21 +27,31 @@ EC_AnimationController::EC_AnimationController(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(animationState, "Animation state", ""),
     INIT_ATTRIBUTE_VALUE(drawDebug, "Draw debug", false),
-    mesh(0)
+    mesh(0),
+    entity_(0),
+    schedulerIndex_(-1)
 {
     ResetState();
     
-    QObject::connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)));
     QObject::connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 }
 
 EC_AnimationController::~EC_AnimationController()
 {
+    if (scheduler_)
+        scheduler_->Unregister(this);
 }
 
 void EC_AnimationController::SetMeshEntity(EC_Mesh *new_mesh)
 {
+    if (mesh == new_mesh)
+        return;
+    if (mesh)
+        disconnect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshAboutToBeDestroyed()));
     mesh = new_mesh;
+    if (mesh)
+        connect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshAboutToBeDestroyed()), Qt::UniqueConnection);
+    OnMeshAboutToBeDestroyed();
 }
 
 QStringList EC_AnimationController::GetAvailableAnimations()
@@ -81,14 +92,21 @@ void EC_AnimationController::Update(float frametime)
     
     PROFILE(EC_AnimationController_Update);
 
-    std::vector<QString> erase_list;
-    
+    AdvanceAnimations(entity, frametime);
+    FinishUpdate(frametime);
+}
+
+void EC_AnimationController::AdvanceAnimations(Ogre::Entity* entity, float frametime)
+{
     // Loop through all animations & update them as necessary
-    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
+    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end();)
     {
-        Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+        Ogre::AnimationState* animstate = i->second.state_;
         if (!animstate)
+        {
+            ++i;
             continue;
+        }
             
         switch(i->second.phase_)
         {
@@ -197,27 +215,19 @@ void EC_AnimationController::Update(float frametime)
                 }
             }
             
+            // The signals are emitted by FinishUpdate, this may be running on a worker thread.
             if (cycled)
-            {
-                if (animstate->getLoop())
-                    emit AnimationCycled(QString::fromStdString(animstate->getAnimationName()));
-                else
-                    emit AnimationFinished(QString::fromStdString(animstate->getAnimationName()));
-            }
+                pendingSignals_.push_back(std::make_pair(QString::fromStdString(animstate->getAnimationName()), animstate->getLoop()));
+            ++i;
         }
         else
         {
             // If stopped, disable & remove this animation from list
             animstate->setEnabled(false);
-            erase_list.push_back(i->first);
+            animations_.erase(i++);
         }
     }
     
-    for(uint i = 0; i < erase_list.size(); ++i)
-    {
-        animations_.erase(erase_list[i]);
-    }
-    
     // High-priority/low-priority blending code
     if (entity->hasSkeleton())
     {
@@ -239,7 +249,7 @@ void EC_AnimationController::Update(float frametime)
         // Loop through all high priority animations & update the lowpriority-blendmask based on their active tracks
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = i->second.state_;
             if (!animstate)
                 continue;            
             // Create blend mask if animstate doesn't have it yet
@@ -250,10 +260,9 @@ void EC_AnimationController::Update(float frametime)
             {
                 // High-priority animations get the full weight blend mask
                 animstate->_setBlendMaskData(&highpriority_mask_[0]);
-                if (!skel->hasAnimation(animstate->getAnimationName()))
+                Ogre::Animation* anim = i->second.skeletonAnimation_;
+                if (!anim)
                     continue;
-                    
-                Ogre::Animation* anim = skel->getAnimation(animstate->getAnimationName());
                 
                 Ogre::Animation::NodeTrackIterator it = anim->getNodeTrackIterator();
                 while(it.hasMoreElements())
@@ -274,13 +283,30 @@ void EC_AnimationController::Update(float frametime)
         // Now set the calculated blendmask on low-priority animations
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = i->second.state_;
             if (!animstate)
                 continue;    
             if (i->second.high_priority_ == false)
                 animstate->_setBlendMaskData(&lowpriority_mask_[0]);
         }
     }
+}
+
+void EC_AnimationController::FinishUpdate(float frametime)
+{
+    if (!pendingSignals_.empty())
+    {
+        // A handler may start another update of this controller, e.g. by calling Update, so the signals are taken first.
+        std::vector<std::pair<QString, bool> > queued;
+        queued.swap(pendingSignals_);
+        for(size_t i = 0; i < queued.size(); ++i)
+        {
+            if (queued[i].second)
+                emit AnimationCycled(queued[i].first);
+            else
+                emit AnimationFinished(queued[i].first);
+        }
+    }
     if (getdrawDebug())
         DrawSkeleton(frametime);
 }
@@ -342,6 +368,8 @@ Ogre::Entity* EC_AnimationController::GetEntity()
         mesh_name_ = entity->getMesh()->getName();
         ResetState();
     }
+    if (entity != entity_)
+        ResolveAnimationStates(entity);
     
     return entity;
 }
@@ -351,6 +379,17 @@ void EC_AnimationController::ResetState()
     animations_.clear();
 }
 
+void EC_AnimationController::OnMeshAboutToBeDestroyed()
+{
+    // The animation states are destroyed with the entity. They are resolved again from the next entity by GetEntity.
+    entity_ = 0;
+    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
+    {
+        i->second.state_ = 0;
+        i->second.skeletonAnimation_ = 0;
+    }
+}
+
 /// Finds an animation state from Ogre::AnimationStateSet by name, performing a case-insensitive name search.
 /// @note This function is O(n), while normal set search would be O(logN) or O(1).
 Ogre::AnimationState *OgreAnimStateSetFindNoCase(Ogre::AnimationStateSet *set, const QString &animState)
@@ -377,6 +416,25 @@ Ogre::AnimationState* EC_AnimationController::GetAnimationState(Ogre::Entity* en
     return OgreAnimStateSetFindNoCase(entity->getAllAnimationStates(), name);
 }
 
+/// Returns the skeleton animation of an animation state, or null if the skeleton of the entity does not have it.
+Ogre::Animation *OgreSkeletonAnimation(Ogre::Entity *entity, Ogre::AnimationState *animstate)
+{
+    Ogre::SkeletonInstance *skel = (entity && animstate && entity->hasSkeleton()) ? entity->getSkeleton() : 0;
+    if (!skel || !skel->hasAnimation(animstate->getAnimationName()))
+        return 0;
+    return skel->getAnimation(animstate->getAnimationName());
+}
+
+void EC_AnimationController::ResolveAnimationStates(Ogre::Entity* entity)
+{
+    entity_ = entity;
+    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
+    {
+        i->second.state_ = GetAnimationState(entity, i->first);
+        i->second.skeletonAnimation_ = OgreSkeletonAnimation(entity, i->second.state_);
+    }
+}
+
 bool EC_AnimationController::EnableExclusiveAnimation(const QString& name, bool looped, float fadein, float fadeout, bool high_priority)
 {
     // Disable all other active animations
@@ -413,6 +471,8 @@ bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, f
         i->second.num_repeats_ = (looped ? 0: 1);
         i->second.fade_period_ = fadein;
         i->second.high_priority_ = high_priority;
+        i->second.state_ = animstate;
+        i->second.skeletonAnimation_ = OgreSkeletonAnimation(entity, animstate);
         // If animation is nonlooped and has already reached end, rewind to beginning
         if ((!looped) && (i->second.speed_factor_ > 0.0f))
         {
@@ -430,6 +490,8 @@ bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, f
     newanim.num_repeats_ = (looped ? 0: 1); // if looped, repeat 0 times (loop indefinetly) otherwise repeat one time.
     newanim.fade_period_ = fadein;
     newanim.high_priority_ = high_priority;
+    newanim.state_ = animstate;
+    newanim.skeletonAnimation_ = OgreSkeletonAnimation(entity, animstate);
 
     animations_[name] = newanim;
 
@@ -665,6 +727,25 @@ void EC_AnimationController::UpdateSignals()
         // Connect to ComponentRemoved signal of the parent entity, so we can check if the mesh gets removed
         connect(parent, SIGNAL(ComponentRemoved(IComponent*, AttributeChange::Type)), this, SLOT(OnComponentRemoved(IComponent*, AttributeChange::Type)));
     }
+
+    ScheduleUpdates();
+}
+
+void EC_AnimationController::ScheduleUpdates()
+{
+    if (scheduler_)
+        return;
+
+    Scene *scene = ParentScene();
+    OgreWorldPtr world = scene ? scene->Subsystem<OgreWorld>() : OgreWorldPtr();
+    if (world && world->Animations())
+    {
+        disconnect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)));
+        scheduler_ = world->Animations();
+        scheduler_->Register(this);
+    }
+    else
+        connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)), Qt::UniqueConnection);
 }
 
 void EC_AnimationController::AutoSetMesh()
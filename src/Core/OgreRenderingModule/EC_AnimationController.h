@@ -8,6 +8,12 @@
 
 #include <OgreAnimationState.h>
 
+#include <QPointer>
+
+#include <vector>
+
+class AnimationScheduler;
+
 /// Ogre-specific mesh entity animation controller
 /** <table class="header">
     <tr>
@@ -17,6 +23,9 @@
 
     Needs to be told of a @ref EC_Mesh "Mesh" component to be usable.
 
+    The animations are updated by the AnimationScheduler of the scene, which updates the controllers of small and off-screen
+    meshes less often than every frame.
+
     Registered by OgreRenderer::OgreRenderingModule.
 
     <b>Attributes</b>:
@@ -125,6 +134,12 @@ public:
         /// current phase
         AnimationPhase phase_;
 
+        /// The Ogre animation state, resolved when the animation is enabled or the Ogre entity changes. Null if not found
+        Ogre::AnimationState *state_;
+
+        /// The skeleton animation of the state, used for high-priority blending. Null if the skeleton does not have it
+        Ogre::Animation *skeletonAnimation_;
+
         Animation() :
             auto_stop_(false),
             fade_period_(0.0),
@@ -133,7 +148,9 @@ public:
             speed_factor_(1.0),
             num_repeats_(0),
             high_priority_(false),
-            phase_(PHASE_STOP)
+            phase_(PHASE_STOP),
+            state_(0),
+            skeletonAnimation_(0)
         {
         }
     };
@@ -148,6 +165,7 @@ public slots:
     void AutoSetMesh();
     
     /// Updates animation(s) by elapsed time
+    /** Called by the AnimationScheduler of the scene, there is no need to call this from scripts. */
     void Update(float frametime);
 
     /// Draws the mesh skeleton
@@ -285,11 +303,29 @@ private slots:
     void UpdateSignals();
     /// Called when component has been removed from the parent entity. Checks if the component removed was the mesh, and autodissociates it.
     void OnComponentRemoved(IComponent* component, AttributeChange::Type change);
+    /// Called when the Ogre entity of the mesh is about to be destroyed. Forgets the animation states of the entity.
+    void OnMeshAboutToBeDestroyed();
 
 private:
+    friend class AnimationScheduler;
+
     /// Gets Ogre entity from the mesh entity component and checks if it has changed; in that case resets internal state
+    /** If the entity was recreated with the same mesh, the animations are kept and their animation states are resolved again. */
     Ogre::Entity* GetEntity();
 
+    /// Resolves the cached animation states of the animations from an Ogre entity
+    void ResolveAnimationStates(Ogre::Entity* entity);
+
+    /// Advances the animations and updates the blend masks. Touches only the controller and the Ogre entity, so that
+    /// AnimationScheduler can run it on a worker thread. The signals are queued for FinishUpdate.
+    void AdvanceAnimations(Ogre::Entity* entity, float frametime);
+
+    /// Emits the signals queued by AdvanceAnimations and draws the debug skeleton
+    void FinishUpdate(float frametime);
+
+    /// Starts the updates of the animations, by the AnimationScheduler of the scene if there is one, otherwise every frame
+    void ScheduleUpdates();
+
     /// Gets animationstate from Ogre entity safely
     /** @param entity Ogre entity
         @param name Animation name
@@ -304,6 +340,18 @@ private:
     
     /// Current mesh name
     std::string mesh_name_;
+
+    /// The Ogre entity the animation states were resolved from
+    Ogre::Entity* entity_;
+
+    /// The scheduler updating this controller, null if updated every frame
+    QPointer<AnimationScheduler> scheduler_;
+
+    /// Index of this controller in the scheduler, -1 if not scheduled
+    int schedulerIndex_;
+
+    /// Names of the animations that cycled (true) or finished (false) on the last AdvanceAnimations
+    std::vector<std::pair<QString, bool> > pendingSignals_;
     
     /// Current animations
     AnimationMap animations_;
@@ -28,6 +28,8 @@
 #include <QDir>
 #include <QDateTime>
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 using namespace OgreRenderer;
@@ -386,7 +388,7 @@ bool EC_Camera::IsEntityVisible(Entity* entity)
     if (queryFrameNumber_ != framework->Frame()->FrameNumber())
         QueryVisibleEntities();
     
-    return visibleEntities_.find(entity->Id()) != visibleEntities_.end();
+    return std::binary_search(visibleEntities_.begin(), visibleEntities_.end(), entity->Id());
 }
 
 QList<Entity*> EC_Camera::VisibleEntities()
@@ -402,7 +404,7 @@ QList<Entity*> EC_Camera::VisibleEntities()
     if (queryFrameNumber_ != framework->Frame()->FrameNumber())
         QueryVisibleEntities();
     
-    for (std::set<entity_id_t>::iterator i = visibleEntities_.begin(); i != visibleEntities_.end(); ++i)
+    for (std::vector<entity_id_t>::const_iterator i = visibleEntities_.begin(); i != visibleEntities_.end(); ++i)
     {
         Entity* entity = scene->GetEntity(*i).get();
         if (entity)
@@ -412,7 +414,7 @@ QList<Entity*> EC_Camera::VisibleEntities()
     return l;
 }
 
-const std::set<entity_id_t>& EC_Camera::VisibleEntityIDs()
+const std::vector<entity_id_t>& EC_Camera::VisibleEntityIDs()
 {
     if (camera_)
     {
@@ -426,33 +428,12 @@ const std::set<entity_id_t>& EC_Camera::VisibleEntityIDs()
 
 void EC_Camera::StartViewTracking(Entity* entity)
 {
-    if (!entity)
-        return;
-
-    EntityPtr entityPtr = entity->shared_from_this();
-    for (unsigned i = 0; i < visibilityTrackedEntities_.size(); ++i)
-    {
-        if (visibilityTrackedEntities_[i].lock() == entityPtr)
-            return; // Already added
-    }
-    
-    visibilityTrackedEntities_.push_back(entity->shared_from_this());
+    viewTracker_.Start(entity);
 }
 
 void EC_Camera::StopViewTracking(Entity* entity)
 {
-    if (!entity)
-        return;
-    
-    EntityPtr entityPtr = entity->shared_from_this();
-    for (unsigned i = 0; i < visibilityTrackedEntities_.size(); ++i)
-    {
-        if (visibilityTrackedEntities_[i].lock() == entityPtr)
-        {
-            visibilityTrackedEntities_.erase(visibilityTrackedEntities_.begin() + i);
-            return;
-        }
-    }
+    viewTracker_.Stop(entity);
 }
 
 float4x4 EC_Camera::ViewMatrix() const
@@ -511,7 +492,7 @@ Frustum EC_Camera::ToFrustum() const
 
 void EC_Camera::OnUpdated(float timeStep)
 {
-    if (visibilityTrackedEntities_.empty())
+    if (viewTracker_.IsEmpty())
         return; // Do nothing if visibility not being tracked for any entities
     
     PROFILE(EC_Camera_OnUpdated);
@@ -519,31 +500,19 @@ void EC_Camera::OnUpdated(float timeStep)
     if (queryFrameNumber_ != framework->Frame()->FrameNumber())
         QueryVisibleEntities();
     
-    for (size_t i = visibilityTrackedEntities_.size() - 1; i < visibilityTrackedEntities_.size(); --i)
+    viewTracker_.Diff(lastVisibleEntities_, visibleEntities_, enteredView_, leftView_);
+    for (size_t i = 0; i < enteredView_.size(); ++i)
     {
-        // Check if the entity has expired; erase from list in that case
-        if (visibilityTrackedEntities_[i].expired())
-            visibilityTrackedEntities_.erase(visibilityTrackedEntities_.begin() + i);
-        else
-        {
-            Entity* entity = visibilityTrackedEntities_[i].lock().get();
-            entity_id_t id = entity->Id();
-            
-            // Check for change in visibility status
-            bool last = lastVisibleEntities_.find(id) != lastVisibleEntities_.end();
-            bool now = visibleEntities_.find(id) != visibleEntities_.end();
-            if (!last && now)
-            {
-                emit EntityEnterView(entity);
-                entity->EmitEnterView(this);
-            }
-            else if (last && !now)
-            {
-                emit EntityLeaveView(entity);
-                entity->EmitLeaveView(this);
-            }
-        }
+        emit EntityEnterView(enteredView_[i].get());
+        enteredView_[i]->EmitEnterView(this);
+    }
+    for (size_t i = 0; i < leftView_.size(); ++i)
+    {
+        emit EntityLeaveView(leftView_[i].get());
+        leftView_[i]->EmitLeaveView(this);
     }
+    enteredView_.clear();
+    leftView_.clear();
 }
 
 void EC_Camera::QueryVisibleEntities()
@@ -554,7 +523,7 @@ void EC_Camera::QueryVisibleEntities()
     PROFILE(EC_Camera_QueryVisibleEntities);
 
 #if OGRE_VERSION_MAJOR >= 1 && OGRE_VERSION_MINOR >= 7
-    lastVisibleEntities_ = visibleEntities_;
+    lastVisibleEntities_.swap(visibleEntities_);
     visibleEntities_.clear();
     
     Ogre::PlaneBoundedVolumeList volumes;
@@ -581,8 +550,9 @@ void EC_Camera::QueryVisibleEntities()
             continue;
         }
         if (entity)
-            visibleEntities_.insert(entity->Id());
+            visibleEntities_.push_back(entity->Id());
     }
+    EntityViewTracker::SortIds(visibleEntities_);
     
     queryFrameNumber_ = framework->Frame()->FrameNumber();
 #else
@@ -5,6 +5,7 @@
 #include "IComponent.h"
 #include "OgreModuleApi.h"
 #include "OgreModuleFwd.h"
+#include "EntityViewTracker.h"
 #include "Math/float3.h"
 #include "Math/float4x4.h"
 #include "Geometry/Frustum.h"
@@ -14,7 +15,7 @@
 #include <QSize>
 #include <QPoint>
 
-#include <set>
+#include <vector>
 
 #include <OgreImage.h>
 
@@ -126,8 +127,8 @@ public:
         @return Texture that has the current camera view. */
     Ogre::TexturePtr UpdateRenderTexture(bool renderUi);
 
-    /// Returns entity IDs of visible entities in the camera's frustum.
-    const std::set<entity_id_t>& VisibleEntityIDs();
+    /// Returns entity IDs of visible entities in the camera's frustum, sorted ascending.
+    const std::vector<entity_id_t>& VisibleEntityIDs();
 
 public slots:
     /// Sets this camera as the active main window camera.
@@ -188,10 +189,11 @@ public slots:
 
     /// Starts tracking an entity's visibility within the scene using this camera
     /** After this, connect either to the camera's EntityEnterView and EntityLeaveView signals,
-        or the entity's EnterView & LeaveView signals, to be notified of the visibility change(s) */
+        or the entity's EnterView & LeaveView signals, to be notified of the visibility change(s).
+        Tracking is reference counted: each call must be paired with a StopViewTracking call. */
     void StartViewTracking(Entity* entity);
 
-    /// Stops tracking an entity's visibility
+    /// Stops tracking an entity's visibility, once StopViewTracking has been called as many times as StartViewTracking
     void StopViewTracking(Entity* entity);
 
     /// Returns the view matrix for this camera, float4x4::nan if not applicable.
@@ -274,14 +276,18 @@ private:
     /// Frame number on which a full frustum query was last performed
     int queryFrameNumber_;
 
-    /// Visible entity ID's during this frame
-    std::set<entity_id_t> visibleEntities_;
+    /// Visible entity ID's during this frame, sorted
+    std::vector<entity_id_t> visibleEntities_;
 
-    /// Visible entity ID's during last frame
-    std::set<entity_id_t> lastVisibleEntities_;
+    /// Visible entity ID's during last frame, sorted
+    std::vector<entity_id_t> lastVisibleEntities_;
 
     /// Entities being tracked for visibility changes
-    std::vector<EntityWeakPtr> visibilityTrackedEntities_;
+    EntityViewTracker viewTracker_;
+
+    /// Tracked entities that entered and left the view on this frame, reusable
+    std::vector<EntityPtr> enteredView_;
+    std::vector<EntityPtr> leftView_;
 
     /// Frustum query
     Ogre::PlaneBoundedVolumeListSceneQuery *query_;
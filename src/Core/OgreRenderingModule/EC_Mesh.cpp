@@ -46,7 +46,8 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     entity_(0),
     instancedEntity_(0),
     adjustmentNode_(0),
-    attached_(false)
+    attached_(false),
+    autoInstancing_(false)
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
@@ -784,7 +785,7 @@ void EC_Mesh::CreateMesh(const AssetPtr &meshAsset)
 {
     // Redirect call if instancing is enabled.
 #ifndef NO_INSTANCING
-    if (useInstancing.Get())
+    if (UsesInstancing())
     {
         LogWarning("EC_Mesh::CreateMesh: Called with instancing enabled, redirecting to CreateInstance().");
         CreateInstance(meshAsset);
@@ -839,7 +840,7 @@ void EC_Mesh::CreateInstance(const AssetPtr &meshAsset)
     return;
 #else
     // Redirect call if instancing is not enabled.
-    if (!useInstancing.Get())
+    if (!UsesInstancing())
     {
         LogWarning("EC_Mesh::CreateInstance: Called with instancing disabled, redirecting to CreateMesh().");
         CreateMesh(meshAsset);
@@ -876,7 +877,16 @@ void EC_Mesh::CreateInstance(const AssetPtr &meshAsset)
 
     instancedEntity_ = world_.lock()->CreateInstance(this, meshAsset.get() != 0 ? meshAsset : this->meshAsset->Asset(), meshMaterial.Get(), drawDistance.Get(), castShadows.Get());
     if (!instancedEntity_)
+    {
+        // Automatic instancing must not make the mesh disappear, fall back to a normal entity.
+        if (autoInstancing_ && !useInstancing.Get())
+        {
+            autoInstancing_ = false;
+            emit AutoInstancingFailed();
+            CreateMesh(meshAsset);
+        }
         return;
+    }
 
     // Make sure adjustment node is up to date
     Transform newTransform = nodeTransformation.Get();
@@ -970,9 +980,9 @@ void EC_Mesh::AttributesChanged()
             useInstancing.Set(false, AttributeChange::Disconnected);
         }
 
-        if (useInstancing.Get())
+        if (UsesInstancing())
             CreateInstance();
-        else if (!useInstancing.Get())
+        else
             CreateMesh();
     }
 #endif
@@ -1069,8 +1079,12 @@ void EC_Mesh::AttributesChanged()
         if (!ViewEnabled())
             return;
 
+        // Skeletal meshes can not be instanced.
         if (!skeletonRef.Get().ref.isEmpty())
+        {
+            SetAutoInstancing(false);
             skeletonAsset->HandleAssetRefChange(&skeletonRef);
+        }
     }
 }
 
@@ -1082,7 +1096,7 @@ void EC_Mesh::OnComponentRemoved(IComponent* component, AttributeChange::Type ch
 
 void EC_Mesh::OnMeshAssetLoaded(AssetPtr asset)
 {
-    if (useInstancing.Get())
+    if (UsesInstancing())
         CreateInstance(asset);
     else
         CreateMesh(asset);
@@ -1124,7 +1138,7 @@ void EC_Mesh::OnSkeletonAssetLoaded(AssetPtr asset)
     }
 
     // Now we have to recreate the entity to get proper animations etc.
-    if (!useInstancing.Get())
+    if (!UsesInstancing())
         SetMesh(entity_->getMesh()->getName().c_str(), false);
 }
 
@@ -1154,7 +1168,7 @@ void EC_Mesh::OnMaterialAssetLoaded(AssetPtr asset)
 
     // If we are using instancing CreateInstance() is
     // currently waiting for this material to load.
-    if (assetUsed && useInstancing.Get())
+    if (assetUsed && UsesInstancing())
         CreateInstance();
 
     // This check & debug print is now in Debug mode only. Rapid changes in materials and the delay-loaded nature of assets makes it unavoidable in some cases.
@@ -1560,7 +1574,9 @@ bool EC_Mesh::Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance,
             PROFILE(EC_Mesh_Raycast_IndexBuf_Lock);
             pLong = static_cast<u32*>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
         }
-        u16* pShort = reinterpret_cast<u16*>(pLong);
+        // The index data may use only a range of a buffer shared with other submeshes, e.g. the LOD levels of EC_Terrain.
+        u16* pShort = reinterpret_cast<u16*>(pLong) + indexData->indexStart;
+        pLong += indexData->indexStart;
         bool use32BitIndices = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
         
         for (unsigned j = 0; j < indexData->indexCount - 2; j += 3)
@@ -1636,6 +1652,23 @@ Ogre::InstancedEntity* EC_Mesh::OgreInstancedEntity() const
     return instancedEntity_;
 }
 
+void EC_Mesh::SetAutoInstancing(bool enabled)
+{
+#ifndef NO_INSTANCING
+    if (enabled == autoInstancing_)
+        return;
+    bool wasInstanced = UsesInstancing();
+    autoInstancing_ = enabled;
+    if (UsesInstancing() == wasInstanced || !ViewEnabled())
+        return;
+
+    if (UsesInstancing())
+        CreateInstance();
+    else
+        CreateMesh();
+#endif
+}
+
 Ogre::SceneNode* EC_Mesh::AdjustmentSceneNode() const
 {
     return adjustmentNode_;
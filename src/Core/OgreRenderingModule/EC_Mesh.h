@@ -141,6 +141,14 @@ public:
     /** @return Instanced Ogre mesh entity, or null if 1) mesh not loaded 2) instancing is disabled @see OgreEntity. */
     Ogre::InstancedEntity* OgreInstancedEntity() const;
 
+    /// Returns if the mesh is created with instancing, either by useInstancing or automatically by MeshBatcher.
+    bool UsesInstancing() const { return useInstancing.Get() || autoInstancing_; }
+
+    /// Sets if the mesh is instanced automatically, regardless of useInstancing. Recreates the mesh if the instancing changes.
+    /** Used by MeshBatcher, which instances meshes that are used by enough components. If the instance can not be created,
+        the automatic instancing is disabled again, AutoInstancingFailed is emitted and a normal Ogre entity is created instead. */
+    void SetAutoInstancing(bool enabled);
+
     /// Returns an Ogre bone safely, or null if not found.
     Ogre::Bone* OgreBone(const QString& boneName) const;
 
@@ -419,6 +427,10 @@ signals:
     /// Signal is emitted when skeleton has successfully applied to entity.
     void SkeletonChanged(QString skeletonName);
 
+    /// Emitted when the instance requested with SetAutoInstancing could not be created and the automatic instancing was disabled.
+    /** Can be emitted later than the SetAutoInstancing call, when the instance is created once the assets have loaded. */
+    void AutoInstancingFailed();
+
 private slots:
     /// Called when the parent entity has been set.
     void UpdateSignals();
@@ -493,6 +505,9 @@ private:
     /// Mesh entity attached to placeable -flag
     bool attached_;
 
+    /// Instanced automatically by MeshBatcher -flag
+    bool autoInstancing_;
+
     /** Manages material asset requests for EC_Mesh. This utility object is used so that 
         EC_Mesh also gets notifications about changes to material assets on disk. */
     std::vector<AssetRefListenerPtr> materialAssets;
@@ -203,6 +203,9 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     }
     transform.SetMetadata(&transAttrData);
 
+    connect(this, SIGNAL(ParentEntitySet()), SLOT(OnParentEntitySet()));
+    connect(this, SIGNAL(ParentEntityDetached()), SLOT(OnParentEntityDetached()));
+
     OgreWorldPtr world = world_.lock();
     if (world)
     {
@@ -248,6 +251,14 @@ EC_Placeable::~EC_Placeable()
 }
 
 void EC_Placeable::AttachNode()
+{
+    CacheParent();
+    AttachNodeToParent();
+    // The world transform changes with the parent, so let the listeners that cache it know.
+    emit TransformChanged();
+}
+
+void EC_Placeable::AttachNodeToParent()
 {
     if (world_.expired())
     {
@@ -685,6 +696,13 @@ void EC_Placeable::RegisterActions()
     }
 }
 
+void EC_Placeable::AttributeChangedDisconnected(IAttribute *attribute)
+{
+    // The scene node is updated on the next connected change, but the transform cache is read by LocalToWorld right away.
+    if (attribute == &transform)
+        CacheLocalTransform();
+}
+
 void EC_Placeable::AttributesChanged()
 {
     // If parent ref or parent bone changed, reattach node to scene hierarchy
@@ -694,6 +712,7 @@ void EC_Placeable::AttributesChanged()
     if (transform.ValueChanged())
     {
         transform.ClearChangedFlag();
+        CacheLocalTransform();
         const Transform& trans = transform.Get();
         if (trans.pos.IsFinite())
             sceneNode_->setPosition(trans.pos);
@@ -798,6 +817,60 @@ void EC_Placeable::OnEntityParentChanged()
         AttachNode();
 }
 
+void EC_Placeable::OnParentEntitySet()
+{
+    CacheLocalTransform();
+    CacheParent();
+}
+
+void EC_Placeable::OnParentEntityDetached()
+{
+    // When the entity is being destroyed, the scene removes it from the cache itself.
+    EntityPtr entity = cachedEntity_.lock();
+    Scene *scene = entity ? entity->ParentScene() : 0;
+    if (scene)
+        scene->Transforms().Remove(entity->Id());
+    cachedEntity_.reset();
+}
+
+void EC_Placeable::CacheLocalTransform()
+{
+    Entity *entity = ParentEntity();
+    Scene *scene = entity ? entity->ParentScene() : 0;
+    if (!scene)
+        return;
+
+    scene->Transforms().SetLocalTransform(entity->Id(), LocalToParent());
+    cachedEntity_ = entity->shared_from_this();
+}
+
+void EC_Placeable::CacheParent()
+{
+    Entity *entity = ParentEntity();
+    Scene *scene = entity ? entity->ParentScene() : 0;
+    if (!scene)
+        return;
+
+    // Resolve the parent the same way as AttachNodeToParent. A bone attachment is left to Ogre, see LocalToWorld.
+    entity_id_t parentId = 0;
+    bool resolved = parentBone.Get().isEmpty();
+    const EntityReference &parent = parentRef.Get();
+    if (!parent.IsEmpty() || entity->Parent())
+    {
+        EntityPtr parentEntity = parent.LookupParent(entity);
+        if (parentEntity)
+            parentId = (parentEntity.get() != entity ? parentEntity->Id() : 0);
+        else
+        {
+            // A parent referred to by ID can be tracked before it is created, one referred to by name is resolved when it is created.
+            parentId = parent.ref.toUInt();
+            if (!parentId)
+                resolved = false;
+        }
+    }
+    scene->Transforms().SetParent(entity->Id(), parentId, resolved);
+}
+
 void EC_Placeable::SetPosition(float x, float y, float z)
 {
     assume(IsFinite(x));
@@ -980,9 +1053,16 @@ float3x4 EC_Placeable::LocalToWorld() const
         return float4x4(sceneNode_->_getFullTransform()).Float3x4Part();
 
     // Otherwise, compute the world matrix using our Tundra scene structures (not the Ogre scene structures, which can be out-of-date!)
-    EC_Placeable *parentPlaceable = ParentPlaceableComponent();
-    assert(parentPlaceable != this);
-    float3x4 localToWorld = parentPlaceable ? (parentPlaceable->LocalToWorld() * LocalToParent()) : LocalToParent();
+    // The transform cache of the scene has it when the whole parent chain is known to it, otherwise walk up the parent placeables.
+    float3x4 localToWorld;
+    Entity *entity = ParentEntity();
+    Scene *scene = entity ? entity->ParentScene() : 0;
+    if (!scene || !scene->Transforms().WorldTransform(entity->Id(), localToWorld))
+    {
+        EC_Placeable *parentPlaceable = ParentPlaceableComponent();
+        assert(parentPlaceable != this);
+        localToWorld = parentPlaceable ? (parentPlaceable->LocalToWorld() * LocalToParent()) : LocalToParent();
+    }
 
 #ifdef _DEBUG
     // But confirm to detect oddities when/if these two don't match.
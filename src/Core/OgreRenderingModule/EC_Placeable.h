@@ -320,15 +320,33 @@ private slots:
     /// Handle the entity reparenting itself
     void OnEntityParentChanged();
 
+    /// Handle the component being added to an entity, start tracking the entity in the transform cache of the scene
+    void OnParentEntitySet();
+
+    /// Handle the component being removed from its entity, stop tracking the entity in the transform cache of the scene
+    void OnParentEntityDetached();
+
 private:
     /// Handle attributechange
     void AttributesChanged();
 
+    /// Keeps the transform cache of the scene up to date with changes that do not reach AttributesChanged
+    void AttributeChangedDisconnected(IAttribute *attribute);
+
     /// attaches scenenode to parent
     void AttachNode();
+
+    /// does the attaching for AttachNode
+    void AttachNodeToParent();
     
     /// detaches scenenode from parent
     void DetachNode();
+
+    /// Sets the transform attribute to the transform cache of the scene
+    void CacheLocalTransform();
+
+    /// Sets the parent to the transform cache of the scene
+    void CacheParent();
     
     /// Ogre world ptr
     OgreWorldWeakPtr world_;
@@ -351,6 +369,9 @@ private:
     /// attached to scene hierarchy-flag
     bool attached_;
 
+    /// The entity tracked in the transform cache of the scene
+    EntityWeakPtr cachedEntity_;
+
     friend class BoneAttachmentListener;
     friend class CustomTagPoint;
 };
@@ -0,0 +1,91 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "EntityViewTracker.h"
+#include "Entity.h"
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+void EntityViewTracker::Start(Entity *entity)
+{
+    if (!entity)
+        return;
+
+    TrackedEntity &tracked = tracked_[entity->Id()];
+    EntityPtr current = tracked.entity.lock();
+    if (current.get() != entity)
+    {
+        // New entry, or an entry left behind by a removed entity with the same ID.
+        tracked.entity = entity->shared_from_this();
+        tracked.refCount = 0;
+    }
+    ++tracked.refCount;
+}
+
+void EntityViewTracker::Stop(Entity *entity)
+{
+    if (!entity)
+        return;
+
+    QHash<entity_id_t, TrackedEntity>::iterator iter = tracked_.find(entity->Id());
+    if (iter == tracked_.end() || iter->entity.lock().get() != entity)
+        return;
+    if (--iter->refCount <= 0)
+        tracked_.erase(iter);
+}
+
+EntityPtr EntityViewTracker::Lookup(entity_id_t id)
+{
+    QHash<entity_id_t, TrackedEntity>::iterator iter = tracked_.find(id);
+    if (iter == tracked_.end())
+        return EntityPtr();
+    EntityPtr entity = iter->entity.lock();
+    if (!entity || entity->Id() != id)
+    {
+        tracked_.erase(iter);
+        return EntityPtr();
+    }
+    return entity;
+}
+
+void EntityViewTracker::Diff(const std::vector<entity_id_t> &lastVisible, const std::vector<entity_id_t> &visible,
+    std::vector<EntityPtr> &entered, std::vector<EntityPtr> &left)
+{
+    entered.clear();
+    left.clear();
+    if (tracked_.isEmpty())
+        return;
+
+    size_t i = 0;
+    size_t j = 0;
+    while(i < lastVisible.size() || j < visible.size())
+    {
+        if (j == visible.size() || (i < lastVisible.size() && lastVisible[i] < visible[j]))
+        {
+            EntityPtr entity = Lookup(lastVisible[i++]);
+            if (entity)
+                left.push_back(entity);
+        }
+        else if (i == lastVisible.size() || visible[j] < lastVisible[i])
+        {
+            EntityPtr entity = Lookup(visible[j++]);
+            if (entity)
+                entered.push_back(entity);
+        }
+        else
+        {
+            ++i;
+            ++j;
+        }
+    }
+}
+
+void EntityViewTracker::SortIds(std::vector<entity_id_t> &ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
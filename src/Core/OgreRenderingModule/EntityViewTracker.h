@@ -0,0 +1,57 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "SceneFwd.h"
+#include "CoreTypes.h"
+
+#include <QHash>
+
+#include <vector>
+
+/// The entities whose visibility changes are reported by EC_Camera and OgreWorld.
+/** Registration is a hash insert, and the per-frame cost depends only on the number of entities that entered or left the view,
+    not on the number of tracked entities: the changes are found with a single linear merge of the sorted visible entity ID lists
+    of the last and the current frame, and only the changed IDs are looked up from the tracked entities.
+
+    Tracking is reference counted, so that several users can track the same entity independently of each other. */
+class OGRE_MODULE_API EntityViewTracker
+{
+public:
+    /// Starts tracking an entity, or adds a reference to its tracking.
+    void Start(Entity *entity);
+
+    /// Removes a reference to the tracking of an entity. The entity is no longer tracked when all the references are removed.
+    void Stop(Entity *entity);
+
+    /// Returns if no entities are tracked.
+    bool IsEmpty() const { return tracked_.isEmpty(); }
+
+    /// Finds the tracked entities whose visibility changed.
+    /** @param lastVisible The IDs of the entities visible on the last frame, sorted ascending without duplicates.
+        @param visible The IDs of the entities visible now, sorted ascending without duplicates.
+        @param entered [out] Receives the tracked entities that entered the view. Cleared first.
+        @param left [out] Receives the tracked entities that left the view. Cleared first.
+        @note The entities are returned as strong references, so that they stay alive while the caller emits signals for them. */
+    void Diff(const std::vector<entity_id_t> &lastVisible, const std::vector<entity_id_t> &visible,
+        std::vector<EntityPtr> &entered, std::vector<EntityPtr> &left);
+
+    /// Sorts and removes duplicates from a list of entity IDs, to pass it to Diff.
+    static void SortIds(std::vector<entity_id_t> &ids);
+
+private:
+    /// @cond PRIVATE
+    struct TrackedEntity
+    {
+        TrackedEntity() : refCount(0) {}
+        EntityWeakPtr entity;
+        int refCount;
+    };
+    /// @endcond
+
+    /// Returns the tracked entity with the ID, or null. Forgets the entity if it has been removed.
+    EntityPtr Lookup(entity_id_t id);
+
+    QHash<entity_id_t, TrackedEntity> tracked_;
+};
@@ -0,0 +1,595 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "MeshBatcher.h"
+#include "OgreWorld.h"
+#include "EC_Mesh.h"
+#include "EC_Placeable.h"
+#include "OgreMeshAsset.h"
+
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Scene/Scene.h"
+#include "SceneAPI.h"
+#include "Entity.h"
+#include "EC_Name.h"
+#include "EC_DynamicComponent.h"
+#include "IAttribute.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <Ogre.h>
+
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+/// @cond PRIVATE
+namespace
+{
+
+/// Returns if the entity of a mesh has only components that leave the Ogre entity of the mesh alone.
+/** @param rigidBodyTypeId The type ID of EC_RigidBody, which is in PhysicsModule that this module does not depend on. */
+bool HasOnlyBatchableComponents(Entity *entity, u32 rigidBodyTypeId)
+{
+    int numMeshes = 0;
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator iter = components.begin(); iter != components.end(); ++iter)
+    {
+        u32 typeId = iter->second->TypeId();
+        if (typeId == EC_Mesh::TypeIdStatic())
+            ++numMeshes;
+        else if (typeId != EC_Placeable::TypeIdStatic() && typeId != EC_Name::TypeIdStatic() &&
+            typeId != EC_DynamicComponent::TypeIdStatic() && typeId != rigidBodyTypeId)
+            return false;
+    }
+    return numMeshes == 1;
+}
+
+} // ~unnamed namespace
+/// @endcond
+
+bool MeshBatcher::RegionKey::operator <(const RegionKey &rhs) const
+{
+    if (x != rhs.x) return x < rhs.x;
+    if (y != rhs.y) return y < rhs.y;
+    if (z != rhs.z) return z < rhs.z;
+    return castShadows < rhs.castShadows;
+}
+
+MeshBatcher::MeshBatcher(OgreWorld *world, Scene *scene) :
+    world_(world),
+    scene_(scene->shared_from_this()),
+    enabled_(false),
+    instancingThreshold_(8),
+    staticDelay_(5.f),
+    regionSize_(100.f),
+    time_(0.0),
+    rigidBodyTypeId_(scene->GetFramework()->Scene()->ComponentTypeIdForTypeName("EC_RigidBody")) // 0 if PhysicsModule is not loaded.
+{
+    connect(scene->GetFramework()->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
+}
+
+MeshBatcher::~MeshBatcher()
+{
+    // The meshes are left as they are, the Ogre scene they are in is being destroyed too.
+    DestroyRegions();
+}
+
+void MeshBatcher::SetEnabled(bool enabled)
+{
+    if (enabled == enabled_)
+        return;
+    enabled_ = enabled;
+
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    if (enabled_)
+    {
+        connect(scene.get(), SIGNAL(ComponentAdded(Entity*, IComponent*, AttributeChange::Type)),
+            this, SLOT(OnComponentAdded(Entity*, IComponent*, AttributeChange::Type)));
+        connect(scene.get(), SIGNAL(ComponentRemoved(Entity*, IComponent*, AttributeChange::Type)),
+            this, SLOT(OnComponentRemoved(Entity*, IComponent*, AttributeChange::Type)));
+        AddAll();
+    }
+    else
+    {
+        disconnect(scene.get(), 0, this, 0);
+        RemoveAll();
+    }
+}
+
+void MeshBatcher::SetInstancingThreshold(int threshold)
+{
+    threshold = std::max(threshold, 2);
+    if (threshold == instancingThreshold_)
+        return;
+    instancingThreshold_ = threshold;
+
+    for(QHash<QString, Group>::iterator iter = groups_.begin(); iter != groups_.end(); ++iter)
+    {
+        bool instanced = iter->members.size() >= instancingThreshold_;
+        if (instanced == iter->instanced)
+            continue;
+        iter->instanced = instanced;
+        foreach(IComponent *mesh, iter->members)
+            SetInstanced(items_[mesh], instanced);
+    }
+}
+
+void MeshBatcher::SetStaticDelay(float seconds)
+{
+    staticDelay_ = std::max(seconds, 0.f);
+}
+
+void MeshBatcher::SetRegionSize(float size)
+{
+    if (size <= 0.f || size == regionSize_)
+        return;
+    regionSize_ = size;
+
+    // Merge everything again into the new regions.
+    DestroyRegions();
+    for(QHash<IComponent*, Item>::iterator iter = items_.begin(); iter != items_.end(); ++iter)
+        MarkDirty(iter.key());
+}
+
+MeshBatcher::Statistics MeshBatcher::Stats() const
+{
+    Statistics stats;
+    ScenePtr scene = scene_.lock();
+    if (scene)
+        stats.meshes = (int)scene->Components(EC_Mesh::TypeIdStatic()).size();
+    stats.groups = groups_.size();
+    for(QHash<QString, Group>::const_iterator iter = groups_.begin(); iter != groups_.end(); ++iter)
+    {
+        stats.batchableMeshes += iter->members.size();
+        if (iter->instanced)
+        {
+            ++stats.instancedGroups;
+            foreach(IComponent *mesh, iter->members)
+                if (items_[mesh].instanced)
+                    ++stats.instancedMeshes;
+        }
+    }
+    for(std::map<RegionKey, Region>::const_iterator iter = regions_.begin(); iter != regions_.end(); ++iter)
+    {
+        if (iter->second.geometry)
+            ++stats.staticRegions;
+        stats.staticMeshes += iter->second.members.size();
+    }
+    return stats;
+}
+
+void MeshBatcher::AddAll()
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    Entity::ComponentVector meshes = scene->Components(EC_Mesh::TypeIdStatic());
+    for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+        AddMesh(iter->get());
+}
+
+void MeshBatcher::RemoveAll()
+{
+    DestroyRegions();
+    QList<IComponent*> meshes = items_.keys();
+    foreach(IComponent *mesh, meshes)
+    {
+        Item &item = items_[mesh];
+        if (!item.weakMesh.expired())
+        {
+            SetInstanced(item, false);
+            mesh->disconnect(this);
+        }
+        SetChain(item, std::vector<EC_Placeable*>());
+    }
+    items_.clear();
+    groups_.clear();
+    dependents_.clear();
+    dirtyItems_.clear();
+    mergeCandidates_.clear();
+}
+
+void MeshBatcher::AddMesh(IComponent *mesh)
+{
+    if (!mesh || !enabled_)
+        return;
+    QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+    if (iter != items_.end())
+    {
+        // A new mesh may have been allocated where a mesh that was removed without a signal was.
+        if (!iter->weakMesh.expired())
+            return;
+        RemoveMesh(mesh);
+    }
+
+    Item &item = items_[mesh];
+    item.mesh = mesh;
+    item.weakMesh = mesh->shared_from_this();
+    MarkDirty(mesh);
+
+    connect(mesh, SIGNAL(MeshChanged()), this, SLOT(OnMeshChanged()), Qt::UniqueConnection);
+    connect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshAboutToBeDestroyed()), Qt::UniqueConnection);
+    connect(mesh, SIGNAL(AutoInstancingFailed()), this, SLOT(OnAutoInstancingFailed()), Qt::UniqueConnection);
+    connect(mesh, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnMeshChanged()), Qt::UniqueConnection);
+}
+
+void MeshBatcher::RemoveMesh(IComponent *mesh)
+{
+    QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+    if (iter == items_.end())
+        return;
+
+    Item &item = *iter;
+    Unmerge(item);
+    LeaveGroup(item);
+    if (!item.weakMesh.expired())
+        mesh->disconnect(this);
+    SetChain(item, std::vector<EC_Placeable*>());
+    items_.erase(iter);
+    // The entries of dirtyItems_ and mergeCandidates_ of removed meshes are skipped when they are processed.
+}
+
+void MeshBatcher::MarkDirty(IComponent *mesh)
+{
+    QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+    if (iter == items_.end())
+        return;
+    iter->changeTime = time_;
+    if (!iter->dirty)
+    {
+        iter->dirty = true;
+        dirtyItems_.push_back(mesh);
+    }
+}
+
+void MeshBatcher::OnUpdated(float frameTime)
+{
+    time_ += frameTime;
+    if (enabled_)
+        Update();
+}
+
+void MeshBatcher::Update()
+{
+    PROFILE(MeshBatcher_Update);
+
+    // Reclassify the changed meshes. Instancing recreates the Ogre objects and marks the meshes dirty again, so collect them anew.
+    std::vector<IComponent*> dirty;
+    dirty.swap(dirtyItems_);
+    for(size_t i = 0; i < dirty.size(); ++i)
+    {
+        QHash<IComponent*, Item>::iterator iter = items_.find(dirty[i]);
+        if (iter == items_.end() || !iter->dirty)
+            continue;
+        Item &item = *iter;
+        item.dirty = false;
+        if (item.weakMesh.expired())
+        {
+            RemoveMesh(dirty[i]);
+            continue;
+        }
+        Unmerge(item);
+        SetGroup(item, Classify(item));
+        if (!item.group.isEmpty() && !item.instanced && !item.queued)
+        {
+            item.queued = true;
+            mergeCandidates_.push_back(std::make_pair(item.mesh, item.changeTime));
+        }
+    }
+
+    // Merge the meshes that have stayed unchanged long enough. A mesh is queued once, with the time it was queued at,
+    // and is queued again with its latest change time if it has changed since.
+    while(!mergeCandidates_.empty() && mergeCandidates_.front().second + staticDelay_ <= time_)
+    {
+        IComponent *mesh = mergeCandidates_.front().first;
+        mergeCandidates_.pop_front();
+        QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+        if (iter == items_.end() || !iter->queued)
+            continue;
+        iter->queued = false;
+        if (iter->dirty)
+            continue; // Queued again when reclassified.
+        if (iter->changeTime + staticDelay_ <= time_)
+            Merge(*iter);
+        else
+        {
+            iter->queued = true;
+            mergeCandidates_.push_back(std::make_pair(mesh, iter->changeTime));
+        }
+    }
+
+    for(std::map<RegionKey, Region>::iterator iter = regions_.begin(); iter != regions_.end();)
+    {
+        if (iter->second.members.isEmpty())
+        {
+            if (iter->second.geometry && world_->OgreSceneManager())
+                world_->OgreSceneManager()->destroyStaticGeometry(iter->second.geometry);
+            regions_.erase(iter++);
+            continue;
+        }
+        if (iter->second.dirty)
+            BuildRegion(iter->first, iter->second);
+        ++iter;
+    }
+}
+
+QString MeshBatcher::Classify(Item &item)
+{
+    ComponentPtr comp = item.weakMesh.lock();
+    EC_Mesh *mesh = static_cast<EC_Mesh*>(comp.get());
+    EC_Placeable *placeable = mesh ? dynamic_cast<EC_Placeable*>(mesh->Placeable().get()) : 0;
+
+    std::vector<EC_Placeable*> chain;
+    bool boneAttached = false;
+    for(EC_Placeable *p = placeable; p && chain.size() < 256; p = p->ParentPlaceableComponent())
+    {
+        chain.push_back(p);
+        if (!p->parentBone.Get().isEmpty())
+            boneAttached = true;
+    }
+    SetChain(item, chain);
+
+    if (!placeable || boneAttached || mesh->useInstancing.Get() || !mesh->skeletonRef.Get().ref.isEmpty() ||
+        !mesh->ParentEntity() || !HasOnlyBatchableComponents(mesh->ParentEntity(), rigidBodyTypeId_))
+        return QString();
+
+    OgreMeshAssetPtr meshAsset = mesh->MeshAsset();
+    if (!meshAsset || meshAsset->ogreMesh.isNull())
+        return QString();
+    Ogre::Mesh *ogreMesh = meshAsset->ogreMesh.get();
+    if (ogreMesh->sharedVertexData || ogreMesh->hasSkeleton())
+        return QString();
+
+    QString key = meshAsset->Name();
+    const AssetReferenceList &materials = mesh->meshMaterial.Get();
+    for(int i = 0; i < materials.Size(); ++i)
+        key += "|" + materials[i].ref;
+    key += mesh->castShadows.Get() ? "|1" : "|0";
+    return key;
+}
+
+void MeshBatcher::SetChain(Item &item, const std::vector<EC_Placeable*> &chain)
+{
+    if (chain == item.chain)
+        return;
+
+    // The old placeables may have been deleted already, so they are not dereferenced. They stay connected, which is harmless.
+    for(size_t i = 0; i < item.chain.size(); ++i)
+        dependents_.remove(item.chain[i], item.mesh);
+    for(size_t i = 0; i < chain.size(); ++i)
+    {
+        if (!dependents_.contains(chain[i]))
+        {
+            // Attribute changes catch the visibility and parenting changes, TransformChanged the transforms set to the Ogre node directly.
+            connect(chain[i], SIGNAL(TransformChanged()), this, SLOT(OnPlaceableChanged()), Qt::UniqueConnection);
+            connect(chain[i], SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableChanged()), Qt::UniqueConnection);
+        }
+        dependents_.insert(chain[i], item.mesh);
+    }
+    item.chain = chain;
+}
+
+void MeshBatcher::SetGroup(Item &item, const QString &group)
+{
+    if (group == item.group)
+        return;
+
+    LeaveGroup(item);
+    item.group = group;
+    if (group.isEmpty())
+    {
+        SetInstanced(item, false);
+        return;
+    }
+
+    Group &newGroup = groups_[group];
+    newGroup.members.insert(item.mesh);
+    if (!newGroup.instanced && newGroup.members.size() >= instancingThreshold_)
+    {
+        newGroup.instanced = true;
+        foreach(IComponent *mesh, newGroup.members)
+            SetInstanced(items_[mesh], true);
+    }
+    else
+        SetInstanced(item, newGroup.instanced);
+}
+
+void MeshBatcher::LeaveGroup(Item &item)
+{
+    QHash<QString, Group>::iterator iter = groups_.find(item.group);
+    item.group.clear();
+    if (iter == groups_.end())
+        return;
+
+    iter->members.remove(item.mesh);
+    if (iter->members.isEmpty())
+        groups_.erase(iter);
+    else if (iter->instanced && iter->members.size() < instancingThreshold_)
+    {
+        iter->instanced = false;
+        foreach(IComponent *mesh, iter->members)
+            SetInstanced(items_[mesh], false);
+    }
+}
+
+void MeshBatcher::SetInstanced(Item &item, bool instanced)
+{
+    if (instanced == item.instanced)
+        return;
+    item.instanced = instanced;
+    if (instanced)
+        Unmerge(item);
+
+    ComponentPtr comp = item.weakMesh.lock();
+    if (comp)
+        static_cast<EC_Mesh*>(comp.get())->SetAutoInstancing(instanced);
+}
+
+void MeshBatcher::Merge(Item &item)
+{
+    if (item.region || item.instanced || item.group.isEmpty())
+        return;
+    ComponentPtr comp = item.weakMesh.lock();
+    EC_Mesh *mesh = static_cast<EC_Mesh*>(comp.get());
+    Ogre::Entity *entity = mesh ? mesh->OgreEntity() : 0;
+    if (!entity || !entity->getParentSceneNode() || mesh->drawDistance.Get() > 0.f)
+        return;
+
+    // Hidden meshes stay out of the static geometry, which would show them.
+    for(size_t i = 0; i < item.chain.size(); ++i)
+        if (!item.chain[i]->visible.Get())
+            return;
+
+    const Ogre::Vector3 &pos = entity->getParentSceneNode()->_getDerivedPosition();
+    RegionKey key;
+    key.x = (int)floor(pos.x / regionSize_);
+    key.y = (int)floor(pos.y / regionSize_);
+    key.z = (int)floor(pos.z / regionSize_);
+    key.castShadows = mesh->castShadows.Get();
+
+    Region &region = regions_[key];
+    region.members.insert(item.mesh);
+    region.dirty = true;
+    item.region = &region;
+}
+
+void MeshBatcher::Unmerge(Item &item)
+{
+    if (item.region)
+    {
+        item.region->members.remove(item.mesh);
+        item.region->dirty = true;
+        item.region = 0;
+    }
+    if (item.hiddenEntity)
+    {
+        // Restore the entity only if the mesh still has it, it may have been destroyed already.
+        ComponentPtr comp = item.weakMesh.lock();
+        EC_Mesh *mesh = static_cast<EC_Mesh*>(comp.get());
+        if (mesh && mesh->OgreEntity() == item.hiddenEntity)
+            item.hiddenEntity->setVisibilityFlags(item.hiddenFlags);
+        item.hiddenEntity = 0;
+    }
+}
+
+void MeshBatcher::BuildRegion(const RegionKey &key, Region &region)
+{
+    PROFILE(MeshBatcher_BuildRegion);
+
+    region.dirty = false;
+    Ogre::SceneManager *sceneManager = world_->OgreSceneManager();
+    if (!sceneManager)
+        return;
+
+    try
+    {
+        if (!region.geometry)
+        {
+            region.geometry = sceneManager->createStaticGeometry(world_->GenerateUniqueObjectName("MeshBatcherRegion"));
+            region.geometry->setRegionDimensions(Ogre::Vector3(regionSize_, regionSize_, regionSize_));
+            region.geometry->setCastShadows(key.castShadows);
+        }
+        else
+            region.geometry->reset();
+
+        foreach(IComponent *comp, region.members)
+        {
+            Item &item = items_[comp];
+            EC_Mesh *mesh = static_cast<EC_Mesh*>(comp);
+            Ogre::Entity *entity = mesh->OgreEntity();
+            if (!entity || !entity->getParentSceneNode())
+                continue;
+
+            Ogre::SceneNode *node = entity->getParentSceneNode();
+            region.geometry->addEntity(entity, node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+            if (item.hiddenEntity != entity)
+            {
+                item.hiddenEntity = entity;
+                item.hiddenFlags = entity->getVisibilityFlags();
+                entity->setVisibilityFlags(0);
+            }
+        }
+        region.geometry->build();
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogError("MeshBatcher::BuildRegion: Could not build static geometry: " + QString(e.what()));
+        // Show the meshes individually instead.
+        QList<IComponent*> members = region.members.toList();
+        foreach(IComponent *comp, members)
+            Unmerge(items_[comp]);
+    }
+}
+
+void MeshBatcher::DestroyRegions()
+{
+    for(QHash<IComponent*, Item>::iterator iter = items_.begin(); iter != items_.end(); ++iter)
+        Unmerge(*iter);
+
+    Ogre::SceneManager *sceneManager = world_->OgreSceneManager();
+    for(std::map<RegionKey, Region>::iterator iter = regions_.begin(); iter != regions_.end(); ++iter)
+        if (iter->second.geometry && sceneManager)
+            sceneManager->destroyStaticGeometry(iter->second.geometry);
+    regions_.clear();
+}
+
+void MeshBatcher::OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type)
+{
+    if (comp->TypeId() == EC_Mesh::TypeIdStatic())
+        AddMesh(comp);
+
+    // Any component may change whether the meshes of the entity can be batched.
+    Entity::ComponentVector meshes = entity->ComponentsOfType(EC_Mesh::TypeIdStatic());
+    for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+        MarkDirty(iter->get());
+}
+
+void MeshBatcher::OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type)
+{
+    if (comp->TypeId() == EC_Mesh::TypeIdStatic())
+        RemoveMesh(comp);
+
+    Entity::ComponentVector meshes = entity->ComponentsOfType(EC_Mesh::TypeIdStatic());
+    for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+        MarkDirty(iter->get());
+}
+
+void MeshBatcher::OnPlaceableChanged()
+{
+    EC_Placeable *placeable = static_cast<EC_Placeable*>(sender());
+    for(QMultiHash<EC_Placeable*, IComponent*>::const_iterator iter = dependents_.find(placeable); iter != dependents_.end() && iter.key() == placeable; ++iter)
+        MarkDirty(iter.value());
+}
+
+void MeshBatcher::OnMeshChanged()
+{
+    MarkDirty(static_cast<IComponent*>(sender()));
+}
+
+void MeshBatcher::OnAutoInstancingFailed()
+{
+    // The mesh fell back to a normal Ogre entity. It stays in its group, but is no longer counted as instanced,
+    // so it is merged into static geometry like the meshes of groups that are not instanced.
+    IComponent *mesh = static_cast<IComponent*>(sender());
+    QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+    if (iter == items_.end())
+        return;
+    iter->instanced = false;
+    MarkDirty(mesh);
+}
+
+void MeshBatcher::OnMeshAboutToBeDestroyed()
+{
+    // The Ogre entity is destroyed right after this, take it out of its region while it is still valid.
+    IComponent *mesh = static_cast<IComponent*>(sender());
+    QHash<IComponent*, Item>::iterator iter = items_.find(mesh);
+    if (iter != items_.end())
+        Unmerge(*iter);
+    MarkDirty(mesh);
+}
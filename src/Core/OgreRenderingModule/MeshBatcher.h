@@ -0,0 +1,193 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <QObject>
+#include <QHash>
+#include <QMultiHash>
+#include <QSet>
+#include <QString>
+
+#include <vector>
+#include <deque>
+#include <map>
+
+class IAttribute;
+
+namespace Ogre { class StaticGeometry; }
+
+/// Batches the meshes of a scene automatically to reduce the draw calls, without the content having to be authored for it.
+/** The meshes that can be batched are grouped by their mesh asset, materials and shadow casting. When a group has at least
+    instancingThreshold meshes, its meshes are instanced with EC_Mesh::SetAutoInstancing, and when it falls below that, they are
+    turned back to normal Ogre entities. The useInstancing attribute is left alone, and meshes that set it are not batched.
+
+    Meshes of the other groups that have not changed for staticDelay seconds are merged into static geometry regions, cubes of
+    regionSize in world space. The Ogre entity of a merged mesh stays in the scene for queries, but is hidden from the viewports
+    with visibility flags. When a merged mesh changes or moves, it is taken out of its region, and the region is rebuilt.
+
+    A mesh can be batched if it has a placeable that is not attached to a bone, has no skeleton or shared vertex data, and its
+    entity has no components that expect to modify the Ogre entity of the mesh, i.e. only EC_Name, EC_Placeable, EC_RigidBody
+    and EC_DynamicComponent besides the one EC_Mesh.
+
+    Disabled by default. Enabled with the "mesh batching" rendering config value, or with SetEnabled.
+    Owned by OgreWorld, see OgreWorld::Batcher. */
+class OGRE_MODULE_API MeshBatcher : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ IsEnabled WRITE SetEnabled)
+    Q_PROPERTY(int instancingThreshold READ InstancingThreshold WRITE SetInstancingThreshold)
+    Q_PROPERTY(float staticDelay READ StaticDelay WRITE SetStaticDelay)
+    Q_PROPERTY(float regionSize READ RegionSize WRITE SetRegionSize)
+
+public:
+    MeshBatcher(OgreWorld *world, Scene *scene);
+    ~MeshBatcher();
+
+    /// The batches currently formed.
+    struct Statistics
+    {
+        Statistics() : meshes(0), batchableMeshes(0), groups(0), instancedGroups(0), instancedMeshes(0), staticRegions(0), staticMeshes(0) {}
+
+        int meshes; ///< Number of meshes in the scene.
+        int batchableMeshes; ///< Number of meshes that can be batched.
+        int groups; ///< Number of distinct mesh, material and shadow combinations of the batchable meshes.
+        int instancedGroups; ///< Number of groups that are instanced.
+        int instancedMeshes; ///< Number of meshes that are instanced automatically.
+        int staticRegions; ///< Number of static geometry regions.
+        int staticMeshes; ///< Number of meshes merged into the static geometry regions.
+    };
+
+    /// Returns the statistics of the batches formed.
+    Statistics Stats() const;
+
+    bool IsEnabled() const { return enabled_; }
+    int InstancingThreshold() const { return instancingThreshold_; }
+    float StaticDelay() const { return staticDelay_; }
+    float RegionSize() const { return regionSize_; }
+
+public slots:
+    /// Enables or disables the batching. Disabling returns all the meshes to normal Ogre entities.
+    void SetEnabled(bool enabled);
+
+    /// Sets the number of meshes a group needs to be instanced. The default is 8.
+    void SetInstancingThreshold(int threshold);
+
+    /// Sets the time in seconds a mesh has to stay unchanged before it is merged into static geometry. The default is 5 seconds.
+    void SetStaticDelay(float seconds);
+
+    /// Sets the edge length of the static geometry regions in world units. The default is 100.
+    void SetRegionSize(float size);
+
+private slots:
+    void OnUpdated(float frameTime);
+    void OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnPlaceableChanged();
+    void OnMeshChanged();
+    void OnMeshAboutToBeDestroyed();
+    void OnAutoInstancingFailed();
+
+private:
+    /// @cond PRIVATE
+    struct Region;
+
+    struct Item
+    {
+        Item() : mesh(0), instanced(false), dirty(false), queued(false), region(0), hiddenEntity(0), hiddenFlags(0), changeTime(0.0) {}
+
+        IComponent *mesh;
+        ComponentWeakPtr weakMesh;
+        QString group; ///< Empty if the mesh can not be batched.
+        bool instanced; ///< Instanced automatically. Cleared if the instance could not be created, even if the group is instanced.
+        bool dirty;
+        bool queued; ///< Has an entry in mergeCandidates_.
+        Region *region; ///< The static geometry region the mesh is merged into, or null.
+        Ogre::Entity *hiddenEntity; ///< The Ogre entity hidden from the viewports because it is drawn by region, or null.
+        unsigned hiddenFlags; ///< The visibility flags of hiddenEntity before hiding it.
+        double changeTime; ///< When the mesh or its placeables last changed.
+        std::vector<EC_Placeable*> chain; ///< The placeable of the mesh and its parent placeables.
+    };
+
+    struct Group
+    {
+        Group() : instanced(false) {}
+        QSet<IComponent*> members;
+        bool instanced;
+    };
+
+    struct RegionKey
+    {
+        int x, y, z;
+        bool castShadows;
+        bool operator <(const RegionKey &rhs) const;
+    };
+
+    struct Region
+    {
+        Region() : geometry(0), dirty(false) {}
+        Ogre::StaticGeometry *geometry;
+        QSet<IComponent*> members;
+        bool dirty;
+    };
+    /// @endcond
+
+    void AddMesh(IComponent *mesh);
+    void RemoveMesh(IComponent *mesh);
+    void MarkDirty(IComponent *mesh);
+
+    /// Starts tracking all the meshes of the scene.
+    void AddAll();
+    /// Returns all the meshes to normal Ogre entities and stops tracking them.
+    void RemoveAll();
+
+    /// Reclassifies the changed meshes, instances the groups that reached the threshold and merges the meshes that have stayed unchanged.
+    void Update();
+
+    /// Returns the group key of a mesh, or an empty string if it can not be batched. Also refreshes the placeable chain of the item.
+    QString Classify(Item &item);
+
+    /// Replaces the placeable chain of an item, updating the dependents.
+    void SetChain(Item &item, const std::vector<EC_Placeable*> &chain);
+
+    /// Moves a mesh to another group, applying the instancing of the new group.
+    void SetGroup(Item &item, const QString &group);
+
+    /// Removes a mesh from its group, un-instancing the rest of the group if it falls below the threshold.
+    void LeaveGroup(Item &item);
+
+    /// Instances or un-instances a mesh.
+    void SetInstanced(Item &item, bool instanced);
+
+    /// Merges a mesh into the static geometry region at its position, if it is still mergeable.
+    void Merge(Item &item);
+
+    /// Takes a mesh out of its static geometry region, showing its Ogre entity again.
+    void Unmerge(Item &item);
+
+    /// Rebuilds the static geometry of a region from its members.
+    void BuildRegion(const RegionKey &key, Region &region);
+
+    /// Destroys all the static geometry regions, showing the Ogre entities of their meshes again.
+    void DestroyRegions();
+
+    OgreWorld *world_;
+    SceneWeakPtr scene_;
+    bool enabled_;
+    int instancingThreshold_;
+    float staticDelay_;
+    float regionSize_;
+    double time_; ///< Time since the batcher was created, in seconds.
+    u32 rigidBodyTypeId_; ///< Type ID of EC_RigidBody, which does not move the meshes of static bodies.
+
+    QHash<IComponent*, Item> items_;
+    QHash<QString, Group> groups_;
+    QMultiHash<EC_Placeable*, IComponent*> dependents_; ///< The meshes that each placeable moves.
+    std::vector<IComponent*> dirtyItems_;
+    std::deque<std::pair<IComponent*, double> > mergeCandidates_; ///< Meshes waiting to be merged, with the time to count the delay from.
+    std::map<RegionKey, Region> regions_;
+};
@@ -40,7 +40,12 @@ using namespace Ogre;
 #include "DisableMemoryLeakCheck.h"
 
 //------------------------------------------------------------------------------------------------
-DebugLines::DebugLines(const std::string& materialName) : SimpleRenderable()
+DebugLines::DebugLines(const std::string& materialName, bool retained) :
+    SimpleRenderable(),
+    _currentShape(0),
+    _colourType(VET_COLOUR_ARGB),
+    _retained(retained),
+    _dirty(false)
 {
 #include "DisableMemoryLeakCheck.h"
     mRenderOp.vertexData = new Ogre::VertexData();
@@ -51,6 +56,18 @@ DebugLines::DebugLines(const std::string& materialName) : SimpleRenderable()
     mRenderOp.operationType = RenderOperation::OT_LINE_LIST;
     mRenderOp.useIndexes = false;
 
+    Ogre::VertexDeclaration *decl = mRenderOp.vertexData->vertexDeclaration;
+    decl->addElement(0, 0, VET_FLOAT3, VES_POSITION);
+    decl->addElement(0, 12, VET_COLOUR, VES_DIFFUSE);
+    assert(decl->getVertexSize(0) == sizeof(DebugLineVertex));
+
+    Ogre::RenderSystem* rs = Root::getSingleton().getRenderSystem();
+    if (rs)
+        _colourType = rs->getColourVertexElementType();
+
+    // The lines are anywhere in the scene, never cull them.
+    mBox.setInfinite();
+
     setCastShadows (false);
     this->setMaterial(materialName);
 }
@@ -66,122 +83,108 @@ DebugLines::~DebugLines(void)
 #include "EnableMemoryLeakCheck.h"
 
 //------------------------------------------------------------------------------------------------
-void DebugLines::clear()
+void DebugLines::addLines(const float3x4 &transform, const float3 *points, size_t numPoints, uint32 packedColour)
 {
-    _lines.clear();
+    std::vector<DebugLineVertex> &vertices = target();
+    size_t first = vertices.size();
+    vertices.resize(first + numPoints);
+    DebugLineVertex *v = &vertices[first];
+    for(size_t i = 0; i < numPoints; ++i, ++v)
+    {
+        const float3 &p = points[i];
+        v->x = transform[0][0] * p.x + transform[0][1] * p.y + transform[0][2] * p.z + transform[0][3];
+        v->y = transform[1][0] * p.x + transform[1][1] * p.y + transform[1][2] * p.z + transform[1][3];
+        v->z = transform[2][0] * p.x + transform[2][1] * p.y + transform[2][2] * p.z + transform[2][3];
+        v->colour = packedColour;
+    }
 }
 
 //------------------------------------------------------------------------------------------------
-void DebugLines::draw()
+void DebugLines::beginShape(const void *owner)
 {
-    if (_lines.empty())
-    {
-        mRenderOp.vertexData->vertexCount = 0;
+    assert(_retained);
+    _currentShape = &_shapes[owner];
+    _currentShape->clear();
+    _dirty = true;
+}
+
+//------------------------------------------------------------------------------------------------
+void DebugLines::endShape()
+{
+    _currentShape = 0;
+}
+
+//------------------------------------------------------------------------------------------------
+void DebugLines::removeShape(const void *owner)
+{
+    std::map<const void*, std::vector<DebugLineVertex> >::iterator iter = _shapes.find(owner);
+    if (iter == _shapes.end())
         return;
-    }
-    
-    // Initialization stuff
-    mRenderOp.vertexData->vertexCount = _lines.size() * 2;
+    if (_currentShape == &iter->second)
+        _currentShape = 0;
+    _shapes.erase(iter);
+    _dirty = true;
+}
 
-    Ogre::VertexDeclaration *decl = mRenderOp.vertexData->vertexDeclaration;
-    Ogre::VertexBufferBinding *bind = mRenderOp.vertexData->vertexBufferBinding;
+//------------------------------------------------------------------------------------------------
+void DebugLines::clear()
+{
+    _vertices.clear();
+}
 
-    if (_vbuf.isNull())
-    {
-        decl->addElement(0, 0, VET_FLOAT3, VES_POSITION);
-        decl->addElement(0, 12, VET_COLOUR, VES_DIFFUSE);
+//------------------------------------------------------------------------------------------------
+void DebugLines::reserveBuffer(size_t numVertices)
+{
+    if (!_vbuf.isNull() && _vbuf->getNumVertices() >= numVertices)
+        return;
 
-        _vbuf = HardwareBufferManager::getSingleton().createVertexBuffer(
-            decl->getVertexSize(0),
-            mRenderOp.vertexData->vertexCount,
-            HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+    size_t capacity = _vbuf.isNull() ? 1024 : _vbuf->getNumVertices();
+    while(capacity < numVertices)
+        capacity *= 2;
 
-        bind->setBinding(0, _vbuf);
-    }
-    else
+    Ogre::VertexBufferBinding *bind = mRenderOp.vertexData->vertexBufferBinding;
+    bind->unsetAllBindings();
+    _vbuf = HardwareBufferManager::getSingleton().createVertexBuffer(sizeof(DebugLineVertex), capacity,
+        HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
+    bind->setBinding(0, _vbuf);
+}
+
+//------------------------------------------------------------------------------------------------
+void DebugLines::draw()
+{
+    if (!_retained)
     {
-        if (_vbuf->getNumVertices() != mRenderOp.vertexData->vertexCount)
+        mRenderOp.vertexData->vertexCount = _vertices.size();
+        if (!_vertices.empty())
         {
-            bind->unsetAllBindings();
-
-            _vbuf = HardwareBufferManager::getSingleton().createVertexBuffer(
-                decl->getVertexSize(0),
-                mRenderOp.vertexData->vertexCount,
-                HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
-
-            bind->setBinding(0, _vbuf);
+            reserveBuffer(_vertices.size());
+            // Discard, so that the lines of the previous frame the GPU may still be reading are not overwritten.
+            _vbuf->writeData(0, _vertices.size() * sizeof(DebugLineVertex), &_vertices[0], true);
         }
+        clear();
+        return;
     }
 
-    // Drawing stuff
-    unsigned int size = (unsigned int)_lines.size();
-    Ogre::Vector3 vaabMin = _lines[0]._start;
-    Ogre::Vector3 vaabMax = _lines[0]._start;
-
-    float *prPos = static_cast<float*>(_vbuf->lock(HardwareBuffer::HBL_DISCARD));
-
-    Ogre::RenderSystem* rs = Root::getSingleton().getRenderSystem();
-    Ogre::VertexElementType vet = VET_COLOUR_ARGB;
-    if (rs)
-        vet = rs->getColourVertexElementType();
+    if (!_dirty)
+        return;
+    _dirty = false;
 
-    for(unsigned int i = 0; i < size; i++)
-    {
-        const DebugLine& line = _lines[i];
-        uint32 packedColor;
-        if (vet == VET_COLOUR_ARGB)
-            packedColor = line._color.getAsARGB();
-        else
-            packedColor = line._color.getAsABGR();
-        
-        *prPos++ = line._start.x;
-        *prPos++ = line._start.y;
-        *prPos++ = line._start.z;
-        *((uint32*)prPos) = packedColor;
-        prPos++;
-        *prPos++ = line._end.x;
-        *prPos++ = line._end.y;
-        *prPos++ = line._end.z;
-        *((uint32*)prPos) = packedColor;
-        prPos++;
-        
-        if (line._start.x < vaabMin.x)
-            vaabMin.x = line._start.x;
-        else if (line._start.x > vaabMax.x)
-            vaabMax.x = line._start.x;
-
-        if (line._start.y < vaabMin.y)
-            vaabMin.y = line._start.y;
-        else if (line._start.y > vaabMax.y)
-            vaabMax.y = line._start.y;
-
-        if (line._start.z < vaabMin.z)
-            vaabMin.z = line._start.z;
-        else if (line._start.z > vaabMax.z)
-            vaabMax.z = line._start.z;
-        
-        if (line._end.x < vaabMin.x)
-            vaabMin.x = line._end.x;
-        else if (line._end.x > vaabMax.x)
-            vaabMax.x = line._end.x;
-
-        if (line._end.y < vaabMin.y)
-            vaabMin.y = line._end.y;
-        else if (line._end.y > vaabMax.y)
-            vaabMax.y = line._end.y;
-
-        if (line._end.z < vaabMin.z)
-            vaabMin.z = line._end.z;
-        else if (line._end.z > vaabMax.z)
-            vaabMax.z = line._end.z;
-    }
+    size_t numVertices = 0;
+    for(std::map<const void*, std::vector<DebugLineVertex> >::const_iterator iter = _shapes.begin(); iter != _shapes.end(); ++iter)
+        numVertices += iter->second.size();
+    mRenderOp.vertexData->vertexCount = numVertices;
+    if (numVertices == 0)
+        return;
 
+    reserveBuffer(numVertices);
+    DebugLineVertex *dst = static_cast<DebugLineVertex*>(_vbuf->lock(0, numVertices * sizeof(DebugLineVertex), HardwareBuffer::HBL_DISCARD));
+    for(std::map<const void*, std::vector<DebugLineVertex> >::const_iterator iter = _shapes.begin(); iter != _shapes.end(); ++iter)
+        if (!iter->second.empty())
+        {
+            memcpy(dst, &iter->second[0], iter->second.size() * sizeof(DebugLineVertex));
+            dst += iter->second.size();
+        }
     _vbuf->unlock();
-
-    mBox.setInfinite();
-    //mBox.Extents(vaabMin, vaabMax);
-    
-    clear();
 }
 //------------------------------------------------------------------------------------------------
 Real DebugLines::getSquaredViewDepth(const Camera *cam) const
@@ -199,4 +202,3 @@ Real DebugLines::getBoundingRadius() const
 {
     return Math::Sqrt(std::max(mBox.getMaximum().squaredLength(), mBox.getMinimum().squaredLength()));
 }
-
@@ -37,32 +37,69 @@ THE SOFTWARE.
 
 #include <Ogre.h>
 #include "Math/float3.h"
+#include "Math/float3x4.h"
 #include "Color.h"
 
+#include <map>
+#include <vector>
+
 /** @cond PRIVATE */
-struct DebugLine
+/// A vertex of the debug line list, written to the vertex buffer as is.
+struct DebugLineVertex
 {
-    Ogre::Vector3 _start;
-    Ogre::Vector3 _end;
-    Ogre::ColourValue _color;
+    float x;
+    float y;
+    float z;
+    Ogre::uint32 colour;
 };
 
 //------------------------------------------------------------------------------------------------
+/// A line list renderable for debug geometry.
+/** In immediate mode the lines added between two draw() calls are shown for one frame. In retained mode the lines are
+    recorded into shapes keyed by an owner, which stay until they are replaced or removed, and the vertex buffer is written
+    only when a shape has changed.
+
+    The vertex buffer grows geometrically and is never shrunk, so that a varying amount of lines does not recreate it. */
 class DebugLines : public Ogre::SimpleRenderable
 {
 public:
-    DebugLines(const std::string& name);
+    DebugLines(const std::string& name, bool retained = false);
     ~DebugLines();
 
+    /// Returns a colour in the vertex colour format of the render system.
+    Ogre::uint32 packColour(const Color &color) const
+    {
+        return _colourType == Ogre::VET_COLOUR_ARGB ? Ogre::ColourValue(color).getAsARGB() : Ogre::ColourValue(color).getAsABGR();
+    }
+
     void addLine(const float3 &from, const float3 &to, const Color &color)
     {
-        DebugLine newLine;
-        newLine._start = from;
-        newLine._end = to;
-        newLine._color = color;
-        _lines.push_back(newLine);
+        addLine(from, to, packColour(color));
+    }
+
+    void addLine(const float3 &from, const float3 &to, Ogre::uint32 packedColour)
+    {
+        std::vector<DebugLineVertex> &vertices = target();
+        DebugLineVertex v = { from.x, from.y, from.z, packedColour };
+        vertices.push_back(v);
+        v.x = to.x; v.y = to.y; v.z = to.z;
+        vertices.push_back(v);
     }
 
+    /// Adds a line list of points transformed by a matrix, e.g. a unit shape template.
+    /** @param points Line segment end points in pairs. @param numPoints Number of points, a multiple of two. */
+    void addLines(const float3x4 &transform, const float3 *points, size_t numPoints, Ogre::uint32 packedColour);
+
+    /// Starts recording the shape of an owner, replacing its previous shape. Retained mode only.
+    void beginShape(const void *owner);
+    /// Ends recording the current shape.
+    void endShape();
+    /// Removes the shape of an owner. Retained mode only.
+    void removeShape(const void *owner);
+    /// Returns if an owner has a shape.
+    bool hasShape(const void *owner) const { return _shapes.find(owner) != _shapes.end(); }
+
+    /// Writes the lines to the vertex buffer if they have changed. In immediate mode clears the lines after writing them.
     void draw ();
     void clear ();
 
@@ -70,8 +107,19 @@ public:
     Ogre::Real getBoundingRadius (void) const;
 
 protected:
-    std::vector<DebugLine> _lines;
+    /// Returns the vertices the added lines go to.
+    std::vector<DebugLineVertex> &target() { return _currentShape ? *_currentShape : _vertices; }
+
+    /// Ensures that the vertex buffer has room for a number of vertices, growing it geometrically.
+    void reserveBuffer(size_t numVertices);
+
+    std::vector<DebugLineVertex> _vertices; ///< The immediate mode lines.
+    std::map<const void*, std::vector<DebugLineVertex> > _shapes; ///< The retained mode shapes by owner.
+    std::vector<DebugLineVertex> *_currentShape; ///< The shape being recorded, or null.
     Ogre::HardwareVertexBufferSharedPtr _vbuf;
+    Ogre::VertexElementType _colourType;
+    bool _retained;
+    bool _dirty; ///< Whether the retained shapes have changed since the last draw.
 };
 /** @endcond */
 #endif //_OgreBulletCollisions_DEBUGLines_H_
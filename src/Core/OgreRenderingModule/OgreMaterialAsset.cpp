@@ -14,6 +14,8 @@
 #include "LoggingFunctions.h"
 #include "Math/float4.h"
 
+#include <OgreResourceGroupManager.h>
+
 #include "MemoryLeakCheck.h"
 
 ///@cond PRIVATE
@@ -519,6 +521,12 @@ bool OgreMaterialAsset::IsLoaded() const
     return ogreMaterial.get() != 0;
 }
 
+bool OgreMaterialAsset::IsInUse() const
+{
+    // The Ogre resource system and this asset hold the only references to an unused material.
+    return ogreMaterial.get() && ogreMaterial.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
+
 void OgreMaterialAsset::DoUnload()
 {
     if (ogreMaterial.isNull())
@@ -30,6 +30,9 @@ public:
 
     bool IsLoaded() const;
 
+    /// IAsset override. Returns true if the material is referenced by Ogre entities or other Ogre objects.
+    virtual bool IsInUse() const;
+
     /// Material ptr to the asset in ogre
     Ogre::MaterialPtr ogreMaterial;
 
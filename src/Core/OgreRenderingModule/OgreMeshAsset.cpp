@@ -12,8 +12,11 @@
 
 #include <QFile>
 #include <QFileInfo>
+#include <QtConcurrentRun>
 #include <Ogre.h>
 
+#include <cstring>
+
 #include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
 
@@ -21,6 +24,7 @@ OgreMeshAsset::OgreMeshAsset(AssetAPI *owner, const QString &type_, const QStrin
     IAsset(owner, type_, name_),
     loadTicket_(0)
 {
+    connect(&meshDataWatcher, SIGNAL(finished()), SLOT(OnMeshDataBuilt()));
 }
 
 OgreMeshAsset::~OgreMeshAsset()
@@ -145,6 +149,7 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, bool a
 
     if (GenerateMeshData())
     {        
+        StartMeshDataBuild();
         // We did a synchronous load, must call AssetLoadCompleted here.
         assetAPI->AssetLoadCompleted(Name());
         return true;
@@ -153,79 +158,85 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, bool a
         return false;
 }
 
-struct KdTreeRayQueryFirstHitVisitor
-{
-    RayQueryResult result;
+/// @cond PRIVATE
+/// Meshes with fewer triangles than this build their raycast hierarchy faster than it loads from disk, so it is not cached.
+static const int cMinCachedMeshDataTriangles = 4096;
 
-    KdTreeRayQueryFirstHitVisitor()
-    {
-        result.entity = 0;
-        result.component = 0;
-        result.t = std::numeric_limits<float>::infinity();
-        result.triangleIndex = KdTree<Triangle>::BUCKET_SENTINEL;
-        result.submeshIndex = (u32)-1;
-    }
-    bool operator()(KdTree<Triangle> &tree, const KdTreeNode &leaf, const Ray &ray, float tNear, float tFar)
-    {
-        u32 *bucket = tree.Bucket(leaf.bucketIndex);
-        assert(bucket);
-        while(*bucket != KdTree<Triangle>::BUCKET_SENTINEL)
-        {
-            const Triangle &tri = tree.Object(*bucket);
-            float u, v, t;
-            t = Triangle::IntersectLineTri(ray.pos, ray.dir, tri.a, tri.b, tri.c, u, v);
-            bool intersects = t < std::numeric_limits<float>::infinity();
-            if (intersects && t >= tNear && t <= tFar && t < result.t)
-            {
-                result.t = t;
-                result.pos = ray.GetPoint(t);
-                result.triangleIndex = *bucket;
-                result.submeshIndex = (u32)-1;
-                result.barycentricUV = float2(u,v);
-            }
-            ++bucket;
-            
-        }
-        return result.t < std::numeric_limits<float>::infinity(); // If we hit a triangle, no need to visit any farther nodes, since we are only interested in the nearest hit.
-    }
-};
+/// Hashes the triangle data, to recognize a cached raycast hierarchy built of the same data.
+static u64 MeshDataHash(const std::vector<Triangle> &triangles)
+{
+    // FNV-1a
+    u64 hash = 14695981039346656037ULL;
+    const u8 *data = triangles.empty() ? 0 : reinterpret_cast<const u8*>(&triangles[0]);
+    const size_t numBytes = triangles.size() * sizeof(Triangle);
+    for(size_t i = 0; i < numBytes; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    return hash;
+}
+/// @endcond
 
 RayQueryResult OgreMeshAsset::Raycast(const Ray &ray)
 {
+    RayQueryResult result;
+    if (!ogreMesh.get())
+        return result;
+    EnsureMeshData();
+    FillRaycastResult(meshData.IntersectRay(ray), ray, result);
+    return result;
+}
+
+void OgreMeshAsset::Raycast(const Ray *rays, int numRays, RayQueryResult *outResults)
+{
+    if (!rays || !outResults || numRays <= 0)
+        return;
+    for(int i = 0; i < numRays; ++i)
+        outResults[i] = RayQueryResult();
     if (!ogreMesh.get())
-        return RayQueryResult();
-    if (meshData.NumObjects() == 0)
-        CreateKdTree();
-    KdTreeRayQueryFirstHitVisitor visitor;
-    meshData.RayQuery(ray, visitor);
-    if (visitor.result.triangleIndex != KdTree<Triangle>::BUCKET_SENTINEL)
-    {
-        visitor.result.normal = normals[visitor.result.triangleIndex];
-        float2 uv = (uvs.size() > visitor.result.triangleIndex*3+2) ?
-                       (1.f - visitor.result.barycentricUV.x - visitor.result.barycentricUV.y) * uvs[visitor.result.triangleIndex*3]
-                       + visitor.result.barycentricUV.x * uvs[visitor.result.triangleIndex*3+1]
-                       + visitor.result.barycentricUV.y * uvs[visitor.result.triangleIndex*3+2]
-                    : float2(-1, -1);
-        visitor.result.uv = uv;
-        int triangleIndex = visitor.result.triangleIndex;
-        for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+        return;
+    EnsureMeshData();
+
+    PROFILE(OgreMeshAsset_RaycastPacket);
+    std::vector<TriangleBVH::Hit> hits(numRays);
+    meshData.IntersectRays(rays, numRays, &hits[0]);
+    for(int i = 0; i < numRays; ++i)
+        FillRaycastResult(hits[i], rays[i], outResults[i]);
+}
+
+void OgreMeshAsset::FillRaycastResult(const TriangleBVH::Hit &hit, const Ray &ray, RayQueryResult &result) const
+{
+    result.entity = 0;
+    result.component = 0;
+    result.t = hit.t;
+    if (hit.triangleIndex < 0)
+        return;
+
+    const size_t triangleIndex = (size_t)hit.triangleIndex;
+    result.pos = ray.GetPoint(hit.t);
+    result.triangleIndex = (unsigned)triangleIndex;
+    result.barycentricUV = float2(hit.u, hit.v);
+    result.normal = normals[triangleIndex];
+    result.uv = (uvs.size() > triangleIndex*3+2) ?
+                   (1.f - hit.u - hit.v) * uvs[triangleIndex*3]
+                   + hit.u * uvs[triangleIndex*3+1]
+                   + hit.v * uvs[triangleIndex*3+2]
+                : float2(-1, -1);
+    int submeshTriangleIndex = hit.triangleIndex;
+    for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+    {
+        if (submeshTriangleIndex < subMeshTriangleCounts[i])
         {
-            if (triangleIndex < subMeshTriangleCounts[i])
-            {
-                visitor.result.submeshIndex = (unsigned)i;
-                break;
-            }
-            else
-                triangleIndex -= subMeshTriangleCounts[i];
+            result.submeshIndex = (unsigned)i;
+            break;
         }
+        else
+            submeshTriangleIndex -= subMeshTriangleCounts[i];
     }
-    return visitor.result;
 }
 
 Triangle OgreMeshAsset::Tri(int submeshIndex, int triangleIndex)
 {
     if (subMeshTriangleCounts.size() == 0)
-        CreateKdTree();
+        ExtractMeshData();
 
     if (triangleIndex < 0 || NumTris(submeshIndex) < triangleIndex)
     {
@@ -235,13 +246,13 @@ Triangle OgreMeshAsset::Tri(int submeshIndex, int triangleIndex)
     // Shift to index in proper location of the submesh triangles array.
     for(int i = 0; i < submeshIndex; ++i)
         triangleIndex += subMeshTriangleCounts[i];
-    return meshData.Object(triangleIndex);
+    return triangles[triangleIndex];
 }
 
 size_t OgreMeshAsset::NumSubmeshes()
 {
     if (subMeshTriangleCounts.size() == 0)
-        CreateKdTree();
+        ExtractMeshData();
 
     return subMeshTriangleCounts.size();
 }
@@ -249,7 +260,7 @@ size_t OgreMeshAsset::NumSubmeshes()
 int OgreMeshAsset::NumTris(int submeshIndex)
 {
     if (subMeshTriangleCounts.size() == 0)
-        CreateKdTree();
+        ExtractMeshData();
 
     if (submeshIndex >= 0 && (size_t)submeshIndex < subMeshTriangleCounts.size())
         return subMeshTriangleCounts[submeshIndex];
@@ -258,9 +269,16 @@ int OgreMeshAsset::NumTris(int submeshIndex)
     return 0;
 }
 
-void OgreMeshAsset::CreateKdTree()
+void OgreMeshAsset::ExtractMeshData()
 {
+    if (!ogreMesh.get())
+        return;
+    // The background build reads the triangles.
+    meshDataBuild.waitForFinished();
+
+    PROFILE(OgreMeshAsset_ExtractMeshData);
     meshData.Clear();
+    triangles.clear();
     normals.clear();
     uvs.clear();
     subMeshTriangleCounts.clear();
@@ -330,8 +348,7 @@ void OgreMeshAsset::CreateKdTree()
             float3 v0 = *(float3*)(pos + posOffset + i0 * posSize);
             float3 v1 = *(float3*)(pos + posOffset + i1 * posSize);
             float3 v2 = *(float3*)(pos + posOffset + i2 * posSize);
-            Triangle t(v0, v1, v2);
-            meshData.AddObjects(&t, 1);
+            triangles.push_back(Triangle(v0, v1, v2));
 
             if (texElem)
             {
@@ -353,11 +370,81 @@ void OgreMeshAsset::CreateKdTree()
             vbufTex->unlock();
         ibuf->unlock();
     }
+}
+
+void OgreMeshAsset::StartMeshDataBuild()
+{
+    ExtractMeshData();
+    if (triangles.empty())
+        return;
 
+    // Look up the cache file here, as the asset cache is not thread-safe.
+    QString cacheFile;
+    if (assetAPI->Cache() && (int)triangles.size() >= cMinCachedMeshDataTriangles)
+        cacheFile = assetAPI->Cache()->FindInCache(MeshDataCacheRef());
+
+    meshDataBuild = QtConcurrent::run(this, &OgreMeshAsset::BuildMeshData, cacheFile);
+    meshDataWatcher.setFuture(meshDataBuild);
+}
+
+bool OgreMeshAsset::BuildMeshData(const QString &cacheFile)
+{
+    // The cache file starts with a hash of the triangles the hierarchy was built of. Note: Not endian safe.
+    const u64 hash = MeshDataHash(triangles);
+    if (!cacheFile.isEmpty())
+    {
+        std::vector<u8> data;
+        u64 cachedHash = 0;
+        if (LoadFileToVector(cacheFile, data) && data.size() > sizeof(u64))
+            memcpy(&cachedHash, &data[0], sizeof(u64));
+        if (cachedHash == hash && meshData.Deserialize(&data[0] + sizeof(u64), data.size() - sizeof(u64)) &&
+            meshData.NumTriangles() == (int)triangles.size())
+            return false;
+    }
+
+    meshData.Build(&triangles[0], (int)triangles.size());
+
+    meshDataCacheBuffer.clear();
+    if ((int)triangles.size() >= cMinCachedMeshDataTriangles)
+    {
+        meshDataCacheBuffer.resize(sizeof(u64));
+        memcpy(&meshDataCacheBuffer[0], &hash, sizeof(u64));
+        meshData.Serialize(meshDataCacheBuffer);
+    }
+    return !meshDataCacheBuffer.empty();
+}
+
+void OgreMeshAsset::OnMeshDataBuilt()
+{
+    if (meshDataCacheBuffer.empty())
+        return;
+    if (assetAPI->Cache())
+    {
+        PROFILE(OgreMeshAsset_StoreMeshData);
+        assetAPI->Cache()->StoreAsset(&meshDataCacheBuffer[0], meshDataCacheBuffer.size(), MeshDataCacheRef());
+    }
+    std::vector<u8>().swap(meshDataCacheBuffer);
+}
+
+void OgreMeshAsset::EnsureMeshData()
+{
+    if (meshDataBuild.isRunning())
     {
-        PROFILE(OgreMeshAsset_KdTree_Build);
-        meshData.Build();
+        PROFILE(OgreMeshAsset_WaitForMeshData);
+        meshDataBuild.waitForFinished();
     }
+    if (subMeshTriangleCounts.empty())
+        ExtractMeshData();
+    if (meshData.IsEmpty() && !triangles.empty())
+    {
+        PROFILE(OgreMeshAsset_BuildMeshData);
+        meshData.Build(&triangles[0], (int)triangles.size());
+    }
+}
+
+QString OgreMeshAsset::MeshDataCacheRef() const
+{
+    return Name() + ".bvh";
 }
 
 bool OgreMeshAsset::GenerateMeshData()
@@ -440,6 +527,7 @@ void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, con
         {
             if (GenerateMeshData())
             {
+                StartMeshDataBuild();
                 assetAPI->AssetLoadCompleted(assetRef);
                 return;
             }
@@ -467,6 +555,15 @@ void OgreMeshAsset::DoUnload()
         Ogre::ResourceBackgroundQueue::getSingleton().abortRequest(loadTicket_);
         loadTicket_ = 0;
     }
+
+    // The background build must not outlive the data it uses.
+    meshDataBuild.waitForFinished();
+    meshDataCacheBuffer.clear();
+    meshData.Clear();
+    std::vector<Triangle>().swap(triangles);
+    std::vector<float3>().swap(normals);
+    std::vector<float2>().swap(uvs);
+    subMeshTriangleCounts.clear();
     
     if (ogreMesh.isNull())
         return;
@@ -498,6 +595,24 @@ bool OgreMeshAsset::IsLoaded() const
     return (ogreMesh.get() != 0);
 }
 
+size_t OgreMeshAsset::CpuMemoryUsage() const
+{
+    // The hierarchy is not stable while it is being built.
+    return (meshDataBuild.isFinished() ? meshData.MemoryUsage() : 0) + triangles.capacity() * sizeof(Triangle) +
+        normals.capacity() * sizeof(float3) + uvs.capacity() * sizeof(float2);
+}
+
+size_t OgreMeshAsset::GpuMemoryUsage() const
+{
+    return ogreMesh.get() ? ogreMesh->getSize() : 0;
+}
+
+bool OgreMeshAsset::IsInUse() const
+{
+    // The Ogre resource system and this asset hold the only references to an unused mesh.
+    return ogreMesh.get() && ogreMesh.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
+
 QString OgreMeshAsset::OgreMeshName() const
 {
     return (ogreMesh.get() != 0 ? QString::fromStdString(ogreMesh->getName()) : "");
@@ -553,7 +668,10 @@ void OgreMeshAsset::OnAssimpConversionDone(bool success)
     if(success)
     {
         if (GenerateMeshData())
+        {
+            StartMeshDataBuild();
             assetAPI->AssetLoadCompleted(Name());
+        }
     }
     else
     {
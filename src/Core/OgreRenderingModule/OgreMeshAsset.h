@@ -9,11 +9,17 @@
 #include <OgreMesh.h>
 #include <OgreResourceBackgroundQueue.h>
 #include "Math/float2.h"
-#include "Geometry/KdTree.h"
+#include "Geometry/TriangleBVH.h"
 #include "Geometry/Triangle.h"
 #include "IRenderer.h"
 
+#include <QFuture>
+#include <QFutureWatcher>
+
 /// Represents an Ogre mesh loaded to the GPU.
+/** A CPU-side copy of the triangles is made when the mesh has loaded, and a TriangleBVH for raycasting them is built
+    in the background. Built hierarchies of large meshes are stored in the asset cache, and reused on the next load
+    of the same mesh data. */
 class OGRE_MODULE_API OgreMeshAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
@@ -37,6 +43,15 @@ public:
     /// Loaded Ogre mesh asset, null if not loaded.
     Ogre::MeshPtr ogreMesh;
 
+    /// IAsset override. Returns the size of the CPU-side raycast geometry.
+    virtual size_t CpuMemoryUsage() const;
+
+    /// IAsset override. Returns the size of the mesh vertex and index buffers.
+    virtual size_t GpuMemoryUsage() const;
+
+    /// IAsset override. Returns true if the mesh is referenced by Ogre entities or other Ogre objects.
+    virtual bool IsInUse() const;
+
 public slots:
     /// IAsset override.
     virtual bool IsLoaded() const;
@@ -45,6 +60,7 @@ public slots:
     QString OgreMeshName() const;
 
     /// Executes raycast to the CPU-side cached geometry.
+    /** If the raycast hierarchy is still being built in the background, waits for it to finish. */
     RayQueryResult Raycast(const Ray &ray);
 
     /// Returns the given triangle of the mesh data.
@@ -59,6 +75,15 @@ public slots:
     /// Is this mesh a Assimp supported file type.
     bool IsAssimpFileType() const;
 
+public:
+    /// Executes raycasts of a number of rays to the CPU-side cached geometry.
+    /** The rays are traversed in packets, which is considerably faster than separate Raycast calls for coherent rays,
+        e.g. rays from the same point to nearby directions.
+        @param rays The rays in the local space of the mesh.
+        @param numRays The number of rays.
+        @param outResults [out] Receives the result of each ray, numRays elements. */
+    void Raycast(const Ray *rays, int numRays, RayQueryResult *outResults);
+
 signals:
     void ExternalConversionRequested(OgreMeshAsset*, const u8*, size_t);
 
@@ -67,12 +92,32 @@ public slots:
     void OnAssimpConversionDone(bool);
 #endif
 
+private slots:
+    /// Stores a newly built raycast hierarchy to the asset cache.
+    void OnMeshDataBuilt();
+
 private:
     /// Unload mesh from Ogre. IAsset override.
     virtual void DoUnload();
 
-    /// Precomputes a kD-tree for the triangle data of this mesh.
-    void CreateKdTree();
+    /// Reads the triangles, normals and UVs of this mesh from the Ogre buffers.
+    void ExtractMeshData();
+
+    /// Extracts the mesh data and starts building the raycast hierarchy in the background. Called when the mesh has loaded.
+    void StartMeshDataBuild();
+
+    /// Builds the raycast hierarchy, or loads it from the given asset cache file if it was built of the same triangles.
+    /** Run in a worker thread. @return True if the hierarchy was built and should be stored to the asset cache. */
+    bool BuildMeshData(const QString &cacheFile);
+
+    /// Makes sure the raycast hierarchy is ready, waiting for the background build or building it now if needed.
+    void EnsureMeshData();
+
+    /// Fills the result of a raycast hit.
+    void FillRaycastResult(const TriangleBVH::Hit &hit, const Ray &ray, RayQueryResult &result) const;
+
+    /// Returns the asset cache ref under which the raycast hierarchy of this mesh is stored.
+    QString MeshDataCacheRef() const;
 
     /// Process mesh data after loading to create tangents and such.
     bool GenerateMeshData();
@@ -84,7 +129,20 @@ private:
     Ogre::BackgroundProcessTicket loadTicket_;
 
     /// Stores a CPU-side version of the mesh geometry data (positions), for raycasting purposes.
-    KdTree<Triangle> meshData;
+    std::vector<Triangle> triangles;
+
+    /// Raycast hierarchy of the triangles.
+    TriangleBVH meshData;
+
+    /// Background build of meshData. The worker reads triangles and writes meshData and meshDataCacheBuffer,
+    /// so they are not touched before the build has finished.
+    QFuture<bool> meshDataBuild;
+
+    /// Notifies when meshDataBuild finishes.
+    QFutureWatcher<bool> meshDataWatcher;
+
+    /// Serialized meshData to be stored to the asset cache when the background build has finished.
+    std::vector<u8> meshDataCacheBuffer;
 
     /// Triangle normals. One per triangle (not per-vertex normals).
     std::vector<float3> normals;
@@ -20,6 +20,8 @@
 #include "EC_EnvironmentLight.h"
 #include "EC_Sky.h"
 #include "OgreWorld.h"
+#include "MeshBatcher.h"
+#include "AnimationScheduler.h"
 #include "OgreMeshAsset.h"
 #include "OgreParticleAsset.h"
 #include "OgreSkeletonAsset.h"
@@ -224,6 +226,20 @@ void OgreRenderingModule::ConsoleStats()
         c->Print("Best FPS: " + QString::number(stats.bestFPS));
         c->Print("Triangles: " + QString::number(stats.triangleCount));
         c->Print("Batches: " + QString::number(stats.batchCount));
+
+        OgreWorldPtr world = renderer->GetActiveOgreWorld();
+        if (world && world->Batcher() && world->Batcher()->IsEnabled())
+        {
+            MeshBatcher::Statistics batches = world->Batcher()->Stats();
+            c->Print(QString("Batchable meshes: %1/%2 in %3 groups").arg(batches.batchableMeshes).arg(batches.meshes).arg(batches.groups));
+            c->Print(QString("Auto-instanced meshes: %1 in %2 groups").arg(batches.instancedMeshes).arg(batches.instancedGroups));
+            c->Print(QString("Static geometry meshes: %1 in %2 regions").arg(batches.staticMeshes).arg(batches.staticRegions));
+        }
+        if (world && world->Animations())
+        {
+            const AnimationScheduler::Statistics &animations = world->Animations()->Stats();
+            c->Print(QString("Animation controllers updated: %1/%2, %3 on worker threads").arg(animations.updated).arg(animations.controllers).arg(animations.threaded));
+        }
         return;
     }
     else
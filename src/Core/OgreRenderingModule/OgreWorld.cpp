@@ -16,8 +16,10 @@
 #include "OgreBulletCollisionsDebugLines.h"
 #include "OgreMaterialAsset.h"
 #include "OgreMeshAsset.h"
+#include "SceneBVH.h"
+#include "MeshBatcher.h"
+#include "AnimationScheduler.h"
 
-#include "OgreMeshAsset.h"
 #include "Entity.h"
 #include "Scene/Scene.h"
 #include "Profiler.h"
@@ -26,7 +28,9 @@
 #include "AssetAPI.h"
 #include "Transform.h"
 #include "Math/float2.h"
+#include "Math/float3x3.h"
 #include "Math/float3x4.h"
+#include "Math/MathFunc.h"
 #include "Geometry/AABB.h"
 #include "Geometry/OBB.h"
 #include "Geometry/Plane.h"
@@ -38,6 +42,8 @@
 #include <Ogre.h>
 #include <OgreOverlaySystem.h>
 
+#include <algorithm>
+
 #ifdef ANDROID
 #include <OgreRTShaderSystem.h>
 #include <OgreShaderGenerator.h>
@@ -53,14 +59,148 @@ struct RaycastResultLessThan
     }
 };
 
+namespace
+{
+
+/// Number of segments of the circles of the debug shape templates.
+const int cDebugCircleSegments = 24;
+
+/// Adds a circle on the XZ plane of the given radius and height as a line list.
+void AddCircleLines(std::vector<float3> &points, float radius, float y)
+{
+    for(int i = 0; i < cDebugCircleSegments; ++i)
+    {
+        float a0 = 2.f * pi * i / cDebugCircleSegments;
+        float a1 = 2.f * pi * (i + 1) / cDebugCircleSegments;
+        points.push_back(float3(radius * Cos(a0), y, radius * Sin(a0)));
+        points.push_back(float3(radius * Cos(a1), y, radius * Sin(a1)));
+    }
+}
+
+/// Adds a half circle arc from +Y down to the XZ plane in the direction of the given angle as a line list.
+void AddMeridianLines(std::vector<float3> &points, float angle)
+{
+    const int halfSegments = cDebugCircleSegments / 4;
+    float3 dir(Cos(angle), 0.f, Sin(angle));
+    for(int i = 0; i < halfSegments; ++i)
+    {
+        float a0 = 0.5f * pi * i / halfSegments;
+        float a1 = 0.5f * pi * (i + 1) / halfSegments;
+        points.push_back(Sin(a0) * dir + float3(0.f, Cos(a0), 0.f));
+        points.push_back(Sin(a1) * dir + float3(0.f, Cos(a1), 0.f));
+    }
+}
+
+/// The edges of the unit cube centered at the origin as a line list.
+std::vector<float3> UnitBoxLines()
+{
+    AABB box(float3::FromScalar(-0.5f), float3::FromScalar(0.5f));
+    std::vector<float3> points;
+    for(int i = 0; i < 12; ++i)
+    {
+        LineSegment edge = box.Edge(i);
+        points.push_back(edge.a);
+        points.push_back(edge.b);
+    }
+    return points;
+}
+
+/// Three orthogonal great circles of the unit sphere as a line list.
+std::vector<float3> UnitSphereLines()
+{
+    std::vector<float3> points;
+    AddCircleLines(points, 1.f, 0.f);
+    size_t numCirclePoints = points.size();
+    for(size_t i = 0; i < numCirclePoints; ++i)
+        points.push_back(float3(points[i].x, points[i].z, 0.f));
+    for(size_t i = 0; i < numCirclePoints; ++i)
+        points.push_back(float3(0.f, points[i].z, points[i].x));
+    return points;
+}
+
+/// The upper half of the unit sphere as a line list: the equator and four meridian arcs.
+std::vector<float3> UnitHemisphereLines()
+{
+    std::vector<float3> points;
+    AddCircleLines(points, 1.f, 0.f);
+    for(int i = 0; i < 4; ++i)
+        AddMeridianLines(points, 0.5f * pi * i);
+    return points;
+}
+
+/// Four vertical lines from y = -0.5 to 0.5 on the unit circle as a line list, the sides of a capsule.
+std::vector<float3> UnitCapsuleSideLines()
+{
+    std::vector<float3> points;
+    for(int i = 0; i < 4; ++i)
+    {
+        float a = 0.5f * pi * i;
+        points.push_back(float3(Cos(a), -0.5f, Sin(a)));
+        points.push_back(float3(Cos(a), 0.5f, Sin(a)));
+    }
+    return points;
+}
+
+/// Orders line segments lexicographically by their end points.
+struct LineLessThan
+{
+    bool operator()(const std::pair<float3, float3> &left, const std::pair<float3, float3> &right) const
+    {
+        if (left.first.x != right.first.x) return left.first.x < right.first.x;
+        if (left.first.y != right.first.y) return left.first.y < right.first.y;
+        if (left.first.z != right.first.z) return left.first.z < right.first.z;
+        if (left.second.x != right.second.x) return left.second.x < right.second.x;
+        if (left.second.y != right.second.y) return left.second.y < right.second.y;
+        return left.second.z < right.second.z;
+    }
+};
+
+/// The edges of the triangulated unit sphere as a line list, each edge shared by two triangles once.
+std::vector<float3> UnitGeosphereLines(int vertices)
+{
+    std::vector<float3> positions(vertices);
+    int actualVertices = Sphere(float3::zero, 1.f).Triangulate(&positions[0], 0, 0, vertices, true);
+
+    LineLessThan lessThan;
+    std::vector<std::pair<float3, float3> > edges;
+    edges.reserve(actualVertices);
+    for(int i = 0; i + 2 < actualVertices; i += 3)
+        for(int j = 0; j < 3; ++j)
+        {
+            std::pair<float3, float3> edge(positions[i + j], positions[i + (j + 1) % 3]);
+            if (lessThan(std::make_pair(edge.second, edge.first), edge))
+                std::swap(edge.first, edge.second);
+            edges.push_back(edge);
+        }
+    std::sort(edges.begin(), edges.end(), lessThan);
+
+    std::vector<float3> points;
+    points.reserve(edges.size() * 2);
+    for(size_t i = 0; i < edges.size(); ++i)
+        if (i == 0 || lessThan(edges[i - 1], edges[i]))
+        {
+            points.push_back(edges[i].first);
+            points.push_back(edges[i].second);
+        }
+    return points;
+}
+
+} // ~unnamed namespace
+
 OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     framework_(scene->GetFramework()),
     renderer_(renderer),
     scene_(scene),
     sceneManager_(0),
     rayQuery_(0),
+    sceneBVH_(0),
+    meshBatcher_(0),
+    animationScheduler_(0),
     debugLines_(0),
     debugLinesNoDepth_(0),
+    debugShapes_(0),
+    debugShapesNoDepth_(0),
+    debugShapeOwner_(0),
     drawDebugInstancing_(false)
 {
     assert(renderer_->IsInitialized());
@@ -76,6 +216,8 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     {
         rayQuery_ = sceneManager_->createRayQuery(Ogre::Ray());
         rayQuery_->setQueryTypeMask(Ogre::SceneManager::FX_TYPE_MASK | Ogre::SceneManager::ENTITY_TYPE_MASK);
+        // The meshes are raycast with sceneBVH_, the Ogre query is only needed for the other objects.
+        rayQuery_->setQueryMask(~SceneBVH::cQueryFlag);
         rayQuery_->setSortByDistance(true);
 
         // If fog is FOG_NONE, force it to some default ineffective settings, because otherwise SuperShader shows just white
@@ -89,10 +231,23 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
 #include "DisableMemoryLeakCheck.h"
         debugLines_ = new DebugLines("PhysicsDebug");
         debugLinesNoDepth_ = new DebugLines("PhysicsDebugNoDepth");
+        debugShapes_ = new DebugLines("PhysicsDebug", true);
+        debugShapesNoDepth_ = new DebugLines("PhysicsDebugNoDepth", true);
 #include "EnableMemoryLeakCheck.h"
         sceneManager_->getRootSceneNode()->attachObject(debugLines_);
         sceneManager_->getRootSceneNode()->attachObject(debugLinesNoDepth_);
+        sceneManager_->getRootSceneNode()->attachObject(debugShapes_);
+        sceneManager_->getRootSceneNode()->attachObject(debugShapesNoDepth_);
         debugLinesNoDepth_->setRenderQueueGroup(Ogre::RENDER_QUEUE_OVERLAY);
+        debugShapesNoDepth_->setRenderQueueGroup(Ogre::RENDER_QUEUE_OVERLAY);
+    }
+
+    sceneBVH_ = new SceneBVH(scene.get());
+    animationScheduler_ = new AnimationScheduler(this, framework_);
+    if (!framework_->IsHeadless())
+    {
+        meshBatcher_ = new MeshBatcher(this, scene.get());
+        meshBatcher_->SetEnabled(framework_->Config()->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "mesh batching", false).toBool());
     }
 
     connect(framework_->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
@@ -103,6 +258,9 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
 
 OgreWorld::~OgreWorld()
 {
+    SAFE_DELETE(meshBatcher_);
+    SAFE_DELETE(animationScheduler_);
+
     if (!instancingTargets_.isEmpty())
     {
         try
@@ -138,6 +296,7 @@ OgreWorld::~OgreWorld()
 
     if (rayQuery_)
         sceneManager_->destroyQuery(rayQuery_);
+    SAFE_DELETE(sceneBVH_);
     
     for (std::vector<RaycastResult*>::iterator i = rayResults_.begin(); i != rayResults_.end(); ++i)
     {
@@ -156,6 +315,16 @@ OgreWorld::~OgreWorld()
         sceneManager_->getRootSceneNode()->detachObject(debugLinesNoDepth_);
         SAFE_DELETE(debugLinesNoDepth_);
     }
+    if (debugShapes_)
+    {
+        sceneManager_->getRootSceneNode()->detachObject(debugShapes_);
+        SAFE_DELETE(debugShapes_);
+    }
+    if (debugShapesNoDepth_)
+    {
+        sceneManager_->getRootSceneNode()->detachObject(debugShapesNoDepth_);
+        SAFE_DELETE(debugShapesNoDepth_);
+    }
     
     // Remove all compositors.
     /// \todo This does not work with a proper multiscene approach
@@ -182,6 +351,45 @@ void OgreWorld::FlushDebugGeometry()
         debugLines_->draw();
     if (debugLinesNoDepth_)
         debugLinesNoDepth_->draw();
+    if (debugShapes_)
+        debugShapes_->draw();
+    if (debugShapesNoDepth_)
+        debugShapesNoDepth_->draw();
+}
+
+void OgreWorld::BeginDebugShape(const void *owner)
+{
+    if (debugShapeOwner_)
+        EndDebugShape();
+    if (!owner || !debugShapes_)
+        return;
+    debugShapeOwner_ = owner;
+    debugShapes_->beginShape(owner);
+    debugShapesNoDepth_->beginShape(owner);
+}
+
+void OgreWorld::EndDebugShape()
+{
+    if (!debugShapeOwner_)
+        return;
+    debugShapes_->endShape();
+    debugShapesNoDepth_->endShape();
+    debugShapeOwner_ = 0;
+}
+
+void OgreWorld::RemoveDebugShape(const void *owner)
+{
+    if (!debugShapes_)
+        return;
+    if (owner == debugShapeOwner_)
+        EndDebugShape();
+    debugShapes_->removeShape(owner);
+    debugShapesNoDepth_->removeShape(owner);
+}
+
+bool OgreWorld::HasDebugShape(const void *owner) const
+{
+    return debugShapes_ && debugShapes_->hasShape(owner);
 }
 
 Color OgreWorld::DefaultSceneAmbientLightColor()
@@ -502,7 +710,7 @@ RaycastResult* OgreWorld::Raycast(int x, int y, unsigned layerMask, float maxDis
     
     int width = renderer_->WindowWidth();
     int height = renderer_->WindowHeight();
-    if (width && height && rayQuery_)
+    if (width && height)
     {
         Ogre::Camera* camera = VerifyCurrentSceneCamera();
         if (camera)
@@ -510,9 +718,8 @@ RaycastResult* OgreWorld::Raycast(int x, int y, unsigned layerMask, float maxDis
             float screenx = x / (float)width;
             float screeny = y / (float)height;
 
-            Ogre::Ray ray = camera->getCameraToViewportRay(screenx, screeny);
-            rayQuery_->setRay(ray);
-            RaycastInternal(layerMask, maxDistance, false);
+            Ray ray = camera->getCameraToViewportRay(screenx, screeny);
+            RaycastInternal(ray, layerMask, maxDistance, false);
         }
     }
     
@@ -523,12 +730,7 @@ RaycastResult* OgreWorld::Raycast(int x, int y, unsigned layerMask, float maxDis
 RaycastResult* OgreWorld::Raycast(const Ray& ray, unsigned layerMask, float maxDistance)
 {
     ClearRaycastResults();
-    
-    if (rayQuery_)
-    {
-        rayQuery_->setRay(Ogre::Ray(ray.pos, ray.dir));
-        RaycastInternal(layerMask, maxDistance, false);
-    }
+    RaycastInternal(ray, layerMask, maxDistance, false);
     
     // Return the closest hit, or a cleared raycastresult if no hits
     return rayHits_.size() ? rayHits_[0] : rayResults_[0];
@@ -560,7 +762,7 @@ QList<RaycastResult*> OgreWorld::RaycastAll(int x, int y, unsigned layerMask, fl
     
     int width = renderer_->WindowWidth();
     int height = renderer_->WindowHeight();
-    if (width && height && rayQuery_)
+    if (width && height)
     {
         Ogre::Camera* camera = VerifyCurrentSceneCamera();
         if (camera)
@@ -568,9 +770,8 @@ QList<RaycastResult*> OgreWorld::RaycastAll(int x, int y, unsigned layerMask, fl
             float screenx = x / (float)width;
             float screeny = y / (float)height;
 
-            Ogre::Ray ray = camera->getCameraToViewportRay(screenx, screeny);
-            rayQuery_->setRay(ray);
-            RaycastInternal(layerMask, maxDistance, true);
+            Ray ray = camera->getCameraToViewportRay(screenx, screeny);
+            RaycastInternal(ray, layerMask, maxDistance, true);
         }
     }
     
@@ -580,25 +781,57 @@ QList<RaycastResult*> OgreWorld::RaycastAll(int x, int y, unsigned layerMask, fl
 QList<RaycastResult*> OgreWorld::RaycastAll(const Ray& ray, unsigned layerMask, float maxDistance)
 {
     ClearRaycastResults();
-    
-    if (rayQuery_)
-    {
-        rayQuery_->setRay(Ogre::Ray(ray.pos, ray.dir));
-        RaycastInternal(layerMask, maxDistance, true);
-    }
+    RaycastInternal(ray, layerMask, maxDistance, true);
     
     return rayHits_;
 }
 
-void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getAllResults)
+void OgreWorld::RaycastInternal(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults)
 {
     PROFILE(OgreWorld_Raycast);
     
-    Ray ray = rayQuery_->getRay();
-    
-    Ogre::RaySceneQueryResult &results = rayQuery_->execute();
     float closestDistance = -1.0f;
     size_t hitIndex = 0;
+
+    meshHits_.clear();
+    sceneBVH_->Raycast(ray, layerMask, maxDistance, getAllResults, meshHits_);
+    for(size_t i = 0; i < meshHits_.size(); ++i)
+    {
+        const RayQueryResult &r = meshHits_[i];
+        if (closestDistance < 0.0f || r.t < closestDistance)
+            closestDistance = r.t;
+        RaycastResult* result = GetOrCreateRaycastResult(hitIndex);
+        result->entity = r.entity;
+        result->component = r.component;
+        result->pos = r.pos;
+        result->normal = r.normal;
+        result->submesh = r.submeshIndex;
+        result->index = r.triangleIndex;
+        result->u = r.uv.x;
+        result->v = r.uv.y;
+        result->t = r.t;
+        rayHits_.push_back(result);
+        ++hitIndex;
+    }
+
+    // Billboards, particles and other non-mesh objects are only known to Ogre.
+    if (rayQuery_)
+        RaycastOgreObjects(ray, layerMask, maxDistance, getAllResults, closestDistance, hitIndex);
+
+    // If several hits, re-sort them in case triangle-level test changed the order, and to merge the mesh and Ogre hits
+    if (rayHits_.size() > 1)
+    {        
+        qSort(rayHits_.begin(), rayHits_.end(), RaycastResultLessThan());
+        
+        if (!getAllResults)
+            rayHits_.erase(rayHits_.begin() + 1, rayHits_.end());
+    }
+}
+
+void OgreWorld::RaycastOgreObjects(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults, float &closestDistance, size_t &hitIndex)
+{
+    rayQuery_->setRay(Ogre::Ray(ray.pos, ray.dir));
+    Ogre::RaySceneQueryResult &results = rayQuery_->execute();
     
     for(size_t i = 0; i < results.size(); ++i)
     {
@@ -630,6 +863,10 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
         {
             continue;
         }
+
+        // Instanced submeshes of meshes already raycast with sceneBVH_ do not carry the query flag.
+        if (dynamic_cast<Ogre::InstancedEntity*>(entry.movable) && sceneBVH_->IsTracked(component))
+            continue;
         
         EC_Placeable* placeable = entity->GetComponent<EC_Placeable>().get();
         if (placeable)
@@ -802,15 +1039,6 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
             }
         }
     }
-    
-    // If several hits, re-sort them in case triangle-level test changed the order
-    if (rayHits_.size() > 1)
-    {        
-        qSort(rayHits_.begin(), rayHits_.end(), RaycastResultLessThan());
-        
-        if (!getAllResults)
-            rayHits_.erase(rayHits_.begin() + 1, rayHits_.end());
-    }
 }
 
 RaycastResult* OgreWorld::GetOrCreateRaycastResult(size_t index)
@@ -829,6 +1057,11 @@ void OgreWorld::ClearRaycastResults()
     rayHits_.clear();
 }
 
+QList<Entity*> OgreWorld::FrustumQuery(const Frustum &frustum) const
+{
+    return sceneBVH_->FrustumQuery(frustum);
+}
+
 QList<Entity*> OgreWorld::FrustumQuery(QRect &viewrect) const
 {
     PROFILE(OgreWorld_FrustumQuery);
@@ -911,14 +1144,7 @@ void OgreWorld::StartViewTracking(Entity* entity)
         return;
     }
 
-    EntityPtr entityPtr = entity->shared_from_this();
-    for (unsigned i = 0; i < visibilityTrackedEntities_.size(); ++i)
-    {
-        if (visibilityTrackedEntities_[i].lock() == entityPtr)
-            return; // Already added
-    }
-    
-    visibilityTrackedEntities_.push_back(entity->shared_from_this());
+    viewTracker_.Start(entity);
 }
 
 void OgreWorld::StopViewTracking(Entity* entity)
@@ -929,22 +1155,14 @@ void OgreWorld::StopViewTracking(Entity* entity)
         return;
     }
 
-    EntityPtr entityPtr = entity->shared_from_this();
-    for (unsigned i = 0; i < visibilityTrackedEntities_.size(); ++i)
-    {
-        if (visibilityTrackedEntities_[i].lock() == entityPtr)
-        {
-            visibilityTrackedEntities_.erase(visibilityTrackedEntities_.begin() + i);
-            return;
-        }
-    }
+    viewTracker_.Stop(entity);
 }
 
 void OgreWorld::OnUpdated(float timeStep)
 {
     PROFILE(OgreWorld_OnUpdated);
     // Do nothing if visibility not being tracked for any entities
-    if (visibilityTrackedEntities_.empty())
+    if (viewTracker_.IsEmpty())
     {
         if (!lastVisibleEntities_.empty())
             lastVisibleEntities_.clear();
@@ -954,38 +1172,27 @@ void OgreWorld::OnUpdated(float timeStep)
     }
     
     // Update visible objects from the active camera
-    lastVisibleEntities_ = visibleEntities_;
+    lastVisibleEntities_.swap(visibleEntities_);
     EC_Camera* activeCamera = VerifyCurrentSceneCameraComponent();
     if (activeCamera)
         visibleEntities_ = activeCamera->VisibleEntityIDs();
     else
         visibleEntities_.clear();
     
-    for (size_t i = visibilityTrackedEntities_.size() - 1; i < visibilityTrackedEntities_.size(); --i)
+    // Only the entities whose visibility changed are looked up from the tracked ones
+    viewTracker_.Diff(lastVisibleEntities_, visibleEntities_, enteredView_, leftView_);
+    for (size_t i = 0; i < enteredView_.size(); ++i)
     {
-        // Check if the entity has expired; erase from list in that case
-        if (visibilityTrackedEntities_[i].expired())
-            visibilityTrackedEntities_.erase(visibilityTrackedEntities_.begin() + i);
-        else
-        {
-            Entity* entity = visibilityTrackedEntities_[i].lock().get();
-            entity_id_t id = entity->Id();
-            
-            // Check for change in visibility status
-            bool last = lastVisibleEntities_.find(id) != lastVisibleEntities_.end();
-            bool now = visibleEntities_.find(id) != visibleEntities_.end();
-            if (!last && now)
-            {
-                emit EntityEnterView(entity);
-                entity->EmitEnterView(activeCamera);
-            }
-            else if (last && !now)
-            {
-                emit EntityLeaveView(entity);
-                entity->EmitLeaveView(activeCamera);
-            }
-        }
+        emit EntityEnterView(enteredView_[i].get());
+        enteredView_[i]->EmitEnterView(activeCamera);
+    }
+    for (size_t i = 0; i < leftView_.size(); ++i)
+    {
+        emit EntityLeaveView(leftView_[i].get());
+        leftView_[i]->EmitLeaveView(activeCamera);
     }
+    enteredView_.clear();
+    leftView_.clear();
 }
 
 void OgreWorld::SetupShadows()
@@ -1178,44 +1385,41 @@ void OgreWorld::SetDebugInstancingEnabled(bool enabled)
     }
 }
 
+DebugLines *OgreWorld::DebugLinesFor(bool depthTest) const
+{
+    if (debugShapeOwner_)
+        return depthTest ? debugShapes_ : debugShapesNoDepth_;
+    return depthTest ? debugLines_ : debugLinesNoDepth_;
+}
+
+void OgreWorld::DebugDrawLines(const float3x4 &t, const std::vector<float3> &points, const Color &clr, bool depthTest)
+{
+    DebugLines *lines = DebugLinesFor(depthTest);
+    if (lines && !points.empty())
+        lines->addLines(t, &points[0], points.size(), lines->packColour(clr));
+}
+
 void OgreWorld::DebugDrawAABB(const AABB &aabb, const Color &clr, bool depthTest)
 {
-    for(int i = 0; i < 12; ++i)
-        DebugDrawLineSegment(aabb.Edge(i), clr, depthTest);
+    float3 size = aabb.Size();
+    DebugDrawBox(float3x4(float3(size.x, 0.f, 0.f), float3(0.f, size.y, 0.f), float3(0.f, 0.f, size.z), aabb.CenterPoint()), clr, depthTest);
 }
 
 void OgreWorld::DebugDrawOBB(const OBB &obb, const Color &clr, bool depthTest)
 {
-    for(int i = 0; i < 12; ++i)
-        DebugDrawLineSegment(obb.Edge(i), clr, depthTest);
+    DebugDrawBox(float3x4(2.f * obb.r.x * obb.axis[0], 2.f * obb.r.y * obb.axis[1], 2.f * obb.r.z * obb.axis[2], obb.pos), clr, depthTest);
 }
 
 void OgreWorld::DebugDrawLineSegment(const LineSegment &l, const Color &clr, bool depthTest)
 {
-    if (depthTest)
-    {
-        if (debugLines_)
-            debugLines_->addLine(l.a, l.b, clr);
-    }
-    else
-    {
-        if (debugLinesNoDepth_)
-            debugLinesNoDepth_->addLine(l.a, l.b, clr);
-    }
+    DebugDrawLine(l.a, l.b, clr, depthTest);
 }
 
 void OgreWorld::DebugDrawLine(const float3& start, const float3& end, const Color &clr, bool depthTest)
 {
-    if (depthTest)
-    {
-        if (debugLines_)
-            debugLines_->addLine(start, end, clr);
-    }
-    else
-    {
-        if (debugLinesNoDepth_)
-            debugLinesNoDepth_->addLine(start, end, clr);
-    }
+    DebugLines *lines = DebugLinesFor(depthTest);
+    if (lines)
+        lines->addLine(start, end, clr);
 }
 
 void OgreWorld::DebugDrawPlane(const Plane &plane, const Color &clr, const float3 &refPoint, float uSpacing, float vSpacing, 
@@ -1276,19 +1480,38 @@ void OgreWorld::DebugDrawAxes(const float3x4 &t, bool depthTest)
 
 void OgreWorld::DebugDrawSphere(const float3& center, float radius, int vertices, const Color &clr, bool depthTest)
 {
-    if (vertices <= 0)
+    if (vertices <= 0 || !DebugLinesFor(depthTest))
         return;
-    
-    std::vector<float3> positions(vertices);
 
-    Sphere sphere(center, radius);
-    int actualVertices = sphere.Triangulate(&positions[0], 0, 0, vertices, true);
-    for (int i = 0; i < actualVertices; i += 3)
-    {
-        DebugDrawLine(positions[i], positions[i + 1], clr, depthTest);
-        DebugDrawLine(positions[i + 1], positions[i + 2], clr, depthTest);
-        DebugDrawLine(positions[i + 2], positions[i], clr, depthTest);
-    }
+    // Triangulate the unit sphere once per vertex count, and draw it transformed from then on.
+    std::vector<float3> &points = debugSphereTemplates_[vertices];
+    if (points.empty())
+        points = UnitGeosphereLines(vertices);
+    DebugDrawLines(float3x4::FromTRS(center, float3x3::identity, float3::FromScalar(radius)), points, clr, depthTest);
+}
+
+void OgreWorld::DebugDrawBox(const float3x4 &t, const Color &clr, bool depthTest)
+{
+    static const std::vector<float3> points = UnitBoxLines();
+    DebugDrawLines(t, points, clr, depthTest);
+}
+
+void OgreWorld::DebugDrawSphere(const float3x4 &t, const Color &clr, bool depthTest)
+{
+    static const std::vector<float3> points = UnitSphereLines();
+    DebugDrawLines(t, points, clr, depthTest);
+}
+
+void OgreWorld::DebugDrawCapsule(const float3x4 &t, float radius, float halfHeight, const Color &clr, bool depthTest)
+{
+    static const std::vector<float3> capPoints = UnitHemisphereLines();
+    static const std::vector<float3> sidePoints = UnitCapsuleSideLines();
+
+    // The caps are the unit hemisphere scaled by the radius, the bottom one mirrored.
+    // The sides are unit length lines on the unit circle, scaled to the radius and height.
+    DebugDrawLines(t * float3x4::FromTRS(float3(0.f, halfHeight, 0.f), float3x3::identity, float3::FromScalar(radius)), capPoints, clr, depthTest);
+    DebugDrawLines(t * float3x4::FromTRS(float3(0.f, -halfHeight, 0.f), float3x3::identity, float3(radius, -radius, radius)), capPoints, clr, depthTest);
+    DebugDrawLines(t * float3x4::FromTRS(float3::zero, float3x3::identity, float3(radius, 2.f * halfHeight, radius)), sidePoints, clr, depthTest);
 }
 
 void OgreWorld::DebugDrawLight(const float3x4 &t, int lightType, float range, float spotAngle, const Color &clr, bool depthTest)
@@ -10,18 +10,23 @@
 #include "Math/MathFwd.h"
 #include "IRenderer.h"
 #include "Color.h"
+#include "EntityViewTracker.h"
 
 #include <QObject>
 #include <QList>
 #include <QPair>
 #include <QHash>
 
-#include <set>
+#include <vector>
+#include <map>
 
 class Framework;
 class DebugLines;
 class Transform;
 class MeshInstanceTarget;
+class SceneBVH;
+class MeshBatcher;
+class AnimationScheduler;
 struct InstancingTarget;
 
 class QRect;
@@ -89,6 +94,19 @@ public:
 
     std::string GetUniqueObjectName(const std::string &prefix) { return GenerateUniqueObjectName(prefix); } /**< @deprecated Use GenerateUniqueObjectName @todo Add warning print */
 
+    /// Starts recording a retained debug shape for an owner, replacing the previous shape of the owner.
+    /** The debug drawing functions called until EndDebugShape() add their lines to the shape instead of the current frame.
+        The shape is drawn every frame until it is replaced or removed, and the debug geometry vertex buffer is written only
+        when the shapes change, so use this for debug geometry that rarely changes, e.g. of static objects.
+        @param owner Identifies the shape, typically the object the shape visualizes. */
+    void BeginDebugShape(const void *owner);
+    /// Ends recording the debug shape started with BeginDebugShape.
+    void EndDebugShape();
+    /// Removes the retained debug shape of an owner.
+    void RemoveDebugShape(const void *owner);
+    /// Returns if an owner has a retained debug shape. Always false on a headless world, which has no debug geometry.
+    bool HasDebugShape(const void *owner) const;
+
 public slots:
     /// Does a raycast into the world from screen coordinates, using specific selection layer(s)
     /** @note The coordinates are screen positions, not viewport positions [0,1].
@@ -157,6 +175,12 @@ public slots:
         @return List of entities within the frustrum. */
     QList<Entity*> FrustumQuery(QRect &viewRect) const;
 
+    /// Returns the entities whose meshes are within a frustum in world space.
+    /** Answered by the scene bounding volume hierarchy, so also works on headless servers.
+        @param frustum The query frustum in world space, e.g. from EC_Camera::ToFrustum.
+        @return List of entities with a visible mesh whose bounding box intersects the frustum. */
+    QList<Entity*> FrustumQuery(const Frustum &frustum) const;
+
     /// Returns whether a single entity is visible in the currently active camera
     bool IsEntityVisible(Entity* entity) const;
     
@@ -168,10 +192,11 @@ public slots:
     
     /// Start tracking an entity's visibility within this scene, using any camera(s)
     /** After this, connect either to the EntityEnterView and EntityLeaveView signals,
-        or the entity's EnterView & LeaveView signals, to be notified of the visibility change(s). */
+        or the entity's EnterView & LeaveView signals, to be notified of the visibility change(s).
+        Tracking is reference counted: each call must be paired with a StopViewTracking call. */
     void StartViewTracking(Entity* entity);
     
-    /// Stop tracking an entity's visibility
+    /// Stop tracking an entity's visibility, once StopViewTracking has been called as many times as StartViewTracking
     void StopViewTracking(Entity* entity);
     
     /// Returns the Renderer instance
@@ -183,6 +208,15 @@ public slots:
     /// Returns the parent scene
     ScenePtr Scene() const { return scene_.lock(); }
 
+    /// Returns the bounding volume hierarchy of the meshes of the scene, which answers the mesh raycasts and frustum queries.
+    SceneBVH *BVH() const { return sceneBVH_; }
+
+    /// Returns the automatic mesh batcher of the scene, or null if headless.
+    MeshBatcher *Batcher() const { return meshBatcher_; }
+
+    /// Returns the scheduler that updates the animation controllers of the scene.
+    AnimationScheduler *Animations() const { return animationScheduler_; }
+
     /// Returns if instances with @c meshRef are currently in static mode.
     /** @param Mesh asset reference.
         @return True if mesh found and instancing is static, false if instancing is not static or instancing target for mesh could not be found. */
@@ -250,6 +284,16 @@ public slots:
     /// Renders a sphere as geosphere.
     void DebugDrawSphere(const float3& center, float radius, int vertices, const Color &clr, bool depthTest = true);
     void DebugDrawSphere(const float3& center, float radius, int vertices, float r, float g, float b, bool depthTest = true) { DebugDrawSphere(center, radius, vertices, Color(r, g, b), depthTest); } /**< @overload */
+    /// Renders a box, the unit cube centered at the origin transformed by @c t.
+    void DebugDrawBox(const float3x4 &t, const Color &clr, bool depthTest = true);
+    void DebugDrawBox(const float3x4 &t, float r, float g, float b, bool depthTest = true) { DebugDrawBox(t, Color(r, g, b), depthTest); } /**< @overload */
+    /// Renders a wireframe sphere, the unit sphere centered at the origin transformed by @c t.
+    void DebugDrawSphere(const float3x4 &t, const Color &clr, bool depthTest = true);
+    void DebugDrawSphere(const float3x4 &t, float r, float g, float b, bool depthTest = true) { DebugDrawSphere(t, Color(r, g, b), depthTest); } /**< @overload */
+    /// Renders a wireframe capsule along the local Y axis, centered at the origin and transformed by @c t.
+    /** @param radius Radius of the capsule. @param halfHeight Half of the distance between the centers of the caps. */
+    void DebugDrawCapsule(const float3x4 &t, float radius, float halfHeight, const Color &clr, bool depthTest = true);
+    void DebugDrawCapsule(const float3x4 &t, float radius, float halfHeight, float r, float g, float b, bool depthTest = true) { DebugDrawCapsule(t, radius, halfHeight, Color(r, g, b), depthTest); } /**< @overload */
 
 signals:
     /// An entity has entered the view
@@ -263,8 +307,11 @@ private slots:
     void OnUpdated(float timeStep);
 
 private:
-    /// Do the actual raycast. rayQuery_ must have been set up beforehand
-    void RaycastInternal(unsigned layerMask, float maxDistance, bool getAllResults);
+    /// Do the actual raycast. Meshes are queried from sceneBVH_, other objects from rayQuery_ if it exists.
+    void RaycastInternal(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults);
+
+    /// Raycasts the objects that are not in sceneBVH_ with rayQuery_, continuing from the hits of RaycastInternal.
+    void RaycastOgreObjects(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults, float &closestDistance, size_t &hitIndex);
 
     /// Clear the hit status from raycast results.
     void ClearRaycastResults();
@@ -301,18 +348,34 @@ private:
     
     /// Ray query results which contain a hit (RaycastAll only)
     QList<RaycastResult*> rayHits_;
+
+    /// Bounding volume hierarchy of the meshes of the scene
+    SceneBVH *sceneBVH_;
+
+    /// Automatic instancing and static geometry batching of the meshes, null if headless
+    MeshBatcher *meshBatcher_;
+
+    /// Update scheduling of the animation controllers
+    AnimationScheduler *animationScheduler_;
+
+    /// Mesh hits of the last raycast, reusable
+    std::vector<RayQueryResult> meshHits_;
     
     /// Soft shadow gaussian listeners
     std::list<GaussianListener *> gaussianListeners_;
     
-    /// Visible entity ID's during this frame. Acquired from the active camera. Not updated if no entities are tracked for visibility.
-    std::set<entity_id_t> visibleEntities_;
+    /// Visible entity ID's during this frame, sorted. Acquired from the active camera. Not updated if no entities are tracked for visibility.
+    std::vector<entity_id_t> visibleEntities_;
     
-    /// Visible entity ID's during last frame. Acquired from the active camera. Not updated if no entities are tracked for visibility.
-    std::set<entity_id_t> lastVisibleEntities_;
+    /// Visible entity ID's during last frame, sorted. Acquired from the active camera. Not updated if no entities are tracked for visibility.
+    std::vector<entity_id_t> lastVisibleEntities_;
     
     /// Entities being tracked for visibility changes
-    std::vector<EntityWeakPtr> visibilityTrackedEntities_;
+    EntityViewTracker viewTracker_;
+
+    /// Tracked entities that entered and left the view on this frame, reusable
+    std::vector<EntityPtr> enteredView_;
+    std::vector<EntityPtr> leftView_;
     
     /// Debug geometry object
     DebugLines* debugLines_;
@@ -320,6 +383,22 @@ private:
     /// Debug geometry object, no depth testing
     DebugLines* debugLinesNoDepth_;
 
+    /// Retained debug geometry objects, with and without depth testing
+    DebugLines* debugShapes_;
+    DebugLines* debugShapesNoDepth_;
+
+    /// Owner of the retained debug shape being recorded, or null
+    const void *debugShapeOwner_;
+
+    /// Unit sphere line lists by the vertex count given to DebugDrawSphere
+    std::map<int, std::vector<float3> > debugSphereTemplates_;
+
+    /// Returns the debug geometry object that the lines drawn now go to, or null if headless
+    DebugLines *DebugLinesFor(bool depthTest) const;
+
+    /// Adds a line list of points transformed by @c t to the debug geometry.
+    void DebugDrawLines(const float3x4 &t, const std::vector<float3> &points, const Color &clr, bool depthTest);
+
     /// Ogre instancing data.
     QList<MeshInstanceTarget*> instancingTargets_;
 
@@ -10,8 +10,10 @@
 
 #include <QWidget>
 #include <QImage>
+#include <QRect>
 
 #include <utility>
+#include <algorithm>
 
 #ifdef Q_WS_X11
 #include <QX11Info>
@@ -276,6 +278,27 @@ void RenderWindow::UpdateOverlayImage(const QImage &src)
     texture->getBuffer()->blitFromMemory(bufbox);
 }
 
+void RenderWindow::UpdateOverlayImage(const QImage &src, const QRect &rect)
+{
+    if (!overlay)
+        return;
+
+    PROFILE(RenderWindow_UpdateOverlayImage_Rect);
+
+    Ogre::TextureManager &mgr = Ogre::TextureManager::getSingleton();
+    Ogre::TexturePtr texture = mgr.getByName(rttTextureName);
+    assert(texture.get());
+
+    // The texture may not be resized to the image size yet, only upload the part that fits both.
+    QRect clipped = rect.intersected(QRect(0, 0, std::min<int>(src.width(), texture->getWidth()), std::min<int>(src.height(), texture->getHeight())));
+    if (clipped.isEmpty())
+        return;
+
+    Ogre::PixelBox bufbox(Ogre::Box(0, 0, src.width(), src.height()), Ogre::PF_A8R8G8B8, (void *)src.bits());
+    Ogre::Box dirtyBox(clipped.left(), clipped.top(), clipped.right() + 1, clipped.bottom() + 1);
+    texture->getBuffer()->blitFromMemory(bufbox.getSubVolume(dirtyBox), dirtyBox);
+}
+
 void RenderWindow::ShowOverlay(bool visible)
 {
     if (overlayContainer)
@@ -86,6 +86,7 @@ static const int MINIMUM_TEXTURE_BUDGET = 1;
 #include <QCloseEvent>
 #include <QSize>
 #include <QDir>
+#include <QPainter>
 
 #ifdef PROFILING
 #include "InputAPI.h"
@@ -990,6 +991,45 @@ namespace OgreRenderer
         renderWindow->UpdateOverlayImage(*backBuffer);
     }
 
+    void Renderer::DoUIRedraw(const QRegion &region)
+    {
+        if (framework->IsHeadless())
+            return;
+
+        if (!renderWindow->OgreOverlay())
+            return;
+
+        PROFILE(Renderer_DoUIRedraw);
+
+        UiGraphicsView *view = framework->Ui()->GraphicsView();
+
+        QImage *backBuffer = view->BackBuffer();
+        if (!backBuffer)
+        {
+            LogWarning("Renderer::DoUIRedraw: UiGraphicsView does not have a backbuffer initialized!");
+            return;
+        }
+
+        const QRegion dirty = region & QRegion(QRect(QPoint(0, 0), view->viewport()->size())) & QRegion(backBuffer->rect());
+        if (dirty.isEmpty())
+            return;
+        const QVector<QRect> rects = dirty.rects();
+
+        // Clear and repaint only the damaged rectangles of the buffer.
+        {
+            PROFILE(Renderer_DoUIRedraw_GraphicsViewPaint);
+            QPainter painter(backBuffer);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            foreach(const QRect &rect, rects)
+                painter.fillRect(rect, Qt::transparent);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            view->viewport()->render(&painter, dirty.boundingRect().topLeft(), dirty, QWidget::DrawChildren);
+        }
+
+        foreach(const QRect &rect, rects)
+            renderWindow->UpdateOverlayImage(*backBuffer, rect);
+    }
+
     RaycastResult* Renderer::Raycast(int x, int y)
     {
         OgreWorldPtr world = GetActiveOgreWorld();
@@ -1099,9 +1139,9 @@ namespace OgreRenderer
             }
 
             Ogre::D3D9RenderWindow *d3d9rw = dynamic_cast<Ogre::D3D9RenderWindow*>(renderWindow->OgreRenderWindow());
-            if (!d3d9rw) // We're not using D3D9.
+            if (!d3d9rw) // We're not using D3D9. The dirty rectangle was already repainted above, only upload it.
             {
-                DoFullUIRedraw();
+                renderWindow->UpdateOverlayImage(*view->BackBuffer(), dirty);
             }
             else
             {
@@ -1198,11 +1238,15 @@ namespace OgreRenderer
                 }
             }
         }
-#else // Not using the subrectangle blit - just do a full UI blit.
-        if (view->IsViewDirty() || resizedDirty)
+#else // Repaint and upload only the damaged regions, unless the window was resized.
+        if (resizedDirty)
         {
             DoFullUIRedraw();
         }
+        else if (view->IsViewDirty())
+        {
+            DoUIRedraw(view->DirtyRegion());
+        }
 #endif
 
         if (resizedDirty > 0)
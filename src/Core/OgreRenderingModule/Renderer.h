@@ -11,6 +11,7 @@
 #include <QObject>
 #include <QVariant>
 #include <QDir>
+#include <QRegion>
 
 class QScriptEngine;
 class Framework;
@@ -192,6 +193,9 @@ namespace OgreRenderer
         /// Performs a full UI repaint with Qt and re-fills the GPU surface accordingly.
         void DoFullUIRedraw();
 
+        /// Repaints only the given region of the UI with Qt, and uploads only the changed rectangles to the GPU surface.
+        void DoUIRedraw(const QRegion &region);
+
         /// Returns the Entity which contains the currently active camera that is used to render on the main window.
         /// The returned Entity is guaranteed to have an EC_Camera component, and it is guaranteed to be attached to a scene.
         Entity *MainCamera();
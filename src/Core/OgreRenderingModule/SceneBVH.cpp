@@ -0,0 +1,621 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#define MATH_OGRE_INTEROP
+
+#include "SceneBVH.h"
+#include "EC_Mesh.h"
+#include "EC_Placeable.h"
+#include "OgreMeshAsset.h"
+
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "IAttribute.h"
+#include "Transform.h"
+#include "Profiler.h"
+#include "Geometry/Ray.h"
+#include "Geometry/Plane.h"
+#include "Geometry/Frustum.h"
+
+#include <Ogre.h>
+#include <OgreInstancedEntity.h>
+
+#include <QSet>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+/// @cond PRIVATE
+namespace
+{
+
+/// Maximum number of items in a leaf.
+const int cMaxLeafItems = 4;
+
+/// Grows aabb to enclose other, ignoring a degenerate other.
+void EncloseFinite(AABB &aabb, const AABB &other)
+{
+    if (!other.IsFinite())
+        return;
+    if (!aabb.IsFinite())
+        aabb = other;
+    else
+        aabb.Enclose(other);
+}
+
+/// Slab test of a ray against an AABB. Returns the entry distance, or FLOAT_INF if the AABB is missed or further away than maxDistance.
+float IntersectAABB(const AABB &aabb, const float3 &pos, const float3 &invDir, float maxDistance)
+{
+    if (!(aabb.minPoint.x <= aabb.maxPoint.x))
+        return FLOAT_INF; // Degenerate, e.g. a leaf whose items have no bounds.
+    float tNear = 0.f;
+    float tFar = maxDistance;
+    for(int i = 0; i < 3; ++i)
+    {
+        float t1 = (aabb.minPoint[i] - pos[i]) * invDir[i];
+        float t2 = (aabb.maxPoint[i] - pos[i]) * invDir[i];
+        if (t1 > t2)
+            std::swap(t1, t2);
+        tNear = Max(tNear, t1);
+        tFar = Min(tFar, t2);
+        if (tNear > tFar)
+            return FLOAT_INF;
+    }
+    return tNear;
+}
+
+/// Returns false if the AABB is certainly outside the frustum, whose planes point outwards.
+bool IntersectsFrustum(const AABB &aabb, const Plane *planes)
+{
+    if (!aabb.IsFinite())
+        return false;
+    const float3 center = aabb.CenterPoint();
+    const float3 halfSize = aabb.HalfSize();
+    for(int i = 0; i < 6; ++i)
+        if (planes[i].normal.Dot(center) - planes[i].d > planes[i].normal.Abs().Dot(halfSize))
+            return false;
+    return true;
+}
+
+struct CentroidLess
+{
+    CentroidLess(const float3 *centroids, int axis) : centroids(centroids), axis(axis) {}
+    bool operator()(int a, int b) const { return centroids[a][axis] < centroids[b][axis]; }
+    const float3 *centroids;
+    int axis;
+};
+
+}
+/// @endcond
+
+SceneBVH::SceneBVH(Scene *scene) :
+    numRemoved_(0),
+    numRefits_(0),
+    needsRebuild_(false)
+{
+    connect(scene, SIGNAL(ComponentAdded(Entity*, IComponent*, AttributeChange::Type)),
+        this, SLOT(OnComponentAdded(Entity*, IComponent*, AttributeChange::Type)));
+    connect(scene, SIGNAL(ComponentRemoved(Entity*, IComponent*, AttributeChange::Type)),
+        this, SLOT(OnComponentRemoved(Entity*, IComponent*, AttributeChange::Type)));
+
+    Entity::ComponentVector meshes = scene->Components(EC_Mesh::TypeIdStatic());
+    for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+        AddMesh(iter->get());
+}
+
+SceneBVH::~SceneBVH()
+{
+}
+
+void SceneBVH::Raycast(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults, std::vector<RayQueryResult> &outHits)
+{
+    PROFILE(SceneBVH_Raycast);
+
+    Update();
+    if (nodes_.empty())
+        return;
+
+    const float3 invDir = ray.dir.Recip();
+    float closestDistance = maxDistance;
+    int closestHit = -1;
+
+    stack_.clear();
+    stack_.push_back(0);
+    while(!stack_.empty())
+    {
+        const Node &node = nodes_[stack_.back()];
+        stack_.pop_back();
+        if (IntersectAABB(node.aabb, ray.pos, invDir, closestDistance) == FLOAT_INF)
+            continue;
+
+        if (node.count == 0)
+        {
+            // Visit the nearer child first, so that the nearest hit shortens the ray as early as possible.
+            const float dLeft = IntersectAABB(nodes_[node.child].aabb, ray.pos, invDir, closestDistance);
+            const float dRight = IntersectAABB(nodes_[node.child + 1].aabb, ray.pos, invDir, closestDistance);
+            const int nearChild = (dLeft <= dRight ? node.child : node.child + 1);
+            const int farChild = (nearChild == node.child ? node.child + 1 : node.child);
+            if (Max(dLeft, dRight) != FLOAT_INF)
+                stack_.push_back(farChild);
+            if (Min(dLeft, dRight) != FLOAT_INF)
+                stack_.push_back(nearChild);
+            continue;
+        }
+
+        for(int i = node.first; i < node.first + node.count; ++i)
+        {
+            const Item &item = items_[leafItems_[i]];
+            if (IntersectAABB(item.worldAABB, ray.pos, invDir, closestDistance) == FLOAT_INF)
+                continue;
+
+            EC_Placeable *placeable = 0;
+            EC_Mesh *mesh = QueryableMesh(item, &placeable);
+            if (!mesh || !(placeable->selectionLayer.Get() & layerMask))
+                continue;
+
+            RayQueryResult r;
+            if (!RaycastItem(item, mesh, ray, r) || r.t > closestDistance)
+                continue;
+            r.entity = mesh->ParentEntity();
+            r.component = mesh;
+
+            if (getAllResults)
+                outHits.push_back(r);
+            else
+            {
+                closestDistance = r.t;
+                if (closestHit < 0)
+                {
+                    closestHit = (int)outHits.size();
+                    outHits.push_back(r);
+                }
+                else
+                    outHits[closestHit] = r;
+            }
+        }
+    }
+}
+
+QList<Entity*> SceneBVH::FrustumQuery(const Frustum &frustum)
+{
+    PROFILE(SceneBVH_FrustumQuery);
+
+    QList<Entity*> entities;
+    Update();
+    if (nodes_.empty())
+        return entities;
+
+    Plane planes[6];
+    frustum.GetPlanes(planes);
+
+    QSet<Entity*> found;
+    stack_.clear();
+    stack_.push_back(0);
+    while(!stack_.empty())
+    {
+        const Node &node = nodes_[stack_.back()];
+        stack_.pop_back();
+        if (!IntersectsFrustum(node.aabb, planes))
+            continue;
+
+        if (node.count == 0)
+        {
+            stack_.push_back(node.child + 1);
+            stack_.push_back(node.child);
+            continue;
+        }
+
+        for(int i = node.first; i < node.first + node.count; ++i)
+        {
+            const Item &item = items_[leafItems_[i]];
+            if (!IntersectsFrustum(item.worldAABB, planes))
+                continue;
+            EC_Placeable *placeable = 0;
+            EC_Mesh *mesh = QueryableMesh(item, &placeable);
+            Entity *entity = mesh ? mesh->ParentEntity() : 0;
+            if (entity && !found.contains(entity))
+            {
+                found.insert(entity);
+                entities << entity;
+            }
+        }
+    }
+    return entities;
+}
+
+void SceneBVH::Update()
+{
+    PROFILE(SceneBVH_Update);
+
+    if (!dirtyItems_.empty())
+    {
+        std::vector<int> dirty;
+        dirty.swap(dirtyItems_);
+        for(size_t i = 0; i < dirty.size(); ++i)
+        {
+            Item &item = items_[dirty[i]];
+            if (!item.mesh)
+                continue;
+            if (item.weakMesh.expired())
+            {
+                // Removed without a signal, e.g. with AttributeChange::Disconnected.
+                RemoveMesh(item.mesh);
+                continue;
+            }
+            item.dirty = false;
+            RefreshItem(item);
+            if (item.animated)
+            {
+                item.dirty = true;
+                dirtyItems_.push_back(dirty[i]);
+            }
+
+            if (needsRebuild_)
+                continue;
+            if (item.leaf >= 0)
+            {
+                Refit(item.leaf);
+                ++numRefits_;
+            }
+            else if (item.worldAABB.IsFinite())
+                needsRebuild_ = true; // The mesh got its bounds, it has to be inserted.
+        }
+    }
+
+    // Refitting keeps the hierarchy correct, but the more the items have moved, the looser the nodes get.
+    if (needsRebuild_ || numRefits_ > (int)items_.size() * 2 + 64 || numRemoved_ > (int)items_.size() / 4 + 16)
+        Rebuild();
+}
+
+void SceneBVH::Rebuild()
+{
+    PROFILE(SceneBVH_Rebuild);
+
+    nodes_.clear();
+    leafItems_.clear();
+    dirtyItems_.clear();
+    numRefits_ = 0;
+    needsRebuild_ = false;
+
+    // Compact the removed items away.
+    if (numRemoved_ > 0)
+    {
+        size_t numItems = 0;
+        for(size_t i = 0; i < items_.size(); ++i)
+        {
+            if (!items_[i].mesh)
+                continue;
+            if (numItems != i)
+                items_[numItems] = items_[i];
+            itemIndices_[items_[numItems].mesh] = (int)numItems;
+            ++numItems;
+        }
+        items_.resize(numItems);
+        numRemoved_ = 0;
+    }
+
+    std::vector<int> indices;
+    std::vector<float3> centroids(items_.size());
+    indices.reserve(items_.size());
+    for(size_t i = 0; i < items_.size(); ++i)
+    {
+        Item &item = items_[i];
+        item.leaf = -1;
+        if (item.dirty)
+            dirtyItems_.push_back((int)i); // Animated items stay dirty.
+        if (item.worldAABB.IsFinite())
+        {
+            indices.push_back((int)i);
+            centroids[i] = item.worldAABB.CenterPoint();
+        }
+    }
+    if (indices.empty())
+        return;
+
+    nodes_.reserve(indices.size() * 2 / cMaxLeafItems + 2);
+    nodes_.push_back(Node());
+    BuildNode(0, indices, centroids, 0, (int)indices.size());
+}
+
+void SceneBVH::BuildNode(int nodeIndex, std::vector<int> &indices, const std::vector<float3> &centroids, int first, int count)
+{
+    AABB centroidBounds;
+    centroidBounds.SetNegativeInfinity();
+    nodes_[nodeIndex].aabb.SetNegativeInfinity();
+    for(int i = first; i < first + count; ++i)
+    {
+        nodes_[nodeIndex].aabb.Enclose(items_[indices[i]].worldAABB);
+        centroidBounds.Enclose(centroids[indices[i]]);
+    }
+
+    if (count <= cMaxLeafItems)
+    {
+        Node &node = nodes_[nodeIndex];
+        node.first = (int)leafItems_.size();
+        node.count = count;
+        for(int i = first; i < first + count; ++i)
+        {
+            leafItems_.push_back(indices[i]);
+            items_[indices[i]].leaf = nodeIndex;
+        }
+        return;
+    }
+
+    // Split at the median of the item centroids along the longest axis of their bounds.
+    // This keeps the depth logarithmic even when many items share the same position.
+    const float3 size = centroidBounds.Size();
+    const int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+    const int mid = first + count / 2;
+    std::nth_element(indices.begin() + first, indices.begin() + mid, indices.begin() + first + count, CentroidLess(&centroids[0], axis));
+
+    const int child = (int)nodes_.size();
+    nodes_.resize(nodes_.size() + 2);
+    nodes_[nodeIndex].child = child;
+    nodes_[child].parent = nodeIndex;
+    nodes_[child + 1].parent = nodeIndex;
+    BuildNode(child, indices, centroids, first, mid - first);
+    BuildNode(child + 1, indices, centroids, mid, first + count - mid);
+}
+
+void SceneBVH::Refit(int leaf)
+{
+    Node &node = nodes_[leaf];
+    node.aabb.SetNegativeInfinity();
+    for(int i = node.first; i < node.first + node.count; ++i)
+        EncloseFinite(node.aabb, items_[leafItems_[i]].worldAABB);
+
+    for(int parent = node.parent; parent >= 0; parent = nodes_[parent].parent)
+    {
+        Node &p = nodes_[parent];
+        p.aabb.SetNegativeInfinity();
+        EncloseFinite(p.aabb, nodes_[p.child].aabb);
+        EncloseFinite(p.aabb, nodes_[p.child + 1].aabb);
+    }
+}
+
+void SceneBVH::RefreshItem(Item &item)
+{
+    item.worldAABB.SetNegativeInfinity();
+    item.animated = false;
+
+    ComponentPtr comp = item.weakMesh.lock();
+    EC_Mesh *mesh = static_cast<EC_Mesh*>(comp.get());
+    EC_Placeable *placeable = mesh ? dynamic_cast<EC_Placeable*>(mesh->Placeable().get()) : 0;
+
+    std::vector<EC_Placeable*> chain;
+    for(EC_Placeable *p = placeable; p && chain.size() < 256; p = p->ParentPlaceableComponent())
+    {
+        chain.push_back(p);
+        if (!p->parentBone.Get().isEmpty())
+            item.animated = true;
+    }
+    SetChain(item, chain);
+    if (!placeable)
+        return;
+
+    Ogre::Entity *ogreEntity = mesh->OgreEntity();
+    if (ogreEntity)
+        ogreEntity->setQueryFlags(cQueryFlag);
+    Ogre::InstancedEntity *instancedEntity = mesh->OgreInstancedEntity();
+    if (instancedEntity)
+        instancedEntity->setQueryFlags(cQueryFlag);
+
+    // Skeletal meshes are raycast against the animated Ogre entity, and bounded by its animated bounds.
+    if (ogreEntity && ogreEntity->hasSkeleton())
+    {
+        item.animated = true;
+        const Ogre::AxisAlignedBox &bounds = ogreEntity->getWorldBoundingBox(true);
+        if (bounds.isFinite())
+            item.worldAABB = AABB(float3(bounds.getMinimum()), float3(bounds.getMaximum()));
+        return;
+    }
+
+    OgreMeshAssetPtr meshAsset = mesh->MeshAsset();
+    if (!meshAsset || meshAsset->ogreMesh.isNull())
+        return;
+    const Ogre::AxisAlignedBox &bounds = meshAsset->ogreMesh->getBounds();
+    if (!bounds.isFinite())
+        return;
+
+    // Same as the transform of the adjustment node of EC_Mesh.
+    Transform adjustment = mesh->nodeTransformation.Get();
+    adjustment.scale = Max(adjustment.scale, float3::FromScalar(0.0000001f));
+    item.localToWorld = placeable->LocalToWorld() * adjustment.ToFloat3x4();
+    item.worldToLocal = item.localToWorld.Inverted();
+    if (!item.localToWorld.IsFinite() || !item.worldToLocal.IsFinite())
+        return;
+
+    item.worldAABB = AABB(float3(bounds.getMinimum()), float3(bounds.getMaximum()));
+    item.worldAABB.TransformAsAABB(item.localToWorld);
+}
+
+void SceneBVH::SetChain(Item &item, const std::vector<EC_Placeable*> &chain)
+{
+    if (chain == item.chain)
+        return;
+
+    for(size_t i = 0; i < item.chain.size(); ++i)
+        dependents_.remove(item.chain[i], item.mesh);
+    for(size_t i = 0; i < chain.size(); ++i)
+    {
+        if (!dependents_.contains(chain[i]))
+        {
+            connect(chain[i], SIGNAL(TransformChanged()), this, SLOT(OnPlaceableTransformChanged()), Qt::UniqueConnection);
+            connect(chain[i], SIGNAL(destroyed(QObject*)), this, SLOT(OnPlaceableDestroyed(QObject*)), Qt::UniqueConnection);
+        }
+        dependents_.insert(chain[i], item.mesh);
+    }
+    item.chain = chain;
+}
+
+void SceneBVH::ForgetPlaceable(EC_Placeable *placeable)
+{
+    // Drop the placeable from the chains of its dependents, so that the key does not outlive it: a placeable allocated
+    // later at the same address would otherwise be taken as already connected.
+    const QList<IComponent*> meshes = dependents_.values(placeable);
+    for(int i = 0; i < meshes.size(); ++i)
+    {
+        QHash<IComponent*, int>::const_iterator iter = itemIndices_.find(meshes[i]);
+        if (iter == itemIndices_.end())
+            continue;
+        SetChain(items_[iter.value()], std::vector<EC_Placeable*>());
+        MarkDirty(meshes[i]);
+    }
+    dependents_.remove(placeable);
+}
+
+void SceneBVH::AddMesh(IComponent *mesh)
+{
+    if (!mesh)
+        return;
+    QHash<IComponent*, int>::const_iterator iter = itemIndices_.find(mesh);
+    if (iter != itemIndices_.end())
+    {
+        // A new mesh may have been allocated where a mesh that was removed without a signal was.
+        if (!items_[iter.value()].weakMesh.expired())
+            return;
+        RemoveMesh(mesh);
+    }
+
+    Item item;
+    item.mesh = mesh;
+    item.weakMesh = mesh->shared_from_this();
+    item.worldAABB.SetNegativeInfinity();
+    itemIndices_[mesh] = (int)items_.size();
+    dirtyItems_.push_back((int)items_.size());
+    items_.push_back(item);
+
+    connect(mesh, SIGNAL(MeshChanged()), this, SLOT(OnMeshChanged()), Qt::UniqueConnection);
+    connect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshChanged()), Qt::UniqueConnection);
+    connect(mesh, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnMeshAttributeChanged(IAttribute*, AttributeChange::Type)), Qt::UniqueConnection);
+}
+
+void SceneBVH::RemoveMesh(IComponent *mesh)
+{
+    QHash<IComponent*, int>::iterator iter = itemIndices_.find(mesh);
+    if (iter == itemIndices_.end())
+        return;
+
+    // Leave a hole in the items, compacted away on the next rebuild, so that the indices of the other items stay valid.
+    Item &item = items_[iter.value()];
+    itemIndices_.erase(iter);
+    if (!item.weakMesh.expired())
+        mesh->disconnect(this);
+    SetChain(item, std::vector<EC_Placeable*>());
+    item.mesh = 0;
+    item.weakMesh.reset();
+    item.worldAABB.SetNegativeInfinity();
+    if (item.leaf >= 0 && !needsRebuild_)
+        Refit(item.leaf);
+    ++numRemoved_;
+}
+
+void SceneBVH::MarkDirty(IComponent *mesh)
+{
+    QHash<IComponent*, int>::const_iterator iter = itemIndices_.find(mesh);
+    if (iter == itemIndices_.end())
+        return;
+    Item &item = items_[iter.value()];
+    if (!item.dirty)
+    {
+        item.dirty = true;
+        dirtyItems_.push_back(iter.value());
+    }
+}
+
+bool SceneBVH::RaycastItem(const Item &item, EC_Mesh *mesh, const Ray &ray, RayQueryResult &result) const
+{
+    Ogre::Entity *ogreEntity = mesh->OgreEntity();
+    if (ogreEntity && ogreEntity->hasSkeleton())
+        return EC_Mesh::Raycast(ogreEntity, ray, &result.t, &result.submeshIndex, &result.triangleIndex, &result.pos, &result.normal, &result.uv);
+
+    OgreMeshAssetPtr meshAsset = mesh->MeshAsset();
+    if (!meshAsset)
+        return false;
+
+    Ray localRay = item.worldToLocal * ray;
+    if (localRay.dir.Normalize() == 0.f)
+        return false;
+    result = meshAsset->Raycast(localRay);
+    if (!(result.t < FLOAT_INF))
+        return false;
+    result.pos = item.localToWorld.MulPos(result.pos);
+    result.normal = item.localToWorld.MulDir(result.normal);
+    result.t = result.pos.Distance(ray.pos);
+    return true;
+}
+
+EC_Mesh *SceneBVH::QueryableMesh(const Item &item, EC_Placeable **placeable) const
+{
+    ComponentPtr comp = item.weakMesh.lock();
+    EC_Mesh *mesh = static_cast<EC_Mesh*>(comp.get());
+    if (!mesh || !mesh->ParentEntity())
+        return 0;
+    *placeable = dynamic_cast<EC_Placeable*>(mesh->Placeable().get());
+    if (!*placeable)
+        return 0;
+
+    // The Ogre visibility includes the hiding of the whole scene node hierarchy and the draw distance.
+    Ogre::MovableObject *movable = mesh->OgreEntity();
+    if (!movable)
+        movable = mesh->OgreInstancedEntity();
+    if (movable ? !movable->isVisible() : !(*placeable)->visible.Get())
+        return 0;
+    return mesh;
+}
+
+void SceneBVH::OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type)
+{
+    if (comp->TypeId() == EC_Mesh::TypeIdStatic())
+        AddMesh(comp);
+    else if (comp->TypeId() == EC_Placeable::TypeIdStatic())
+    {
+        Entity::ComponentVector meshes = entity->ComponentsOfType(EC_Mesh::TypeIdStatic());
+        for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+            MarkDirty(iter->get());
+    }
+}
+
+void SceneBVH::OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type)
+{
+    if (comp->TypeId() == EC_Mesh::TypeIdStatic())
+        RemoveMesh(comp);
+    else if (comp->TypeId() == EC_Placeable::TypeIdStatic())
+    {
+        EC_Placeable *placeable = static_cast<EC_Placeable*>(comp);
+        placeable->disconnect(this);
+        ForgetPlaceable(placeable);
+        // EC_Mesh drops the placeable only after this, so the items are refreshed lazily on the next query.
+        Entity::ComponentVector meshes = entity->ComponentsOfType(EC_Mesh::TypeIdStatic());
+        for(Entity::ComponentVector::const_iterator iter = meshes.begin(); iter != meshes.end(); ++iter)
+            MarkDirty(iter->get());
+    }
+}
+
+void SceneBVH::OnPlaceableTransformChanged()
+{
+    EC_Placeable *placeable = static_cast<EC_Placeable*>(sender());
+    for(QMultiHash<EC_Placeable*, IComponent*>::const_iterator iter = dependents_.find(placeable); iter != dependents_.end() && iter.key() == placeable; ++iter)
+        MarkDirty(iter.value());
+}
+
+void SceneBVH::OnPlaceableDestroyed(QObject *object)
+{
+    // Only the address is used, the placeable is not accessed anymore.
+    ForgetPlaceable(static_cast<EC_Placeable*>(object));
+}
+
+void SceneBVH::OnMeshChanged()
+{
+    MarkDirty(static_cast<IComponent*>(sender()));
+}
+
+void SceneBVH::OnMeshAttributeChanged(IAttribute *attribute, AttributeChange::Type)
+{
+    EC_Mesh *mesh = static_cast<EC_Mesh*>(sender());
+    if (attribute == &mesh->nodeTransformation)
+        MarkDirty(mesh);
+}
@@ -0,0 +1,140 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+#include "IRenderer.h"
+#include "Math/MathFwd.h"
+#include "Math/float3x4.h"
+#include "Geometry/AABB.h"
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+
+#include <vector>
+
+class IAttribute;
+
+/// A bounding volume hierarchy of the meshes of a scene, for raycasts and frustum queries that do not depend on the Ogre scene.
+/** Each EC_Mesh that has a placeable is an item of the hierarchy, with its world AABB and a cached world transform and its
+    inverse, which are computed from the Tundra transforms of the placeable chain and the mesh asset bounds. Queries therefore
+    work the same on headless servers as on clients, whether or not the meshes have been rendered yet.
+
+    The items are kept up to date incrementally: the TransformChanged signals of the placeables of the chain of each item mark it dirty,
+    and the dirty items are refreshed and refitted into the hierarchy on the next query. The hierarchy is rebuilt only when items are
+    added, or when enough refits have degraded it. Meshes attached to a bone, and skeletal meshes, move with animation without signals,
+    and are refreshed on every query.
+
+    Skeletal meshes are tested against their animated Ogre entity with EC_Mesh::Raycast, other meshes against their OgreMeshAsset
+    with the ray transformed to the local space of the mesh.
+
+    Owned by OgreWorld, see OgreWorld::BVH. */
+class OGRE_MODULE_API SceneBVH : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SceneBVH(Scene *scene);
+    ~SceneBVH();
+
+    /// Ogre query flag set on the Ogre entities of the tracked meshes, so that Ogre scene queries can exclude them.
+    static const u32 cQueryFlag = 0x80000000;
+
+    /// Finds the intersections of a ray with the meshes of the scene.
+    /** Invisible meshes are ignored.
+        @param ray The ray in world space. The direction must be normalized.
+        @param layerMask Only meshes of entities whose EC_Placeable::selectionLayer has any of these bits set are hit.
+        @param maxDistance Hits further away than this along the ray are ignored.
+        @param getAllResults If true, all hits are returned, otherwise only the nearest one.
+        @param outHits [out] The hits are appended here, in no particular order. */
+    void Raycast(const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults, std::vector<RayQueryResult> &outHits);
+
+    /// Returns the entities with a visible mesh whose world AABB intersects the frustum.
+    /** The test is conservative: an entity whose AABB is near a corner of the frustum may be returned without intersecting it. */
+    QList<Entity*> FrustumQuery(const Frustum &frustum);
+
+    /// Returns if the mesh component is tracked by the hierarchy, i.e. its queries are answered by Raycast and FrustumQuery.
+    bool IsTracked(IComponent *mesh) const { return itemIndices_.contains(mesh); }
+
+private slots:
+    void OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnPlaceableTransformChanged();
+    void OnPlaceableDestroyed(QObject *object);
+    void OnMeshChanged();
+    void OnMeshAttributeChanged(IAttribute *attribute, AttributeChange::Type change);
+
+private:
+    /// @cond PRIVATE
+    struct Item
+    {
+        Item() : mesh(0), leaf(-1), dirty(true), animated(false) {}
+
+        IComponent *mesh; ///< The EC_Mesh, null for a removed item that has not been compacted away yet.
+        ComponentWeakPtr weakMesh;
+        float3x4 localToWorld; ///< Transform from the mesh space to world space, including the adjustment transform of the mesh.
+        float3x4 worldToLocal; ///< Inverse of localToWorld.
+        AABB worldAABB; ///< Degenerate (negative infinity) if the mesh has no placeable or bounds, in which case it is never hit.
+        int leaf; ///< The leaf node the item is in, or -1 if not in the hierarchy.
+        bool dirty;
+        bool animated; ///< Moves without transform signals, refreshed on every query.
+        std::vector<EC_Placeable*> chain; ///< The placeable of the mesh and its parent placeables, whose transform changes move the mesh.
+    };
+
+    /// A node of the hierarchy. The children of an inner node are the nodes child and child + 1.
+    struct Node
+    {
+        Node() : parent(-1), child(-1), first(0), count(0) {}
+
+        AABB aabb;
+        int parent;
+        int child;
+        int first; ///< Index of the first item of a leaf in leafItems_.
+        int count; ///< Number of items of a leaf, 0 for an inner node.
+    };
+    /// @endcond
+
+    /// Refreshes the dirty items and refits or rebuilds the hierarchy as needed.
+    void Update();
+
+    /// Rebuilds the hierarchy of all the items, dropping the removed items.
+    void Rebuild();
+    void BuildNode(int nodeIndex, std::vector<int> &indices, const std::vector<float3> &centroids, int first, int count);
+
+    /// Recomputes the AABBs of a leaf and its ancestors.
+    void Refit(int leaf);
+
+    /// Recomputes the transforms, AABB and placeable chain of an item.
+    void RefreshItem(Item &item);
+
+    /// Replaces the placeable chain of an item, updating the dependents.
+    void SetChain(Item &item, const std::vector<EC_Placeable*> &chain);
+
+    /// Removes a placeable that is being removed or destroyed from the dependents, and marks the meshes it moved dirty.
+    void ForgetPlaceable(EC_Placeable *placeable);
+
+    void AddMesh(IComponent *mesh);
+    void RemoveMesh(IComponent *mesh);
+    void MarkDirty(IComponent *mesh);
+
+    /// Tests a ray against the mesh of an item. @return True if the mesh was hit, in which case result is filled.
+    bool RaycastItem(const Item &item, EC_Mesh *mesh, const Ray &ray, RayQueryResult &result) const;
+
+    /// Returns the mesh of an item if it is alive, visible and has a placeable, and the placeable.
+    EC_Mesh *QueryableMesh(const Item &item, EC_Placeable **placeable) const;
+
+    std::vector<Item> items_;
+    QHash<IComponent*, int> itemIndices_; ///< Index of the item of each mesh.
+    QMultiHash<EC_Placeable*, IComponent*> dependents_; ///< The meshes that each placeable moves.
+    std::vector<int> dirtyItems_;
+    std::vector<Node> nodes_; ///< The nodes, root first. Empty if there are no items with bounds.
+    std::vector<int> leafItems_; ///< Item indices of the leaves.
+    std::vector<int> stack_; ///< Traversal stack, reused between queries.
+    int numRemoved_; ///< Number of removed items waiting for the next rebuild.
+    int numRefits_; ///< Number of refits since the last rebuild.
+    bool needsRebuild_;
+};
@@ -4,6 +4,7 @@
 #include "DebugOperatorNew.h"
 
 #include "TextureAsset.h"
+#include "TextureTranscoder.h"
 #include "OgreRenderingModule.h"
 #include "Renderer.h"
 
@@ -16,15 +17,12 @@
 #include <QFontMetrics>
 #include <QPainter>
 #include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
 
 #include <Ogre.h>
 
-#include <crn_decomp.h>
-#include <dds_defs.h>
-
-#ifdef WIN32
 #include <squish.h>
-#endif
 
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
 #ifdef SAFE_DELETE
@@ -96,101 +94,46 @@ QString TextureAsset::NameSuffix() const
 bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData)
 {
     PROFILE(TextureAsset_DeserializeFromData_CRN_Uncompress);
-    ddsData.clear();
-    
-    // Texture data
-    crnd::crn_texture_info textureInfo;
-    if (!crnd::crnd_get_texture_info((void*)crnData, (crnd::uint32)crnNumBytes, &textureInfo))
+    QString errorMessage;
+    if (!TextureTranscoder::DecompressCRNtoDDS(crnData, crnNumBytes, ddsData, &errorMessage))
     {
-        LogError("CRN texture info parsing failed, invalid input data.");
+        LogError(errorMessage);
         return false;
     }
-    // Begin unpack
-    crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin((void*)crnData, (crnd::uint32)crnNumBytes);
-    if (!crnContext)
-    {
-        LogError("CRN texture data unpacking failed, invalid input data.");
+    return true;
+}
+
+QString TextureAsset::DxtCacheRef() const
+{
+    return Name() + ".dxt.dds";
+}
+
+bool TextureAsset::LoadDxtFromCache(std::vector<u8> &ddsData) const
+{
+    AssetCache *cache = assetAPI->GetAssetCache();
+    if (!cache || !assetAPI->GetFramework()->HasCommandLineParameter("--autoDxtCompress"))
         return false;
-    }
-    
-    // DDS header
-    crnlib::DDSURFACEDESC2 header;
-    memset(&header, 0, sizeof(header));
-    header.dwSize = sizeof(header);
-    // - Size and flags
-    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((textureInfo.m_levels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
-    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
-    header.dwWidth = textureInfo.m_width;
-    header.dwHeight = textureInfo.m_height;
-    // - Pixelformat
-    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
-    header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
-    crn_format fundamentalFormat = crnd::crnd_get_fundamental_dxt_format(textureInfo.m_format);
-    header.ddpfPixelFormat.dwFourCC = crnd::crnd_crn_format_to_fourcc(fundamentalFormat);
-    if (fundamentalFormat != textureInfo.m_format)
-        header.ddpfPixelFormat.dwRGBBitCount = crnd::crnd_crn_format_to_fourcc(textureInfo.m_format);
-    // - Mipmaps
-    header.dwMipMapCount = (textureInfo.m_levels > 1) ? textureInfo.m_levels : 0;
-    if (textureInfo.m_levels > 1)
-        header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
-    // - Cubemap with 6 faces
-    if (textureInfo.m_faces == 6)
-    {
-        header.ddsCaps.dwCaps2 = crnlib::DDSCAPS2_CUBEMAP | 
-            crnlib::DDSCAPS2_CUBEMAP_POSITIVEX | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEX | crnlib::DDSCAPS2_CUBEMAP_POSITIVEY | 
-            crnlib::DDSCAPS2_CUBEMAP_NEGATIVEY | crnlib::DDSCAPS2_CUBEMAP_POSITIVEZ | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEZ;
-    }
-    
-    // Set pitch/linear size field (some DDS readers require this field to be non-zero).
-    int bits_per_pixel = crnd::crnd_get_crn_format_bits_per_texel(textureInfo.m_format);
-    header.lPitch = (((header.dwWidth + 3) & ~3) * ((header.dwHeight + 3) & ~3) * bits_per_pixel) >> 3;
-    header.dwFlags |= crnlib::DDSD_LINEARSIZE;
-          
-    // Prepare output data
-    uint totalSize = sizeof(crnlib::cDDSFileSignature) + header.dwSize;
-    uint writePos = 0;
-    ddsData.resize(totalSize);
-
-    // Write signature. Note: Not endian safe.
-    memcpy(&ddsData[0] + writePos, &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
-    writePos += sizeof(crnlib::cDDSFileSignature);
-
-    // Write header
-    memcpy(&ddsData[0] + writePos, &header, header.dwSize);
-    writePos += header.dwSize;
-    
-    // Now transcode all face and mipmap levels into memory, one mip level at a time.    
-    for (crn_uint32 iLevel = 0; iLevel < textureInfo.m_levels; iLevel++)
-    {
-        // Compute the face's width, height, number of DXT blocks per row/col, etc.
-        const crn_uint32 width = std::max(1U, textureInfo.m_width >> iLevel);
-        const crn_uint32 height = std::max(1U, textureInfo.m_height >> iLevel);
-        const crn_uint32 blocksX = std::max(1U, (width + 3) >> 2);
-        const crn_uint32 blocksY = std::max(1U, (height + 3) >> 2);
-        const crn_uint32 rowPitch = blocksX * crnd::crnd_get_bytes_per_dxt_block(textureInfo.m_format);
-        const crn_uint32 faceSize = rowPitch * blocksY;
-
-        totalSize += faceSize;
-        if (ddsData.size() < totalSize)
-            ddsData.resize(totalSize);
-    
-        // Now transcode the level to raw DXTn
-        void *dest = (void*)(&ddsData[0] + writePos);
-        if (!crnd::crnd_unpack_level(crnContext, &dest, faceSize, rowPitch, iLevel))
-        {
-            ddsData.clear();
-            break;
-        }
-        writePos += faceSize;
-    }
-    crnd::crnd_unpack_end(crnContext);
-    
-    if (ddsData.size() == 0)
-    {
-        LogError("CRN uncompression failed!");
+    QString nameSuffix = NameSuffix();
+    if (nameSuffix == "dds" || nameSuffix == "crn")
         return false;
+
+    QString dxtFile = cache->FindInCache(DxtCacheRef());
+    if (dxtFile.isEmpty())
+        return false;
+
+    // Data loaded from the asset cache is the same data the DXT version was made from. Otherwise only trust the
+    // DXT version if it is newer than the source file. Freshly downloaded data always has to be compressed again.
+    if (diskSourceType != IAsset::Cached)
+    {
+        if (diskSource.isEmpty() || QDir::fromNativeSeparators(diskSource).startsWith(cache->CacheDirectory(), Qt::CaseInsensitive))
+            return false;
+        QFileInfo sourceInfo(diskSource);
+        if (!sourceInfo.exists() || sourceInfo.lastModified() > QFileInfo(dxtFile).lastModified())
+            return false;
     }
-    return true;
+
+    PROFILE(TextureAsset_LoadDxtFromCache);
+    return LoadFileToVector(dxtFile, ddsData) && !ddsData.empty();
 }
 
 bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool allowAsynchronous)
@@ -222,6 +165,17 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
 
     QString nameSuffix = NameSuffix();
     bool isCompressed = nameSuffix == "crn" || nameSuffix == "dds";
+
+    // If this texture has been DXT compressed on a previous run, load the compressed version from the asset cache
+    // instead, which skips both the image decode and the compression.
+    std::vector<u8> dxtCacheData;
+    if (LoadDxtFromCache(dxtCacheData))
+    {
+        data = &dxtCacheData[0];
+        numBytes = dxtCacheData.size();
+        allowAsynchronous = false;
+        isCompressed = true;
+    }
     
     // Check if this is a crunch library CRN file and we need to decompress to DDS.
     std::vector<u8> crnUncompressData;
@@ -537,6 +491,17 @@ bool TextureAsset::IsLoaded() const
     return ogreTexture.get() != 0;
 }
 
+size_t TextureAsset::GpuMemoryUsage() const
+{
+    return ogreTexture.get() ? ogreTexture->getSize() : 0;
+}
+
+bool TextureAsset::IsInUse() const
+{
+    // The Ogre resource system and this asset hold the only references to an unused texture.
+    return ogreTexture.get() && ogreTexture.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
+
 QImage TextureAsset::ToQImage(Ogre::Texture* tex, size_t faceIndex, size_t mipmapLevel)
 {
     PROFILE(TextureAsset_ToQImage);
@@ -835,16 +800,24 @@ void TextureAsset::CompressTexture()
         flags |= squish::kDxt1;
     }
     
-    // Compress original texture data
-    std::vector<unsigned char*> compressedImageData;
-    
+    // Compress original texture data. All the mip levels are compressed in parallel, split into bands of block rows.
+    std::vector<TextureTranscoder::SourceLevel> sourceLevels;
     for (size_t level = 0; level < imageBoxes.size(); ++level)
+        sourceLevels.push_back(TextureTranscoder::SourceLevel(imageData[level], (int)imageBoxes[level].right, (int)imageBoxes[level].bottom));
+    std::vector<std::vector<u8> > compressedImageData;
+    {
+        PROFILE(TextureAsset_CompressTexture_DXT);
+        TextureTranscoder::CompressDXT(sourceLevels, flags, compressedImageData);
+    }
+
+    // Store the compressed texture to the asset cache, so that the next load can skip the compression. Reduced size versions
+    // are not stored, as the size limits may be different on the next run.
+    if (assetAPI->GetAssetCache() && imageBoxes[0].right == ogreTexture->getWidth() && imageBoxes[0].bottom == ogreTexture->getHeight())
     {
-        int compressedSize = squish::GetStorageRequirements((int)imageBoxes[level].right, (int)imageBoxes[level].bottom, flags);
-        LogDebug("Compressing level " + QString::number(level) + " " + QString::number(imageBoxes[level].right) + "x" + QString::number(imageBoxes[level].bottom) + " into " + QString::number(compressedSize) + " bytes");
-        unsigned char* compressedData = new unsigned char[compressedSize];
-        squish::CompressImage((squish::u8*)imageData[level], (int)imageBoxes[level].right, (int)imageBoxes[level].bottom, compressedData, flags);
-        compressedImageData.push_back(compressedData);
+        PROFILE(TextureAsset_CompressTexture_CacheStore);
+        std::vector<u8> ddsData;
+        TextureTranscoder::WriteDDS((int)imageBoxes[0].right, (int)imageBoxes[0].bottom, newFormat == Ogre::PF_DXT5, compressedImageData, ddsData);
+        assetAPI->GetAssetCache()->StoreAsset(&ddsData[0], ddsData.size(), DxtCacheRef());
     }
     
     // Change Ogre texture format
@@ -867,7 +840,7 @@ void TextureAsset::CompressTexture()
             
             size_t numRows = (buf->getHeight() + 3) / 4;
             size_t sourceStride = (buf->getWidth() + 3) / 4 * bytesPerBlock;
-            unsigned char* src = compressedImageData[level];
+            const u8* src = &compressedImageData[level][0];
             
             Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(buf.get());
             assert(pixelBuffer);
@@ -897,8 +870,6 @@ void TextureAsset::CompressTexture()
     // Delete CPU-side temp image data
     for (size_t i = 0; i < imageData.size(); ++i)
         delete[] imageData[i];
-    for (size_t i = 0; i < compressedImageData.size(); ++i)
-        delete[] compressedImageData[i];
 #endif
 }
 
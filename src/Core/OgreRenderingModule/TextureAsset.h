@@ -33,6 +33,12 @@ public:
 
     bool IsLoaded() const;
 
+    /// IAsset override. Returns the size of the texture surfaces.
+    virtual size_t GpuMemoryUsage() const;
+
+    /// IAsset override. Returns true if the texture is referenced by Ogre materials or other Ogre objects.
+    virtual bool IsInUse() const;
+
     /// Sets the contents of this texture asset from raw pixel data.
     /** @param newWidth The desired pixel width for this texture.
         @param newHeight The desired pixel height for this texture. If newWidth or newHeight do not match with the current texture size on the GPU side,
@@ -94,11 +100,11 @@ public:
     void CalculateTextureSize(size_t width, size_t height, size_t& outWidth, size_t& outHeight, size_t bitsPerPixel);
     
     /// Decompresses any CRN input data to DDS.
-    /** @param crnData Ptr to compressed crn data.
+    /** The mip levels are transcoded in parallel, see TextureTranscoder::DecompressCRNtoDDS.
+     ** @param crnData Ptr to compressed crn data.
      ** @param crnNumBytes Size of crn data in bytes.
-     ** @param outDdsNumByte Size of decompressed dds data in bytes is assigned to this parameter.
-     ** @return void* to the uncompressed DDS data. It is the callers responsibility to free the 
-     ** data with crn_free_block when done with it. */
+     ** @param ddsData The decompressed DDS data is written to this vector.
+     ** @return True on success, false otherwise. */
     bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData);
 
 public slots:
@@ -124,6 +130,12 @@ private:
     /// Check whether asynchronous loading can be supported
     bool AllowAsyncLoading() const;
     
+    /// Returns the asset cache ref under which the runtime DXT compressed version of this texture is stored.
+    QString DxtCacheRef() const;
+
+    /// Loads the runtime DXT compressed version of this texture from the asset cache, if --autoDxtCompress is used and the cached version is up to date.
+    bool LoadDxtFromCache(std::vector<u8> &ddsData) const;
+
     /// Strip the top level mips from a DDS image if it is too large. Overwrite memory stream with modified one as necessary. Needs a temp vector for the modified data.
     void ProcessDDSImage(Ogre::DataStreamPtr& stream, std::vector<u8>& modifiedDDSData);
 };
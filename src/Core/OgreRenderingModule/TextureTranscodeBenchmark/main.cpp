@@ -0,0 +1,154 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+/** Standalone benchmark for TextureTranscoder.
+    Compresses every .png/.jpg/.tga file of the given directory to DXT with a full mip chain, and transcodes every .crn file to DDS,
+    first with a single worker thread and then with the given number of worker threads, and prints the timings.
+    Usage: TextureTranscodeBenchmark <directory> [--threads <count>] [--iterations <count>] [--dxt5] */
+
+#include "TextureTranscoder.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QStringList>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QSize>
+
+#include <squish.h>
+
+#include <cstdio>
+
+/// Converts the image and its mip chain to tightly packed RGBA data.
+static void CreateMipChain(QImage image, std::vector<std::vector<u8> > &levelData, std::vector<TextureTranscoder::SourceLevel> &levels)
+{
+    std::vector<QSize> sizes;
+    image = image.convertToFormat(QImage::Format_ARGB32);
+    for(;;)
+    {
+        sizes.push_back(image.size());
+        levelData.push_back(std::vector<u8>((size_t)image.width() * image.height() * 4));
+        u8 *dst = &levelData.back()[0];
+        for(int y = 0; y < image.height(); ++y)
+        {
+            const QRgb *src = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+            for(int x = 0; x < image.width(); ++x, dst += 4)
+            {
+                dst[0] = (u8)qRed(src[x]);
+                dst[1] = (u8)qGreen(src[x]);
+                dst[2] = (u8)qBlue(src[x]);
+                dst[3] = (u8)qAlpha(src[x]);
+            }
+        }
+        if (image.width() == 1 && image.height() == 1)
+            break;
+        image = image.scaled(qMax(1, image.width() / 2), qMax(1, image.height() / 2), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // Take the pointers only after levelData is complete, as growing it may move the level buffers.
+    levels.clear();
+    for(size_t i = 0; i < levelData.size(); ++i)
+        levels.push_back(TextureTranscoder::SourceLevel(&levelData[i][0], sizes[i].width(), sizes[i].height()));
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    if (args.size() < 2)
+    {
+        printf("Usage: TextureTranscodeBenchmark <directory> [--threads <count>] [--iterations <count>] [--dxt5]\n");
+        return 1;
+    }
+
+    int threads = QThread::idealThreadCount();
+    int iterations = 3;
+    int idx = args.indexOf("--threads");
+    if (idx != -1 && idx + 1 < args.size())
+        threads = qMax(1, args[idx + 1].toInt());
+    idx = args.indexOf("--iterations");
+    if (idx != -1 && idx + 1 < args.size())
+        iterations = qMax(1, args[idx + 1].toInt());
+    const int squishFlags = squish::kColourRangeFit | (args.contains("--dxt5") ? squish::kDxt5 : squish::kDxt1);
+
+    QDir dir(args[1]);
+    QStringList files = dir.entryList(QStringList() << "*.png" << "*.jpg" << "*.jpeg" << "*.tga" << "*.crn", QDir::Files, QDir::Name);
+    if (files.isEmpty())
+    {
+        printf("No .png, .jpg, .tga or .crn files found in %s\n", qPrintable(dir.absolutePath()));
+        return 1;
+    }
+
+    printf("%-40s %12s %12s %12s %8s\n", "File", "Size", "1 thread ms", QString("%1 threads ms").arg(threads).toAscii().constData(), "Speedup");
+
+    double totalSerial = 0.0;
+    double totalParallel = 0.0;
+    foreach(const QString &file, files)
+    {
+        const QString path = dir.absoluteFilePath(file);
+        const bool isCrn = file.endsWith(".crn", Qt::CaseInsensitive);
+
+        std::vector<u8> crnData;
+        std::vector<std::vector<u8> > levelData;
+        std::vector<TextureTranscoder::SourceLevel> levels;
+        QString sizeString;
+        if (isCrn)
+        {
+            QFile f(path);
+            if (!f.open(QIODevice::ReadOnly))
+            {
+                printf("%-40s failed to open\n", qPrintable(file));
+                continue;
+            }
+            QByteArray bytes = f.readAll();
+            if (bytes.isEmpty())
+                continue;
+            crnData.assign(bytes.constData(), bytes.constData() + bytes.size());
+            sizeString = QString::number(bytes.size() / 1024) + " KB";
+        }
+        else
+        {
+            QImage image(path);
+            if (image.isNull())
+            {
+                printf("%-40s failed to load\n", qPrintable(file));
+                continue;
+            }
+            sizeString = QString("%1x%2").arg(image.width()).arg(image.height());
+            CreateMipChain(image, levelData, levels);
+        }
+
+        double timings[2] = { 0.0, 0.0 };
+        std::vector<std::vector<u8> > results[2];
+        const int threadCounts[2] = { 1, threads };
+        for(int run = 0; run < 2; ++run)
+        {
+            QThreadPool::globalInstance()->setMaxThreadCount(threadCounts[run]);
+            QElapsedTimer timer;
+            timer.start();
+            for(int i = 0; i < iterations; ++i)
+            {
+                if (isCrn)
+                {
+                    results[run].resize(1);
+                    if (!TextureTranscoder::DecompressCRNtoDDS(&crnData[0], crnData.size(), results[run][0]))
+                        break;
+                }
+                else
+                    TextureTranscoder::CompressDXT(levels, squishFlags, results[run]);
+            }
+            timings[run] = (double)timer.nsecsElapsed() / 1e6 / iterations;
+        }
+
+        const bool identical = (results[0] == results[1]);
+        printf("%-40s %12s %12.2f %12.2f %7.2fx%s\n", qPrintable(file), qPrintable(sizeString), timings[0], timings[1],
+            timings[1] > 0.0 ? timings[0] / timings[1] : 0.0, identical ? "" : "  OUTPUT MISMATCH");
+        totalSerial += timings[0];
+        totalParallel += timings[1];
+    }
+
+    printf("%-40s %12s %12.2f %12.2f %7.2fx\n", "Total", "", totalSerial, totalParallel, totalParallel > 0.0 ? totalSerial / totalParallel : 0.0);
+    return 0;
+}
@@ -0,0 +1,256 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureTranscoder.h"
+
+#include <QtConcurrentMap>
+
+#include <crn_decomp.h>
+#include <dds_defs.h>
+#include <squish.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace TextureTranscoder
+{
+
+/// @cond PRIVATE
+/// Number of 4x4 block rows compressed by a single DXT job.
+static const int cBlockRowsPerJob = 16;
+
+/// A band of block rows of a single level, compressed by one worker.
+struct DXTJob
+{
+    const u8 *rgba;
+    int width;
+    int height; ///< Height of the band in pixels.
+    u8 *blocks;
+    int flags;
+};
+
+static void CompressDXTJob(const DXTJob &job)
+{
+    squish::CompressImage(job.rgba, job.width, job.height, job.blocks, job.flags);
+}
+
+/// A range of mip levels of a CRN file, unpacked by one worker using its own unpack context.
+struct CRNJob
+{
+    const u8 *crnData;
+    size_t crnNumBytes;
+    crn_uint32 firstLevel;
+    crn_uint32 lastLevel;
+    std::vector<void*> faceDest; ///< Destination of each face of each level, [level - firstLevel][face] flattened.
+    std::vector<crn_uint32> levelSize; ///< Size of one face of each level.
+    std::vector<crn_uint32> rowPitch; ///< Row pitch of each level.
+    crn_uint32 numFaces;
+    bool succeeded;
+};
+
+static void UnpackCRNJob(CRNJob &job)
+{
+    job.succeeded = false;
+    crnd::crnd_unpack_context context = crnd::crnd_unpack_begin((void*)job.crnData, (crnd::uint32)job.crnNumBytes);
+    if (!context)
+        return;
+    job.succeeded = true;
+    for(crn_uint32 level = job.firstLevel; level <= job.lastLevel && job.succeeded; ++level)
+    {
+        size_t i = level - job.firstLevel;
+        job.succeeded = crnd::crnd_unpack_level(context, &job.faceDest[i * job.numFaces], job.levelSize[i], job.rowPitch[i], level);
+    }
+    crnd::crnd_unpack_end(context);
+}
+/// @endcond
+
+void CompressDXT(const std::vector<SourceLevel> &levels, int squishFlags, std::vector<std::vector<u8> > &outLevels)
+{
+    const size_t bytesPerBlock = (squishFlags & squish::kDxt1) ? 8 : 16;
+
+    outLevels.clear();
+    outLevels.resize(levels.size());
+
+    std::vector<DXTJob> jobs;
+    for(size_t i = 0; i < levels.size(); ++i)
+    {
+        const SourceLevel &level = levels[i];
+        if (!level.rgba || level.width <= 0 || level.height <= 0)
+            continue;
+        outLevels[i].resize(squish::GetStorageRequirements(level.width, level.height, squishFlags));
+
+        // The compressed blocks are stored row by row, so a band of block rows maps to a contiguous range of the output.
+        const size_t blockRowBytes = ((level.width + 3) / 4) * bytesPerBlock;
+        for(int y = 0; y < level.height; y += cBlockRowsPerJob * 4)
+        {
+            DXTJob job;
+            job.rgba = level.rgba + (size_t)y * level.width * 4;
+            job.width = level.width;
+            job.height = std::min(cBlockRowsPerJob * 4, level.height - y);
+            job.blocks = &outLevels[i][0] + (size_t)(y / 4) * blockRowBytes;
+            job.flags = squishFlags;
+            jobs.push_back(job);
+        }
+    }
+
+    if (jobs.size() == 1)
+        CompressDXTJob(jobs[0]);
+    else if (!jobs.empty())
+        QtConcurrent::blockingMap(jobs, CompressDXTJob);
+}
+
+void WriteDDS(int width, int height, bool dxt5, const std::vector<std::vector<u8> > &levels, std::vector<u8> &ddsData)
+{
+    crnlib::DDSURFACEDESC2 header;
+    memset(&header, 0, sizeof(header));
+    header.dwSize = sizeof(header);
+    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | crnlib::DDSD_LINEARSIZE |
+        ((levels.size() > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
+    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
+    if (levels.size() > 1)
+        header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
+    header.dwWidth = width;
+    header.dwHeight = height;
+    header.dwMipMapCount = (levels.size() > 1) ? (crn_uint32)levels.size() : 0;
+    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
+    header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
+    header.ddpfPixelFormat.dwFourCC = dxt5 ? crnlib::PIXEL_FMT_DXT5 : crnlib::PIXEL_FMT_DXT1;
+    header.lPitch = levels.empty() ? 0 : (crn_int32)levels[0].size();
+
+    size_t totalSize = sizeof(crnlib::cDDSFileSignature) + header.dwSize;
+    for(size_t i = 0; i < levels.size(); ++i)
+        totalSize += levels[i].size();
+    ddsData.resize(totalSize);
+
+    // Note: Not endian safe.
+    size_t writePos = 0;
+    memcpy(&ddsData[0] + writePos, &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
+    writePos += sizeof(crnlib::cDDSFileSignature);
+    memcpy(&ddsData[0] + writePos, &header, header.dwSize);
+    writePos += header.dwSize;
+    for(size_t i = 0; i < levels.size(); ++i)
+    {
+        if (!levels[i].empty())
+            memcpy(&ddsData[0] + writePos, &levels[i][0], levels[i].size());
+        writePos += levels[i].size();
+    }
+}
+
+bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, QString *errorMessage)
+{
+    ddsData.clear();
+
+    // Texture data
+    crnd::crn_texture_info textureInfo;
+    if (!crnd::crnd_get_texture_info((void*)crnData, (crnd::uint32)crnNumBytes, &textureInfo) || textureInfo.m_levels == 0)
+    {
+        if (errorMessage)
+            *errorMessage = "CRN texture info parsing failed, invalid input data.";
+        return false;
+    }
+
+    // DDS header
+    crnlib::DDSURFACEDESC2 header;
+    memset(&header, 0, sizeof(header));
+    header.dwSize = sizeof(header);
+    // - Size and flags
+    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((textureInfo.m_levels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
+    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
+    header.dwWidth = textureInfo.m_width;
+    header.dwHeight = textureInfo.m_height;
+    // - Pixelformat
+    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
+    header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
+    crn_format fundamentalFormat = crnd::crnd_get_fundamental_dxt_format(textureInfo.m_format);
+    header.ddpfPixelFormat.dwFourCC = crnd::crnd_crn_format_to_fourcc(fundamentalFormat);
+    if (fundamentalFormat != textureInfo.m_format)
+        header.ddpfPixelFormat.dwRGBBitCount = crnd::crnd_crn_format_to_fourcc(textureInfo.m_format);
+    // - Mipmaps
+    header.dwMipMapCount = (textureInfo.m_levels > 1) ? textureInfo.m_levels : 0;
+    if (textureInfo.m_levels > 1)
+        header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
+    // - Cubemap with 6 faces
+    if (textureInfo.m_faces == 6)
+    {
+        header.ddsCaps.dwCaps2 = crnlib::DDSCAPS2_CUBEMAP |
+            crnlib::DDSCAPS2_CUBEMAP_POSITIVEX | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEX | crnlib::DDSCAPS2_CUBEMAP_POSITIVEY |
+            crnlib::DDSCAPS2_CUBEMAP_NEGATIVEY | crnlib::DDSCAPS2_CUBEMAP_POSITIVEZ | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEZ;
+    }
+
+    // Set pitch/linear size field (some DDS readers require this field to be non-zero).
+    int bits_per_pixel = crnd::crnd_get_crn_format_bits_per_texel(textureInfo.m_format);
+    header.lPitch = (((header.dwWidth + 3) & ~3) * ((header.dwHeight + 3) & ~3) * bits_per_pixel) >> 3;
+    header.dwFlags |= crnlib::DDSD_LINEARSIZE;
+
+    // Compute the size of each level up front, so that the whole file can be allocated once and the levels unpacked in parallel.
+    const crn_uint32 numFaces = std::max(1U, textureInfo.m_faces);
+    std::vector<crn_uint32> levelSizes(textureInfo.m_levels);
+    std::vector<crn_uint32> rowPitches(textureInfo.m_levels);
+    size_t faceChainSize = 0;
+    for(crn_uint32 level = 0; level < textureInfo.m_levels; ++level)
+    {
+        const crn_uint32 width = std::max(1U, textureInfo.m_width >> level);
+        const crn_uint32 height = std::max(1U, textureInfo.m_height >> level);
+        const crn_uint32 blocksX = std::max(1U, (width + 3) >> 2);
+        const crn_uint32 blocksY = std::max(1U, (height + 3) >> 2);
+        rowPitches[level] = blocksX * crnd::crnd_get_bytes_per_dxt_block(textureInfo.m_format);
+        levelSizes[level] = rowPitches[level] * blocksY;
+        faceChainSize += levelSizes[level];
+    }
+
+    const size_t headerSize = sizeof(crnlib::cDDSFileSignature) + header.dwSize;
+    ddsData.resize(headerSize + faceChainSize * numFaces);
+
+    // Write signature and header. Note: Not endian safe.
+    memcpy(&ddsData[0], &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
+    memcpy(&ddsData[0] + sizeof(crnlib::cDDSFileSignature), &header, header.dwSize);
+
+    // Each level takes roughly a quarter of the time of the previous one, so the two largest levels get their own jobs and the rest of the chain is
+    // unpacked by a third one. crnd cannot split a single level, and each job needs its own unpack context.
+    std::vector<CRNJob> jobs;
+    for(crn_uint32 level = 0; level < textureInfo.m_levels; ++level)
+    {
+        if (level <= 2)
+        {
+            CRNJob job;
+            job.crnData = crnData;
+            job.crnNumBytes = crnNumBytes;
+            job.firstLevel = level;
+            job.numFaces = numFaces;
+            job.succeeded = false;
+            jobs.push_back(job);
+        }
+        CRNJob &job = jobs.back();
+        job.lastLevel = level;
+        job.levelSize.push_back(levelSizes[level]);
+        job.rowPitch.push_back(rowPitches[level]);
+
+        // In a DDS file each face stores its full mip chain before the next face.
+        size_t levelOffset = 0;
+        for(crn_uint32 i = 0; i < level; ++i)
+            levelOffset += levelSizes[i];
+        for(crn_uint32 face = 0; face < numFaces; ++face)
+            job.faceDest.push_back(&ddsData[0] + headerSize + face * faceChainSize + levelOffset);
+    }
+
+    if (jobs.size() == 1)
+        UnpackCRNJob(jobs[0]);
+    else
+        QtConcurrent::blockingMap(jobs, UnpackCRNJob);
+
+    for(size_t i = 0; i < jobs.size(); ++i)
+        if (!jobs[i].succeeded)
+        {
+            ddsData.clear();
+            if (errorMessage)
+                *errorMessage = "CRN uncompression failed!";
+            return false;
+        }
+    return true;
+}
+
+}
@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+
+#include <QString>
+#include <vector>
+
+/// Parallel DXT compression and CRN transcoding of texture data.
+/** The work is split into independent jobs (rows of 4x4 blocks for DXT compression, mip levels for CRN transcoding)
+    which are run on the global QThreadPool. The functions do not depend on Ogre or the rest of the renderer,
+    so they can be used from worker threads and from standalone tools.
+    @note The number of worker threads used is controlled by QThreadPool::globalInstance()->maxThreadCount(). */
+namespace TextureTranscoder
+{
+    /// A single uncompressed source image, or a mip level of it, to be compressed to DXT.
+    struct OGRE_MODULE_API SourceLevel
+    {
+        SourceLevel() : rgba(0), width(0), height(0) {}
+        SourceLevel(const u8 *rgba_, int width_, int height_) : rgba(rgba_), width(width_), height(height_) {}
+
+        /// Pixel data in tightly packed R8G8B8A8 byte order, width*height*4 bytes.
+        const u8 *rgba;
+        int width;
+        int height;
+    };
+
+    /// DXT compresses the given mip levels in parallel.
+    /** Each level is split into bands of block rows, and all the bands of all the levels are compressed concurrently.
+        @param levels The source levels, typically a full or partial mip chain.
+        @param squishFlags Compression flags passed to squish::CompressImage, e.g. squish::kDxt1 | squish::kColourRangeFit.
+        @param outLevels [out] Receives the compressed data of each level, in the same order as levels. */
+    OGRE_MODULE_API void CompressDXT(const std::vector<SourceLevel> &levels, int squishFlags, std::vector<std::vector<u8> > &outLevels);
+
+    /// Writes a DDS file of already DXT compressed mip levels.
+    /** @param width Width of the first level.
+        @param height Height of the first level.
+        @param dxt5 True if the levels are DXT5 compressed, false if DXT1.
+        @param levels The compressed levels, as produced by CompressDXT.
+        @param ddsData [out] Receives the DDS file data. */
+    OGRE_MODULE_API void WriteDDS(int width, int height, bool dxt5, const std::vector<std::vector<u8> > &levels, std::vector<u8> &ddsData);
+
+    /// Transcodes CRN data to DDS, unpacking the mip levels in parallel.
+    /** @param crnData Ptr to compressed crn data.
+        @param crnNumBytes Size of crn data in bytes.
+        @param ddsData [out] Receives the DDS file data.
+        @param errorMessage [out] Optional, receives a description of the error on failure.
+        @return True on success, false otherwise. */
+    OGRE_MODULE_API bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, QString *errorMessage = 0);
+}
@@ -0,0 +1,494 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#define MATH_BULLET_INTEROP
+#include "DebugOperatorNew.h"
+
+#include "CollisionShapeCache.h"
+#include "CollisionShapeUtils.h"
+#include "ConvexHull.h"
+#include "EC_RigidBody.h"
+
+#include "OgreMeshAsset.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+// Disable unreferenced formal parameter coming from Bullet
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4100)
+#endif
+#include <btBulletDynamicsCommon.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <QFile>
+#include <QtConcurrentRun>
+
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+using namespace Physics;
+
+/// @cond PRIVATE
+namespace
+{
+
+const u32 cCookedShapeMagic = 0x4C4F4354; // "TCOL"
+const u32 cCookedShapeVersion = 1;
+
+/// FNV-1a, continued from a previous hash.
+u64 HashBytes(const u8 *data, size_t numBytes, u64 hash = 14695981039346656037ULL)
+{
+    for(size_t i = 0; i < numBytes; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/// Hashes the contents of a file. Unlike LoadFileToVector, does not log, as it is called in a worker thread.
+bool HashFile(const QString &filename, u64 &hash)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    hash = HashBytes(0, 0);
+    std::vector<u8> chunk(256 * 1024);
+    for(;;)
+    {
+        qint64 numRead = file.read(reinterpret_cast<char*>(&chunk[0]), (qint64)chunk.size());
+        if (numRead < 0)
+            return false;
+        if (numRead == 0)
+            return true;
+        hash = HashBytes(&chunk[0], (size_t)numRead, hash);
+    }
+}
+
+/// Reads a file whole. Unlike LoadFileToVector, does not log, as it is called in a worker thread.
+bool ReadFile(const QString &filename, std::vector<u8> &dst)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    dst.resize((size_t)file.size());
+    return dst.empty() || file.read(reinterpret_cast<char*>(&dst[0]), (qint64)dst.size()) == (qint64)dst.size();
+}
+
+template<typename T>
+void AppendPod(std::vector<u8> &dst, const T *data, size_t count)
+{
+    if (!count)
+        return;
+    size_t pos = dst.size();
+    dst.resize(pos + sizeof(T) * count);
+    memcpy(&dst[pos], data, sizeof(T) * count);
+}
+
+template<typename T>
+bool ReadPod(const u8 *&data, const u8 *end, T *dst, size_t count)
+{
+    if ((size_t)(end - data) / sizeof(T) < count)
+        return false;
+    if (count)
+        memcpy(dst, data, sizeof(T) * count);
+    data += sizeof(T) * count;
+    return true;
+}
+
+/// Deletes a BVH deserialized in place, which lives at the start of its aligned buffer.
+struct InPlaceBvhDeleter
+{
+    void operator()(btOptimizedBvh *bvh) const
+    {
+        bvh->~btOptimizedBvh();
+        btAlignedFree(bvh);
+    }
+};
+
+/// Creates a triangle mesh with its bounds precomputed, so that the shapes created of it do not need to scan its vertices.
+shared_ptr<btTriangleMesh> CreateTriangleMesh(const std::vector<float3> &triangles, const float3 &aabbMin, const float3 &aabbMax)
+{
+#include "DisableMemoryLeakCheck.h"
+    shared_ptr<btTriangleMesh> mesh = MAKE_SHARED(btTriangleMesh);
+#include "EnableMemoryLeakCheck.h"
+    GenerateTriangleMesh(triangles, mesh.get());
+    mesh->setPremadeAabb(aabbMin, aabbMax);
+    return mesh;
+}
+
+} // ~unnamed namespace
+/// @endcond
+
+CollisionShapeCache::CollisionShapeCache(AssetAPI *assetAPI) :
+    assetAPI_(assetAPI)
+{
+}
+
+CollisionShapeCache::~CollisionShapeCache()
+{
+    foreach(Job *job, jobs_)
+    {
+        job->future.waitForFinished();
+        delete job;
+    }
+    jobs_.clear();
+}
+
+bool CollisionShapeCache::Shape(OgreMeshAsset *asset, int shapeType, EC_RigidBody *body, CookedShape &shape)
+{
+    shape = CookedShape();
+    if (!asset || (shapeType != EC_RigidBody::Shape_TriMesh && shapeType != EC_RigidBody::Shape_ConvexHull))
+        return true;
+
+    const QString assetRef = asset->Name();
+    if (failedShapes_.contains(AssetShapeKey(assetRef, shapeType)))
+        return true;
+    QHash<QString, u64>::const_iterator hash = sourceHashes_.find(assetRef);
+    if (hash != sourceHashes_.end() && CachedShapeFor(*hash, shapeType, shape))
+        return true;
+
+    Job *job = 0;
+    foreach(Job *pending, jobs_)
+        if (!pending->stale && pending->shapeType == shapeType && pending->assetRef == assetRef)
+        {
+            job = pending;
+            break;
+        }
+
+    if (!job)
+    {
+        PROFILE(CollisionShapeCache_StartCooking);
+        job = new Job;
+        job->assetRef = assetRef;
+        job->shapeType = shapeType;
+        if (hash != sourceHashes_.end())
+        {
+            job->hash = *hash;
+            job->hashed = true;
+        }
+        // Assets without a file on disk, e.g. ones from a zip bundle, are keyed by their triangles instead.
+        job->sourceFile = asset->DiskSource();
+        if (job->sourceFile.isEmpty() || !QFile::exists(job->sourceFile))
+        {
+            job->sourceFile.clear();
+            if (asset->ogreMesh.get())
+                GetTrianglesFromMesh(asset->ogreMesh.get(), job->triangles);
+            if (job->triangles.size() < 3)
+            {
+                delete job;
+                return true;
+            }
+        }
+        // Look up the cache directory here, as the asset cache is not thread-safe.
+        if (assetAPI_->Cache())
+            job->cacheDirectory = assetAPI_->Cache()->CacheDirectory();
+
+        connect(asset, SIGNAL(Unloaded(IAsset *)), this, SLOT(OnAssetUnloaded(IAsset *)), Qt::UniqueConnection);
+        job->watcher = new QFutureWatcher<void>(this);
+        connect(job->watcher, SIGNAL(finished()), this, SLOT(OnJobFinished()));
+        jobs_.push_back(job);
+        Start(job);
+    }
+
+    if (body && !job->bodies.contains(body))
+        job->bodies.push_back(body);
+    return false;
+}
+
+void CollisionShapeCache::Start(Job *job)
+{
+    job->future = QtConcurrent::run(&CollisionShapeCache::Cook, job);
+    job->watcher->setFuture(job->future);
+}
+
+void CollisionShapeCache::Cook(Job *job)
+{
+    if (!job->hashed)
+    {
+        if (!job->sourceFile.isEmpty())
+        {
+            if (!HashFile(job->sourceFile, job->hash))
+                return; // The main thread falls back to hashing the triangles.
+        }
+        else
+            job->hash = HashBytes(reinterpret_cast<const u8*>(&job->triangles[0]), job->triangles.size() * sizeof(float3));
+        job->hashed = true;
+    }
+
+    if (!job->cacheChecked)
+    {
+        job->cacheChecked = true;
+        // The cooked shape refs do not contain any characters that AssetCache would sanitate.
+        std::vector<u8> data;
+        if (!job->cacheDirectory.isEmpty() && ReadFile(job->cacheDirectory + CookedShapeRef(job->hash, job->shapeType), data) &&
+            Deserialize(data, job->shapeType, job->hash, job->shape))
+            return;
+    }
+
+    if (job->triangles.size() < 3)
+        return; // The main thread extracts the triangles and runs the job again.
+
+    if (job->shapeType == EC_RigidBody::Shape_TriMesh)
+    {
+        float3 aabbMin = job->triangles[0];
+        float3 aabbMax = job->triangles[0];
+        for(size_t i = 1; i < job->triangles.size(); ++i)
+        {
+            aabbMin = aabbMin.Min(job->triangles[i]);
+            aabbMax = aabbMax.Max(job->triangles[i]);
+        }
+        job->shape.triangleMesh = CreateTriangleMesh(job->triangles, aabbMin, aabbMax);
+#include "DisableMemoryLeakCheck.h"
+        job->shape.bvh = shared_ptr<btOptimizedBvh>(new btOptimizedBvh);
+#include "EnableMemoryLeakCheck.h"
+        job->shape.bvh->build(job->shape.triangleMesh.get(), true, aabbMin, aabbMax);
+    }
+    else
+    {
+        shared_ptr<ConvexHullSet> hullSet = MAKE_SHARED(ConvexHullSet);
+        if (GenerateConvexHullSet(job->triangles, hullSet.get()))
+            job->shape.convexHullSet = hullSet;
+    }
+
+    if (!job->cacheDirectory.isEmpty() && !job->shape.IsEmpty())
+        Serialize(job->triangles, job->shape, job->shapeType, job->hash, job->cacheData);
+}
+
+void CollisionShapeCache::OnJobFinished()
+{
+    Job *job = 0;
+    foreach(Job *pending, jobs_)
+        if (pending->watcher == sender())
+        {
+            job = pending;
+            break;
+        }
+    if (!job)
+        return;
+
+    if (job->shape.IsEmpty() && job->triangles.empty())
+    {
+        // The shape was not in the asset cache. Use the same shape cooked for another asset of the same data, or cook it.
+        if (!job->hashed || !CachedShapeFor(job->hash, job->shapeType, job->shape))
+        {
+            if (!job->stale)
+            {
+                PROFILE(CollisionShapeCache_ExtractTriangles);
+                OgreMeshAsset *asset = dynamic_cast<OgreMeshAsset*>(assetAPI_->GetAsset(job->assetRef).get());
+                if (asset && asset->ogreMesh.get())
+                    GetTrianglesFromMesh(asset->ogreMesh.get(), job->triangles);
+                if (job->triangles.size() >= 3)
+                {
+                    if (!job->hashed)
+                        job->sourceFile.clear();
+                    Start(job);
+                    return;
+                }
+                LogError("CollisionShapeCache: Could not read the triangles of mesh " + job->assetRef + " to cook its collision shape.");
+                failedShapes_.insert(AssetShapeKey(job->assetRef, job->shapeType));
+            }
+
+            jobs_.removeOne(job);
+            job->watcher->deleteLater();
+            // The bodies request the shape again, and get the failure, or in case of a stale job start a new job for the reloaded asset.
+            Deliver(job);
+            delete job;
+            return;
+        }
+    }
+    else if (job->shape.IsEmpty())
+        LogWarning("CollisionShapeCache: Could not cook a collision shape of mesh " + job->assetRef + ".");
+
+    jobs_.removeOne(job);
+    job->watcher->deleteLater();
+
+    if (!job->shape.IsEmpty())
+        CacheShape(job->hash, job->shapeType, job->shape);
+    if (!job->stale)
+    {
+        sourceHashes_[job->assetRef] = job->hash;
+        if (job->shape.IsEmpty())
+            failedShapes_.insert(AssetShapeKey(job->assetRef, job->shapeType));
+    }
+    if (!job->cacheData.empty() && assetAPI_->Cache())
+    {
+        PROFILE(CollisionShapeCache_StoreCookedShape);
+        assetAPI_->Cache()->StoreAsset(&job->cacheData[0], job->cacheData.size(), CookedShapeRef(job->hash, job->shapeType));
+    }
+
+    // The job keeps the shape alive until the bodies have taken it.
+    Deliver(job);
+    delete job;
+}
+
+bool CollisionShapeCache::CachedShapeFor(u64 hash, int shapeType, CookedShape &shape)
+{
+    QHash<ShapeKey, CachedShape>::iterator cached = shapes_.find(ShapeKey(hash, shapeType));
+    if (cached == shapes_.end())
+        return false;
+
+    CookedShape found;
+    found.triangleMesh = cached->triangleMesh.lock();
+    found.bvh = cached->bvh.lock();
+    found.convexHullSet = cached->convexHullSet.lock();
+    if (shapeType == EC_RigidBody::Shape_TriMesh ? (!found.triangleMesh || !found.bvh) : !found.convexHullSet)
+    {
+        shapes_.erase(cached);
+        return false;
+    }
+    shape = found;
+    return true;
+}
+
+void CollisionShapeCache::CacheShape(u64 hash, int shapeType, const CookedShape &shape)
+{
+    for(QHash<ShapeKey, CachedShape>::iterator iter = shapes_.begin(); iter != shapes_.end();)
+    {
+        if (iter->triangleMesh.expired() && iter->convexHullSet.expired())
+            iter = shapes_.erase(iter);
+        else
+            ++iter;
+    }
+
+    CachedShape &cached = shapes_[ShapeKey(hash, shapeType)];
+    cached.triangleMesh = shape.triangleMesh;
+    cached.bvh = shape.bvh;
+    cached.convexHullSet = shape.convexHullSet;
+}
+
+void CollisionShapeCache::Deliver(Job *job)
+{
+    foreach(const QPointer<EC_RigidBody> &body, job->bodies)
+        if (body)
+            body->OnCollisionShapeCooked(job->assetRef, job->shapeType);
+}
+
+void CollisionShapeCache::OnAssetUnloaded(IAsset *asset)
+{
+    const QString assetRef = asset->Name();
+    sourceHashes_.remove(assetRef);
+    failedShapes_.remove(AssetShapeKey(assetRef, EC_RigidBody::Shape_TriMesh));
+    failedShapes_.remove(AssetShapeKey(assetRef, EC_RigidBody::Shape_ConvexHull));
+    foreach(Job *job, jobs_)
+        if (job->assetRef == assetRef)
+            job->stale = true;
+}
+
+QString CollisionShapeCache::CookedShapeRef(u64 hash, int shapeType)
+{
+    return QString("collisionshape_%1.%2").arg(hash, 16, 16, QChar('0')).arg(shapeType == EC_RigidBody::Shape_TriMesh ? "trimesh" : "hulls");
+}
+
+void CollisionShapeCache::Serialize(const std::vector<float3> &triangles, const CookedShape &shape, int shapeType, u64 hash, std::vector<u8> &dst)
+{
+    dst.clear();
+    AppendPod(dst, &hash, 1);
+    const u32 header[3] = { cCookedShapeMagic, cCookedShapeVersion, (u32)shapeType };
+    AppendPod(dst, header, 3);
+
+    if (shapeType == EC_RigidBody::Shape_TriMesh)
+    {
+        // The triangles are stored in the order the BVH refers to them.
+        const u32 numTriangles = (u32)(triangles.size() / 3);
+        AppendPod(dst, &numTriangles, 1);
+        AppendPod(dst, &triangles[0], numTriangles * 3);
+
+        btVector3 aabbMin, aabbMax;
+        shape.triangleMesh->getPremadeAabb(&aabbMin, &aabbMax);
+        const float bounds[6] = { aabbMin.x(), aabbMin.y(), aabbMin.z(), aabbMax.x(), aabbMax.y(), aabbMax.z() };
+        AppendPod(dst, bounds, 6);
+
+        // Bullet serializes the BVH into a 16-byte aligned buffer.
+        const u32 bvhSize = shape.bvh->calculateSerializeBufferSize();
+        AppendPod(dst, &bvhSize, 1);
+        void *buffer = btAlignedAlloc(bvhSize, 16);
+        shape.bvh->serializeInPlace(buffer, bvhSize, false);
+        AppendPod(dst, static_cast<const u8*>(buffer), bvhSize);
+        btAlignedFree(buffer);
+    }
+    else
+    {
+        const u32 numHulls = (u32)shape.convexHullSet->hulls_.size();
+        AppendPod(dst, &numHulls, 1);
+        for(u32 i = 0; i < numHulls; ++i)
+        {
+            const ConvexHull &hull = shape.convexHullSet->hulls_[i];
+            AppendPod(dst, &hull.position_, 1);
+            const u32 numPoints = (u32)hull.hull_->getNumPoints();
+            AppendPod(dst, &numPoints, 1);
+            const btVector3 *points = hull.hull_->getUnscaledPoints();
+            for(u32 j = 0; j < numPoints; ++j)
+            {
+                const float point[3] = { points[j].x(), points[j].y(), points[j].z() };
+                AppendPod(dst, point, 3);
+            }
+        }
+    }
+}
+
+bool CollisionShapeCache::Deserialize(const std::vector<u8> &data, int shapeType, u64 hash, CookedShape &shape)
+{
+    shape = CookedShape();
+    const u8 *pos = data.empty() ? 0 : &data[0];
+    const u8 *end = pos + data.size();
+
+    u64 cookedHash = 0;
+    u32 header[3];
+    if (!ReadPod(pos, end, &cookedHash, 1) || !ReadPod(pos, end, header, 3) || cookedHash != hash ||
+        header[0] != cCookedShapeMagic || header[1] != cCookedShapeVersion || header[2] != (u32)shapeType)
+        return false;
+
+    if (shapeType == EC_RigidBody::Shape_TriMesh)
+    {
+        u32 numTriangles = 0;
+        if (!ReadPod(pos, end, &numTriangles, 1) || numTriangles == 0 || (size_t)(end - pos) / (9 * sizeof(float)) < numTriangles)
+            return false;
+        std::vector<float3> triangles(numTriangles * 3);
+        float bounds[6];
+        u32 bvhSize = 0;
+        if (!ReadPod(pos, end, &triangles[0], triangles.size()) || !ReadPod(pos, end, bounds, 6) || !ReadPod(pos, end, &bvhSize, 1) ||
+            (size_t)(end - pos) != bvhSize || bvhSize < sizeof(btOptimizedBvh))
+            return false;
+
+        // The BVH is deserialized in place, so it stays in an aligned copy of its data.
+        void *buffer = btAlignedAlloc(bvhSize, 16);
+        memcpy(buffer, pos, bvhSize);
+        btOptimizedBvh *bvh = btOptimizedBvh::deSerializeInPlace(buffer, bvhSize, false);
+        if (!bvh)
+        {
+            btAlignedFree(buffer);
+            return false;
+        }
+        shape.bvh = shared_ptr<btOptimizedBvh>(bvh, InPlaceBvhDeleter());
+        shape.triangleMesh = CreateTriangleMesh(triangles, float3(bounds[0], bounds[1], bounds[2]), float3(bounds[3], bounds[4], bounds[5]));
+        return true;
+    }
+
+    u32 numHulls = 0;
+    if (!ReadPod(pos, end, &numHulls, 1) || numHulls == 0)
+        return false;
+    shared_ptr<ConvexHullSet> hullSet = MAKE_SHARED(ConvexHullSet);
+    std::vector<float3> points;
+    for(u32 i = 0; i < numHulls; ++i)
+    {
+        ConvexHull hull;
+        u32 numPoints = 0;
+        if (!ReadPod(pos, end, &hull.position_, 1) || !ReadPod(pos, end, &numPoints, 1) || numPoints == 0 ||
+            (size_t)(end - pos) / sizeof(float3) < numPoints)
+            return false;
+        points.resize(numPoints);
+        ReadPod(pos, end, &points[0], numPoints);
+#include "DisableMemoryLeakCheck.h"
+        hull.hull_ = MAKE_SHARED(btConvexHullShape, &points[0].x, (int)numPoints, (int)sizeof(float3));
+#include "EnableMemoryLeakCheck.h"
+        hullSet->hulls_.push_back(hull);
+    }
+    if (pos != end)
+        return false;
+    shape.convexHullSet = hullSet;
+    return true;
+}
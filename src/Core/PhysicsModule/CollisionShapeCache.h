@@ -0,0 +1,140 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "PhysicsModuleFwd.h"
+#include "AssetFwd.h"
+#include "Math/float3.h"
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QList>
+#include <QPointer>
+#include <QFuture>
+#include <QFutureWatcher>
+
+#include <vector>
+
+class OgreMeshAsset;
+class btOptimizedBvh;
+
+/// Cooks the collision shapes of mesh assets in the background, and keeps them in memory while used and in the asset cache.
+/** The cooked shapes are keyed by a hash of the source data of the mesh asset, so a mesh is cooked only once for all the rigid
+    bodies using it, even under different asset refs, and the cooked data stored in the asset cache is reused on the next run
+    as long as the mesh data has not changed. A cached shape is loaded without reading the geometry of the Ogre mesh at all.
+    The shapes in memory are held weakly, so a shape is dropped when the last body using it releases it.
+
+    Cooking a triangle mesh builds its quantized BVH, which is then shared by the bodies instead of each building its own.
+    Cooking a convex hull set runs the hull decomposition. The worker threads of the global thread pool are used.
+
+    Owned by PhysicsModule, see PhysicsModule::CollisionShapes. Used from the main thread only. */
+class CollisionShapeCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CollisionShapeCache(AssetAPI *assetAPI);
+    /// Waits for the cooking in progress to finish.
+    ~CollisionShapeCache();
+
+    /// A cooked collision shape.
+    struct CookedShape
+    {
+        shared_ptr<btTriangleMesh> triangleMesh; ///< The triangles, for Shape_TriMesh.
+        shared_ptr<btOptimizedBvh> bvh; ///< The BVH of triangleMesh, for Shape_TriMesh.
+        shared_ptr<ConvexHullSet> convexHullSet; ///< The hulls, for Shape_ConvexHull.
+
+        bool IsEmpty() const { return !triangleMesh && !convexHullSet; }
+    };
+
+    /// Gets the cooked collision shape of a mesh asset, or starts cooking it.
+    /** @param asset The mesh asset. It must be loaded, as its geometry is read if the shape is not found in the asset cache.
+        @param shapeType EC_RigidBody::Shape_TriMesh or EC_RigidBody::Shape_ConvexHull.
+        @param body The rigid body to notify with EC_RigidBody::OnCollisionShapeCooked when the shape has been cooked, if it is not yet.
+        @param shape [out] Receives the shape if it is already cooked. It is empty if the mesh has no geometry to cook,
+            or if cooking it has failed.
+        @return True if the shape was already cooked or failed to cook, false if cooking was started or joined. */
+    bool Shape(OgreMeshAsset *asset, int shapeType, EC_RigidBody *body, CookedShape &shape);
+
+private slots:
+    /// Finishes a cooking job when its background work is done.
+    void OnJobFinished();
+
+    /// Forgets the source data hash and the cooking failures of an unloaded asset, as it may be reloaded from different data.
+    void OnAssetUnloaded(IAsset *asset);
+
+private:
+    /// @cond PRIVATE
+    /// The cooking of one shape of a mesh asset. The worker reads the input members and writes the output members,
+    /// so they are not touched on the main thread while the future is running.
+    struct Job
+    {
+        Job() : shapeType(0), hash(0), hashed(false), cacheChecked(false), stale(false), watcher(0) {}
+
+        // Input
+        QString assetRef;
+        int shapeType;
+        QString sourceFile; ///< The disk source of the asset to hash, or empty to hash the triangles instead.
+        QString cacheDirectory; ///< Empty if there is no asset cache.
+        std::vector<float3> triangles; ///< The geometry of the mesh, three vertices per triangle. Extracted only if needed.
+
+        // Output
+        u64 hash;
+        bool hashed;
+        bool cacheChecked;
+        CookedShape shape;
+        std::vector<u8> cacheData; ///< The serialized shape to store to the asset cache.
+
+        // Main thread only
+        bool stale; ///< The asset has been unloaded while the job was running.
+        QList<QPointer<EC_RigidBody> > bodies; ///< The bodies waiting for the shape.
+        QFuture<void> future;
+        QFutureWatcher<void> *watcher; ///< Owned by CollisionShapeCache, as it is deleted later than the job.
+    };
+    /// @endcond
+
+    /// Runs the background work of a job. Called in a worker thread.
+    static void Cook(Job *job);
+
+    /// Starts the background work of a job.
+    void Start(Job *job);
+
+    /// Notifies the bodies waiting for the shape of a job.
+    void Deliver(Job *job);
+
+    /// Returns the asset cache ref under which a cooked shape is stored.
+    static QString CookedShapeRef(u64 hash, int shapeType);
+
+    /// Serializes a cooked shape, prefixed with the hash of the source data. Note: Not endian safe.
+    /** @param triangles The triangles the shape was cooked of. Stored for a triangle mesh. */
+    static void Serialize(const std::vector<float3> &triangles, const CookedShape &shape, int shapeType, u64 hash, std::vector<u8> &dst);
+
+    /// Deserializes a cooked shape, validating its header and size. @return False if the data is not a valid shape cooked from the same source data.
+    static bool Deserialize(const std::vector<u8> &data, int shapeType, u64 hash, CookedShape &shape);
+
+    /// A cooked shape held weakly by the cache.
+    struct CachedShape
+    {
+        weak_ptr<btTriangleMesh> triangleMesh;
+        weak_ptr<btOptimizedBvh> bvh;
+        weak_ptr<ConvexHullSet> convexHullSet;
+    };
+
+    /// Gets a cooked shape from the memory cache. @return False if the shape is not cached or no longer used by anyone.
+    bool CachedShapeFor(u64 hash, int shapeType, CookedShape &shape);
+
+    /// Adds a cooked shape to the memory cache, and drops the shapes no longer used by anyone.
+    void CacheShape(u64 hash, int shapeType, const CookedShape &shape);
+
+    typedef QPair<u64, int> ShapeKey;
+    QHash<ShapeKey, CachedShape> shapes_; ///< The cooked shapes by the hash of their source data and the shape type.
+    typedef QPair<QString, int> AssetShapeKey;
+    QSet<AssetShapeKey> failedShapes_; ///< The loaded assets and shape types whose shape could not be cooked, so that it is not tried again for every body.
+    QHash<QString, u64> sourceHashes_; ///< The source data hashes of the loaded assets whose shapes have been cooked.
+    QList<Job*> jobs_; ///< The jobs in progress.
+    AssetAPI *assetAPI_;
+};
@@ -11,6 +11,9 @@
 
 #include <Ogre.h>
 
+#include <QMutex>
+#include <QMutexLocker>
+
 // Disable unreferenced formal parameter coming from Bullet
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -23,6 +26,14 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+/// The hull library keeps its scratch data in static variables, so only one hull can be generated at a time.
+QMutex hullMutex;
+
+} // ~unnamed namespace
+
 namespace Physics
 {
 
@@ -30,8 +41,14 @@ void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr)
 {
     std::vector<float3> triangles;
     GetTrianglesFromMesh(mesh, triangles);
-    
-    for(uint i = 0; i < triangles.size(); i += 3)
+    GenerateTriangleMesh(triangles, ptr);
+}
+
+void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr)
+{
+    ptr->preallocateVertices((int)triangles.size());
+    ptr->preallocateIndices((int)triangles.size());
+    for(uint i = 0; i + 2 < triangles.size(); i += 3)
         ptr->addTriangle(triangles[i], triangles[i+1], triangles[i+2]);
 }
 
@@ -45,6 +62,15 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
         return;
     }
     
+    if (!GenerateConvexHullSet(vertices, ptr))
+        LogError("No vertices were generated; aborting convex hull generation");
+}
+
+bool GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr)
+{
+    if (!vertices.size())
+        return false;
+
     StanHull::HullDesc desc;
     desc.SetHullFlag(StanHull::QF_TRIANGLES);
     desc.mVcount = (uint)vertices.size();
@@ -52,15 +78,14 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     desc.mVertexStride = sizeof(float3);
     desc.mSkinWidth = 0.01f; // Hardcoded skin width
     
+    QMutexLocker lock(&hullMutex);
+
     StanHull::HullLibrary lib;
     StanHull::HullResult result;
     lib.CreateConvexHull(desc, result);
 
     if (!result.mNumOutputVertices)
-    {
-        LogError("No vertices were generated; aborting convex hull generation");
-        return;
-    }
+        return false;
     
     ConvexHull hull;
     hull.position_ = float3(0,0,0);
@@ -71,6 +96,7 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     ptr->hulls_.push_back(hull);
     
     lib.ReleaseResult(result);
+    return true;
 }
 
 void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest)
@@ -14,4 +14,10 @@ namespace Physics
     void PHYSICS_MODULE_API GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr);
     void PHYSICS_MODULE_API GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest);
     void PHYSICS_MODULE_API GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr);
+
+    /// Fills a Bullet triangle mesh from a triangle list of three vertices per triangle. Can be called from any thread.
+    void PHYSICS_MODULE_API GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr);
+    /// Generates a convex hull set from a triangle list of three vertices per triangle. Can be called from any thread.
+    /** @return False if no hull could be generated. */
+    bool PHYSICS_MODULE_API GenerateConvexHullSet(const std::vector<float3>& triangles, ConvexHullSet* ptr);
 }
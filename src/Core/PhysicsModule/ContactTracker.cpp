@@ -0,0 +1,198 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ContactTracker.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const size_t cMinCapacity = 64;
+
+} // ~unnamed namespace
+
+ContactTracker::ContactTracker() :
+    numPairs_(0),
+    tick_(0)
+{
+    Rehash(cMinCapacity);
+}
+
+size_t ContactTracker::Hash(const btCollisionObject *lo, const btCollisionObject *hi)
+{
+    // The objects are aligned, so the low bits of the addresses carry no information.
+    u32 h = (u32)((size_t)lo >> 4) * 0x9E3779B1u ^ (u32)((size_t)hi >> 4) * 0x85EBCA77u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+size_t ContactTracker::Find(const btCollisionObject *lo, const btCollisionObject *hi) const
+{
+    const size_t mask = slots_.size() - 1;
+    size_t i = Hash(lo, hi) & mask;
+    while(slots_[i].lo && (slots_[i].lo != lo || slots_[i].hi != hi))
+        i = (i + 1) & mask;
+    return i;
+}
+
+void ContactTracker::Erase(size_t slot)
+{
+    const size_t mask = slots_.size() - 1;
+    size_t i = slot;
+    size_t j = slot;
+    for(;;)
+    {
+        j = (j + 1) & mask;
+        if (!slots_[j].lo)
+            break;
+        // Move the pair back to the hole, unless its home slot is cyclically between the hole and its current slot.
+        size_t home = Hash(slots_[j].lo, slots_[j].hi) & mask;
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+        {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i].lo = 0;
+    slots_[i].hi = 0;
+    --numPairs_;
+}
+
+void ContactTracker::Rehash(size_t capacity)
+{
+    std::vector<Slot> old;
+    old.swap(slots_);
+    Slot empty = { 0, 0, 0, -1 };
+    slots_.assign(capacity, empty);
+    for(size_t i = 0; i < old.size(); ++i)
+        if (old[i].lo)
+            slots_[Find(old[i].lo, old[i].hi)] = old[i];
+}
+
+void ContactTracker::BeginTick()
+{
+    ++tick_;
+}
+
+int ContactTracker::Touch(const btCollisionObject *objectA, const btCollisionObject *objectB, bool report)
+{
+    const btCollisionObject *lo = objectA < objectB ? objectA : objectB;
+    const btCollisionObject *hi = objectA < objectB ? objectB : objectA;
+
+    if ((numPairs_ + 1) * 2 > slots_.size())
+        Rehash(slots_.size() * 2);
+
+    Slot &slot = slots_[Find(lo, hi)];
+    bool entered = false;
+    if (!slot.lo)
+    {
+        // A pair that has not been reported touching can not stay touching either.
+        if (!report)
+            return -1;
+        slot.lo = lo;
+        slot.hi = hi;
+        slot.event = -1;
+        ++numPairs_;
+        entered = true;
+    }
+    else if (slot.stamp == tick_)
+        return slot.event; // Another manifold of the pair
+    else if (!removed_.isEmpty() && (removed_.contains(lo) || removed_.contains(hi)))
+        entered = true; // A new object has been allocated at the address of a removed one.
+
+    slot.stamp = tick_;
+    slot.event = -1;
+    if (!report)
+        return -1;
+
+    Event e;
+    e.objectA = objectA;
+    e.objectB = objectB;
+    e.type = entered ? Enter : Stay;
+    e.numContacts = 0;
+    e.position = float3::zero;
+    e.normal = float3::zero;
+    e.distance = 0.f;
+    e.impulse = 0.f;
+    slot.event = (int)events_.size();
+    events_.push_back(e);
+    return slot.event;
+}
+
+bool ContactTracker::AddContact(int event, const float3 &position, const float3 &normal, float distance, float impulse)
+{
+    if (event < 0)
+        return false;
+
+    Event &e = events_[event];
+    const bool first = e.numContacts == 0;
+    if (first || distance < e.distance)
+    {
+        e.position = position;
+        e.normal = normal;
+        e.distance = distance;
+    }
+    e.impulse += impulse;
+    ++e.numContacts;
+    return first && e.type == Enter;
+}
+
+void ContactTracker::EndTick()
+{
+    stale_.clear();
+    for(size_t i = 0; i < slots_.size(); ++i)
+    {
+        const Slot &slot = slots_[i];
+        if (!slot.lo || slot.stamp == tick_)
+            continue;
+        stale_.push_back(std::make_pair(slot.lo, slot.hi));
+        // The pairs of removed objects are dropped silently, as the objects may no longer exist.
+        if (!removed_.isEmpty() && (removed_.contains(slot.lo) || removed_.contains(slot.hi)))
+            continue;
+
+        Event e;
+        e.objectA = slot.lo;
+        e.objectB = slot.hi;
+        e.type = Leave;
+        e.numContacts = 0;
+        e.position = float3::zero;
+        e.normal = float3::zero;
+        e.distance = 0.f;
+        e.impulse = 0.f;
+        events_.push_back(e);
+    }
+    removed_.clear();
+
+    for(size_t i = 0; i < stale_.size(); ++i)
+        Erase(Find(stale_[i].first, stale_[i].second));
+
+    // Shrink after a burst of contacts, to not scan a mostly empty table on every substep.
+    if (slots_.size() > cMinCapacity && numPairs_ * 8 < slots_.size())
+        Rehash(slots_.size() / 2);
+}
+
+void ContactTracker::Remove(const btCollisionObject *object)
+{
+    if (numPairs_ > 0)
+        removed_.insert(object);
+}
+
+void ContactTracker::Clear()
+{
+    Slot empty = { 0, 0, 0, -1 };
+    slots_.assign(cMinCapacity, empty);
+    numPairs_ = 0;
+    events_.clear();
+    removed_.clear();
+}
+
+std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > ContactTracker::Pairs() const
+{
+    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > pairs;
+    for(size_t i = 0; i < slots_.size(); ++i)
+        if (slots_[i].lo)
+            pairs.insert(std::make_pair(slots_[i].lo, slots_[i].hi));
+    return pairs;
+}
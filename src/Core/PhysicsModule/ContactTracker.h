@@ -0,0 +1,109 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "PhysicsModuleFwd.h"
+#include "Math/float3.h"
+
+#include <QSet>
+
+#include <vector>
+#include <set>
+#include <utility>
+
+/// Tracks the pairs of collision objects in contact over the simulation substeps, for the collision signals of PhysicsWorld.
+/** The pairs are kept in a flat open addressing hash table keyed on the two objects, and stamped with the substep they were
+    last touched on. On each substep, BeginTick starts a new stamp, Touch is called for each contact manifold, and EndTick
+    reports the pairs that were not touched as having left contact and forgets them. A pair with several manifolds, e.g. of a
+    compound shape, has one event per substep, aggregated over all its contact points.
+
+    The table and the event buffer are reused, so nothing is allocated once they have grown to the number of contacts in
+    the scene. Used by the thread that steps the world, see PhysicsWorld::SetAsynchronous. */
+class ContactTracker
+{
+public:
+    ContactTracker();
+
+    enum EventType
+    {
+        Enter, ///< The pair started touching on the substep.
+        Stay, ///< The pair was already touching on the previous substep.
+        Leave ///< The pair stopped touching on the substep. Has no contact points.
+    };
+
+    /// The contact of a pair of objects on a substep.
+    struct Event
+    {
+        const btCollisionObject *objectA;
+        const btCollisionObject *objectB;
+        EventType type;
+        int numContacts;
+        float3 position; ///< World position of the deepest contact point.
+        float3 normal; ///< World normal of the deepest contact point, on objectB pointing towards objectA.
+        float distance; ///< Distance of the deepest contact point, negative when penetrating.
+        float impulse; ///< Sum of the impulses applied at the contact points.
+    };
+
+    /// Starts a new substep.
+    void BeginTick();
+
+    /// Marks a pair as touching on the current substep. Called for each contact manifold with contact points.
+    /** @param report False to only keep the pair touching without an event, e.g. when both objects are sleeping.
+        @return Index of the event of the pair in Events(), or -1 if none. */
+    int Touch(const btCollisionObject *objectA, const btCollisionObject *objectB, bool report);
+
+    /// Adds a contact point to an event returned by Touch.
+    /** @return True for the first contact point of a pair that started touching. */
+    bool AddContact(int event, const float3 &position, const float3 &normal, float distance, float impulse);
+
+    /// Ends the substep, adding the Leave events of the pairs not touched on it.
+    void EndTick();
+
+    /// Forgets the pairs of an object that is removed from the world, without Leave events. Takes effect on the next EndTick.
+    void Remove(const btCollisionObject *object);
+
+    /// Forgets all the pairs and events.
+    void Clear();
+
+    /// Returns the events of the substeps since the last ClearEvents, in the order of the substeps.
+    const std::vector<Event> &Events() const { return events_; }
+
+    /// Clears the events, keeping the capacity.
+    void ClearEvents() { events_.clear(); }
+
+    /// Returns the number of pairs touching.
+    size_t NumPairs() const { return numPairs_; }
+
+    /// Returns the pairs touching, the object with the lower address first.
+    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > Pairs() const;
+
+private:
+    /// @cond PRIVATE
+    struct Slot
+    {
+        const btCollisionObject *lo; ///< Null for an empty slot.
+        const btCollisionObject *hi;
+        u32 stamp; ///< The substep the pair was last touched on.
+        int event; ///< The event of the pair on the substep it was last touched on, or -1.
+    };
+    /// @endcond
+
+    static size_t Hash(const btCollisionObject *lo, const btCollisionObject *hi);
+
+    /// Returns the slot of a pair, or the empty slot where it would be inserted.
+    size_t Find(const btCollisionObject *lo, const btCollisionObject *hi) const;
+
+    /// Empties a slot, moving the following slots of the probe sequence back.
+    void Erase(size_t slot);
+
+    /// Reallocates the table with a capacity, reinserting the pairs.
+    void Rehash(size_t capacity);
+
+    std::vector<Slot> slots_; ///< Capacity is a power of two, and at most half of the slots are used.
+    size_t numPairs_;
+    u32 tick_;
+    std::vector<Event> events_;
+    std::vector<std::pair<const btCollisionObject*, const btCollisionObject*> > stale_; ///< Reused by EndTick.
+    QSet<const btCollisionObject*> removed_; ///< The objects removed since the last EndTick.
+};
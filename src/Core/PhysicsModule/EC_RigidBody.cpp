@@ -10,6 +10,7 @@
 #include "PhysicsModule.h"
 #include "PhysicsUtils.h"
 #include "PhysicsWorld.h"
+#include "CollisionShapeCache.h"
 
 #include "Profiler.h"
 #include "OgreMeshAsset.h"
@@ -27,8 +28,10 @@
 #include <LinearMath/btMotionState.h>
 #include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+#include <LinearMath/btAabbUtil2.h>
 #include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <set>
+#include <algorithm>
 
 #include <OgreSceneNode.h>
 
@@ -38,6 +41,16 @@ static const float cForceThresholdSq = 0.0005f * 0.0005f;
 static const float cImpulseThresholdSq = 0.0005f * 0.0005f;
 static const float cTorqueThresholdSq = 0.0005f * 0.0005f;
 
+/// Wakes up the collision objects whose bounding boxes overlap the queried region.
+struct WakeUpObjectsCallback : public btBroadphaseAabbCallback
+{
+    virtual bool process(const btBroadphaseProxy *proxy)
+    {
+        static_cast<btCollisionObject*>(proxy->m_clientObject)->activate();
+        return true;
+    }
+};
+
 struct EC_RigidBody::Impl : public btMotionState
 {
     Impl(EC_RigidBody *rb) :
@@ -46,6 +59,8 @@ struct EC_RigidBody::Impl : public btMotionState
         shape(0),
         childShape(0),
         heightField(0),
+        heightFieldMin(0.f),
+        heightFieldMax(0.f),
         disconnected(false),
         cachedShapeType(-1),
         cachedSize(float3::zero),
@@ -57,6 +72,13 @@ struct EC_RigidBody::Impl : public btMotionState
     /// btMotionState override. Called when Bullet wants us to tell the body's initial transform
     void getWorldTransform(btTransform &worldTrans) const
     {
+        // The placeable must not be read by the stepping thread. The body has its transform already, see PlaceableUpdated.
+        if (body && world && world->IsStepping())
+        {
+            worldTrans = body->getWorldTransform();
+            return;
+        }
+
         if (placeable.expired())
             return;
 
@@ -70,6 +92,10 @@ struct EC_RigidBody::Impl : public btMotionState
     /// btMotionState override. Called when Bullet wants to tell us the body's current transform
     void setWorldTransform(const btTransform &worldTrans)
     {
+        // When stepping asynchronously, the transform is applied at the sync point, see PhysicsWorld::SetAsynchronous.
+        if (body && world && world->BufferTransform(body, worldTrans))
+            return;
+
         /// \todo For a large scene, applying the changed transforms of rigid bodies is slow (slower than the physics simulation itself,
         /// or handling collisions) due to the large number of Qt signals being fired.
     
@@ -134,6 +160,13 @@ struct EC_RigidBody::Impl : public btMotionState
         disconnected = false;
     }
 
+    /// Waits for the asynchronous step of the physics world to finish before the body is accessed.
+    void WaitForStep() const
+    {
+        if (world)
+            world->WaitForStep();
+    }
+
     /// Calculate mass, shape & static/dynamic-classification dependant properties
     void GetProperties(btVector3& localInertia, float& m, int& collisionFlags)
     {
@@ -192,12 +225,19 @@ struct EC_RigidBody::Impl : public btMotionState
     float3 cachedSize;
     /// Bullet triangle mesh
     shared_ptr<btTriangleMesh> triangleMesh;
+    /// BVH of the triangle mesh, shared with the other bodies of the same mesh. Null if the shape builds its own BVH.
+    shared_ptr<btOptimizedBvh> triangleBvh;
+    /// The collision mesh whose shape is being cooked for this body, see CollisionShapeCache.
+    QString cookingMeshRef;
     /// Convex hull set
     shared_ptr<ConvexHullSet> convexHullSet;
     /// Bullet heightfield shape. Note: this is always put inside a compound shape (impl->shape)
     btHeightfieldTerrainShape* heightField;
-    /// Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues;
+    /// The height values of the terrain the heightfield refers to. Kept alive while the heightfield exists, even if the terrain reallocates its heights.
+    shared_ptr<const std::vector<float> > heightValues;
+    /// The height range the heightfield has been created with. The heightfield is centered on it.
+    float heightFieldMin;
+    float heightFieldMax;
 };
 
 EC_RigidBody::EC_RigidBody(Scene* scene) :
@@ -371,6 +411,7 @@ void EC_RigidBody::Activate()
     if (!HasAuthority())
         return;
     
+    impl->WaitForStep();
     if (!impl->body)
         CreateBody();
     if (impl->body)
@@ -379,12 +420,14 @@ void EC_RigidBody::Activate()
 
 void EC_RigidBody::KeepActive()
 {
+    impl->WaitForStep();
     if (impl->body)
         impl->body->activate(true);
 }
 
 bool EC_RigidBody::IsActive()
 {
+    impl->WaitForStep();
     if (impl->body)
         return impl->body->isActive();
     else
@@ -397,6 +440,7 @@ void EC_RigidBody::ResetForces()
     if (!HasAuthority())
         return;
     
+    impl->WaitForStep();
     if (!impl->body)
         CreateBody();
     if (impl->body)
@@ -440,6 +484,8 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         {
             impl->terrain = terrain;
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
+            connect(terrain.get(), SIGNAL(HeightsAboutToChange()), this, SLOT(OnTerrainHeightsAboutToChange()), Qt::DirectConnection);
+            connect(terrain.get(), SIGNAL(HeightsChanged(uint, uint, uint, uint)), this, SLOT(OnTerrainHeightsChanged(uint, uint, uint, uint)));
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
     }
@@ -477,7 +523,14 @@ void EC_RigidBody::CreateCollisionShape()
         if (impl->triangleMesh)
         {
             // Need to first create a bvhTriangleMeshShape, then a scaled version of it to allow for individual scaling.
-            impl->childShape = new btBvhTriangleMeshShape(impl->triangleMesh.get(), true, true);
+            if (impl->triangleBvh)
+            {
+                btBvhTriangleMeshShape *meshShape = new btBvhTriangleMeshShape(impl->triangleMesh.get(), true, false);
+                meshShape->setOptimizedBvh(impl->triangleBvh.get());
+                impl->childShape = meshShape;
+            }
+            else
+                impl->childShape = new btBvhTriangleMeshShape(impl->triangleMesh.get(), true, true);
             impl->shape = new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape*>(impl->childShape), btVector3(1.0f, 1.0f, 1.0f));
         }
         break;
@@ -500,6 +553,7 @@ void EC_RigidBody::CreateCollisionShape()
 
 void EC_RigidBody::RemoveCollisionShape()
 {
+    impl->WaitForStep();
     if (impl->shape)
     {
         if (impl->body)
@@ -508,6 +562,7 @@ void EC_RigidBody::RemoveCollisionShape()
     }
     SAFE_DELETE(impl->childShape);
     SAFE_DELETE(impl->heightField);
+    impl->heightValues.reset();
 }
 
 void EC_RigidBody::CreateBody()
@@ -568,6 +623,7 @@ void EC_RigidBody::RemoveBody()
     if (impl->body && impl->world)
     {
         impl->world->BulletWorld()->removeRigidBody(impl->body);
+        impl->world->DiscardStepResults(impl->body);
         SAFE_DELETE(impl->body);
     }
 }
@@ -579,40 +635,114 @@ void EC_RigidBody::SetClientExtrapolating(bool isClientExtrapolating)
 
 btRigidBody* EC_RigidBody::BulletRigidBody() const
 {
+    impl->WaitForStep();
     return impl->body;
 }
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+
+    // The heightfield refers to the height values of the terrain, so it only needs to be recreated if the terrain
+    // has allocated new ones, i.e. has been resized or reloaded. Edits in place are handled by OnTerrainHeightsChanged.
+    EC_Terrain *terrain = impl->terrain.lock().get();
+    if (terrain && impl->heightField && terrain->Heights() == impl->heightValues)
+        return;
+    CreateCollisionShape();
+}
+
+void EC_RigidBody::OnTerrainHeightsAboutToChange()
+{
+    // The step reads the height values directly, so they must not be edited while it is running.
+    if (impl->heightField)
+        impl->WaitForStep();
+}
+
+void EC_RigidBody::OnTerrainHeightsChanged(uint firstPatchX, uint firstPatchY, uint lastPatchX, uint lastPatchY)
+{
+    EC_Terrain *terrain = impl->terrain.lock().get();
+    if (shapeType.Get() != Shape_HeightField || !terrain || !impl->heightField || terrain->Heights() != impl->heightValues)
+        return; // The heightfield is (re)created on TerrainRegenerated.
+
+    // The heightfield sees the new height values already. It only needs to be recreated if they do not fit in its height range.
+    float minY, maxY;
+    terrain->GetTerrainHeightRange(minY, maxY);
+    if (minY < impl->heightFieldMin || maxY > impl->heightFieldMax)
+    {
         CreateCollisionShape();
+        return;
+    }
+
+    if (!impl->body || !impl->world)
+        return;
+
+    // Wake up the objects on the changed patches, so that the sleeping ones react to the new surface. The triangles touching
+    // the edge vertices of the patches have changed as well. The heightfield is centered on its extents, see btHeightfieldTerrainShape.
+    const int width = (int)terrain->VerticesWidth();
+    const int height = (int)terrain->VerticesHeight();
+    const int minX = std::max(0, (int)(firstPatchX * EC_Terrain::cPatchSize) - 1);
+    const int minZ = std::max(0, (int)(firstPatchY * EC_Terrain::cPatchSize) - 1);
+    const int maxX = std::min(width - 1, (int)((lastPatchX + 1) * EC_Terrain::cPatchSize));
+    const int maxZ = std::min(height - 1, (int)((lastPatchY + 1) * EC_Terrain::cPatchSize));
+    const float midY = (impl->heightFieldMin + impl->heightFieldMax) * 0.5f;
+    const btVector3 scale = impl->heightField->getLocalScaling();
+    btVector3 localMin = btVector3(minX - (width - 1) * 0.5f, impl->heightFieldMin - midY, minZ - (height - 1) * 0.5f) * scale;
+    btVector3 localMax = btVector3(maxX - (width - 1) * 0.5f, impl->heightFieldMax - midY, maxZ - (height - 1) * 0.5f) * scale;
+    // The scale may be negative.
+    btVector3 regionMin = localMin;
+    regionMin.setMin(localMax);
+    localMax.setMax(localMin);
+    localMin = regionMin;
+
+    impl->WaitForStep();
+    btCompoundShape *compound = static_cast<btCompoundShape*>(impl->shape);
+    btTransform transform = impl->body->getWorldTransform() * compound->getChildTransform(0);
+    btVector3 worldMin, worldMax;
+    btTransformAabb(localMin, localMax, impl->heightField->getMargin(), transform, worldMin, worldMax);
+    WakeUpObjectsCallback wakeUp;
+    impl->world->BulletWorld()->getBroadphase()->aabbTest(worldMin, worldMax, wakeUp);
 }
 
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
     if (!meshAsset || !meshAsset->ogreMesh.get())
+    {
         LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
             asset->Name() + "\", but Ogre::Mesh pointer was null!");
+        return;
+    }
 
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
-
-    if (mesh)
+    const int type = shapeType.Get();
+    if (type == Shape_TriMesh || type == Shape_ConvexHull)
     {
-        if (shapeType.Get() == Shape_TriMesh)
-        {
-            impl->triangleMesh = impl->owner->GetTriangleMeshFromOgreMesh(mesh);
-            CreateCollisionShape();
-        }
-        if (shapeType.Get() == Shape_ConvexHull)
+        // The shape is cooked in the background, unless it has been cooked already. Keep the old shape meanwhile.
+        CollisionShapeCache::CookedShape shape;
+        impl->cookingMeshRef.clear();
+        if (impl->owner->CollisionShapes()->Shape(meshAsset, type, this, shape))
         {
-            impl->convexHullSet = impl->owner->GetConvexHullSetFromOgreMesh(mesh);
+            impl->triangleMesh = shape.triangleMesh;
+            impl->triangleBvh = shape.bvh;
+            impl->convexHullSet = shape.convexHullSet;
             CreateCollisionShape();
         }
-
-        impl->cachedShapeType = shapeType.Get();
-        impl->cachedSize = size.Get();
+        else
+            impl->cookingMeshRef = meshAsset->Name();
     }
+
+    impl->cachedShapeType = type;
+    impl->cachedSize = size.Get();
+}
+
+void EC_RigidBody::OnCollisionShapeCooked(const QString &assetRef, int cookedShapeType)
+{
+    if (assetRef != impl->cookingMeshRef || cookedShapeType != shapeType.Get())
+        return;
+
+    AssetPtr asset = GetFramework()->Asset()->GetAsset(assetRef);
+    if (asset && asset->IsLoaded())
+        OnCollisionMeshAssetLoaded(asset);
 }
 
 void EC_RigidBody::AttributesChanged()
@@ -620,6 +750,7 @@ void EC_RigidBody::AttributesChanged()
     if (impl->disconnected)
         return;
     
+    impl->WaitForStep();
     // Create body now if does not exist yet
     if (!impl->body)
         CreateBody();
@@ -730,6 +861,7 @@ void EC_RigidBody::PlaceableUpdated(IAttribute* attribute)
         // Important: when changing both transform and parent, always set parentref first, then transform
         // Otherwise the physics simulation may interpret things wrong and the object ends up
         // in an unintended location
+        impl->WaitForStep();
         UpdatePosRotFromPlaceable();
         UpdateScale();
 
@@ -767,6 +899,8 @@ void EC_RigidBody::SetRotation(const float3& rotation)
         
         if (impl->body)
         {
+            impl->WaitForStep();
+            impl->world->DiscardTransform(impl->body);
             btTransform& worldTrans = impl->body->getWorldTransform();
             btTransform interpTrans = impl->body->getInterpolationWorldTransform();
             worldTrans.setRotation(trans.Orientation());
@@ -795,6 +929,8 @@ void EC_RigidBody::Rotate(const float3& rotation)
         
         if (impl->body)
         {
+            impl->WaitForStep();
+            impl->world->DiscardTransform(impl->body);
             btTransform& worldTrans = impl->body->getWorldTransform();
             btTransform interpTrans = impl->body->getInterpolationWorldTransform();
             worldTrans.setRotation(trans.Orientation());
@@ -813,6 +949,7 @@ PhysicsWorld* EC_RigidBody::World() const
 
 float3 EC_RigidBody::GetLinearVelocity()
 {
+    impl->WaitForStep();
     if (impl->body)
         return impl->body->getLinearVelocity();
     else 
@@ -821,6 +958,7 @@ float3 EC_RigidBody::GetLinearVelocity()
 
 float3 EC_RigidBody::GetAngularVelocity()
 {
+    impl->WaitForStep();
     if (impl->body)
         return RadToDeg(impl->body->getAngularVelocity());
     else
@@ -830,6 +968,7 @@ float3 EC_RigidBody::GetAngularVelocity()
 void EC_RigidBody::GetAabbox(float3 &outAabbMin, float3 &outAabbMax)
 {
     btVector3 aabbMin, aabbMax;
+    impl->WaitForStep();
     impl->body->getAabb(aabbMin, aabbMax);
     outAabbMin.Set(aabbMin.x(), aabbMin.y(), aabbMin.z());
     outAabbMax.Set(aabbMax.x(), aabbMax.y(), aabbMax.z());
@@ -846,6 +985,7 @@ bool EC_RigidBody::HasAuthority() const
 AABB EC_RigidBody::ShapeAABB() const
 {
     btVector3 aabbMin, aabbMax;
+    impl->WaitForStep();
     impl->body->getAabb(aabbMin, aabbMax);
     return AABB(aabbMin, aabbMax);
 }
@@ -874,7 +1014,7 @@ void EC_RigidBody::TerrainUpdated(IAttribute* attribute)
     EC_Terrain* terrain = impl->terrain.lock().get();
     if (!terrain)
         return;
-    /// \todo It is suboptimal to regenerate the whole heightfield when just the terrain's transform changes
+    // Recreating the heightfield is cheap, as it refers to the height values of the terrain instead of copying them.
     if (attribute == &terrain->nodeTransformation && shapeType.Get() == Shape_HeightField)
         CreateCollisionShape();
 }
@@ -892,6 +1032,9 @@ void EC_RigidBody::RequestMesh()
         collisionMesh = mesh->meshRef.Get().ref.trimmed();
     }
 
+    // A shape still being cooked of the previous mesh is no longer wanted.
+    impl->cookingMeshRef.clear();
+
     if (!collisionMesh.isEmpty())
     {
         // Do not create shape right now, but request the mesh resource
@@ -918,6 +1061,7 @@ void EC_RigidBody::UpdateScale()
     EC_Placeable* placeable = impl->placeable.lock().get();
     if (placeable && impl->shape)
     {
+        impl->WaitForStep();
         // Note: for now, world scale is purposefully NOT used, because it would be problematic to change the scale when a parenting change occurs
         const float3& scale = placeable->transform.Get().scale;
         // Trianglemesh or convexhull does not have scaling of its own in the shape, so multiply with the size
@@ -933,6 +1077,7 @@ void EC_RigidBody::UpdateGravity()
     if (!impl->body || !impl->world)
         return;
     
+    impl->WaitForStep();
     int flags = impl->body->getFlags();
     if (useGravity.Get())
     {
@@ -956,34 +1101,28 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     if (!terrain)
         return;
     
-    uint width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    uint height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
-    if (!width || !height)
+    uint width = terrain->VerticesWidth();
+    uint height = terrain->VerticesHeight();
+    shared_ptr<const std::vector<float> > heights = terrain->Heights();
+    if (!width || !height || !heights || heights->size() < width * height)
         return;
     
-    impl->heightValues.resize(width * height);
+    // The heightfield refers to the height values of the terrain directly. The height range is taken from the cached ranges of the terrain patches.
+    impl->heightValues = heights;
     
     float xzSpacing = 1.0f;
     float ySpacing = 1.0f;
-    float minY = 1000000000;
-    float maxY = -1000000000;
-    for(uint z = 0; z < height; ++z)
-        for(uint x = 0; x < width; ++x)
-        {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            impl->heightValues[z * width + x] = value;
-        }
+    float minY, maxY;
+    terrain->GetTerrainHeightRange(minY, maxY);
+    impl->heightFieldMin = minY;
+    impl->heightFieldMax = maxY;
 
     float3 scale = terrain->nodeTransformation.Get().scale;
     float3 bbMin(0, minY, 0);
     float3 bbMax(xzSpacing * (width - 1), maxY, xzSpacing * (height - 1));
     float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
     
-    impl->heightField = new btHeightfieldTerrainShape(width, height, &impl->heightValues[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
+    impl->heightField = new btHeightfieldTerrainShape(width, height, &(*heights)[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
     
     /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
         the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
@@ -1029,6 +1168,8 @@ void EC_RigidBody::UpdatePosRotFromPlaceable()
     if (!placeable || !impl->body)
         return;
     
+    impl->WaitForStep();
+    impl->world->DiscardTransform(impl->body);
     float3 position = placeable->WorldPosition();
     Quat orientation = placeable->WorldOrientation();
 
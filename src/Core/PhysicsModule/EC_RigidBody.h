@@ -102,6 +102,7 @@ class PHYSICS_MODULE_API EC_RigidBody : public IComponent
     Q_ENUMS(ShapeType)
 
     friend class PhysicsWorld;
+    friend class CollisionShapeCache;
 
 public:
     /// @cond PRIVATE
@@ -225,6 +226,22 @@ signals:
         If collision has multiple contact points, newCollision can only be true for the first of them. */
     void PhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
 
+    /// This rigid body started touching another entity.
+    /** Emitted once per touching pair after the simulation substep the contact started on, instead of for every contact point.
+        @param otherEntity The other entity
+        @param position World position of the deepest contact point
+        @param normal World normal of the deepest contact point, pointing from the other entity towards this one
+        @param impulse Sum of the impulses applied at the contact points */
+    void CollisionEnter(Entity* otherEntity, const float3& position, const float3& normal, float impulse);
+
+    /// This rigid body is still touching another entity. Emitted once per touching pair after each substep.
+    /** Not emitted while both bodies are sleeping. For the parameters, see CollisionEnter. */
+    void CollisionStay(Entity* otherEntity, const float3& position, const float3& normal, float impulse);
+
+    /// This rigid body stopped touching another entity.
+    /** Not emitted when either of the rigid bodies is removed from the physics world. */
+    void CollisionLeave(Entity* otherEntity);
+
 public slots:
     /// Set collision mesh from visible mesh. Also sets mass 0 (static) because trimeshes cannot move in Bullet
     /** @return true if successful (EC_Mesh could be found and contained a mesh reference) */
@@ -325,6 +342,12 @@ private slots:
     /// Called when EC_Terrain has been regenerated
     void OnTerrainRegenerated();
 
+    /// Called before the height values of EC_Terrain are edited
+    void OnTerrainHeightsAboutToChange();
+
+    /// Called when the height values of EC_Terrain have been edited
+    void OnTerrainHeightsChanged(uint firstPatchX, uint firstPatchY, uint lastPatchX, uint lastPatchY);
+
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
@@ -343,6 +366,9 @@ private:
     
     /// Create a convex hull set collisionshape
     void CreateConvexHullSetShape();
+
+    /// Called by CollisionShapeCache when the collision shape of a mesh has been cooked.
+    void OnCollisionShapeCooked(const QString &assetRef, int cookedShapeType);
     
     /// Create the body. No-op if the scene is not associated with a physics world.
     void CreateBody();
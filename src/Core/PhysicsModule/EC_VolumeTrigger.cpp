@@ -32,42 +32,45 @@ EC_VolumeTrigger::EC_VolumeTrigger(Scene* scene) :
 
 EC_VolumeTrigger::~EC_VolumeTrigger()
 {
+    PhysicsWorldPtr world = world_.lock();
+    if (world)
+    {
+        for(size_t i = 0; i < inside_.size(); ++i)
+            world->RemoveTriggerOccupant(this, inside_[i].entity);
+        for(size_t i = 0; i < outside_.size(); ++i)
+            world->RemoveTriggerOccupant(this, outside_[i].entity);
+    }
 }
 
 QList<EntityWeakPtr> EC_VolumeTrigger::GetEntitiesInside() const
 {
     QList<EntityWeakPtr> ret;
-    for(EntitiesWithinVolumeMap::const_iterator it = entities_.begin(); it != entities_.end(); ++it)
-        ret.push_back(it->first);
+    for(size_t i = 0; i < inside_.size(); ++i)
+        ret.push_back(inside_[i].weak);
     return ret;
 }
 
 size_t EC_VolumeTrigger::GetNumEntitiesInside() const
 {
-    return entities_.size();
+    return inside_.size();
 }
 
 Entity* EC_VolumeTrigger::GetEntityInside(int idx) const
 {
-    if (idx >=0 && (size_t)idx < entities_.size())
-    {
-        int currentIndex = 0;
-        for(EntitiesWithinVolumeMap::const_iterator it = entities_.begin(); it != entities_.end(); ++it)
-        {
-            if (currentIndex == idx)
-                return it->first.lock().get();
-            ++currentIndex;
-        }
-    }
+    if (idx >=0 && (size_t)idx < inside_.size())
+        return inside_[idx].weak.lock().get();
     return 0;
 }
 
 QStringList EC_VolumeTrigger::GetEntityNamesInside() const
 {
     QStringList entitynames;
-    for(EntitiesWithinVolumeMap::const_iterator it = entities_.begin(); it != entities_.end(); ++it)
-        if (!it->first.expired())
-            entitynames.append(it->first.lock()->Name());
+    for(size_t i = 0; i < inside_.size(); ++i)
+    {
+        EntityPtr entity = inside_[i].weak.lock();
+        if (entity)
+            entitynames.append(entity->Name());
+    }
     return entitynames;
 }
 
@@ -99,9 +102,12 @@ float EC_VolumeTrigger::GetEntityInsidePercent(const Entity *entity) const
 
 float EC_VolumeTrigger::GetEntityInsidePercentByName(const QString &name) const
 {
-    for(EntitiesWithinVolumeMap::const_iterator it = entities_.begin(); it != entities_.end(); ++it)
-        if (!it->first.expired() && it->first.lock()->Name().compare(name) == 0)
-            return GetEntityInsidePercent(it->first.lock().get());
+    for(size_t i = 0; i < inside_.size(); ++i)
+    {
+        EntityPtr entity = inside_[i].weak.lock();
+        if (entity && entity->Name().compare(name) == 0)
+            return GetEntityInsidePercent(entity.get());
+    }
     return 0.f;
 }
 
@@ -154,10 +160,28 @@ bool EC_VolumeTrigger::IsInsideVolume(const float3& point) const
 
 void EC_VolumeTrigger::AttributesChanged()
 {
-    /// \todo Attribute updates not handled yet, there are a bit too many problems of what signals to send after the update -cm
+    /// \todo Changes to the interesting entities are not handled yet, there are a bit too many problems of what signals to send after the update -cm
 
-    //if (mass.ValueChanged())
-    //    ReadBody();
+    if (byPivot.ValueChanged())
+    {
+        ConnectPhysicsUpdate();
+        // Without byPivot, all the entities touching the volume are inside it. With it, the pivots are checked on the next physics update.
+        if (!byPivot.Get() && !outside_.empty())
+        {
+            OccupantVector entered;
+            entered.swap(outside_);
+            inside_.insert(inside_.end(), entered.begin(), entered.end());
+            for(size_t i = 0; i < entered.size(); ++i)
+            {
+                EntityPtr entity = entered[i].weak.lock();
+                if (entity)
+                {
+                    emit EntityEnter(entity.get());
+                    emit entityEnter(entity.get());
+                }
+            }
+        }
+    }
 }
 
 void EC_VolumeTrigger::UpdateSignals()
@@ -167,11 +191,22 @@ void EC_VolumeTrigger::UpdateSignals()
         return;
     
     connect(parent, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(CheckForRigidBody()), Qt::UniqueConnection);
+    connect(parent, SIGNAL(ComponentRemoved(IComponent*, AttributeChange::Type)), this, SLOT(OnComponentRemoved(IComponent*)), Qt::UniqueConnection);
 
     Scene* scene = parent->ParentScene();
-    PhysicsWorld* world = scene->GetWorld<PhysicsWorld>().get();
-    if (world)
-        connect(world, SIGNAL(Updated(float)), this, SLOT(OnPhysicsUpdate()), Qt::UniqueConnection);
+    world_ = scene->GetWorld<PhysicsWorld>();
+    ConnectPhysicsUpdate();
+}
+
+void EC_VolumeTrigger::ConnectPhysicsUpdate()
+{
+    PhysicsWorldPtr world = world_.lock();
+    if (!world)
+        return;
+    if (byPivot.Get())
+        connect(world.get(), SIGNAL(Updated(float)), this, SLOT(OnPhysicsUpdate()), Qt::UniqueConnection);
+    else
+        disconnect(world.get(), SIGNAL(Updated(float)), this, SLOT(OnPhysicsUpdate()));
 }
 
 void EC_VolumeTrigger::CheckForRigidBody()
@@ -184,110 +219,206 @@ void EC_VolumeTrigger::CheckForRigidBody()
     {
         shared_ptr<EC_RigidBody> rigidbody = parent->GetComponent<EC_RigidBody>();
         if (rigidbody)
+            SetRigidBody(rigidbody);
+    }
+}
+
+void EC_VolumeTrigger::SetRigidBody(const shared_ptr<EC_RigidBody> &rigidbody)
+{
+    rigidbody_ = rigidbody;
+    connect(rigidbody.get(), SIGNAL(CollisionEnter(Entity*, const float3&, const float3&, float)),
+        this, SLOT(OnCollisionEnter(Entity*, const float3&, const float3&, float)), Qt::UniqueConnection);
+    connect(rigidbody.get(), SIGNAL(CollisionLeave(Entity*)), this, SLOT(OnCollisionLeave(Entity*)), Qt::UniqueConnection);
+}
+
+void EC_VolumeTrigger::OnComponentRemoved(IComponent *component)
+{
+    shared_ptr<EC_RigidBody> rigidbody = rigidbody_.lock();
+    if (!rigidbody || rigidbody.get() != component)
+        return;
+
+    disconnect(rigidbody.get(), 0, this, 0);
+    rigidbody_.reset();
+
+    // The removal of the rigid body ends its contacts without the leave signals, so all the occupants leave now.
+    OccupantVector left;
+    left.swap(inside_);
+    PhysicsWorldPtr world = world_.lock();
+    if (world)
+    {
+        for(size_t i = 0; i < left.size(); ++i)
+            world->RemoveTriggerOccupant(this, left[i].entity);
+        for(size_t i = 0; i < outside_.size(); ++i)
+            world->RemoveTriggerOccupant(this, outside_[i].entity);
+    }
+    outside_.clear();
+
+    // The removed rigid body is still in the entity at this point.
+    Entity *parent = ParentEntity();
+    if (parent)
+    {
+        std::vector<shared_ptr<EC_RigidBody> > rigidbodies = parent->ComponentsOfType<EC_RigidBody>();
+        for(size_t i = 0; i < rigidbodies.size(); ++i)
+            if (rigidbodies[i].get() != component)
+            {
+                SetRigidBody(rigidbodies[i]);
+                break;
+            }
+    }
+
+    for(size_t i = 0; i < left.size(); ++i)
+    {
+        EntityPtr entity = left[i].weak.lock();
+        if (entity)
         {
-            rigidbody_ = rigidbody;
-            connect(rigidbody.get(), SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool)),
-                this, SLOT(OnPhysicsCollision(Entity*, const float3&, const float3&, float, float, bool)), Qt::UniqueConnection);
+            emit EntityLeave(entity.get());
+            emit entityLeave(entity.get());
         }
     }
 }
 
+int EC_VolumeTrigger::Find(const OccupantVector &occupants, const Entity *entity)
+{
+    for(size_t i = 0; i < occupants.size(); ++i)
+        if (occupants[i].entity == entity)
+            return (int)i;
+    return -1;
+}
+
+void EC_VolumeTrigger::RemoveAt(OccupantVector &occupants, int index)
+{
+    occupants[index] = occupants.back();
+    occupants.pop_back();
+}
+
 void EC_VolumeTrigger::OnPhysicsUpdate()
 {
+    if (inside_.empty() && outside_.empty())
+        return;
+
     PROFILE(EC_VolumeTrigger_OnPhysicsUpdate);
-    
-    for(EntitiesWithinVolumeMap::iterator it = entities_.begin(); it != entities_.end();)
+
+    // Sort the entities whose pivot has crossed the volume to the other array first, and signal after that,
+    // as the signal handlers may change the occupants.
+    std::vector<EntityWeakPtr> entered, left;
+    OccupantVector inside, outside;
+    inside.reserve(inside_.size() + outside_.size());
+    outside.reserve(inside_.size() + outside_.size());
+    for(size_t i = 0; i < inside_.size(); ++i)
     {
-        bool remove = false;
-        EntityPtr entity = it->first.lock();
-        
-        // Entity was destroyed without us knowing? Remove from map in that case
-        if (!entity)
-            remove = true;
+        EntityPtr entity = inside_[i].weak.lock();
+        if (entity && !IsPivotInside(entity.get()))
+        {
+            outside.push_back(inside_[i]);
+            left.push_back(entity);
+        }
         else
+            inside.push_back(inside_[i]);
+    }
+    for(size_t i = 0; i < outside_.size(); ++i)
+    {
+        EntityPtr entity = outside_[i].weak.lock();
+        if (entity && IsPivotInside(entity.get()))
         {
-            // If collision is old, remove the entity if its rigidbody is active
-            // (inactive rigidbodies do not refresh the collision, so we would remove the entity mistakenly)
-            if (!it->second)
-            {
-                bool active = true;
-                shared_ptr<EC_RigidBody> rigidbody = entity->GetComponent<EC_RigidBody>();
-                if (rigidbody)
-                    active = rigidbody->IsActive();
-                if (active)
-                    remove = true;
-            }
-            else
-            {
-                // Age the collision from new to old
-                it->second = false;
-            }
+            inside.push_back(outside_[i]);
+            entered.push_back(entity);
         }
-        
-        if (!remove)
-            ++it;
         else
+            outside.push_back(outside_[i]);
+    }
+    inside_.swap(inside);
+    outside_.swap(outside);
+
+    for(size_t i = 0; i < left.size(); ++i)
+    {
+        EntityPtr entity = left[i].lock();
+        if (entity)
         {
-            EntitiesWithinVolumeMap::iterator current = it;
-            ++it;
-            entities_.erase(current);
-            if (entity)
-            {
-                emit EntityLeave(entity.get());
-                emit entityLeave(entity.get());
-                disconnect(entity.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
-            }
+            emit EntityLeave(entity.get());
+            emit entityLeave(entity.get());
+        }
+    }
+    for(size_t i = 0; i < entered.size(); ++i)
+    {
+        EntityPtr entity = entered[i].lock();
+        if (entity)
+        {
+            emit EntityEnter(entity.get());
+            emit entityEnter(entity.get());
         }
     }
 }
 
-void EC_VolumeTrigger::OnPhysicsCollision(Entity* otherEntity, const float3& /*position*/,
-    const float3& /*normal*/, float /*distance*/, float /*impulse*/, bool newCollision)
+void EC_VolumeTrigger::OnCollisionEnter(Entity* otherEntity, const float3& /*position*/, const float3& /*normal*/, float /*impulse*/)
 {
-    PROFILE(EC_VolumeTrigger_OnPhysicsCollision);
+    PROFILE(EC_VolumeTrigger_OnCollisionEnter);
 
     assert(otherEntity && "Physics collision with no entity.");
 
     if (!entities.Get().isEmpty() && !IsInterestingEntity(otherEntity->Name()))
         return;
+    if (Find(inside_, otherEntity) >= 0 || Find(outside_, otherEntity) >= 0)
+        return;
 
-    EntityPtr entity = otherEntity->shared_from_this();
+    Occupant occupant;
+    occupant.entity = otherEntity;
+    occupant.weak = otherEntity->shared_from_this();
+    PhysicsWorldPtr world = world_.lock();
+    if (world)
+        world->AddTriggerOccupant(this, otherEntity);
 
     // If byPivot attribute is enabled, we require the object pivot to enter the volume trigger area.
-    // Otherwise, we react on each physics collision message (i.e. we accept if the volumetrigger and other entity just touch).
-    if (byPivot.Get() && !IsPivotInside(entity.get()))
+    // Otherwise, we react on the contact (i.e. we accept if the volumetrigger and other entity just touch).
+    if (byPivot.Get() && !IsPivotInside(otherEntity))
+    {
+        outside_.push_back(occupant);
         return;
+    }
 
-    bool refreshed = false;
-    
-    if (newCollision)
+    inside_.push_back(occupant);
+    emit EntityEnter(otherEntity);
+    emit entityEnter(otherEntity);
+}
+
+void EC_VolumeTrigger::OnCollisionLeave(Entity* otherEntity)
+{
+    PROFILE(EC_VolumeTrigger_OnCollisionLeave);
+
+    int index = Find(outside_, otherEntity);
+    if (index >= 0)
     {
-        // make sure the entity isn't already inside the volume
-        if (entities_.find(entity) == entities_.end())
-        {
-            entities_[entity] = true;
-            emit EntityEnter(otherEntity);
-            refreshed = true;
-            emit entityEnter(otherEntity);
-            connect(otherEntity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
-        }
+        RemoveAt(outside_, index);
+        PhysicsWorldPtr world = world_.lock();
+        if (world)
+            world->RemoveTriggerOccupant(this, otherEntity);
+        return;
     }
 
-    if (!refreshed)
+    index = Find(inside_, otherEntity);
+    if (index >= 0)
     {
-        // Refresh the collision status to new
-        entities_[entity] = true;
+        RemoveAt(inside_, index);
+        PhysicsWorldPtr world = world_.lock();
+        if (world)
+            world->RemoveTriggerOccupant(this, otherEntity);
+        emit EntityLeave(otherEntity);
+        emit entityLeave(otherEntity);
     }
 }
 
-/** Called when the given entity is deleted from the scene. In that case, remove the Entity immediately from our tracking data structure (and signal listeners). */
+/** Called when the given entity is deleted from the scene. In that case, remove the Entity immediately from our tracking data structure.
+    The removal of its rigid body ends its contacts without the leave signals. */
 void EC_VolumeTrigger::OnEntityRemoved(Entity *entity)
 {
     assert(entity);
-    EntitiesWithinVolumeMap::iterator i = entities_.find(entity->shared_from_this());
-    if (i != entities_.end())
+    int index = Find(outside_, entity);
+    if (index >= 0)
+        RemoveAt(outside_, index);
+
+    index = Find(inside_, entity);
+    if (index >= 0)
     {
-        entities_.erase(i);
+        RemoveAt(inside_, index);
         emit EntityLeave(entity);
         emit entityLeave(entity);
     }
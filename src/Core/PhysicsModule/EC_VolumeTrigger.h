@@ -7,7 +7,7 @@
 #include "Math/float3.h"
 #include "PhysicsModuleFwd.h"
 
-#include <map>
+#include <vector>
 
 /// Physics volume trigger component
 /** <table class="header">
@@ -49,12 +49,14 @@
 
     <b>Depends on the component RigitBody.</b>.
 
+    The entities entering and leaving the volume are followed from the contacts of its rigid body as they start and end,
+    so a trigger does no work on the physics updates where nothing enters or leaves it.
+
     @note If you use 'byPivot' -option or use IsPivotInside-function, the pivot point shouldn't be outside the mesh 
         (or physics collision primitive) because physics collisions are used for efficiency even in this case.
-    @todo If you add an entity to the 'interesting entities list', no signals may get send for that entity,
-          and it may not show up in any list of entities contained in this volume trigger until that entity moves.
-          Also if you enable/disable 'byPivot' option when entities are inside the volume, no signals may get send for those entities,
-          and they may not show up in any list of entities contained in this volume trigger until the entities move.
+        With 'byPivot', the pivots of the entities touching the volume are checked on each physics update.
+    @todo If you add an entity to the 'interesting entities list' while it is touching the volume, no signals are sent for that entity,
+          and it does not show up in any list of entities contained in this volume trigger until it leaves and enters the volume again.
 
     </table> */
 class EC_VolumeTrigger : public IComponent
@@ -151,30 +153,56 @@ private slots:
     /// Check for rigid body component and connect to its signal
     void CheckForRigidBody();
 
-    /// Collisions have been processed for the scene the parent entity is in
+    /// Lets the occupants leave when the rigid body of the volume is removed, and switches to another rigid body of the entity, if any.
+    void OnComponentRemoved(IComponent *component);
+
+    /// Rechecks the pivots of the entities touching the volume. Connected only when byPivot is true.
     void OnPhysicsUpdate();
 
-    /// Called when physics collisions occurs.
-    void OnPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
+    /// Called when the rigid body starts touching another entity.
+    void OnCollisionEnter(Entity* otherEntity, const float3& position, const float3& normal, float impulse);
 
-    /// Called when entity inside this volume is removed from the scene
-    void OnEntityRemoved(Entity* entity);
+    /// Called when the rigid body stops touching another entity.
+    void OnCollisionLeave(Entity* otherEntity);
 
 private:
+    /// Called by PhysicsWorld when an entity touching this volume is removed from the scene.
+    void OnEntityRemoved(Entity* entity);
+
     /// Called when some of the attributes has been changed.
     void AttributesChanged();
 
-    /// Rigid body component that is needed for collision signals
-    weak_ptr<EC_RigidBody> rigidbody_;
+    /// Connects to or disconnects from the physics updates, depending on byPivot.
+    void ConnectPhysicsUpdate();
 
-    /// As C++ standard weak_ptr doesn't provide less than operator (or any comparison operators for that matter), we need to provide it ourselves.
-    struct EntityWeakPtrLessThan
+    /// Sets the rigid body whose collision signals define the volume, and connects to them.
+    void SetRigidBody(const shared_ptr<EC_RigidBody> &rigidbody);
+
+    /// @cond PRIVATE
+    /// An entity touching the volume.
+    struct Occupant
     {
-        bool operator() (const EntityWeakPtr &a, const EntityWeakPtr &b) const { return WEAK_PTR_LESS_THAN(a, b); }
+        Entity *entity; ///< Identifies the entity. Dereferenced only while the entity is known to exist, see OnEntityRemoved.
+        EntityWeakPtr weak;
     };
-    typedef std::map<EntityWeakPtr, bool, EntityWeakPtrLessThan> EntitiesWithinVolumeMap;
-    /// Map of entities inside this volume. 
-    /** The value is used in physics update to see if the entity is still inside
-        this volume or if it left the volume during last physics update. */
-    EntitiesWithinVolumeMap entities_;
+    /// @endcond
+    typedef std::vector<Occupant> OccupantVector;
+
+    /// Returns the index of an entity in an occupant array, or -1 if not found.
+    static int Find(const OccupantVector &occupants, const Entity *entity);
+
+    /// Removes an entity from an occupant array by moving the last one in its place.
+    static void RemoveAt(OccupantVector &occupants, int index);
+
+    /// Rigid body component that is needed for collision signals
+    weak_ptr<EC_RigidBody> rigidbody_;
+
+    /// The physics world the occupants are registered to, see PhysicsWorld::AddTriggerOccupant.
+    PhysicsWorldWeakPtr world_;
+
+    /// The entities inside this volume, in no particular order.
+    OccupantVector inside_;
+
+    /// The entities touching this volume with their pivot outside it, when byPivot is true.
+    OccupantVector outside_;
 };
@@ -6,6 +6,7 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "CollisionShapeUtils.h"
+#include "CollisionShapeCache.h"
 #include "ConvexHull.h"
 #include "EC_RigidBody.h"
 #include "EC_VolumeTrigger.h"
@@ -50,12 +51,15 @@ using namespace Physics;
 PhysicsModule::PhysicsModule()
 :IModule("Physics"),
 defaultPhysicsUpdatePeriod_(1.0f / 60.0f),
-defaultMaxSubSteps_(6) // If fps is below 10, we start to slow down physics
+defaultMaxSubSteps_(6), // If fps is below 10, we start to slow down physics
+defaultWorkerThreads_(0),
+collisionShapes_(0)
 {
 }
 
 PhysicsModule::~PhysicsModule()
 {
+    SAFE_DELETE(collisionShapes_);
 }
 
 void PhysicsModule::Load()
@@ -69,6 +73,8 @@ void PhysicsModule::Load()
 void PhysicsModule::Initialize()
 {
     framework_->RegisterDynamicObject("physics", this);
+
+    collisionShapes_ = new CollisionShapeCache(framework_->Asset());
     
     connect(framework_->Scene(), SIGNAL(SceneCreated(Scene *, AttributeChange::Type)), this, SLOT(CreatePhysicsWorld(Scene *)));
     connect(framework_->Scene(), SIGNAL(SceneAboutToBeRemoved(Scene *, AttributeChange::Type)), this, SLOT(RemovePhysicsWorld(Scene *)));
@@ -101,6 +107,13 @@ void PhysicsModule::Initialize()
         if (ok && steps > 0)
             SetDefaultMaxSubSteps(steps);
     }
+    if (framework_->HasCommandLineParameter("--physicsthreads"))
+    {
+        bool ok;
+        int threads = framework_->CommandLineParameters("--physicsthreads")[0].toInt(&ok);
+        if (ok && threads >= 0)
+            SetDefaultWorkerThreads(threads);
+    }
 }
 
 void PhysicsModule::Uninitialize()
@@ -130,6 +143,12 @@ void PhysicsModule::SetDefaultMaxSubSteps(int steps)
         defaultMaxSubSteps_ = steps;
 }
 
+void PhysicsModule::SetDefaultWorkerThreads(int threads)
+{
+    if (threads >= 0)
+        defaultWorkerThreads_ = threads;
+}
+
 void PhysicsModule::StopPhysics()
 {
     SetRunPhysics(false);
@@ -181,7 +200,7 @@ void PhysicsModule::Update(f64 frametime)
 
 void PhysicsModule::CreatePhysicsWorld(Scene *scene)
 {
-    shared_ptr<PhysicsWorld> newWorld = MAKE_SHARED(PhysicsWorld, scene->shared_from_this(), !scene->IsAuthority());
+    shared_ptr<PhysicsWorld> newWorld = MAKE_SHARED(PhysicsWorld, scene->shared_from_this(), !scene->IsAuthority(), defaultWorkerThreads_);
     newWorld->SetGravity(scene->UpVector() * -9.81f);
     newWorld->SetPhysicsUpdatePeriod(defaultPhysicsUpdatePeriod_);
     newWorld->SetMaxSubSteps(defaultMaxSubSteps_);
@@ -28,6 +28,7 @@ class PHYSICS_MODULE_API PhysicsModule : public IModule
     Q_OBJECT
     Q_PROPERTY(float defaultPhysicsUpdatePeriod READ DefaultPhysicsUpdatePeriod WRITE SetDefaultPhysicsUpdatePeriod)
     Q_PROPERTY(int defaultMaxSubSteps READ DefaultMaxSubSteps WRITE SetDefaultMaxSubSteps)
+    Q_PROPERTY(int defaultWorkerThreads READ DefaultWorkerThreads WRITE SetDefaultWorkerThreads)
 
 public:
     PhysicsModule();
@@ -46,6 +47,10 @@ public:
     /** If already has been generated, returns the previously created one */
     shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
 
+    /// Returns the cache of the collision shapes cooked from mesh assets in the background.
+    /** Rigid bodies get their triangle mesh and convex hull shapes from here. */
+    CollisionShapeCache *CollisionShapes() const { return collisionShapes_; }
+
     /// Set default physics update rate for new physics worlds
     void SetDefaultPhysicsUpdatePeriod(float updatePeriod);
 
@@ -58,6 +63,13 @@ public:
     /// Return default physics max substeps for new physics worlds
     int DefaultMaxSubSteps() const { return defaultMaxSubSteps_; }
 
+    /// Set default number of physics worker threads for new physics worlds, 0 to step the physics on the main thread only
+    /** @note Has an effect only if Tundra is built with TUNDRA_BULLET_MULTITHREADED. */
+    void SetDefaultWorkerThreads(int threads);
+
+    /// Return default number of physics worker threads for new physics worlds
+    int DefaultWorkerThreads() const { return defaultWorkerThreads_; }
+
 public slots:
     /// Toggles physics debug geometry
     void ToggleDebugGeometry();
@@ -95,9 +107,13 @@ private:
     typedef std::map<std::string, shared_ptr<ConvexHullSet> > ConvexHullSetMap;
     /// Bullet convex hull sets generated from Ogre meshes
     ConvexHullSetMap convexHullSets_;
+
+    /// Collision shapes cooked from mesh assets
+    CollisionShapeCache *collisionShapes_;
     
     float defaultPhysicsUpdatePeriod_;
     int defaultMaxSubSteps_;
+    int defaultWorkerThreads_;
 };
 Q_DECLARE_METATYPE(PhysicsModule*);
 
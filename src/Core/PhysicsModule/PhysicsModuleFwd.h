@@ -23,6 +23,7 @@ class PhysicsWorld;
 class PhysicsRaycastResult;
 class EC_RigidBody;
 class EC_VolumeTrigger;
+class CollisionShapeCache;
 
 typedef shared_ptr<PhysicsWorld> PhysicsWorldPtr;
 typedef weak_ptr<PhysicsWorld> PhysicsWorldWeakPtr;
@@ -34,8 +35,10 @@ class btBroadphaseInterface;
 class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btDispatcher;
+class btThreadSupportInterface;
 class btCollisionObject;
 class btConvexHullShape;
 class btRigidBody;
+class btTransform;
 class btCollisionShape;
 class btHeightfieldTerrainShape;
@@ -7,14 +7,17 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "PhysicsUtils.h"
+#include "ContactTracker.h"
 #include "Profiler.h"
 #include "Scene/Scene.h"
 #include "OgreWorld.h"
 #include "EC_RigidBody.h"
+#include "EC_VolumeTrigger.h"
 #include "LoggingFunctions.h"
 #include "Geometry/LineSegment.h"
 #include "Geometry/OBB.h"
 #include "Math/float3x3.h"
+#include "Math/float3x4.h"
 #include "Math/Quat.h"
 #include "Entity.h"
 
@@ -25,21 +28,37 @@
 #pragma warning(disable : 4100)
 #endif
 #include <btBulletDynamicsCommon.h>
+#ifdef TUNDRA_BULLET_MULTITHREADED
+#include <BulletMultiThreaded/SpuGatheringCollisionDispatcher.h>
+#include <BulletMultiThreaded/SpuNarrowPhaseCollisionTask/SpuGatheringCollisionTask.h>
+#include <BulletMultiThreaded/btParallelConstraintSolver.h>
+#ifdef _WIN32
+#include <BulletMultiThreaded/Win32ThreadSupport.h>
+#else
+#include <BulletMultiThreaded/PosixThreadSupport.h>
+#endif
+#endif
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
 
 #include <Ogre.h>
+#include <QHash>
+#include <QSet>
+#include <QPointer>
+#include <QThreadPool>
+#include <QRunnable>
 
 #include "MemoryLeakCheck.h"
 
 namespace
 {
 
-struct CollisionSignal
+/// A contact point recorded by RecordContacts, to emit the PhysicsCollision signals for later.
+struct ContactRecord
 {
-    weak_ptr<EC_RigidBody> bodyA;
-    weak_ptr<EC_RigidBody> bodyB;
+    const btCollisionObject *objectA;
+    const btCollisionObject *objectB;
     float3 position;
     float3 normal;
     float distance;
@@ -47,6 +66,14 @@ struct CollisionSignal
     bool newCollision;
 };
 
+/// A substep recorded by RecordContacts, to emit its signals for later.
+struct TickRecord
+{
+    float time;
+    size_t contactsEnd; ///< End index of the contact points of the substep.
+    size_t eventsEnd; ///< End index of the contact events of the substep.
+};
+
 struct ObbCallback : public btCollisionWorld::ContactResultCallback
 {
     ObbCallback(std::set<btCollisionObjectWrapper*>& result) : result_(result) {}
@@ -66,25 +93,86 @@ void TickCallback(btDynamicsWorld *world, btScalar timeStep)
     static_cast<PhysicsWorld*>(world->getWorldUserInfo())->ProcessPostTick(timeStep);
 }
 
+#ifdef TUNDRA_BULLET_MULTITHREADED
+#ifdef _WIN32
+typedef Win32ThreadFunc ThreadFunc;
+typedef Win32lsMemorySetupFunc ThreadMemorySetupFunc;
+#else
+typedef PosixThreadFunc ThreadFunc;
+typedef PosixlsMemorySetupFunc ThreadMemorySetupFunc;
+#endif
+
+/// Creates numThreads Bullet worker threads that run a task function.
+btThreadSupportInterface *CreateThreadSupport(const char *name, ThreadFunc taskFunc, ThreadMemorySetupFunc memoryFunc, int numThreads)
+{
+#include "DisableMemoryLeakCheck.h"
+#ifdef _WIN32
+    return new Win32ThreadSupport(Win32ThreadSupport::Win32ThreadConstructionInfo(name, taskFunc, memoryFunc, numThreads));
+#else
+    return new PosixThreadSupport(PosixThreadSupport::ThreadConstructionInfo(name, taskFunc, memoryFunc, numThreads));
+#endif
+#include "EnableMemoryLeakCheck.h"
+}
+
+/// Number of physics worlds with collision threads. The local store memory of the collision threads is shared by all of them.
+int numThreadedWorlds = 0;
+#endif
+
 } // ~unnamed namespace
 
 struct PhysicsWorld::Impl : public btIDebugDraw
 {
-    explicit Impl(PhysicsWorld *owner) :
+    Impl(PhysicsWorld *owner, int numWorkerThreads) :
         collisionConfiguration(0),
         collisionDispatcher(0),
         broadphase(0),
         solver(0),
         world(0),
+        collisionThreads(0),
+        solverThreads(0),
+        workerThreads(0),
         debugDrawMode(0),
-        cachedOgreWorld(0)
+        cachedOgreWorld(0),
+        debugFrame(0),
+        stepping(false),
+        syncing(false)
     {
+        stepThread.setMaxThreadCount(1);
 #include "DisableMemoryLeakCheck.h"
-        collisionConfiguration = new btDefaultCollisionConfiguration();
-        collisionDispatcher = new btCollisionDispatcher(collisionConfiguration);
+#ifdef TUNDRA_BULLET_MULTITHREADED
+        if (numWorkerThreads > 0)
+        {
+            // The narrowphase of the convex pairs is spread over the collision threads, and the constraints of all the islands are
+            // solved together by the parallel solver, in batches that do not share bodies. The other pairs, the manifolds and the
+            // internal tick callbacks stay on the main thread, so the order of the manifolds, and the collision signals, is the same
+            // as when stepping on the main thread only.
+            workerThreads = numWorkerThreads;
+            btDefaultCollisionConstructionInfo info;
+            info.m_defaultMaxPersistentManifoldPoolSize = 32768;
+            collisionConfiguration = new btDefaultCollisionConfiguration(info);
+            collisionThreads = CreateThreadSupport("PhysicsCollision", processCollisionTask, createCollisionLocalStoreMemory, workerThreads);
+            ++numThreadedWorlds;
+            collisionDispatcher = new SpuGatheringCollisionDispatcher(collisionThreads, workerThreads, collisionConfiguration);
+            solverThreads = CreateThreadSupport("PhysicsSolver", SolverThreadFunc, SolverlsMemoryFunc, workerThreads);
+            solver = new btParallelConstraintSolver(solverThreads);
+        }
+#else
+        if (numWorkerThreads > 0)
+            LogWarning("PhysicsWorld: Built without TUNDRA_BULLET_MULTITHREADED, stepping the physics on the main thread only.");
+#endif
+        if (!collisionConfiguration)
+        {
+            collisionConfiguration = new btDefaultCollisionConfiguration();
+            collisionDispatcher = new btCollisionDispatcher(collisionConfiguration);
+            solver = new btSequentialImpulseConstraintSolver();
+        }
         broadphase = new btDbvtBroadphase();
-        solver = new btSequentialImpulseConstraintSolver();
         world = new btDiscreteDynamicsWorld(collisionDispatcher, broadphase, solver, collisionConfiguration);
+        if (workerThreads > 0)
+        {
+            world->getSimulationIslandManager()->setSplitIslands(false);
+            world->getDispatchInfo().m_enableSPU = true;
+        }
         world->setDebugDrawer(this);
         world->setInternalTickCallback(TickCallback, (void*)owner, false);
 #include "EnableMemoryLeakCheck.h"
@@ -92,11 +180,21 @@ struct PhysicsWorld::Impl : public btIDebugDraw
 
     ~Impl()
     {
+        ClearRetainedDebugShapes();
         delete world;
         delete solver;
         delete broadphase;
         delete collisionDispatcher;
         delete collisionConfiguration;
+#ifdef TUNDRA_BULLET_MULTITHREADED
+        delete solverThreads;
+        if (collisionThreads)
+        {
+            delete collisionThreads;
+            if (--numThreadedWorlds == 0)
+                deleteCollisionLocalStoreMemory();
+        }
+#endif
     }
 
     /// btIDebugDraw override
@@ -106,6 +204,40 @@ struct PhysicsWorld::Impl : public btIDebugDraw
             cachedOgreWorld->DebugDrawLine(from, to, color.x(), color.y(), color.z());
     }
 
+    /// btIDebugDraw override, draws a transformed box template.
+    virtual void drawBox(const btVector3& bbMin, const btVector3& bbMax, const btTransform& trans, const btVector3& color)
+    {
+        if (IsDebugGeometryEnabled() && cachedOgreWorld)
+        {
+            float3 size = bbMax - bbMin;
+            float3x4 box(float3(size.x, 0.f, 0.f), float3(0.f, size.y, 0.f), float3(0.f, 0.f, size.z), 0.5f * (float3(bbMin) + float3(bbMax)));
+            cachedOgreWorld->DebugDrawBox(ToFloat3x4(trans) * box, color.x(), color.y(), color.z());
+        }
+    }
+
+    /// btIDebugDraw override, draws a transformed sphere template.
+    virtual void drawSphere(btScalar radius, const btTransform& transform, const btVector3& color)
+    {
+        if (IsDebugGeometryEnabled() && cachedOgreWorld)
+            cachedOgreWorld->DebugDrawSphere(ToFloat3x4(transform) * float3x4::FromTRS(float3::zero, float3x3::identity, float3::FromScalar(radius)),
+                color.x(), color.y(), color.z());
+    }
+
+    /// btIDebugDraw override, draws a transformed capsule template.
+    virtual void drawCapsule(btScalar radius, btScalar halfHeight, int upAxis, const btTransform& transform, const btVector3& color)
+    {
+        if (IsDebugGeometryEnabled() && cachedOgreWorld)
+        {
+            // The capsule template is along the Y axis, swap it to the up axis.
+            float3x4 axes = float3x4::identity;
+            if (upAxis == 0)
+                axes = float3x4(float3(0.f, 1.f, 0.f), float3(1.f, 0.f, 0.f), float3(0.f, 0.f, 1.f), float3::zero);
+            else if (upAxis == 2)
+                axes = float3x4(float3(1.f, 0.f, 0.f), float3(0.f, 0.f, 1.f), float3(0.f, 1.f, 0.f), float3::zero);
+            cachedOgreWorld->DebugDrawCapsule(ToFloat3x4(transform) * axes, radius, halfHeight, color.x(), color.y(), color.z());
+        }
+    }
+
     /// btIDebugDraw override
     virtual void reportErrorWarning(const char* warningString)
     {
@@ -127,6 +259,118 @@ struct PhysicsWorld::Impl : public btIDebugDraw
 
     bool IsDebugGeometryEnabled() const { return getDebugMode() != btIDebugDraw::DBG_NoDebug; }
 
+    static float3x4 ToFloat3x4(const btTransform &transform) { return float3x4(float3x3(transform.getBasis()), float3(transform.getOrigin())); }
+
+    /// Returns the debug color of a collision object by its activation state, the same as Bullet uses.
+    static btVector3 DebugColor(const btCollisionObject *object)
+    {
+        switch(object->getActivationState())
+        {
+        case ACTIVE_TAG: return btVector3(1, 1, 1);
+        case ISLAND_SLEEPING: return btVector3(0, 1, 0);
+        case WANTS_DEACTIVATION: return btVector3(0, 1, 1);
+        case DISABLE_DEACTIVATION: return btVector3(1, 0, 0);
+        case DISABLE_SIMULATION: return btVector3(1, 1, 0);
+        default: return btVector3(1, 0, 0);
+        }
+    }
+
+    /// Draws the debug geometry of the world to cachedOgreWorld.
+    /** Replaces btDiscreteDynamicsWorld::debugDrawWorld: static and sleeping objects, which are typically most of the world, are
+        recorded once into retained debug shapes of the OgreWorld and re-recorded only when they change, and only the moving objects
+        are drawn every frame. */
+    void DrawDebugWorld()
+    {
+        if (retainedDebugWorld.lock().get() != cachedOgreWorld)
+        {
+            ClearRetainedDebugShapes();
+            retainedDebugWorld = cachedOgreWorld->shared_from_this();
+        }
+        ++debugFrame;
+
+        const btCollisionObjectArray &objects = world->getCollisionObjectArray();
+        for(int i = 0; i < objects.size(); ++i)
+        {
+            const btCollisionObject *object = objects[i];
+            if (object->getCollisionFlags() & btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT)
+                continue;
+
+            btVector3 color = DebugColor(object);
+            if (object->isStaticObject() || !object->isActive())
+            {
+                RetainedDebugObject &retained = retainedDebugObjects[object];
+                retained.frame = debugFrame;
+                const btCollisionShape *shape = object->getCollisionShape();
+                if (!cachedOgreWorld->HasDebugShape(object) || retained.shape != shape || !(retained.transform == object->getWorldTransform()) ||
+                    retained.scale != shape->getLocalScaling() || retained.color != color)
+                {
+                    retained.shape = shape;
+                    retained.transform = object->getWorldTransform();
+                    retained.scale = shape->getLocalScaling();
+                    retained.color = color;
+                    cachedOgreWorld->BeginDebugShape(object);
+                    world->debugDrawObject(object->getWorldTransform(), shape, color);
+                    cachedOgreWorld->EndDebugShape();
+                }
+                continue;
+            }
+
+            // The object has woken up, draw it every frame from now on.
+            if (!retainedDebugObjects.isEmpty() && retainedDebugObjects.remove(object))
+                cachedOgreWorld->RemoveDebugShape(object);
+            world->debugDrawObject(object->getWorldTransform(), object->getCollisionShape(), color);
+        }
+
+        // Forget the objects that have been removed from the world or are no longer visualized.
+        for(QHash<const btCollisionObject*, RetainedDebugObject>::iterator iter = retainedDebugObjects.begin(); iter != retainedDebugObjects.end();)
+        {
+            if (iter->frame != debugFrame)
+            {
+                cachedOgreWorld->RemoveDebugShape(iter.key());
+                iter = retainedDebugObjects.erase(iter);
+            }
+            else
+                ++iter;
+        }
+
+        if (getDebugMode() & (btIDebugDraw::DBG_DrawConstraints | btIDebugDraw::DBG_DrawConstraintLimits))
+            for(int i = world->getNumConstraints() - 1; i >= 0; --i)
+                world->debugDrawConstraint(world->getConstraint(i));
+    }
+
+    /// Removes the retained debug shapes of the collision objects from the OgreWorld they were drawn to.
+    void ClearRetainedDebugShapes()
+    {
+        OgreWorldPtr ogreWorld = retainedDebugWorld.lock();
+        if (ogreWorld)
+            for(QHash<const btCollisionObject*, RetainedDebugObject>::const_iterator iter = retainedDebugObjects.begin(); iter != retainedDebugObjects.end(); ++iter)
+                ogreWorld->RemoveDebugShape(iter.key());
+        retainedDebugObjects.clear();
+        retainedDebugWorld.reset();
+    }
+
+    /// @cond PRIVATE
+    /// Steps the world on the stepping thread.
+    struct StepTask : public QRunnable
+    {
+        StepTask(PhysicsWorld *world_, f64 frametime_) : world(world_), frametime(frametime_) {}
+        void run() { world->StepSimulation(frametime); }
+        PhysicsWorld *world;
+        f64 frametime;
+    };
+
+    /// The state a retained debug shape of a collision object was recorded with.
+    struct RetainedDebugObject
+    {
+        RetainedDebugObject() : shape(0), frame(0) {}
+        const btCollisionShape *shape;
+        btTransform transform;
+        btVector3 scale;
+        btVector3 color;
+        u32 frame;
+    };
+    /// @endcond
+
     /// Bullet collision config
     btCollisionConfiguration* collisionConfiguration;
     /// Bullet collision dispatcher
@@ -137,13 +381,64 @@ struct PhysicsWorld::Impl : public btIDebugDraw
     btConstraintSolver* solver;
     /// Bullet physics world
     btDiscreteDynamicsWorld* world;
+    /// Bullet worker threads for the narrowphase, null if stepping on the main thread only
+    btThreadSupportInterface* collisionThreads;
+    /// Bullet worker threads for the constraint solver, null if stepping on the main thread only
+    btThreadSupportInterface* solverThreads;
+    /// Number of worker threads per task type, 0 if stepping on the main thread only
+    int workerThreads;
     /// Bullet debug draw / debug behaviour flags
     int debugDrawMode;
     /// Cached OgreWorld pointer for drawing debug geometry
     OgreWorld* cachedOgreWorld;
+    /// The OgreWorld that has the retained debug shapes of the static and sleeping collision objects
+    OgreWorldWeakPtr retainedDebugWorld;
+    /// The collision objects that have a retained debug shape
+    QHash<const btCollisionObject*, RetainedDebugObject> retainedDebugObjects;
+    /// Number of debug geometry draws, to find the retained debug shapes of removed objects
+    u32 debugFrame;
+    /// The stepping thread, with at most one step queued or running at a time
+    QThreadPool stepThread;
+    /// Whether a step has been started on the stepping thread and not waited for. Written by the main thread only, when no step is running
+    bool stepping;
+    /// The transforms Bullet has set to the rigid bodies during the asynchronous step, applied to the placeables at the sync point
+    std::vector<std::pair<btRigidBody*, btTransform> > transforms;
+    /// Whether the results of a step are being applied or emitted. Collision objects removed meanwhile are collected to removedObjects
+    bool syncing;
+    /// The contact points of the substeps not yet emitted as collision signals
+    std::vector<ContactRecord> contacts;
+    /// The pairs of collision objects touching, with the contact events of the substeps not yet emitted
+    ContactTracker tracker;
+    /// The substeps not yet emitted
+    std::vector<TickRecord> ticks;
+    /// The bodies whose buffered transforms have been overridden since the step, e.g. by setting the placeable transform
+    QSet<const btCollisionObject*> discardedTransforms;
+    /// The collision objects removed from the world since the step
+    QSet<const btCollisionObject*> removedObjects;
+    /// The volume triggers touched by each entity, see AddTriggerOccupant
+    QMultiHash<Entity*, EC_VolumeTrigger*> triggerOccupants;
+
+    /// Returns the rigid body of a collision object, or null if the object has been removed since the step or the body has no parent entity.
+    EC_RigidBody *Body(const btCollisionObject *object) const
+    {
+        if (!removedObjects.isEmpty() && removedObjects.contains(object))
+            return 0;
+        EC_RigidBody *body = static_cast<EC_RigidBody*>(object->getUserPointer());
+        return body && body->ParentEntity() ? body : 0;
+    }
+
+    /// Returns the volume triggers an entity is touching. Guarded, as the triggers may be removed by the signal handlers.
+    QList<QPointer<EC_VolumeTrigger> > TriggersTouching(Entity *entity) const
+    {
+        QList<QPointer<EC_VolumeTrigger> > triggers;
+        for(QMultiHash<Entity*, EC_VolumeTrigger*>::const_iterator iter = triggerOccupants.find(entity);
+            iter != triggerOccupants.end() && iter.key() == entity; ++iter)
+            triggers.append(iter.value());
+        return triggers;
+    }
 };
 
-PhysicsWorld::PhysicsWorld(const ScenePtr &scene, bool isClient) :
+PhysicsWorld::PhysicsWorld(const ScenePtr &scene, bool isClient, int numWorkerThreads) :
     scene_(scene),
     physicsUpdatePeriod_(1.0f / 60.0f),
     maxSubSteps_(6), // If fps is below 10, we start to slow down physics
@@ -151,19 +446,26 @@ PhysicsWorld::PhysicsWorld(const ScenePtr &scene, bool isClient) :
     runPhysics_(true),
     drawDebugManuallySet_(false),
     useVariableTimestep_(false),
-    impl(new Impl(this))
+    asynchronous_(false),
+    impl(new Impl(this, numWorkerThreads))
 {
     if (scene->GetFramework()->HasCommandLineParameter("--variablephysicsstep"))
         useVariableTimestep_ = true;
+    if (scene->GetFramework()->HasCommandLineParameter("--physicsasync"))
+        asynchronous_ = true;
+    connect(scene.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
+    connect(scene.get(), SIGNAL(ComponentRemoved(Entity*, IComponent*, AttributeChange::Type)), this, SLOT(OnComponentRemoved(Entity*, IComponent*)));
 }
 
 PhysicsWorld::~PhysicsWorld()
 {
+    WaitForStep();
     delete impl;
 }
 
 void PhysicsWorld::SetPhysicsUpdatePeriod(float updatePeriod)
 {
+    WaitForStep();
     // Allow max.1000 fps
     if (updatePeriod <= 0.001f)
         updatePeriod = 0.001f;
@@ -172,27 +474,62 @@ void PhysicsWorld::SetPhysicsUpdatePeriod(float updatePeriod)
 
 void PhysicsWorld::SetMaxSubSteps(int steps)
 {
+    WaitForStep();
     if (steps > 0)
         maxSubSteps_ = steps;
 }
 
 void PhysicsWorld::SetGravity(const float3& gravity)
 {
+    WaitForStep();
     impl->world->setGravity(gravity);
 }
 
 float3 PhysicsWorld::Gravity() const
 {
+    WaitForStep();
     return impl->world->getGravity();
 }
 
 btDiscreteDynamicsWorld* PhysicsWorld::BulletWorld() const
 {
+    WaitForStep();
     return impl->world;
 }
 
+int PhysicsWorld::WorkerThreads() const
+{
+    return impl->workerThreads;
+}
+
+void PhysicsWorld::SetAsynchronous(bool enable)
+{
+    if (asynchronous_ && !enable)
+        SyncStep();
+    asynchronous_ = enable;
+}
+
+void PhysicsWorld::WaitForStep() const
+{
+    if (!impl->stepping)
+        return;
+
+    PROFILE(PhysicsWorld_WaitForStep);
+    impl->stepThread.waitForDone();
+    impl->stepping = false;
+}
+
+bool PhysicsWorld::IsStepping() const
+{
+    return impl->stepping;
+}
+
 void PhysicsWorld::Simulate(f64 frametime)
 {
+    // The sync point: finish the step started on the previous frame before anything else of this frame touches the world.
+    if (asynchronous_)
+        SyncStep();
+
     if (!runPhysics_)
         return;
     
@@ -200,19 +537,10 @@ void PhysicsWorld::Simulate(f64 frametime)
     
     emit AboutToUpdate((float)frametime);
     
+    if (!asynchronous_)
     {
         PROFILE(Bullet_stepSimulation); ///\note Do not delete or rename this PROFILE() block. The DebugStats profiler uses this string as a label to know where to inject the Bullet internal profiling data.
-        
-        // Use variable timestep if enabled, and if frame timestep exceeds the single physics simulation substep
-        if (useVariableTimestep_ && frametime > physicsUpdatePeriod_)
-        {
-            float clampedTimeStep = (float)frametime;
-            if (clampedTimeStep > 0.1f)
-                clampedTimeStep = 0.1f; // Advance max. 1/10 sec. during one frame
-            impl->world->stepSimulation(clampedTimeStep, 0, clampedTimeStep);
-        }
-        else
-            impl->world->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
+        StepSimulation(frametime);
     }
     
     // Automatically enable debug geometry if at least one debug-enabled rigidbody. Automatically disable if no debug-enabled rigidbodies
@@ -227,118 +555,278 @@ void PhysicsWorld::Simulate(f64 frametime)
     
     if (IsDebugGeometryEnabled())
         DrawDebugGeometry();
+
+    if (asynchronous_)
+    {
+        // The main thread must not touch the world until WaitForStep, so the results are recorded by the stepping thread.
+        impl->stepping = true;
+#include "DisableMemoryLeakCheck.h"
+        impl->stepThread.start(new Impl::StepTask(this, frametime));
+#include "EnableMemoryLeakCheck.h"
+    }
+}
+
+void PhysicsWorld::StepSimulation(f64 frametime)
+{
+    // Use variable timestep if enabled, and if frame timestep exceeds the single physics simulation substep
+    if (useVariableTimestep_ && frametime > physicsUpdatePeriod_)
+    {
+        float clampedTimeStep = (float)frametime;
+        if (clampedTimeStep > 0.1f)
+            clampedTimeStep = 0.1f; // Advance max. 1/10 sec. during one frame
+        impl->world->stepSimulation(clampedTimeStep, 0, clampedTimeStep);
+    }
+    else
+        impl->world->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
+}
+
+void PhysicsWorld::SyncStep()
+{
+    WaitForStep();
+    if (impl->syncing || (impl->ticks.empty() && impl->transforms.empty()))
+        return;
+
+    PROFILE(PhysicsWorld_SyncStep);
+    impl->syncing = true;
+
+    // Apply the transforms first, so that the collision handlers see the placeables at the end of the step.
+    {
+        PROFILE(PhysicsWorld_ApplyTransforms);
+        for(size_t i = 0; i < impl->transforms.size(); ++i)
+        {
+            btRigidBody *body = impl->transforms[i].first;
+            if (!impl->removedObjects.isEmpty() && impl->removedObjects.contains(body))
+                continue;
+            if (!impl->discardedTransforms.isEmpty() && impl->discardedTransforms.contains(body))
+                continue;
+            body->getMotionState()->setWorldTransform(impl->transforms[i].second);
+        }
+        impl->transforms.clear();
+        impl->discardedTransforms.clear();
+    }
+
+    EmitStepResults();
+    impl->syncing = false;
+    impl->removedObjects.clear();
+}
+
+bool PhysicsWorld::BufferTransform(btRigidBody *body, const btTransform &transform)
+{
+    if (!impl->stepping)
+        return false;
+    impl->transforms.push_back(std::make_pair(body, transform));
+    return true;
+}
+
+void PhysicsWorld::DiscardTransform(const btCollisionObject *object)
+{
+    if (!impl->transforms.empty())
+        impl->discardedTransforms.insert(object);
+}
+
+void PhysicsWorld::DiscardStepResults(const btCollisionObject *object)
+{
+    impl->tracker.Remove(object);
+    if (impl->syncing || !impl->transforms.empty() || !impl->ticks.empty())
+        impl->removedObjects.insert(object);
 }
 
 void PhysicsWorld::ProcessPostTick(float substeptime)
 {
+    // When stepping asynchronously, the signals are emitted on the main thread at the sync point. The profiler is main thread only.
+    if (impl->stepping)
+    {
+        RecordContacts(substeptime);
+        return;
+    }
+
     PROFILE(PhysicsWorld_ProcessPostTick);
-    // Check contacts and send collision signals for them
-    int numManifolds = impl->collisionDispatcher->getNumManifolds();
-    
-    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > currentCollisions;
-    
-    // Collect all collision signals to a list before emitting any of them, in case a collision
-    // handler changes physics state before the loop below is over (which would lead into catastrophic
-    // consequences)
-    std::vector<CollisionSignal> collisions;
-    collisions.reserve(numManifolds * 3); // Guess some initial memory size for the collision list.
+    RecordContacts(substeptime);
+    impl->syncing = true;
+    EmitStepResults();
+    impl->syncing = false;
+    impl->removedObjects.clear();
+}
 
-    if (numManifolds > 0)
+void PhysicsWorld::RecordContacts(float substeptime)
+{
+    // Check contacts and record them for the collision signals
+    ContactTracker &tracker = impl->tracker;
+    tracker.BeginTick();
+
+    int numManifolds = impl->collisionDispatcher->getNumManifolds();
+    for(int i = 0; i < numManifolds; ++i)
     {
-        PROFILE(PhysicsWorld_SendCollisions);
+        btPersistentManifold* contactManifold = impl->collisionDispatcher->getManifoldByIndexInternal(i);
+        int numContacts = contactManifold->getNumContacts();
+        if (numContacts == 0)
+            continue;
+
+        const btCollisionObject* objectA = contactManifold->getBody0();
+        const btCollisionObject* objectB = contactManifold->getBody1();
         
-        for(int i = 0; i < numManifolds; ++i)
+        // The contacts of sleeping bodies are not reported, but the bodies stay touching until they wake up
+        if (!objectA->isActive() && !objectB->isActive())
         {
-            btPersistentManifold* contactManifold = impl->collisionDispatcher->getManifoldByIndexInternal(i);
-            int numContacts = contactManifold->getNumContacts();
-            if (numContacts == 0)
-                continue;
-
-            const btCollisionObject* objectA = contactManifold->getBody0();
-            const btCollisionObject* objectB = contactManifold->getBody1();
-			
-            std::pair<const btCollisionObject*, const btCollisionObject*> objectPair;
-            if (objectA < objectB)
-                objectPair = std::make_pair(objectA, objectB);
-            else
-                objectPair = std::make_pair(objectB, objectA);
-            
-            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
-            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
+            tracker.Touch(objectA, objectB, false);
+            continue;
+        }
+        
+        int event = tracker.Touch(objectA, objectB, true);
+        for(int j = 0; j < numContacts; ++j)
+        {
+            btManifoldPoint& point = contactManifold->getContactPoint(j);
             
-            // We are only interested in collisions where both EC_RigidBody components are known
-            if (!bodyA || !bodyB)
-            {
-                LogError("Inconsistent Bullet physics scene state! An object exists in the physics scene which does not have an associated EC_RigidBody!");
-                continue;
-            }
-            // Also, both bodies should have valid parent entities
-            Entity* entityA = bodyA->ParentEntity();
-            Entity* entityB = bodyB->ParentEntity();
-            if (!entityA || !entityB)
+            ContactRecord c;
+            c.objectA = objectA;
+            c.objectB = objectB;
+            c.position = point.m_positionWorldOnB;
+            c.normal = point.m_normalWorldOnB;
+            c.distance = point.m_distance1;
+            c.impulse = point.m_appliedImpulse;
+            // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
+            // (for example play a sound -> avoid multiple sounds being played)
+            c.newCollision = tracker.AddContact(event, c.position, c.normal, c.distance, c.impulse);
+            impl->contacts.push_back(c);
+        }
+    }
+
+    tracker.EndTick();
+    TickRecord tick = { substeptime, impl->contacts.size(), tracker.Events().size() };
+    impl->ticks.push_back(tick);
+}
+
+void PhysicsWorld::EmitStepResults()
+{
+    // The signal handlers may change the physics state and remove bodies, so the bodies are looked up again before each signal.
+    // The bodies removed meanwhile are found from removedObjects.
+    const bool hasCollisionReceivers = receivers(SIGNAL(PhysicsCollision(Entity*, Entity*, const float3&, const float3&, float, float, bool))) > 0;
+    size_t contact = 0;
+    size_t event = 0;
+    for(size_t t = 0; t < impl->ticks.size(); ++t)
+    {
+        const TickRecord &tick = impl->ticks[t];
+        if (contact < tick.contactsEnd)
+        {
+            PROFILE(PhysicsWorld_emit_PhysicsCollisions);
+            for(; contact < tick.contactsEnd; ++contact)
             {
-                LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
-                continue;
+                const ContactRecord &c = impl->contacts[contact];
+                EC_RigidBody *bodyA = impl->Body(c.objectA);
+                EC_RigidBody *bodyB = impl->Body(c.objectB);
+                if (!bodyA || !bodyB)
+                    continue;
+                if (hasCollisionReceivers)
+                {
+                    emit PhysicsCollision(bodyA->ParentEntity(), bodyB->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
+                    bodyA = impl->Body(c.objectA);
+                    bodyB = impl->Body(c.objectB);
+                    if (!bodyA || !bodyB)
+                        continue;
+                }
+                bodyA->EmitPhysicsCollision(bodyB->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
+                
+                bodyA = impl->Body(c.objectA);
+                bodyB = impl->Body(c.objectB);
+                if (!bodyA || !bodyB)
+                    continue;
+                bodyB->EmitPhysicsCollision(bodyA->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
             }
-            // Check that at least one of the bodies is active
-            if (!objectA->isActive() && !objectB->isActive())
-                continue;
-            
-            bool newCollision = previousCollisions_.find(objectPair) == previousCollisions_.end();
-            
-            for(int j = 0; j < numContacts; ++j)
+        }
+
+        if (event < tick.eventsEnd)
+        {
+            PROFILE(PhysicsWorld_emit_CollisionEvents);
+            for(; event < tick.eventsEnd; ++event)
             {
-                btManifoldPoint& point = contactManifold->getContactPoint(j);
-                
-                CollisionSignal s;
-                s.bodyA = static_pointer_cast<EC_RigidBody>(bodyA->shared_from_this());
-                s.bodyB = static_pointer_cast<EC_RigidBody>(bodyB->shared_from_this());
-                s.position = point.m_positionWorldOnB;
-                s.normal = point.m_normalWorldOnB;
-                s.distance = point.m_distance1;
-                s.impulse = point.m_appliedImpulse;
-                s.newCollision = newCollision;
-                collisions.push_back(s);
+                const ContactTracker::Event &e = impl->tracker.Events()[event];
+                EC_RigidBody *bodyA = impl->Body(e.objectA);
+                EC_RigidBody *bodyB = impl->Body(e.objectB);
+                if (!bodyA || !bodyB)
+                    continue;
+                EmitContactEvent(bodyA, bodyB->ParentEntity(), event, false);
                 
-                // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
-                // (for example play a sound -> avoid multiple sounds being played)
-                newCollision = false;
+                bodyA = impl->Body(e.objectA);
+                bodyB = impl->Body(e.objectB);
+                if (!bodyA || !bodyB)
+                    continue;
+                EmitContactEvent(bodyB, bodyA->ParentEntity(), event, true);
             }
-            
-            currentCollisions.insert(objectPair);
         }
-    }
-
-    // Now fire all collision signals. Safeguard for the body components expiring in case signal handlers delete them from the scene
-    {
-        PROFILE(PhysicsWorld_emit_PhysicsCollisions);
-        for(size_t i = 0; i < collisions.size(); ++i)
+        
         {
-            if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
-                continue;
-            emit PhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
-            
-            if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
-                continue;
-            collisions[i].bodyA.lock()->EmitPhysicsCollision(collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
-            
-            if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
-                continue;
-            collisions[i].bodyB.lock()->EmitPhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
+            PROFILE(PhysicsWorld_ProcessPostTick_Updated);
+            emit Updated(tick.time);
         }
     }
 
-    previousCollisions_ = currentCollisions;
-    
+    impl->contacts.clear();
+    impl->tracker.ClearEvents();
+    impl->ticks.clear();
+}
+
+void PhysicsWorld::EmitContactEvent(EC_RigidBody *body, Entity *otherEntity, size_t event, bool isObjectB)
+{
+    const ContactTracker::Event &e = impl->tracker.Events()[event];
+    switch(e.type)
     {
-        PROFILE(PhysicsWorld_ProcessPostTick_Updated);
-        emit Updated(substeptime);
+    case ContactTracker::Enter:
+        emit body->CollisionEnter(otherEntity, e.position, isObjectB ? -e.normal : e.normal, e.impulse);
+        break;
+    case ContactTracker::Stay:
+        emit body->CollisionStay(otherEntity, e.position, isObjectB ? -e.normal : e.normal, e.impulse);
+        break;
+    case ContactTracker::Leave:
+        emit body->CollisionLeave(otherEntity);
+        break;
     }
 }
 
+void PhysicsWorld::AddTriggerOccupant(EC_VolumeTrigger *trigger, Entity *entity)
+{
+    impl->triggerOccupants.insert(entity, trigger);
+}
+
+void PhysicsWorld::RemoveTriggerOccupant(EC_VolumeTrigger *trigger, Entity *entity)
+{
+    impl->triggerOccupants.remove(entity, trigger);
+}
+
+void PhysicsWorld::OnEntityRemoved(Entity *entity)
+{
+    if (impl->triggerOccupants.isEmpty() || !impl->triggerOccupants.contains(entity))
+        return;
+
+    QList<QPointer<EC_VolumeTrigger> > triggers = impl->TriggersTouching(entity);
+    impl->triggerOccupants.remove(entity);
+    for(int i = 0; i < triggers.size(); ++i)
+        if (triggers[i])
+            triggers[i]->OnEntityRemoved(entity);
+}
+
+void PhysicsWorld::OnComponentRemoved(Entity *entity, IComponent *component)
+{
+    if (impl->triggerOccupants.isEmpty() || !dynamic_cast<EC_RigidBody*>(component) || !impl->triggerOccupants.contains(entity))
+        return;
+
+    // The removal of a rigid body ends its contacts without the leave signals, see ContactTracker::Remove.
+    // OnCollisionLeave unregisters the entity from each trigger.
+    QList<QPointer<EC_VolumeTrigger> > triggers = impl->TriggersTouching(entity);
+    for(int i = 0; i < triggers.size(); ++i)
+        if (triggers[i])
+            triggers[i]->OnCollisionLeave(entity);
+}
+
+std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > PhysicsWorld::PreviousFrameCollisions() const
+{
+    WaitForStep();
+    return impl->tracker.Pairs();
+}
+
 PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup, int collisionmask)
 {
     PROFILE(PhysicsWorld_Raycast);
+    WaitForStep();
     
     static PhysicsRaycastResult result;
     
@@ -372,6 +860,7 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
 EntityList PhysicsWorld::ObbCollisionQuery(const OBB &obb, int collisionGroup, int collisionMask)
 {
     PROFILE(PhysicsWorld_ObbCollisionQuery);
+    WaitForStep();
     
     std::set<btCollisionObjectWrapper*> objects;
     EntityList entities;
@@ -407,6 +896,10 @@ void PhysicsWorld::SetDebugGeometryEnabled(bool enable)
     if (scene_.expired() || !scene_.lock()->ViewEnabled() || IsDebugGeometryEnabled() == enable)
         return;
 
+    WaitForStep();
+    if (!enable)
+        impl->ClearRetainedDebugShapes();
+
     /// @todo Make possisble to set other debug modes too.
     impl->setDebugMode(enable ? btIDebugDraw::DBG_DrawWireframe | btIDebugDraw::DBG_DrawConstraintLimits | btIDebugDraw::DBG_DrawConstraints : btIDebugDraw::DBG_NoDebug);
 }
@@ -432,5 +925,5 @@ void PhysicsWorld::DrawDebugGeometry()
         return;
     
     // Get all lines of the physics world
-    impl->world->debugDrawWorld();
+    impl->DrawDebugWorld();
 }
@@ -49,29 +49,41 @@ class PHYSICS_MODULE_API PhysicsWorld : public QObject, public enable_shared_fro
     Q_PROPERTY(float3 gravity READ Gravity WRITE SetGravity)
     Q_PROPERTY(bool drawDebugGeometry READ IsDebugGeometryEnabled WRITE SetDebugGeometryEnabled)
     Q_PROPERTY(bool running READ IsRunning WRITE SetRunning)
+    Q_PROPERTY(int workerThreads READ WorkerThreads)
+    Q_PROPERTY(bool asynchronous READ IsAsynchronous WRITE SetAsynchronous)
 
     friend class ::PhysicsModule;
     friend class ::EC_RigidBody;
+    friend class ::EC_VolumeTrigger;
 
 public:
     /// Constructor.
     /** @param scene Scene of which this PhysicsWorld is physical representation of.
-        @param isClient Whether this physics world is for a client scene i.e. only simulates local entities' motion on their own.*/
-    PhysicsWorld(const ScenePtr &scene, bool isClient);
+        @param isClient Whether this physics world is for a client scene i.e. only simulates local entities' motion on their own.
+        @param numWorkerThreads Number of worker threads for the narrowphase and the constraint solver, 0 to step on the main thread only.
+               Has an effect only if Tundra is built with TUNDRA_BULLET_MULTITHREADED. */
+    PhysicsWorld(const ScenePtr &scene, bool isClient, int numWorkerThreads = 0);
     virtual ~PhysicsWorld();
     
     /// Step the physics world. May trigger several internal simulation substeps, according to the deltatime given.
+    /** When stepping asynchronously, first waits for the step started on the previous call to finish and applies its results,
+        then starts the next step on the stepping thread and returns without waiting for it. */
     void Simulate(f64 frametime);
     
     /// Process collision from an internal sub-step (Bullet post-tick callback)
     void ProcessPostTick(float subStepTime);
+
+    /// Waits for the step in progress on the stepping thread to finish, if any.
+    /** Everything that accesses the Bullet world or its bodies between the frames calls this first, see SetAsynchronous.
+        The results of the step are applied only at the start of the next Simulate call. */
+    void WaitForStep() const;
     
     /// Dynamic scene property name
     static const char* PropertyName() { return "physics"; }
 
-    /// Returns the set of collisions that occurred during the previous frame.
+    /// Returns the pairs of collision objects touching after the last simulation substep.
     /// \important Use this function only for debugging, the availability of this set data structure is not guaranteed in the future.
-    const std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > &PreviousFrameCollisions() const { return previousCollisions_; }
+    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > PreviousFrameCollisions() const;
 
     /// Set physics update period (= length of each simulation step.) By default 1/60th of a second.
     /** @param updatePeriod Update period */
@@ -109,6 +121,22 @@ public:
     /// Return the Bullet world object
     btDiscreteDynamicsWorld* BulletWorld() const;
 
+    /// Return the number of worker threads the simulation uses, 0 if it steps on the main thread only
+    int WorkerThreads() const;
+
+    /// Enable/disable stepping the simulation on a dedicated thread, overlapped with the rest of the frame. Disabled by default.
+    /** When enabled, Simulate starts the step for the frame on the stepping thread, and the main thread goes on with the network
+        sync, the scripts and the rendering meanwhile. The transforms of the rigid bodies are not written to their placeables by the
+        stepping thread, but buffered and written at the start of the next Simulate call, so the placeables show the state at the
+        end of one step for the whole frame. The collision signals and Updated are emitted after that, still once per substep, and
+        before AboutToUpdate and the start of the next step. Accessing the Bullet world, a rigid body or a raycast while the step is
+        in progress waits for it to finish. Also enabled with the --physicsasync command line parameter.
+        Disabling waits for the step in progress and applies its results. */
+    void SetAsynchronous(bool enable);
+
+    /// Return whether the simulation steps on a dedicated thread
+    bool IsAsynchronous() const { return asynchronous_; }
+
 public slots:
     /// Return whether the physics world is for a client scene. Client scenes only simulate local entities' motion on their own.
     bool IsClient() const { return isClient_; }
@@ -133,6 +161,8 @@ signals:
     /// A physics collision has happened between two entities. 
     /** Note: both rigidbodies participating in the collision will also emit a signal separately. 
         Also, if there are several contact points, the signal will be sent multiple times for each contact.
+        To follow the collisions of a single entity, connect to the CollisionEnter, CollisionStay and CollisionLeave signals
+        of its EC_RigidBody instead, which are emitted once per touching pair.
         @param entityA The first entity
         @param entityB The second entity
         @param position World position of collision
@@ -148,13 +178,57 @@ signals:
     void AboutToUpdate(float frametime);
     
     /// Emitted after each simulation step
-    /** @param frametime Length of simulation step */
+    /** When stepping asynchronously, emitted for the substeps of the previous step at the start of Simulate.
+        @param frametime Length of simulation step */
     void Updated(float frametime);
 
+private slots:
+    /// Tells the volume triggers the entity is touching that it has been removed from the scene.
+    void OnEntityRemoved(Entity *entity);
+
+    /// Tells the volume triggers the entity is touching that it has left them, if its rigid body is removed.
+    void OnComponentRemoved(Entity *entity, IComponent *component);
+
 private:
     /// Draw physics debug geometry, if debug drawing enabled
     void DrawDebugGeometry();
 
+    /// Registers an entity touching a volume trigger, so that the trigger is told when the entity is removed from the scene.
+    /** This way the triggers need no connections to the signals of the entities touching them. */
+    void AddTriggerOccupant(EC_VolumeTrigger *trigger, Entity *entity);
+
+    /// Unregisters an entity that no longer touches a volume trigger.
+    void RemoveTriggerOccupant(EC_VolumeTrigger *trigger, Entity *entity);
+
+    /// Steps the Bullet world. Runs on the stepping thread when stepping asynchronously.
+    void StepSimulation(f64 frametime);
+
+    /// Waits for the step in progress and applies its buffered transforms, then emits its collision signals.
+    void SyncStep();
+
+    /// Records the contacts of a substep for the collision signals.
+    void RecordContacts(float substeptime);
+
+    /// Emits the collision signals and Updated for the substeps recorded by RecordContacts.
+    void EmitStepResults();
+
+    /// Emits the CollisionEnter, CollisionStay or CollisionLeave signal of a rigid body for a contact event of the ContactTracker.
+    /** @param isObjectB Whether the body is the second object of the event, which has the contact normal pointing away from it. */
+    void EmitContactEvent(EC_RigidBody *body, Entity *otherEntity, size_t event, bool isObjectB);
+
+    /// Returns whether a step is in progress on the stepping thread. Called by the motion states of the rigid bodies.
+    bool IsStepping() const;
+
+    /// Buffers the transform Bullet sets to a rigid body during an asynchronous step.
+    /** @return False if not stepping asynchronously, in which case the transform should be applied immediately. */
+    bool BufferTransform(btRigidBody *body, const btTransform &transform);
+
+    /// Drops the buffered transform of a rigid body, when its transform has been set after the step.
+    void DiscardTransform(const btCollisionObject *object);
+
+    /// Drops the buffered transform and contacts of a collision object that is removed from the world.
+    void DiscardStepResults(const btCollisionObject *object);
+
     struct Impl;
     Impl *impl;
     /// Length of one physics simulation step
@@ -165,14 +239,14 @@ private:
     bool isClient_;
     /// Parent scene
     SceneWeakPtr scene_;
-    /// Previous frame's collisions. We store these to know whether the collision was new or "ongoing"
-    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > previousCollisions_;
     /// Debug geometry manually enabled/disabled (with physicsdebug console command). If true, do not automatically enable/disable debug geometry anymore
     bool drawDebugManuallySet_;
     /// Whether should run physics. Default true
     bool runPhysics_;
     /// Variable timestep flag
     bool useVariableTimestep_;
+    /// Asynchronous stepping flag
+    bool asynchronous_;
     /// Debug draw-enabled rigidbodies. Note: these pointers are never dereferenced, it is just used for counting
     std::set<EC_RigidBody*> debugRigidBodies_;
 };
@@ -24,24 +24,171 @@
 #include "Profiler.h"
 #include "CoreStringUtils.h"
 #include "FileUtils.h"
+#include "ConfigAPI.h"
 
 #include <QDir>
 #include <QFileSystemWatcher>
 #include <QList>
 #include <QMap>
 
+#include <set>
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
+/// @cond PRIVATE
+static bool LastUsedTimeLessThan(const std::pair<f64, AssetPtr> &a, const std::pair<f64, AssetPtr> &b)
+{
+    return a.first < b.first;
+}
+
+/// Upper bound for the number of cached canonical asset refs, the cache is cleared when this is exceeded.
+static const int cMaxCanonicalAssetRefs = 16384;
+
+/// Removes "./" and "../" segments and duplicate separators from the path part of an already resolved ref.
+/** The protocol specifier, the query and the sub asset name are left untouched. */
+static QString NormalizeResolvedAssetRef(const QString &ref)
+{
+    int protocolEnd = ref.indexOf("://");
+    int pathStart = (protocolEnd != -1 ? protocolEnd + 3 : 0);
+    int namedStorageEnd = ref.indexOf(':');
+    if (protocolEnd == -1 && namedStorageEnd > 1) // "storage:path", but not "C:/path".
+        pathStart = namedStorageEnd + 1;
+    int subAssetStart = ref.indexOf('#', pathStart);
+    QString path = (subAssetStart != -1 ? ref.mid(pathStart, subAssetStart - pathStart) : ref.mid(pathStart));
+    QString subAsset = (subAssetStart != -1 ? ref.mid(subAssetStart) : QString());
+    // The query may contain anything, e.g. another URL, so split it off before cleaning the path.
+    int queryStart = path.indexOf('?');
+    QString query = (queryStart != -1 ? path.mid(queryStart) : QString());
+    if (queryStart != -1)
+        path.truncate(queryStart);
+
+    if (query == "?")
+        query.clear();
+    if (subAsset == "#")
+        subAsset.clear();
+
+    // Only run cleanPath when there is something to clean, as it would also strip a meaningful trailing slash.
+    if (path.contains("/.") || path.startsWith("./") || path.contains("//", Qt::CaseSensitive))
+    {
+        bool leadingSlash = path.startsWith('/'); // file:///unix/path
+        bool trailingSlash = path.endsWith('/');
+        path = QDir::cleanPath(path);
+        if (path.startsWith("./"))
+            path = path.mid(2);
+        if (leadingSlash && !path.startsWith('/'))
+            path.prepend('/');
+        if (trailingSlash && !path.endsWith('/'))
+            path.append('/');
+    }
+    return ref.left(pathStart) + path + query + subAsset;
+}
+/// @endcond
+
 AssetAPI::AssetAPI(Framework *framework, bool headless) :
     fw(framework),
     isHeadless(headless),
     assetCache(0),
-    diskSourceChangeWatcher(0)
+    diskSourceChangeWatcher(0),
+    memoryBudget(0),
+    assetTime(0.0),
+    memoryBudgetCheckTimer(0.0)
 {
     // The Asset API always understands at least this single built-in asset type "Binary".
     // You can use this type to request asset data as binary, without generating any kind of in-memory representation or loading for it.
     // Your module/component can then parse the content in a custom way.
     RegisterAssetTypeFactory(MAKE_SHARED(BinaryAssetFactory, "Binary", ""));
+
+    // Memory budget in megabytes, 0 (no budget) by default.
+    ConfigData configData(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_FRAMEWORK);
+    int budgetMegabytes = fw->Config()->DeclareSetting(configData, "asset memory budget", 0).toInt();
+    QStringList budgetParam = fw->CommandLineParameters("--assetMemoryBudget");
+    if (!budgetParam.isEmpty())
+        budgetMegabytes = budgetParam.first().toInt();
+    if (budgetMegabytes > 0)
+        SetMemoryBudget((size_t)budgetMegabytes * 1024 * 1024);
+}
+
+void AssetAPI::SetMemoryBudget(size_t bytes)
+{
+    memoryBudget = bytes;
+    memoryBudgetCheckTimer = 0.0;
+    if (memoryBudget > 0)
+        LogInfo("AssetAPI: Asset memory budget set to " + QString::number(memoryBudget / (1024 * 1024)) + " MB.");
+}
+
+size_t AssetAPI::LoadedAssetsMemoryUsage() const
+{
+    size_t usage = 0;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        if (iter->second->IsLoaded())
+            usage += iter->second->CpuMemoryUsage() + iter->second->GpuMemoryUsage();
+    return usage;
+}
+
+int AssetAPI::EnforceMemoryBudget()
+{
+    PROFILE(AssetAPI_EnforceMemoryBudget);
+
+    if (memoryBudget == 0)
+        return 0;
+
+    // Assets that loaded assets depend on are in use by them. The dependencies are stored as canonical refs,
+    // so they can be matched against the asset map keys below.
+    std::set<QString, QStringLessThanNoCase> dependees;
+    for(size_t i = 0; i < assetDependencies.size(); ++i)
+    {
+        AssetMap::const_iterator dependent = assets.find(assetDependencies[i].first);
+        if (dependent != assets.end() && dependent->second->IsLoaded())
+            dependees.insert(assetDependencies[i].second);
+    }
+
+    // Collect the unload candidates and refresh the use time of everything that is in use.
+    typedef std::pair<f64, AssetPtr> UnloadCandidate;
+    std::vector<UnloadCandidate> candidates;
+    size_t usage = 0;
+    for(AssetMap::iterator iter = assets.begin(); iter != assets.end(); ++iter)
+    {
+        const AssetPtr &asset = iter->second;
+        if (!asset->IsLoaded())
+            continue;
+        size_t assetUsage = asset->CpuMemoryUsage() + asset->GpuMemoryUsage();
+        usage += assetUsage;
+
+        // The assets map holds one reference, anything more is a live reference from elsewhere. Asset types that
+        // cannot tell whether they have users, i.e. do not override IAsset::IsInUse, are always in use.
+        bool inUse = asset.use_count() > 1 || asset->IsInUse() || dependees.find(iter->first) != dependees.end() ||
+            currentTransfers.find(iter->first) != currentTransfers.end();
+        if (inUse)
+            asset->MarkUsed(assetTime);
+        // Only assets that can be transparently reloaded from their disk source are unloaded.
+        // Assets without a memory estimate, e.g. materials, are unloaded as well, as they may keep their dependencies in use.
+        else if (!asset->IsModified() && !asset->DiskSource().isEmpty() && asset->DiskSourceType() != IAsset::Programmatic)
+            candidates.push_back(std::make_pair(asset->LastUsedTime(), asset));
+    }
+
+    if (usage <= memoryBudget)
+        return 0;
+
+    std::sort(candidates.begin(), candidates.end(), LastUsedTimeLessThan);
+
+    int numUnloaded = 0;
+    size_t usageBefore = usage;
+    for(size_t i = 0; i < candidates.size() && usage > memoryBudget; ++i)
+    {
+        const AssetPtr &asset = candidates[i].second;
+        usage -= std::min(usage, asset->CpuMemoryUsage() + asset->GpuMemoryUsage());
+        LOG_DEBUG("AssetAPI: Unloading unused asset " + asset->Name() + " to fit the asset memory budget.");
+        asset->Unload();
+        ++numUnloaded;
+    }
+
+    if (numUnloaded > 0)
+        LOG_DEBUG("AssetAPI: Unloaded " + QString::number(numUnloaded) + " unused assets, memory usage estimate reduced from " +
+            QString::number(usageBefore / 1024) + " KB to " + QString::number(usage / 1024) + " KB.");
+    if (usage > memoryBudget)
+        LOG_DEBUG("AssetAPI: Loaded assets still exceed the memory budget by " + QString::number((usage - memoryBudget) / 1024) + " KB, all of them are in use.");
+    return numUnloaded;
 }
 
 AssetAPI::~AssetAPI()
@@ -109,7 +256,10 @@ bool AssetAPI::RemoveAssetStorage(const QString &name)
     /// not be possible to specify which storage to delete.
     foreach(const AssetProviderPtr &provider, AssetProviders())
         if (provider->RemoveAssetStorage(name))
+        {
+            ClearCanonicalAssetRefs();
             return true;
+        }
 
     return false;
 }
@@ -149,6 +299,7 @@ AssetStoragePtr AssetAPI::DefaultAssetStorage() const
 void AssetAPI::SetDefaultAssetStorage(const AssetStoragePtr &storage)
 {
     defaultStorage = storage;
+    ClearCanonicalAssetRefs(); // Relative refs resolve to the default storage.
     if (storage)
         LogInfo("Set asset storage \"" + storage->Name() + "\" as the default storage (" + storage->SerializeToString() + ").");
     else
@@ -729,6 +880,7 @@ void AssetAPI::Reset()
     assetDependencies.clear();
     currentUploadTransfers.clear();
     currentTransfers.clear();
+    canonicalRefs.clear();
     providers.clear();
 }
 
@@ -744,6 +896,7 @@ std::vector<AssetTransferPtr> AssetAPI::PendingTransfers() const
 
 AssetTransferPtr AssetAPI::GetPendingTransfer(QString assetRef) const
 {
+    assetRef = CanonicalAssetRef(assetRef);
     AssetTransferMap::const_iterator iter = currentTransfers.find(assetRef);
     if (iter != currentTransfers.end())
         return iter->second;
@@ -767,8 +920,8 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
 
     PROFILE(AssetAPI_RequestAsset);
 
-    // Turn named storage and default storage specifiers to absolute specifiers.
-    assetRef = ResolveAssetRef("", assetRef);
+    // Turn named storage and default storage specifiers to absolute specifiers, and equivalent spellings of the ref to a single key.
+    assetRef = CanonicalAssetRef(assetRef);
     assetType = assetType.trimmed();
     if (assetRef.isEmpty())
         return AssetTransferPtr();
@@ -847,6 +1000,7 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
     if (existingAssetIter != assets.end())
     {
         existingAsset = existingAssetIter->second;
+        existingAsset->MarkUsed(assetTime);
         if (!assetType.isEmpty() && assetType != existingAsset->Type())
             LogWarning("AssetAPI::RequestAsset: Tried to request asset \"" + assetRef + "\" by type \"" + assetType + "\". Asset by that name exists, but it is of type \"" + existingAsset->Type() + "\"!");
         assetType = existingAsset->Type();
@@ -1133,6 +1287,39 @@ QString AssetAPI::ResolveAssetRef(QString context, QString assetRef) const
     return assetRef;
 }
 
+QString AssetAPI::CanonicalAssetRef(QString assetRef) const
+{
+    QHash<QString, QString>::const_iterator cached = canonicalRefs.find(assetRef);
+    if (cached != canonicalRefs.end())
+        return cached.value();
+
+    if (assetRef.trimmed().isEmpty())
+        return "";
+
+    // An exact match to an existing asset is used as-is. Don't cache it, the asset may be forgotten later.
+    if (assets.find(assetRef) != assets.end())
+        return assetRef;
+
+    QString canonicalRef = NormalizeResolvedAssetRef(ResolveAssetRef("", assetRef));
+
+    // Share the string data of an already interned canonical ref, so each distinct ref is stored only once.
+    QHash<QString, QString>::const_iterator interned = canonicalRefs.find(canonicalRef);
+    if (interned != canonicalRefs.end())
+        canonicalRef = interned.value();
+
+    if (canonicalRefs.size() >= cMaxCanonicalAssetRefs)
+        canonicalRefs.clear();
+    canonicalRefs.insert(assetRef, canonicalRef);
+    if (canonicalRef != assetRef)
+        canonicalRefs.insert(canonicalRef, canonicalRef);
+    return canonicalRef;
+}
+
+void AssetAPI::ClearCanonicalAssetRefs()
+{
+    canonicalRefs.clear();
+}
+
 void AssetAPI::RegisterAssetTypeFactory(AssetTypeFactoryPtr factory)
 {
     AssetTypeFactoryPtr existingFactory = AssetTypeFactory(factory->Type());
@@ -1257,6 +1444,7 @@ AssetPtr AssetAPI::CreateNewAsset(QString type, QString name, AssetStoragePtr st
 
     // Remember this asset in the global AssetAPI storage.
     assets[name] = asset;
+    canonicalRefs.remove(name); // From now on the name refers to this asset as-is.
 
     ///\bug DiskSource and DiskSourceType are not set yet.
     {
@@ -1420,15 +1608,8 @@ AssetBundleTypeFactoryPtr AssetAPI::AssetBundleTypeFactory(const QString &typeNa
 
 AssetPtr AssetAPI::GetAsset(QString assetRef) const
 {
-    // First try to see if the ref has an exact match.
-    AssetMap::const_iterator iter = assets.find(assetRef);
-    if (iter != assets.end())
-        return iter->second;
-
-    // If not, normalize and resolve the lookup of the given asset.
-    assetRef = ResolveAssetRef("", assetRef);
-
-    iter = assets.find(assetRef);
+    // CanonicalAssetRef returns the ref as-is if there is an exact match, so a single lookup is enough.
+    AssetMap::const_iterator iter = assets.find(CanonicalAssetRef(assetRef));
     if (iter != assets.end())
         return iter->second;
     return AssetPtr();
@@ -1442,7 +1623,7 @@ AssetBundlePtr AssetAPI::GetBundle(QString bundleRef) const
         return iter->second;
 
     // If not, normalize and resolve the lookup of the given asset bundle.
-    bundleRef = ResolveAssetRef("", bundleRef);
+    bundleRef = CanonicalAssetRef(bundleRef);
 
     iter = assetBundles.find(bundleRef);
     if (iter != assetBundles.end())
@@ -1454,9 +1635,21 @@ void AssetAPI::Update(f64 frametime)
 {
     PROFILE(AssetAPI_Update);
 
+    assetTime += frametime;
+
     for(size_t i = 0; i < providers.size(); ++i)
         providers[i]->Update(frametime);
 
+    if (memoryBudget > 0)
+    {
+        memoryBudgetCheckTimer += frametime;
+        if (memoryBudgetCheckTimer >= 1.0)
+        {
+            memoryBudgetCheckTimer = 0.0;
+            EnforceMemoryBudget();
+        }
+    }
+
     // Proceed with ready transfers.
     if (readyTransfers.size() > 0)
     {
@@ -1478,6 +1671,20 @@ void AssetAPI::Update(f64 frametime)
         // readySubTransfers contains sub asset transfers to loaded bundles. The sub asset loading cannot be completed in RequestAsset
         // as it would trigger signals before the calling code can receive and hook to the AssetTransfer. We delay calling LoadSubAssetToTransfer
         // into this function so that all is hooked and loading can be done normally. This is very similar to the above case for readyTransfers.
+        std::map<QString, QStringList, QStringLessThanNoCase> prefetches;
+        for(size_t i = 0; i < readySubTransfers.size(); ++i)
+        {
+            QString subAssetName;
+            ParseAssetRef(readySubTransfers[i].subAssetTransfer->source.ref, 0, 0, 0, 0, 0, 0, 0, &subAssetName);
+            prefetches[readySubTransfers[i].parentBundleRef] << subAssetName;
+        }
+        for(std::map<QString, QStringList, QStringLessThanNoCase>::iterator iter = prefetches.begin(); iter != prefetches.end(); ++iter)
+        {
+            AssetBundleMap::iterator bundleIter = assetBundles.find(iter->first);
+            if (bundleIter != assetBundles.end())
+                bundleIter->second->PrefetchSubAssets(iter->second);
+        }
+
         for(size_t i = 0; i < readySubTransfers.size(); ++i)
         {
             AssetTransferPtr subTransfer = readySubTransfers[i].subAssetTransfer;
@@ -1530,12 +1737,12 @@ std::map<QString, QString> ParseAssetRefArgs(const QString &url, QString *body)
 
 AssetTransferMap::iterator AssetAPI::FindTransferIterator(QString assetRef)
 {
-    return currentTransfers.find(assetRef);
+    return currentTransfers.find(CanonicalAssetRef(assetRef));
 }
 
 AssetTransferMap::const_iterator AssetAPI::FindTransferIterator(QString assetRef) const
 {
-    return currentTransfers.find(assetRef);
+    return currentTransfers.find(CanonicalAssetRef(assetRef));
 }
 
 AssetTransferMap::iterator AssetAPI::FindTransferIterator(IAssetTransfer *transfer)
@@ -1779,6 +1986,7 @@ void AssetAPI::AssetLoadCompleted(const QString assetRef)
 
     if (asset.get())
     {
+        asset->MarkUsed(assetTime);
         asset->LoadCompleted();
 
         // Add to watch this path for changed, note this does nothing if the path is already added
@@ -1866,6 +2074,16 @@ void AssetAPI::AssetBundleLoadCompleted(IAssetBundle *bundle)
         std::vector<AssetTransferPtr> subTransfers = bundleMonitor->SubAssetTransfers();
         bundleMonitors.erase(monitorIter);
         
+        // Let the bundle start unpacking all the pending sub assets at once, it may be able to do it in parallel.
+        QStringList subAssetNames;
+        for (std::vector<AssetTransferPtr>::iterator subIter = subTransfers.begin(); subIter != subTransfers.end(); ++subIter)
+        {
+            QString subAssetName;
+            ParseAssetRef((*subIter)->source.ref, 0, 0, 0, 0, 0, 0, 0, &subAssetName);
+            subAssetNames << subAssetName;
+        }
+        bundle->PrefetchSubAssets(subAssetNames);
+
         // Start the load process for all sub asset transfers now. From here on out the normal asset request flow should followed.
         for (std::vector<AssetTransferPtr>::iterator subIter = subTransfers.begin(); subIter != subTransfers.end(); ++subIter)
             LoadSubAssetToTransfer((*subIter), bundle, (*subIter)->source.ref);
@@ -1954,8 +2172,9 @@ void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
         if (ref.isEmpty())
             continue;
 
-        // Remember this assetref for future lookup.
-        assetDependencies.push_back(std::make_pair(asset->Name(), ref));
+        // Remember this assetref for future lookup. Store it in canonical form, so that it can be compared against
+        // the asset and transfer map keys.
+        assetDependencies.push_back(std::make_pair(asset->Name(), CanonicalAssetRef(ref)));
     }
 }
 
@@ -1996,6 +2215,7 @@ std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
 {
     PROFILE(AssetAPI_FindDependents);
 
+    dependee = CanonicalAssetRef(dependee);
     std::vector<AssetPtr> dependents;
     for(size_t i = 0; i < assetDependencies.size(); ++i)
     {
@@ -2132,6 +2352,7 @@ void AssetAPI::EmitAssetStorageAdded(AssetStoragePtr newStorage)
     // from its refs whenever new assets are added to this storage from external sources.
     connect(newStorage.get(), SIGNAL(AssetChanged(QString, QString, IAssetStorage::ChangeType)),
         SLOT(OnAssetChanged(QString, QString, IAssetStorage::ChangeType)), Qt::UniqueConnection);
+    ClearCanonicalAssetRefs(); // Named storage refs may now resolve differently.
     emit AssetStorageAdded(newStorage);
 }
 
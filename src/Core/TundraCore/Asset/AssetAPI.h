@@ -9,6 +9,7 @@
 #include "IAssetStorage.h"
 
 #include <QObject>
+#include <QHash>
 #include <vector>
 #include <utility>
 #include <map>
@@ -109,6 +110,23 @@ public:
 
     bool IsHeadless() const { return isHeadless; }
 
+    /// Sets the memory budget for loaded assets, in bytes. 0 disables the budget.
+    /** When the combined CpuMemoryUsage and GpuMemoryUsage of the loaded assets exceeds the budget, the least recently used assets
+        that are not in use and can be reloaded from their disk source are unloaded. They are reloaded when requested again.
+        The initial value is read from the "asset memory budget" config setting (in megabytes) or the --assetMemoryBudget command line parameter. */
+    void SetMemoryBudget(size_t bytes);
+
+    /// Returns the memory budget for loaded assets, in bytes. 0 if the budget is disabled.
+    size_t MemoryBudget() const { return memoryBudget; }
+
+    /// Returns the combined memory usage estimate of all loaded assets, in bytes.
+    size_t LoadedAssetsMemoryUsage() const;
+
+    /// Unloads unused assets, least recently used first, until the loaded assets fit in the memory budget.
+    /** Called periodically from Update when a budget is set.
+        @return Number of assets unloaded. */
+    int EnforceMemoryBudget();
+
     /// Returns all the currently loaded assets which depend on the asset dependeeAssetRef.
     std::vector<AssetPtr> FindDependents(QString dependeeAssetRef);
 
@@ -299,6 +317,13 @@ public slots:
         If ref is an absolute asset reference, it is returned unmodified (no need for context). */
     QString ResolveAssetRef(QString context, QString ref) const;
 
+    /// Returns the canonical form of the given asset ref, which is used as the key for asset transfers and loaded assets.
+    /** The ref is resolved in the context of the default storage (see ResolveAssetRef), after which "./" and "../" path segments,
+        duplicate path separators and an empty trailing '?' are removed. This way equivalent but differently spelled refs,
+        e.g. "texture.png", "./texture.png" and "LOCAL://texture.png", map to a single transfer and a single asset.
+        The results are cached, so repeated requests to the same ref do not re-parse it. */
+    QString CanonicalAssetRef(QString ref) const;
+
     /// Given an assetRef, turns it into a native OS file path to the asset.
     /** The given ref is resolved in the context of "local://", if it is a relative asset ref.
         If ref contains a subAssetName, it is stripped from outFilePath, and returned in subAssetName.
@@ -514,6 +539,9 @@ private:
     /// Create new asset, when the storage is already known. This is used internally for optimization
     AssetPtr CreateNewAsset(QString type, QString name, AssetStoragePtr storage);
 
+    /// Clears the canonical asset ref cache. Called whenever the storage setup, which the canonical refs depend on, changes.
+    void ClearCanonicalAssetRefs();
+
     /// Load sub asset to transfer. Used internally for loading sub asset from bundle to virtual transfers.
     bool LoadSubAssetToTransfer(AssetTransferPtr transfer, const QString &bundleRef, const QString &fullSubAssetRef, QString subAssetType = QString());
 
@@ -581,6 +609,18 @@ private:
 
     Framework *fw;
     AssetCache *assetCache;
+
+    /// Maps asset ref spellings to their canonical refs. The canonical ref strings are shared between all spellings of the same ref.
+    mutable QHash<QString, QString> canonicalRefs;
+
+    /// Memory budget for loaded assets in bytes, 0 if disabled.
+    size_t memoryBudget;
+
+    /// Time accumulated from Update calls, used to stamp asset use times.
+    f64 assetTime;
+
+    /// Time since the memory budget was last enforced.
+    f64 memoryBudgetCheckTimer;
 };
 
 #include "AssetAPI.inl"
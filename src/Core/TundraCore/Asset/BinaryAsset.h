@@ -51,5 +51,10 @@ public:
         return data.size() > 0;
     }
 
+    virtual size_t CpuMemoryUsage() const
+    {
+        return data.capacity();
+    }
+
     std::vector<u8> data;
 };
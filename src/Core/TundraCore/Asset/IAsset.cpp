@@ -14,7 +14,7 @@
 #include "MemoryLeakCheck.h"
 
 IAsset::IAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false)
+:assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false), lastUsedTime(0.0)
 {
     assert(assetAPI);
 }
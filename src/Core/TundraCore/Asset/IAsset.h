@@ -179,6 +179,26 @@ public:
     /// @param serializationParameters Optional parameters for the actual asset type serializer that specifies custom options on how to perform the serialization.
     virtual bool SerializeTo(std::vector<u8> &data, const QString &serializationParameters = "") const;
 
+    /// Returns an estimate of the main memory this asset takes while loaded, in bytes.
+    /** Used by the AssetAPI memory budget. The default implementation returns 0, i.e. unknown. */
+    virtual size_t CpuMemoryUsage() const { return 0; }
+
+    /// Returns an estimate of the GPU memory this asset takes while loaded, in bytes.
+    /** Used by the AssetAPI memory budget. The default implementation returns 0, i.e. unknown. */
+    virtual size_t GpuMemoryUsage() const { return 0; }
+
+    /// Returns true if the loaded asset is in use outside the asset system, for example by a renderer object.
+    /** Assets in use are never unloaded by the AssetAPI memory budget. The default implementation returns true, as most
+        consumers, e.g. components, refer to their assets only through weak references that the asset system cannot see.
+        Asset types that can tell when they are unused, like the Ogre resources, override this to let the budget unload them. */
+    virtual bool IsInUse() const { return true; }
+
+    /// Returns the AssetAPI time (in seconds) this asset was last requested or found to be in use.
+    f64 LastUsedTime() const { return lastUsedTime; }
+
+    /// Stamps the last use time of this asset. Intended to be only called internally by Asset API.
+    void MarkUsed(f64 time) { lastUsedTime = time; }
+
 protected:
     /// Loads this asset by deserializing it from the given data.
     /** The data pointer that is passed in is never null, and numBytes is always greater than zero.
@@ -214,4 +234,7 @@ protected:
     
     /// Modified in memory -status of the asset.
     bool modified;
+
+    /// AssetAPI time of the last use of this asset.
+    f64 lastUsedTime;
 };
@@ -8,6 +8,7 @@
 #include "AssetReference.h"
 
 #include <QObject>
+#include <QStringList>
 #include <vector>
 
 /// Base class for all asset bundles that provide sub assets.
@@ -53,6 +54,12 @@ public slots:
         @return Absolute disk source path if available, empty string otherwise.*/
     virtual QString GetSubAssetDiskSource(const QString &subAssetName) = 0;
 
+    /// Hints the bundle that the given sub assets will be requested soon.
+    /** Implementations can use this to unpack the sub assets in parallel before the GetSubAssetData calls arrive.
+        AssetAPI calls this with all pending sub asset names when the bundle has been loaded.
+        @note Default implementation does nothing. */
+    virtual void PrefetchSubAssets(const QStringList & /*subAssetNames*/) {}
+
     /// Returns the sub asset count in this bundle.
     /** @return Count of the assets or -1 if count is unknown. */
     virtual int SubAssetCount() const { return -1; }
@@ -10,6 +10,7 @@
 #include "ConsoleAPI.h"
 #include "ConsoleWidget.h"
 #include "ShellInputThread.h"
+#include "LogWriter.h"
 #include "Application.h"
 #include "Profiler.h"
 #include "Framework.h"
@@ -20,13 +21,10 @@
 #include "FunctionInvoker.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <QFile>
-#include <QTextStream>
-
-#ifdef ANDROID
-#include <android/log.h>
-#endif
 
 #include "MemoryLeakCheck.h"
 
@@ -34,14 +32,14 @@ ConsoleAPI::ConsoleAPI(Framework *fw) :
     QObject(fw),
     framework(fw),
     enabledLogChannels(LogLevelErrorWarnInfo),
-    logFile(0),
-    logFileText(0)
+    logWriter(MAKE_SHARED(LogWriter))
 {
 }
 
 ConsoleAPI::~ConsoleAPI()
 {
     Reset();
+    logWriter.reset();
 }
 
 void ConsoleAPI::Reset()
@@ -50,8 +48,8 @@ void ConsoleAPI::Reset()
     inputContext.reset();
     SAFE_DELETE(consoleWidget);
     shellInputThread.reset();
-    SAFE_DELETE(logFileText);
-    SAFE_DELETE(logFile);
+    if (logWriter)
+        logWriter->SetFile(0);
 }
 
 QVariant ConsoleCommand::Invoke(const QStringList &params)
@@ -189,39 +187,25 @@ void ConsoleAPI::Print(const QString &message)
     else if (!framework->IsHeadless())
         backBuffer << message; // ConsoleWidget not created yet, but will be - store message to back buffer.
 
-    ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
-    if (!message.endsWith("\n"))
+    if (logWriter)
     {
-#ifndef ANDROID
-        printf("%s\n", message.toStdString().c_str());
-#else
-        __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s\n", message.toStdString().c_str());
-#endif
-        if (logFileText)
-        {
-            (*logFileText) << message << "\n";
-            /// \note If we want to guarantee that each message gets to the log even in the presence of a crash, we must flush()
-            /// after each write. Tested that on Windows 7, if you kill the process using Ctrl-C on command line, or from 
-            /// task manager, the log will not contain all the text, so this is required for correctness.
-            /// But this flush() after each message also causes a *serious* performance drawback.
-            /// One way to try avoiding this issue is to move to using C API for file writing, and at atexit() and other crash
-            /// handlers, close the file handle gracefully.
-            logFileText->flush(); 
-        }
+        // LogWriter appends the line ending in case it's not there (output of console commands in headless mode).
+        const std::string text = message.toStdString();
+        logWriter->Write(0, text.c_str(), text.length());
     }
+}
+
+void ConsoleAPI::Print(u32 logChannel, const char *message)
+{
+    if (consoleWidget)
+        consoleWidget->PrintToConsole(message);
+    else if (!framework->IsHeadless())
+        backBuffer << message;
+
+    if (logWriter)
+        logWriter->Write(logChannel, message, strlen(message));
     else
-    {
-#ifndef ANDROID
-        printf("%s", message.toStdString().c_str());
-#else
-        __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", message.toStdString().c_str());
-#endif
-        if (logFileText)
-        {
-            (*logFileText) << message;
-            logFileText->flush(); // See comment about flush() above.
-        }
-    }
+        printf("%s", message);
 }
 
 void ConsoleAPI::ListCommands()
@@ -265,21 +249,19 @@ void ConsoleAPI::SetLogFile(const QString &wildCardFilename)
     // An empty log file closes the log output writing.
     if (filename.isEmpty())
     {
-        SAFE_DELETE(logFileText);
-        SAFE_DELETE(logFile);
+        logWriter->SetFile(0);
         return;
     }
-    logFile = new QFile(filename);
-    bool isOpen = logFile->open(QIODevice::WriteOnly | QIODevice::Text);
-    if (!isOpen)
+    // The C API is used for the file, so that the exit and crash handlers of LogWriter can write out the pending output.
+    FILE *logFile = fopen(QFile::encodeName(filename).constData(), "w");
+    if (!logFile)
     {
         LogError("Failed to open file \"" + filename + "\" for logging! (parsed from string \"" + wildCardFilename + "\")");
-        SAFE_DELETE(logFile);
     }
     else
     {
+        logWriter->SetFile(logFile); // Writes out the pending output first, so this is printed in order.
         printf("Opened logging file \"%s\".\n", filename.toStdString().c_str());
-        logFileText = new QTextStream(logFile);
     }
 }
 
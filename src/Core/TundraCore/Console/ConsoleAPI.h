@@ -15,12 +15,11 @@
 #include <QObject>
 #include <QMap>
 
-class QFile;
-class QTextStream;
 class Framework;
 
 class ConsoleWidget;
 class ShellInputThread;
+class LogWriter;
 class ConsoleCommand;
 
 /// Console core API.
@@ -57,6 +56,13 @@ public:
         @see UnregisterCommand */
     void RegisterCommand(const QString &name, const QString &desc, QObject *receiver, const char *memberSlot, const char *memberSlotDefaultArgs = 0);
 
+    /// Prints a message of the given log channel to the console widget's log, stdout and the log file.
+    /** Used by PrintLogMessage. Unlike Print(const QString &), passes the text to stdout and the log file as is, and converts
+        it to QString only for the console widget, which does not exist in headless mode.
+        @param logChannel The LogChannel of the message. Errors are flushed to stdout and the log file right away.
+        @param message The text message to print. */
+    void Print(u32 logChannel, const char *message);
+
 public slots:
     /// Registers a new console command which triggers a signal when executed.
     /** Use this function from QtScript to implement custom console commands from a script.
@@ -76,8 +82,10 @@ public slots:
     /** @param command Console command, syntax: "command(param1, param2, param3, ...)". */
     void ExecuteCommand(const QString &command);
 
-    /// Prints a message to the console widget's log and stdout.
-    /** @param message The text message to print. */
+    /// Prints a message to the console widget's log, stdout and the log file.
+    /** The writes to stdout and the log file happen in a background thread, which flushes them when an error is logged and
+        otherwise at a short interval. The pending output is written out also if the program exits or crashes.
+        @param message The text message to print. */
     void Print(const QString &message);
 
     /// Lists all console commands and their descriptions to the log.
@@ -138,8 +146,7 @@ private:
     QPointer<ConsoleWidget> consoleWidget;
     shared_ptr<ShellInputThread> shellInputThread;
     u32 enabledLogChannels; ///< Stores the set of currently active log channels.
-    QFile *logFile; ///< Points to the currently open text file for logging.
-    QTextStream *logFileText;
+    shared_ptr<LogWriter> logWriter; ///< Writes the output to stdout and the log file.
     QStringList backBuffer; ///< Back buffer of unprinted log prints before ConsoleWidget is created.
 
 private slots:
@@ -0,0 +1,294 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "LogWriter.h"
+#include "LoggingFunctions.h"
+
+#include "Win.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+#ifdef ANDROID
+#include <android/log.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const unsigned cQueueSize = 4096; ///< The number of messages that fit in the queue. Must be a power of two.
+const unsigned cWakeInterval = cQueueSize / 4; ///< The writer thread is woken up each time this many messages have been queued.
+const unsigned long cFlushIntervalMsecs = 200; ///< How often the writer thread writes and flushes the queue at most when no errors are logged.
+const int cCrashFlushTimeoutMsecs = 500; ///< How long the crash handlers wait at most for a write in progress.
+const size_t cMaxBatchSize = 64 * 1024; ///< The size of the batch of messages in bytes after which it is written out before dequeuing more.
+
+/// The position arithmetic of the ring buffer is done with unsigned integers, as the positions wrap around.
+inline unsigned LoadAcquire(QAtomicInt &value) { return (unsigned)value.fetchAndAddAcquire(0); }
+
+/// The writer whose queue the exit and crash handlers write out.
+LogWriter *activeWriter = 0;
+bool exitHandlerInstalled = false;
+
+/// Writes out the queued messages after a crash, without waiting for long in case the crash happened in the writer thread.
+void FlushAfterCrash()
+{
+    LogWriter *writer = activeWriter;
+    if (writer)
+        writer->Flush(cCrashFlushTimeoutMsecs);
+}
+
+void FlushAtExit()
+{
+    LogWriter *writer = activeWriter;
+    if (writer)
+        writer->Flush();
+}
+
+typedef void (*SignalHandler)(int);
+
+const int cCrashSignals[] =
+{
+    SIGABRT, SIGFPE, SIGILL, SIGSEGV, SIGTERM,
+#ifndef WIN32
+    SIGINT, // On Windows Ctrl-C is handled by HandleConsoleControl.
+#endif
+};
+const size_t cNumCrashSignals = sizeof(cCrashSignals) / sizeof(cCrashSignals[0]);
+SignalHandler previousSignalHandlers[cNumCrashSignals];
+
+void HandleCrashSignal(int signalNumber)
+{
+    FlushAfterCrash();
+    // Restore the previous handler and raise the signal again for it, so that e.g. the default action of terminating the process,
+    // or dumping core, happens as without us.
+    for(size_t i = 0; i < cNumCrashSignals; ++i)
+        if (cCrashSignals[i] == signalNumber)
+            signal(signalNumber, previousSignalHandlers[i]);
+    raise(signalNumber);
+}
+
+#ifdef WIN32
+LPTOP_LEVEL_EXCEPTION_FILTER previousExceptionFilter = 0;
+
+LONG WINAPI HandleUnhandledException(EXCEPTION_POINTERS *exceptionInfo)
+{
+    FlushAfterCrash();
+    return previousExceptionFilter ? previousExceptionFilter(exceptionInfo) : EXCEPTION_CONTINUE_SEARCH;
+}
+
+BOOL WINAPI HandleConsoleControl(DWORD /*controlType*/)
+{
+    FlushAfterCrash();
+    return FALSE; // Let the next handler, by default the one terminating the process, handle the event.
+}
+#endif
+
+void InstallCrashHandlers()
+{
+    if (!exitHandlerInstalled)
+    {
+        atexit(FlushAtExit);
+        exitHandlerInstalled = true;
+    }
+    for(size_t i = 0; i < cNumCrashSignals; ++i)
+    {
+        previousSignalHandlers[i] = signal(cCrashSignals[i], HandleCrashSignal);
+        // Do not start handling signals the process ignores, e.g. SIGINT when run in the background from a shell.
+        if (previousSignalHandlers[i] == SIG_IGN)
+            signal(cCrashSignals[i], SIG_IGN);
+    }
+#ifdef WIN32
+    previousExceptionFilter = SetUnhandledExceptionFilter(HandleUnhandledException);
+    SetConsoleCtrlHandler(HandleConsoleControl, TRUE);
+#endif
+}
+
+void UninstallCrashHandlers()
+{
+    for(size_t i = 0; i < cNumCrashSignals; ++i)
+    {
+        // Leave alone the handlers that others have installed after us.
+        SignalHandler current = signal(cCrashSignals[i], previousSignalHandlers[i]);
+        if (current != HandleCrashSignal)
+            signal(cCrashSignals[i], current);
+    }
+#ifdef WIN32
+    SetUnhandledExceptionFilter(previousExceptionFilter);
+    SetConsoleCtrlHandler(HandleConsoleControl, FALSE);
+#endif
+}
+
+} // ~unnamed namespace
+
+LogWriter::LogWriter() :
+    queue(cQueueSize),
+    enqueuePos(0),
+    dequeuePos(0),
+    file(0),
+    flushRequested(0),
+    stopRequested(false)
+{
+    for(unsigned i = 0; i < cQueueSize; ++i)
+        queue[i].sequence = (int)i;
+    batch.reserve(cMaxBatchSize);
+
+    activeWriter = this;
+    InstallCrashHandlers();
+    start();
+}
+
+LogWriter::~LogWriter()
+{
+    wakeLock.lock();
+    stopRequested = true;
+    wakeCondition.wakeOne();
+    wakeLock.unlock();
+    wait();
+
+    if (activeWriter == this)
+    {
+        UninstallCrashHandlers();
+        activeWriter = 0;
+    }
+    SetFile(0);
+}
+
+void LogWriter::Write(u32 logChannel, const char *message, size_t length)
+{
+    // Claim a slot by advancing the enqueue position, as in the bounded MPMC queue by Dmitry Vyukov.
+    unsigned pos = LoadAcquire(enqueuePos);
+    Slot *slot;
+    for(;;)
+    {
+        slot = &queue[pos & (cQueueSize - 1)];
+        const int diff = (int)(LoadAcquire(slot->sequence) - pos);
+        if (diff == 0)
+        {
+            if (enqueuePos.testAndSetRelaxed((int)pos, (int)(pos + 1)))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The queue is full: the writer thread has not yet written the message queued to this slot on the previous round.
+            wakeCondition.wakeOne();
+            yieldCurrentThread();
+        }
+        pos = LoadAcquire(enqueuePos);
+    }
+
+    slot->logChannel = logChannel;
+    slot->text.assign(message, length);
+    if (length == 0 || message[length-1] != '\n')
+        slot->text += '\n';
+    slot->sequence.fetchAndStoreRelease((int)(pos + 1));
+
+    if ((logChannel & LogChannelError) != 0)
+    {
+        // Errors are rare, so lock to make sure the wake-up is not missed.
+        QMutexLocker lock(&wakeLock);
+        flushRequested.fetchAndStoreRelease(1);
+        wakeCondition.wakeOne();
+    }
+    else if (((pos + 1) & (cWakeInterval - 1)) == 0)
+        wakeCondition.wakeOne(); // Spurious or missed wake-ups only affect when the queue is written.
+}
+
+void LogWriter::SetFile(FILE *newFile)
+{
+    QMutexLocker lock(&outputLock);
+    WriteQueued();
+    if (file)
+        fclose(file);
+    file = newFile;
+}
+
+bool LogWriter::Flush(int timeoutMsecs)
+{
+    const bool locked = outputLock.tryLock(timeoutMsecs);
+    if (locked)
+        WriteQueued();
+#ifndef ANDROID
+    fflush(stdout);
+#endif
+    if (file)
+        fflush(file);
+    if (locked)
+        outputLock.unlock();
+    return locked;
+}
+
+void LogWriter::run()
+{
+    for(;;)
+    {
+        wakeLock.lock();
+        if (!stopRequested && LoadAcquire(flushRequested) == 0)
+            wakeCondition.wait(&wakeLock, cFlushIntervalMsecs);
+        const bool stop = stopRequested;
+        flushRequested.fetchAndStoreRelaxed(0);
+        wakeLock.unlock();
+
+        Flush();
+        if (stop)
+            return;
+    }
+}
+
+void LogWriter::WriteQueued()
+{
+    for(;;)
+    {
+        Slot &slot = queue[dequeuePos & (cQueueSize - 1)];
+        if (LoadAcquire(slot.sequence) != dequeuePos + 1)
+            break; // The queue is empty, or the next message is still being copied to its slot.
+
+#ifdef WIN32
+        // Highlight errors and warnings in the console.
+        const bool highlight = (slot.logChannel & (LogChannelError | LogChannelWarning)) != 0;
+        if (highlight)
+        {
+            WriteBatch();
+            fflush(stdout);
+            SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), (slot.logChannel & LogChannelError) != 0 ?
+                FOREGROUND_RED | FOREGROUND_INTENSITY : FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+        }
+#endif
+#ifdef ANDROID
+        __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", slot.text.c_str());
+#endif
+        batch += slot.text;
+#ifdef WIN32
+        if (highlight)
+        {
+            WriteBatch();
+            fflush(stdout);
+            SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+        }
+#endif
+
+        // Do not keep the memory of exceptionally long messages reserved.
+        if (slot.text.capacity() > 1024)
+            std::string().swap(slot.text);
+        slot.sequence.fetchAndStoreRelease((int)(dequeuePos + cQueueSize));
+        ++dequeuePos;
+
+        if (batch.size() >= cMaxBatchSize)
+            WriteBatch();
+    }
+    WriteBatch();
+}
+
+void LogWriter::WriteBatch()
+{
+    if (batch.empty())
+        return;
+#ifndef ANDROID
+    fwrite(batch.data(), 1, batch.size(), stdout);
+#endif
+    if (file)
+        fwrite(batch.data(), 1, batch.size(), file);
+    batch.clear();
+}
@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+
+/// Writes the log output to stdout and to the log file in a background thread.
+/** Write only copies the message to a lock-free ring buffer, so that logging does not stall the calling thread for the console
+    and file I/O. The writer thread writes the queued messages in batches, and flushes the outputs when an error is logged and
+    otherwise at a fixed interval. The messages still in the queue are written out also when the program exits, or is terminated
+    by a signal, a crash or, on Windows, by closing the console window.
+    @note Only one LogWriter is expected to exist at a time, the one of ConsoleAPI: the exit and crash handlers flush the latest one.
+    @cond PRIVATE */
+class LogWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    /// Starts the writer thread and installs the exit and crash handlers.
+    LogWriter();
+    /// Writes out the queued messages, stops the thread and closes the log file.
+    ~LogWriter();
+
+    /// Queues a message to be written. Thread-safe, and lock-free unless the queue is full, in which case waits for the writer thread.
+    /** Appends a line ending if the message does not end with one.
+        @param logChannel The LogChannel of the message, or 0 if the message is not a log message, e.g. output of a console command.
+            Errors make the writer thread write and flush the queue right away. */
+    void Write(u32 logChannel, const char *message, size_t length);
+
+    /// Sets the file the output is written to in addition to stdout, or closes the current one if null. Takes the ownership of the file.
+    /** The messages queued earlier are written out to the previous file, if any, first. */
+    void SetFile(FILE *file);
+
+    /// Writes out the queued messages and flushes the outputs in the calling thread.
+    /** @param timeoutMsecs How long to wait at most for a write in progress in the writer thread, or -1 to wait as long as it takes.
+        @return False if the wait timed out, in which case the outputs are only flushed. */
+    bool Flush(int timeoutMsecs = -1);
+
+private:
+    /// QThread override
+    void run();
+
+    /// Writes out the queued messages. outputLock must be locked.
+    void WriteQueued();
+    /// Writes the batch to stdout and the log file and clears it. outputLock must be locked.
+    void WriteBatch();
+
+    /// A message in the ring buffer.
+    struct Slot
+    {
+        /// The position of the slot in the queue: equal to the enqueue position when the slot is free, and to the position
+        /// plus one when the message has been written to it.
+        QAtomicInt sequence;
+        u32 logChannel;
+        std::string text;
+    };
+
+    std::vector<Slot> queue; ///< The ring buffer, whose size is a power of two.
+    QAtomicInt enqueuePos; ///< The position the next message is queued to. Wraps around.
+    unsigned dequeuePos; ///< The position of the next message to write. Accessed only with outputLock locked.
+
+    QMutex outputLock; ///< Serializes the writes to the outputs, and the dequeuing.
+    FILE *file; ///< The log file, or null.
+    std::string batch; ///< The messages dequeued for writing.
+
+    QMutex wakeLock;
+    QWaitCondition wakeCondition; ///< Wakes the writer thread before its flush interval has passed.
+    QAtomicInt flushRequested; ///< Set when an error has been logged.
+    bool stopRequested; ///< Accessed only with wakeLock locked.
+};
+/** @endcond */
@@ -186,6 +186,8 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
         cmdLineDescs.commands["--noAssetCache"] = "Disable asset cache."; // Framework
         cmdLineDescs.commands["--assetCacheDir"] = "Specify asset cache directory to use."; // Framework
         cmdLineDescs.commands["--clearAssetCache"] = "At the start of Tundra, remove all data and metadata files from asset cache."; // AssetCache
+        cmdLineDescs.commands["--assetMemoryBudget"] = "Sets the memory budget for loaded assets in megabytes. When exceeded, the least recently used assets that are not in use are unloaded. Default: 0 (no budget)."; // AssetAPI
+        cmdLineDescs.commands["--extractZipBundles"] = "Extract zip asset bundles fully to the asset cache instead of unpacking sub assets on demand from the archive."; // ArchivePlugin
         cmdLineDescs.commands["--logLevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'."; // ConsoleAPI
         cmdLineDescs.commands["--logFile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt'."; // ConsoleAPI
         cmdLineDescs.commands["--physicsRate"] = "Specifies the number of physics simulation steps per second. Default: 60."; // PhysicsModule
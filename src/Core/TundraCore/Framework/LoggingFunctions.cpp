@@ -4,8 +4,6 @@
 #include "Framework.h"
 #include "ConsoleAPI.h"
 
-#include "Win.h"
-
 #ifdef ANDROID
 #include <android/log.h>
 #endif
@@ -18,14 +16,10 @@ void PrintLogMessage(u32 logChannel, const char *str)
     Framework *instance = Framework::Instance();
     ConsoleAPI *console = (instance ? instance->Console() : 0);
 
-    // On Windows, highlight errors and warnings.
-#ifdef WIN32
-    if ((logChannel & LogChannelError) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
-    else if ((logChannel & LogChannelWarning) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
-#endif
-    // The console and stdout prints are equivalent.
+    // The console and stdout prints are equivalent. The console writes stdout in a background thread, which also highlights
+    // errors and warnings on Windows.
     if (console)
-        console->Print(str);
+        console->Print(logChannel, str);
     else // The Console API is already dead for some reason, print directly to stdout to guarantee we don't lose any logging messags.
     {
         #ifndef ANDROID
@@ -34,11 +28,6 @@ void PrintLogMessage(u32 logChannel, const char *str)
             __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", str);
         #endif
     }
-
-    // Restore the text color to normal.
-#ifdef WIN32
-    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
-#endif
 }
 
 bool IsLogChannelEnabled(u32 logChannel)
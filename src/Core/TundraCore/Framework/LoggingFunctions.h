@@ -46,3 +46,12 @@ static inline void LogError(const QString &msg)    { if (IsLogChannelEnabled(Log
 static inline void LogWarning(const QString &msg)  { if (IsLogChannelEnabled(LogChannelWarning)) PrintLogMessage(LogChannelWarning, ("Warning: " + msg + "\n").toStdString().c_str());     }
 static inline void LogInfo(const QString &msg)     { if (IsLogChannelEnabled(LogChannelInfo)) PrintLogMessage(LogChannelInfo, (msg + "\n").toStdString().c_str());                   }
 static inline void LogDebug(const QString &msg)    { if (IsLogChannelEnabled(LogChannelDebug)) PrintLogMessage(LogChannelDebug, ("Debug: " + msg + "\n").toStdString().c_str());       }
+
+/// Logs to the given channel like the functions above, but evaluates the message expression only if the channel is enabled.
+/** The functions above receive the message already built, so e.g. LogDebug("Loaded " + QString::number(n) + " assets.") formats
+    the string even when debug output is disabled. Use these in frequently executed code instead, e.g.
+    LOG_DEBUG("Loaded " + QString::number(n) + " assets."); */
+#define LOG_ERROR(msg)   do { if (IsLogChannelEnabled(LogChannelError)) ::LogError(msg); } while(0)
+#define LOG_WARNING(msg) do { if (IsLogChannelEnabled(LogChannelWarning)) ::LogWarning(msg); } while(0)
+#define LOG_INFO(msg)    do { if (IsLogChannelEnabled(LogChannelInfo)) ::LogInfo(msg); } while(0)
+#define LOG_DEBUG(msg)   do { if (IsLogChannelEnabled(LogChannelDebug)) ::LogDebug(msg); } while(0)
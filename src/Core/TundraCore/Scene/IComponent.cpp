@@ -501,7 +501,10 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
     assert(change != AttributeChange::Default);
 
     if (change == AttributeChange::Disconnected)
+    {
+        AttributeChangedDisconnected(attribute);
         return; // No signals
+    }
     
     // Trigger scenemanager signal
     Scene* scene = ParentScene();
@@ -452,6 +452,11 @@ private:
     /// and after reacting to the change, call IAttribute::ClearChangedFlag().
     virtual void AttributesChanged() {}
 
+    /// Called instead of AttributesChanged when an attribute is changed with AttributeChange::Disconnected, which sends no signals.
+    /// The derived class can use this to keep bookkeeping that must not go stale, e.g. caches keyed by the attribute value, up to date.
+    /// The changed flag of the attribute is left set, so AttributesChanged still sees the change on the next connected change.
+    virtual void AttributeChangedDisconnected(IAttribute * /*attribute*/) {}
+
     /// Set component id. Called by Entity
     void SetNewId(component_id_t newId);
 
@@ -158,6 +158,7 @@ void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
     old_entity->SetNewId(new_id);
     entities_.erase(old_id);
     entities_[new_id] = old_entity;
+    transforms_.ChangeId(old_id, new_id);
 }
 
 bool Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
@@ -179,6 +180,7 @@ bool Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
         
         // Then make the entity remove all of its components, so that their individual removals are signaled properly
         del_entity->RemoveAllComponents(change);
+        transforms_.Remove(id);
         
         // If the entity is parented, remove from the parent. No signaling is necessary
         if (del_entity->Parent())
@@ -226,6 +228,7 @@ void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
         LogWarning("Scene::RemoveAllEntities: entity map was not clear after removing all entities, clearing manually");
         entities_.clear();
     }
+    transforms_.Clear();
     
     if (signal)
         emit SceneCleared(this);
@@ -1558,6 +1561,8 @@ void Scene::OnUpdated(float /*frameTime*/)
     }
     
     entitiesCreatedThisFrame_.clear();
+
+    transforms_.Update();
 }
 
 EntityList Scene::FindEntities(const QString &pattern) const
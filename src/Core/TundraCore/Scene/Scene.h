@@ -11,6 +11,7 @@
 #include "Math/float3.h"
 #include "SceneDesc.h"
 #include "Entity.h"
+#include "TransformCache.h"
 
 #include <QObject>
 #include <QVariant>
@@ -63,6 +64,10 @@ public:
     /// Returns entity map for introspection purposes
     const EntityMap &Entities() const { return entities_; }
 
+    /// Returns the cache of the world transforms of the entities, fed by their placeables.
+    /** Preferable to EC_Placeable::LocalToWorld for code that reads the transforms of many entities, e.g. every frame. */
+    TransformCache &Transforms() { return transforms_; }
+
     /// Returns true if the two scenes have the same name
     bool operator == (const Scene &other) const { return Name() == other.Name(); }
 
@@ -496,7 +501,7 @@ signals:
     void EntityParentChanged(Entity* entity, Entity* newParent, AttributeChange::Type change);
 
 private slots:
-    /// Handle frame update. Signal this frame's entity creations.
+    /// Handle frame update. Signal this frame's entity creations and update the world transforms.
     void OnUpdated(float frameTime);
 
 private:
@@ -529,6 +534,7 @@ private:
     bool authority_; ///< Authority -flag
     std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
+    TransformCache transforms_; ///< World transforms of the entities.
 };
 
 #include "Scene.inl"
@@ -0,0 +1,349 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TransformCache.h"
+#include "Profiler.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const u8 cTracked = 1; ///< The local transform has been set.
+const u8 cSelfResolved = 2; ///< The world transform follows from the parent.
+const u8 cDirty = 4; ///< The world transform needs to be recomputed.
+const u8 cValid = 8; ///< The slot and all its ancestors are tracked and self-resolved, i.e. the world transform is available.
+
+} // ~unnamed namespace
+
+TransformCache::TransformCache()
+{
+}
+
+int TransformCache::Slot(entity_id_t id) const
+{
+    QHash<entity_id_t, int>::const_iterator iter = slots_.find(id);
+    return iter != slots_.end() ? iter.value() : -1;
+}
+
+int TransformCache::AllocateSlot(entity_id_t id)
+{
+    int slot = Slot(id);
+    if (slot >= 0)
+        return slot;
+
+    if (!freeSlots_.empty())
+    {
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    }
+    else
+    {
+        slot = (int)ids_.size();
+        ids_.push_back(0);
+        local_.push_back(float3x4::identity);
+        world_.push_back(float3x4::identity);
+        parent_.push_back(-1);
+        firstChild_.push_back(-1);
+        nextSibling_.push_back(-1);
+        prevSibling_.push_back(-1);
+        flags_.push_back(0);
+    }
+
+    ids_[slot] = id;
+    local_[slot] = float3x4::identity;
+    parent_[slot] = -1;
+    firstChild_[slot] = -1;
+    nextSibling_[slot] = -1;
+    prevSibling_[slot] = -1;
+    flags_[slot] = cSelfResolved;
+    slots_[id] = slot;
+    return slot;
+}
+
+void TransformCache::ReleaseSlot(int slot)
+{
+    if (slot < 0 || !ids_[slot] || (flags_[slot] & (cTracked | cSelfResolved)) != cSelfResolved || firstChild_[slot] >= 0 ||
+        parent_[slot] >= 0)
+        return;
+
+    slots_.remove(ids_[slot]);
+    ids_[slot] = 0;
+    flags_[slot] = 0;
+    freeSlots_.push_back(slot);
+}
+
+void TransformCache::Link(int slot, int parent)
+{
+    int oldParent = parent_[slot];
+    if (oldParent == parent)
+        return;
+
+    if (oldParent >= 0)
+    {
+        int prev = prevSibling_[slot];
+        int next = nextSibling_[slot];
+        if (prev >= 0)
+            nextSibling_[prev] = next;
+        else
+            firstChild_[oldParent] = next;
+        if (next >= 0)
+            prevSibling_[next] = prev;
+    }
+
+    parent_[slot] = parent;
+    prevSibling_[slot] = -1;
+    nextSibling_[slot] = -1;
+    if (parent >= 0)
+    {
+        int next = firstChild_[parent];
+        nextSibling_[slot] = next;
+        if (next >= 0)
+            prevSibling_[next] = slot;
+        firstChild_[parent] = slot;
+    }
+
+    // The old parent may have been only a placeholder for this child.
+    ReleaseSlot(oldParent);
+}
+
+void TransformCache::MarkDirty(int slot)
+{
+    // A dirty slot always has dirty descendants, so the walk can stop at the slots already dirty.
+    scratch_.clear();
+    scratch_.push_back(slot);
+    while(!scratch_.empty())
+    {
+        int s = scratch_.back();
+        scratch_.pop_back();
+        if (flags_[s] & cDirty)
+            continue;
+        flags_[s] |= cDirty;
+        dirtySlots_.push_back(s);
+        for(int child = firstChild_[s]; child >= 0; child = nextSibling_[child])
+            scratch_.push_back(child);
+    }
+}
+
+void TransformCache::Resolve(int slot)
+{
+    // Collect the dirty ancestors, then compute from the topmost one down. A clean slot always has clean ancestors.
+    scratch_.clear();
+    for(int s = slot; s >= 0 && (flags_[s] & cDirty); s = parent_[s])
+        scratch_.push_back(s);
+
+    for(int i = (int)scratch_.size() - 1; i >= 0; --i)
+    {
+        int s = scratch_[i];
+        int parent = parent_[s];
+        u8 flags = flags_[s] & ~(cDirty | cValid);
+        if ((flags & cTracked) && (flags & cSelfResolved) && (parent < 0 || (flags_[parent] & cValid)))
+        {
+            world_[s] = parent >= 0 ? world_[parent] * local_[s] : local_[s];
+            flags |= cValid;
+        }
+        flags_[s] = flags;
+    }
+}
+
+void TransformCache::SetLocalTransform(entity_id_t id, const float3x4 &localToParent)
+{
+    if (!id)
+        return;
+    int slot = AllocateSlot(id);
+    local_[slot] = localToParent;
+    flags_[slot] |= cTracked;
+    MarkDirty(slot);
+}
+
+void TransformCache::SetParent(entity_id_t id, entity_id_t parentId, bool resolved)
+{
+    if (!id)
+        return;
+    int slot = AllocateSlot(id);
+
+    int parent = -1;
+    if (parentId && parentId != id)
+    {
+        parent = AllocateSlot(parentId);
+        for(int s = parent; s >= 0; s = parent_[s])
+            if (s == slot)
+            {
+                parent = -1;
+                break;
+            }
+        // The parent slot may have been allocated just now for the cycle check.
+        if (parent < 0)
+            ReleaseSlot(Slot(parentId));
+    }
+
+    bool changed = parent != parent_[slot] || resolved != ((flags_[slot] & cSelfResolved) != 0);
+    Link(slot, parent);
+    if (resolved)
+        flags_[slot] |= cSelfResolved;
+    else
+        flags_[slot] &= ~cSelfResolved;
+    if (changed)
+        MarkDirty(slot);
+}
+
+void TransformCache::Remove(entity_id_t id)
+{
+    int slot = Slot(id);
+    if (slot < 0)
+        return;
+
+    // If children keep the slot, it stays as a placeholder like a parent that has not been tracked yet.
+    flags_[slot] = (flags_[slot] & cDirty) | cSelfResolved;
+    local_[slot] = float3x4::identity;
+    MarkDirty(slot);
+    Link(slot, -1);
+    ReleaseSlot(slot);
+}
+
+void TransformCache::ChangeId(entity_id_t oldId, entity_id_t newId)
+{
+    int slot = Slot(oldId);
+    if (slot < 0 || oldId == newId || !newId)
+        return;
+
+    // Children may refer to the new ID already. Adopt them, unless that would create a cycle.
+    int other = Slot(newId);
+    if (other >= 0)
+    {
+        while(firstChild_[other] >= 0)
+        {
+            int child = firstChild_[other];
+            bool cycle = false;
+            for(int s = slot; s >= 0; s = parent_[s])
+                if (s == child)
+                {
+                    cycle = true;
+                    break;
+                }
+            Link(child, cycle ? -1 : slot);
+            MarkDirty(child);
+        }
+        if (ids_[other] == newId)
+        {
+            // Any entity that had the new ID has been removed by now, so its slot can be dropped.
+            flags_[other] = (flags_[other] & cDirty) | cSelfResolved;
+            Link(other, -1);
+            ReleaseSlot(other);
+        }
+    }
+
+    slots_.remove(oldId);
+    slots_[newId] = slot;
+    ids_[slot] = newId;
+    MarkDirty(slot);
+}
+
+void TransformCache::Clear()
+{
+    slots_.clear();
+    freeSlots_.clear();
+    ids_.clear();
+    local_.clear();
+    world_.clear();
+    parent_.clear();
+    firstChild_.clear();
+    nextSibling_.clear();
+    prevSibling_.clear();
+    flags_.clear();
+    dirtySlots_.clear();
+}
+
+bool TransformCache::Contains(entity_id_t id) const
+{
+    int slot = Slot(id);
+    return slot >= 0 && (flags_[slot] & cTracked) != 0;
+}
+
+bool TransformCache::WorldTransform(entity_id_t id, float3x4 &localToWorld)
+{
+    int slot = Slot(id);
+    if (slot < 0)
+        return false;
+    if (flags_[slot] & cDirty)
+        Resolve(slot);
+    if (!(flags_[slot] & cValid))
+        return false;
+    localToWorld = world_[slot];
+    return true;
+}
+
+bool TransformCache::WorldPosition(entity_id_t id, float3 &position)
+{
+    int slot = Slot(id);
+    if (slot < 0)
+        return false;
+    if (flags_[slot] & cDirty)
+        Resolve(slot);
+    if (!(flags_[slot] & cValid))
+        return false;
+    position = world_[slot].TranslatePart();
+    return true;
+}
+
+void TransformCache::Update()
+{
+    if (dirtySlots_.empty())
+        return;
+
+    PROFILE(TransformCache_Update);
+    // Start from the dirty slots whose parents are clean. A dirty slot always has dirty descendants, so the rest are reached
+    // through the children, a level at a time.
+    level_.clear();
+    for(size_t i = 0; i < dirtySlots_.size(); ++i)
+    {
+        int slot = dirtySlots_[i];
+        int parent = parent_[slot];
+        if (ids_[slot] && (flags_[slot] & cDirty) && (parent < 0 || !(flags_[parent] & cDirty)))
+            level_.push_back(slot);
+    }
+    dirtySlots_.clear();
+
+    while(!level_.empty())
+    {
+        nextLevel_.clear();
+        batchSlots_.clear();
+        batchParents_.clear();
+        batchLocals_.clear();
+        for(size_t i = 0; i < level_.size(); ++i)
+        {
+            int s = level_[i];
+            if (!(flags_[s] & cDirty))
+                continue; // Listed twice in dirtySlots_.
+            int parent = parent_[s];
+            u8 flags = flags_[s] & ~(cDirty | cValid);
+            if ((flags & cTracked) && (flags & cSelfResolved) && (parent < 0 || (flags_[parent] & cValid)))
+            {
+                if (parent >= 0)
+                {
+                    batchSlots_.push_back(s);
+                    batchParents_.push_back(world_[parent]);
+                    batchLocals_.push_back(local_[s]);
+                }
+                else
+                    world_[s] = local_[s];
+                flags |= cValid;
+            }
+            flags_[s] = flags;
+            for(int child = firstChild_[s]; child >= 0; child = nextSibling_[child])
+                if (flags_[child] & cDirty)
+                    nextLevel_.push_back(child);
+        }
+
+        if (!batchSlots_.empty())
+        {
+            batchWorlds_.resize(batchSlots_.size());
+            float3x4::BatchMul(&batchWorlds_[0], &batchParents_[0], &batchLocals_[0], (int)batchSlots_.size());
+            for(size_t i = 0; i < batchSlots_.size(); ++i)
+                world_[batchSlots_[i]] = batchWorlds_[i];
+        }
+        level_.swap(nextLevel_);
+    }
+}
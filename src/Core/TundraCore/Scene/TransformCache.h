@@ -0,0 +1,108 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "Math/float3x4.h"
+
+#include <QHash>
+
+#include <vector>
+
+/// Caches the world transforms of the placeable entities of a scene, without depending on the renderer.
+/** The local-to-parent transforms and the parents of the entities are set by their placeables, see EC_Placeable. The world
+    transforms are computed from them lazily: changing a transform or a parent only marks the entity and its descendants dirty,
+    and a dirty world transform is recomputed when it is read, or at the latest by Update, which Scene calls once per frame.
+    Update processes the dirty entities a level of the hierarchy at a time, parents first, so each world transform is computed
+    once per change however deep the hierarchy is, and the transforms of a level are composed in one batch with float3x4::BatchMul.
+
+    The transforms are stored in arrays indexed by a slot per entity, the parents and children as slot indices. An entity
+    can be referred to as a parent before its placeable exists, e.g. while the scene is being loaded. Such an entity, and an
+    entity whose world transform depends on something the cache does not know, like a skeleton bone, is unresolved. The world
+    transforms of unresolved entities and their descendants are not available from the cache.
+
+    Owned by Scene, see Scene::Transforms. Not thread-safe. */
+class TUNDRACORE_API TransformCache
+{
+public:
+    TransformCache();
+
+    /// Sets the local-to-parent transform of an entity, and starts tracking the entity if it was not tracked yet.
+    void SetLocalTransform(entity_id_t id, const float3x4 &localToParent);
+
+    /// Sets the parent of an entity.
+    /** @param id The entity.
+        @param parentId The parent entity, or 0 if the entity is a root. A parent that would create a cycle is ignored, and the entity is made a root.
+        @param resolved False if the world transform of the entity does not follow from the transform of the parent, e.g. when attached to a bone. */
+    void SetParent(entity_id_t id, entity_id_t parentId, bool resolved = true);
+
+    /// Stops tracking an entity. Its children stay attached to it, but become unresolved until the entity is tracked again.
+    void Remove(entity_id_t id);
+
+    /// Moves an entity to another ID, e.g. when the server acks an entity created by a client.
+    void ChangeId(entity_id_t oldId, entity_id_t newId);
+
+    /// Stops tracking all the entities.
+    void Clear();
+
+    /// Returns if an entity is tracked, i.e. has a local transform set.
+    bool Contains(entity_id_t id) const;
+
+    /// Gets the world transform of an entity, recomputing it if dirty.
+    /** @return False if the entity is not tracked or is unresolved, in which case localToWorld is left untouched. */
+    bool WorldTransform(entity_id_t id, float3x4 &localToWorld);
+
+    /// Gets the world position of an entity, recomputing it if dirty.
+    /** @return False if the entity is not tracked or is unresolved, in which case position is left untouched. */
+    bool WorldPosition(entity_id_t id, float3 &position);
+
+    /// Recomputes all the dirty world transforms.
+    void Update();
+
+    /// Returns the number of entities tracked.
+    int Size() const { return (int)(ids_.size() - freeSlots_.size()); }
+
+private:
+    /// Returns the slot of an entity, or -1 if it has none.
+    int Slot(entity_id_t id) const;
+
+    /// Returns the slot of an entity, allocating one if it has none.
+    int AllocateSlot(entity_id_t id);
+
+    /// Frees a slot if it is not tracked, not unresolved and not linked to other slots.
+    void ReleaseSlot(int slot);
+
+    /// Links a slot to a parent slot, or unlinks it if parent is -1.
+    void Link(int slot, int parent);
+
+    /// Marks a slot and its descendants dirty.
+    void MarkDirty(int slot);
+
+    /// Recomputes the world transform of a dirty slot and its dirty ancestors.
+    void Resolve(int slot);
+
+    QHash<entity_id_t, int> slots_; ///< The slots of the entities.
+    std::vector<int> freeSlots_;
+
+    // The state of the slots, indexed by slot.
+    std::vector<entity_id_t> ids_; ///< 0 for a free slot.
+    std::vector<float3x4> local_; ///< Local-to-parent transforms.
+    std::vector<float3x4> world_; ///< Local-to-world transforms, valid when the slot is not dirty and is resolved.
+    std::vector<int> parent_;
+    std::vector<int> firstChild_;
+    std::vector<int> nextSibling_;
+    std::vector<int> prevSibling_;
+    std::vector<u8> flags_;
+
+    std::vector<int> dirtySlots_; ///< Dirty slots to process in Update, may contain slots that have since been resolved or freed.
+    std::vector<int> scratch_; ///< Reused by Resolve.
+
+    // Reused by Update.
+    std::vector<int> level_; ///< The dirty slots whose parents are clean or were processed before.
+    std::vector<int> nextLevel_;
+    std::vector<int> batchSlots_; ///< The slots of level_ whose world transforms are composed from the parents.
+    std::vector<float3x4> batchParents_; ///< The world transforms of the parents of batchSlots_.
+    std::vector<float3x4> batchLocals_; ///< The local transforms of batchSlots_.
+    std::vector<float3x4> batchWorlds_;
+};
@@ -22,6 +22,9 @@
 
 using namespace std;
 
+/// Maximum number of separate rectangles tracked in the dirty region before it is simplified to its bounding rectangle.
+static const int cMaxDirtyRects = 8;
+
 UiGraphicsView::UiGraphicsView(Framework* fw, QWidget *parent)
 :QGraphicsView(parent), framework(fw), backBuffer(0)
 {
@@ -51,6 +54,7 @@ QImage *UiGraphicsView::BackBuffer() const
 void UiGraphicsView::MarkViewUndirty()
 {
     dirtyRectangle = QRectF(-1, -1, -1, -1);
+    dirtyRegion = QRegion();
 }
 
 bool UiGraphicsView::IsViewDirty() const
@@ -63,6 +67,11 @@ QRectF UiGraphicsView::DirtyRectangle() const
     return dirtyRectangle;
 }
 
+QRegion UiGraphicsView::DirtyRegion() const
+{
+    return dirtyRegion;
+}
+
 void UiGraphicsView::drawBackground(QPainter *painter, const QRectF &rect)
 {
     // Default backgroudBrush for QGraphicsScene and QGraphicsView is NoBrush,
@@ -102,6 +111,7 @@ void UiGraphicsView::Resize(int newWidth, int newHeight)
         viewport()->setGeometry(0, 0, newWidth, newHeight);
         scene()->setSceneRect(viewport()->rect());
         dirtyRectangle = QRectF(0, 0, newWidth, newHeight);
+        dirtyRegion = QRegion(0, 0, newWidth, newHeight);
 
         delete backBuffer;
         backBuffer = new QImage(newWidth, newHeight, QImage::Format_ARGB32);
@@ -196,7 +206,10 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
     // We received an unknown-sized scene change message. Mark everything dirty! (I've no idea what Qt
     // means when it sends a message saying 'nothing changed').
     if (rectangles.size() == 0)
+    {
         dirtyRectangle = QRectF(0, 0, width(), height());
+        dirtyRegion = QRegion(0, 0, width(), height());
+    }
 #endif
 
     if (!IsViewDirty() && rectangles.size() > 0)
@@ -216,6 +229,26 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
     dirtyRectangle.setTop(max<int>(dirtyRectangle.top(), 0));
     dirtyRectangle.setRight(min<int>(dirtyRectangle.right(), width()));
     dirtyRectangle.setBottom(min<int>(dirtyRectangle.bottom(), height()));
+
+    // Track the individual rectangles as well, so that small separate changes (e.g. a blinking cursor and a clock)
+    // don't cause a repaint of everything in between.
+    const QRect viewRect(0, 0, width(), height());
+    for(int i = 0; i < rectangles.size(); ++i)
+    {
+        QRect rect = rectangles[i].toAlignedRect().adjusted(-guardbandWidth, -guardbandWidth, guardbandWidth, guardbandWidth);
+        dirtyRegion += rect.intersected(viewRect);
+    }
+
+    // Coalesce the damage when it gets fragmented, or when the rectangles cover most of their bounds anyway.
+    if (dirtyRegion.rectCount() > 1)
+    {
+        QRect bounds = dirtyRegion.boundingRect();
+        qint64 area = 0;
+        foreach(const QRect &rect, dirtyRegion.rects())
+            area += (qint64)rect.width() * rect.height();
+        if (dirtyRegion.rectCount() > cMaxDirtyRects || area * 4 > (qint64)bounds.width() * bounds.height() * 3)
+            dirtyRegion = QRegion(bounds);
+    }
 }
 
 QGraphicsItem *UiGraphicsView::VisibleItemAtCoords(int x, int y) const
@@ -6,6 +6,7 @@
 #include "TundraCoreApi.h"
 
 #include <QGraphicsView>
+#include <QRegion>
 
 class QDropEvent;
 class QDragEnterEvent;
@@ -37,6 +38,11 @@ public:
     /// Returns the rectangle that represents the dirty area of the screen, pending a Qt repaint.
     QRectF DirtyRectangle() const;
 
+    /// Returns the dirty area of the screen as a set of rectangles, pending a Qt repaint.
+    /** The damage reported during a frame is coalesced: when it is split into too many rectangles, or the rectangles cover most of
+        their bounding rectangle, the region is simplified to the bounding rectangle. The region is clipped to the view. */
+    QRegion DirtyRegion() const;
+
 public slots:
     /// Returns the topmost visible QGraphicsItem in the given application main window coordinates.
     QGraphicsItem *VisibleItemAtCoords(int x, int y) const;
@@ -73,6 +79,7 @@ private:
     Framework* framework;
     QImage *backBuffer;
     QRectF dirtyRectangle;
+    QRegion dirtyRegion;
 
     /// This virtual function is overridden from the QGraphicsView original to disable any background drawing functionality.
     /// The main QGraphicsView background displays the 3D scene rendered using Ogre.
@@ -64,7 +64,7 @@ bool InterestManager::CheckRelevance(UserConnectionPtr conn, Entity* changed_ent
     Quat client_orientation = conn->syncState->clientOrientation.Normalized();
 
     params_.client_position = conn->syncState->clientLocation;      //Client location vector
-    params_.entity_position = entity_location->transform.Get().pos; //Entitys location vector
+    params_.entity_position = entity_location->WorldPosition();     //Entitys location vector, in world space also when parented
 
     float3 d = params_.client_position - params_.entity_position;
     float3 v = params_.entity_position - params_.client_position;   //Calculate the vector between the player and the changed entity by substracting their location vectors
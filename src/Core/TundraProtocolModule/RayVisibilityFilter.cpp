@@ -54,7 +54,7 @@ bool RayVisibilityFilter::Filter(const IMParameters& params)
                 {
 #ifdef IM_DEBUG
                     if(params.connection->ConnectionId() == 1)
-                        ::LogInfo("Not the time to raycast, returning true. Last " + QString::number(lastRaycasted + raycastinterval_) + " Current " + QString::number(currentTime));
+                        LOG_INFO("Not the time to raycast, returning true. Last " + QString::number(lastRaycasted + raycastinterval_) + " Current " + QString::number(currentTime));
 #endif
                     return true;
                 }
@@ -62,7 +62,7 @@ bool RayVisibilityFilter::Filter(const IMParameters& params)
                 {
 #ifdef IM_DEBUG
                     if(params.connection->ConnectionId() == 1)
-                        ::LogInfo("Not the time to raycast, returning false. Last " + QString::number(lastRaycasted + raycastinterval_) + " Current " + QString::number(currentTime));
+                        LOG_INFO("Not the time to raycast, returning false. Last " + QString::number(lastRaycasted + raycastinterval_) + " Current " + QString::number(currentTime));
 #endif
                     return false;
                 }
@@ -81,7 +81,7 @@ bool RayVisibilityFilter::Filter(const IMParameters& params)
                 {
                     im_->UpdateEntityVisibility(params.connection, params.changed_entity->Id(), true);
 #ifdef IM_DEBUG
-                    ::LogInfo("Entity " + QString::number(params.changed_entity->Id()) + " is visible to connection " + QString::number(params.connection->ConnectionId()));
+                    LOG_INFO("Entity " + QString::number(params.changed_entity->Id()) + " is visible to connection " + QString::number(params.connection->ConnectionId()));
 #endif
                     return true;
                 }